@@ -6,6 +6,16 @@
 
 #include "AtverterH.h"
 
+// control timer state, file scope because TimerOne only calls plain functions
+static volatile unsigned long tickCount = 0; // interrupts since initializeInterruptTimer()
+static void (*controlFunction)(void) = NULL; // the controller given to initializeInterruptTimer()
+
+// counts the interrupt before running the controller, so the controller sees its own tick
+static void tickInterrupt() {
+  tickCount++;
+  controlFunction();
+}
+
 AtverterH::AtverterH() {
 }
 
@@ -21,20 +31,20 @@ void AtverterH::initialize() {
 
 // sets up the pin mode for all AtverterH pins
 void AtverterH::setupPinMode() {
-  pinMode(LED2_PIN, OUTPUT);
-  pinMode(LED1_PIN, OUTPUT);
-  pinMode(PWM_PIN, OUTPUT);
-  pinMode(ALT_PIN, OUTPUT);
-  pinMode(VCTRL1_PIN, OUTPUT);
-  pinMode(VCTRL2_PIN, OUTPUT);
-  pinMode(PRORESET_PIN, OUTPUT);
-  pinMode(GATESD_PIN, INPUT);
-  pinMode(V1_PIN, INPUT);
-  pinMode(I1_PIN, INPUT);
-  pinMode(V2_PIN, INPUT);
-  pinMode(I2_PIN, INPUT);
-  pinMode(T1_PIN, INPUT);
-  pinMode(T2_PIN, INPUT);
+  halPinMode(LED2_PIN, OUTPUT);
+  halPinMode(LED1_PIN, OUTPUT);
+  halPinMode(PWM_PIN, OUTPUT);
+  halPinMode(ALT_PIN, OUTPUT);
+  halPinMode(VCTRL1_PIN, OUTPUT);
+  halPinMode(VCTRL2_PIN, OUTPUT);
+  halPinMode(PRORESET_PIN, OUTPUT);
+  halPinMode(GATESD_PIN, INPUT);
+  halPinMode(V1_PIN, INPUT);
+  halPinMode(I1_PIN, INPUT);
+  halPinMode(V2_PIN, INPUT);
+  halPinMode(I2_PIN, INPUT);
+  halPinMode(T1_PIN, INPUT);
+  halPinMode(T2_PIN, INPUT);
 }
 
 // // initialize sensor average array to sensor read
@@ -54,8 +64,9 @@ void AtverterH::initializeSensors() {
 // inputs: control period in microseconds, controller interrupt function reference
 // example usage: atverterH.initializeInterruptTimer(1, &controlUpdate);
 void AtverterH::initializeInterruptTimer(long periodus, void (*interruptFunction)(void)) {
-  Timer1.initialize(periodus); // arg: period in microseconds
-  Timer1.attachInterrupt(interruptFunction); // arg: interrupt function to call
+  _tickPeriodus = periodus;
+  controlFunction = interruptFunction;
+  halStartTimer(periodus, tickInterrupt); // Timer1 on the AVR
   // _bootstrapCounterMax = 10000/periodus; // refresh bootstrap capacitors every 10ms
   _bootstrapCounterMax = 1000/periodus; // refresh bootstrap capacitors every 10ms
   if (_bootstrapCounterMax < 1)
@@ -63,11 +74,38 @@ void AtverterH::initializeInterruptTimer(long periodus, void (*interruptFunction
   refreshBootstrap();
 }
 
+// returns the number of control timer interrupts so far, the device's monotonic clock
+// the host pairs it with its own clock (RTCK command) to timestamp records to a fraction of a tick
+unsigned long AtverterH::getTicks() {
+  uint8_t state = halDisableInterrupts(); // a 32-bit read is four byte reads on the AVR, keep the ISR out
+  unsigned long ticks = tickCount;
+  halRestoreInterrupts(state); // restores rather than enables, so this is safe inside the ISR itself
+  return ticks;
+}
+
+// returns the control timer period in microseconds
+long AtverterH::getTickPeriod() {
+  return _tickPeriodus;
+}
+
+// counts control timer interrupts that ran no controller, on a simulation that found them idle
+// the bootstrap counter moves as checkBootstrapRefresh() would have moved it; the refresh pulses
+// themselves leave nothing behind, ALT_PIN ends high either way
+void AtverterH::skipTicks(unsigned long ticks) {
+  uint8_t state = halDisableInterrupts();
+  tickCount += ticks;
+  halRestoreInterrupts(state);
+  if ((long)ticks < _bootstrapCounter)
+    _bootstrapCounter -= ticks;
+  else
+    _bootstrapCounter = _bootstrapCounterMax - (long)(ticks - _bootstrapCounter)%_bootstrapCounterMax;
+}
+
 // resets protection latch, enabling the gate drivers
 void AtverterH::enableGateDrivers(int holdProtectMicroseconds) {
-  digitalWrite(PRORESET_PIN, HIGH);
-  delayMicroseconds(holdProtectMicroseconds);
-  digitalWrite(PRORESET_PIN, LOW);
+  halDigitalWrite(PRORESET_PIN, HIGH);
+  halDelayMicroseconds(holdProtectMicroseconds);
+  halDigitalWrite(PRORESET_PIN, LOW);
   _shutdownCode = 0; // reset shutdown code (i.e. set to "hardware" shutdown)
 }
 
@@ -94,8 +132,22 @@ void AtverterH::initializePWMTimer() {
 void AtverterH::setDutyCycle(int dutyCycle) {
   _dutyCycle = dutyCycle;
   _dutyCycle = constrain(_dutyCycle, 1, 99);
+  _dutyCycleRaw = (int)(((long)_dutyCycle*DUTY_RAW_SCALE + 50)/100);
+  _dutyCycleResidue = 0;
   // FastPwmPin::enablePwmPin(pin number, frequency, duty cycle 0-100);
-  FastPwmPin::enablePwmPin(PWM_PIN, 100000L, _dutyCycle);
+  halSetPwm(PWM_PIN, 100000L, _dutyCycle);
+}
+
+// sets the duty cycle in raw form (DUTY_RAW_MIN to DUTY_RAW_MAX), e.g. a compensator output
+// the switch only takes whole %, so it gets one of the two either side, the rest of the % carried to the next
+// call (first order sigma-delta): called every tick, the switch averages the finer value getDutyCycleRaw() keeps
+void AtverterH::setDutyCycleRaw(int dutyRaw) {
+  _dutyCycleRaw = constrain(dutyRaw, DUTY_RAW_MIN, DUTY_RAW_MAX);
+  long scaled = (long)_dutyCycleRaw*100 + _dutyCycleResidue; // % in 1/1024ths
+  _dutyCycle = constrain((int)(scaled >> 10), 1, 99);
+  _dutyCycleResidue = (int)(scaled - ((long)_dutyCycle << 10));
+  _dutyCycleResidue = constrain(_dutyCycleResidue, -DUTY_RAW_SCALE, DUTY_RAW_SCALE); // past 1 or 99 % it cannot pay back
+  halSetPwm(PWM_PIN, 100000L, _dutyCycle);
 }
 
 // sets the duty cycle, float argument (0.0-1.0)
@@ -105,8 +157,9 @@ void AtverterH::setDutyCycleFloat(float dutyCycleFloat) {
 
 // get the duty cycle as a int percentage (0-100)
 // note that the duty cycle is referenced to side 1; side 2 duty = 100 - getDutyCycle()
+// the nearest % to what the switch averages, not the one setDutyCycleRaw() dithered it to in the last tick
 int AtverterH::getDutyCycle() {
-  return _dutyCycle;
+  return (int)(((long)_dutyCycleRaw*100 + DUTY_RAW_SCALE/2) >> 10);
 }
 
 // get the duty cycle as a float (0.0-1.0)
@@ -114,6 +167,11 @@ float AtverterH::getDutyCycleFloat() {
   return ((float)getDutyCycle()/100.0);
 }
 
+// get the duty cycle in raw form (0-1024), as last set by either setter
+int AtverterH::getDutyCycleRaw() {
+  return _dutyCycleRaw;
+}
+
 // Alternate Drive Signal --------------------------------------------------
 
 // check bootstrap counter to see if need to refresh caps
@@ -127,31 +185,31 @@ void AtverterH::checkBootstrapRefresh() {
 // refresh the bootstrap capacitors and reset bootstrap counter
 void AtverterH::refreshBootstrap() {
   _bootstrapCounter = _bootstrapCounterMax;
-  digitalWrite(ALT_PIN, LOW);
-  digitalWrite(ALT_PIN, HIGH);
+  halDigitalWrite(ALT_PIN, LOW);
+  halDigitalWrite(ALT_PIN, HIGH);
 }
 
 // set gate driver 1 to use an always-high alternate signal
 void AtverterH::applyHoldHigh1() {
-  digitalWrite(VCTRL1_PIN, HIGH);
-  digitalWrite(VCTRL2_PIN, LOW);
-  digitalWrite(ALT_PIN, HIGH);
+  halDigitalWrite(VCTRL1_PIN, HIGH);
+  halDigitalWrite(VCTRL2_PIN, LOW);
+  halDigitalWrite(ALT_PIN, HIGH);
   refreshBootstrap();
 }
 
 // set gate driver 2 to use an always-high alternate signal
 void AtverterH::applyHoldHigh2() {
-  digitalWrite(VCTRL2_PIN, HIGH);
-  digitalWrite(VCTRL1_PIN, LOW);
-  digitalWrite(ALT_PIN, HIGH);
+  halDigitalWrite(VCTRL2_PIN, HIGH);
+  halDigitalWrite(VCTRL1_PIN, LOW);
+  halDigitalWrite(ALT_PIN, HIGH);
   refreshBootstrap();
 }
 
 // sets both gate drivers to use the primary pwm signal
 void AtverterH::removeHold() {
-  digitalWrite(VCTRL1_PIN, LOW);
-  digitalWrite(VCTRL2_PIN, LOW);
-  digitalWrite(ALT_PIN, LOW);
+  halDigitalWrite(VCTRL1_PIN, LOW);
+  halDigitalWrite(VCTRL2_PIN, LOW);
+  halDigitalWrite(ALT_PIN, LOW);
 }
 
 // Sensor Average Updating -------------------------------------------------
@@ -169,17 +227,17 @@ void AtverterH::updateVCC() {
 }
 
 void AtverterH::updateTSensors() {
-  updateSensorRaw(T1_INDEX, analogReadFast(T1_PIN));
-  updateSensorRaw(T2_INDEX, analogReadFast(T2_PIN));
+  updateSensorRaw(T1_INDEX, halAnalogRead(T1_PIN));
+  updateSensorRaw(T2_INDEX, halAnalogRead(T2_PIN));
 }
 
 void AtverterH::updateVISensors() {
   // analogRead() measured at 116 microseconds, updateSensorRaw adds negligable time
   // total updateVISensors time is measured at 456 microseconds
-  updateSensorRaw(V1_INDEX, analogReadFast(V1_PIN));
-  updateSensorRaw(V2_INDEX, analogReadFast(V2_PIN));
-  updateSensorRaw(I1_INDEX, analogReadFast(I1_PIN) - 512);
-  updateSensorRaw(I2_INDEX, analogReadFast(I2_PIN) - 512);
+  updateSensorRaw(V1_INDEX, halAnalogRead(V1_PIN));
+  updateSensorRaw(V2_INDEX, halAnalogRead(V2_PIN));
+  updateSensorRaw(I1_INDEX, halAnalogRead(I1_PIN) - 512);
+  updateSensorRaw(I2_INDEX, halAnalogRead(I2_PIN) - 512);
 }
 
 void AtverterH::updateSensorRaw(int index, int sample) {
@@ -311,21 +369,21 @@ int AtverterH::raw2mA(int raw) {
   return rawL*getVCC()*3/1024;
 }
 
-// converts a raw 10-bit analog reading (0-1023) to a °C reading (0-100)
+// converts a raw 10-bit analog reading (0-1023) to a °C reading (10-100)
+//  saturates at the ends of the table: a shorted thermistor (1023) reads 100, not a division by zero
 int AtverterH::raw2degC(int raw) {
-  int x0 = 0;
-  int x1 = 0;
-  int y0 = 0;
-  int y1 = 0;
-  for (int n = 1; n < sizeof(TTABLE)/sizeof(TTABLE[0]); n++) {
-    if (raw < TTABLE[n][0]) {
-      x0 = TTABLE[n-1][0];
-      x1 = TTABLE[n][0];
-      y0 = TTABLE[n-1][1];
-      y1 = TTABLE[n][1];
-      break;
-    }
-  }
+  const int last = sizeof(TTABLE)/sizeof(TTABLE[0]) - 1;
+  if (raw <= TTABLE[0][0])
+    return TTABLE[0][1];
+  if (raw >= TTABLE[last][0])
+    return TTABLE[last][1];
+  int n = 1;
+  while (raw >= TTABLE[n][0])
+    n++;
+  int x0 = TTABLE[n-1][0];
+  int x1 = TTABLE[n][0];
+  int y0 = TTABLE[n-1][1];
+  int y1 = TTABLE[n][1];
   return y0 + (raw - x0)*(y1 - y0)/(x1 - x0);
 }
 
@@ -373,23 +431,7 @@ int AtverterH::getVDroopRaw(int iOut) {
 // returns the official VCC voltage in milliVolts
 int AtverterH::readVCC() {
   // reads 1.1V reference against AVcc
-  // set the reference to Vcc and the measurement to the internal 1.1V reference
-  #if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
-    ADMUX = _BV(REFS0) | _BV(MUX4) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
-  #elif defined (__AVR_ATtiny24__) || defined(__AVR_ATtiny44__) || defined(__AVR_ATtiny84__)
-     ADMUX = _BV(MUX5) | _BV(MUX0) ;
-  #else
-    ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
-  #endif
- 
-  delayMicroseconds(2000); // Wait for Vref to settle (originally 2 ms delay)
-  ADCSRA |= _BV(ADSC); // Start conversion
-  while (bit_is_set(ADCSRA,ADSC)); // measuring
- 
-  uint8_t low  = ADCL; // must read ADCL first - it then locks ADCH  
-  uint8_t high = ADCH; // unlocks both
- 
-  long result = (high<<8) | low;
+  long result = halReadBandgap();
  
   result = 1125300L / result; // Calculate Vcc (in mV); 1125300 = 1.1*1023*1000
   return (int)result; // Vcc in millivolts
@@ -399,7 +441,7 @@ int AtverterH::readVCC() {
 
 // sets one of the LEDs to a given state (HIGH or LOW)
 void AtverterH::setLED(int led, int state) {
-  digitalWrite(led, state);
+  halDigitalWrite(led, state);
 }
 
 // sets yellow LED to HIGH or LOW
@@ -422,16 +464,16 @@ void AtverterH::shutdownGates() {
 // immediately triggers the gate shutdown
 void AtverterH::shutdownGates(int shutdownCode) {
   _shutdownCode = shutdownCode;
-  pinMode(GATESD_PIN, OUTPUT);
-  digitalWrite(GATESD_PIN, LOW);
-  delayMicroseconds(10000);
-  // digitalWrite(GATESD_PIN, HIGH);
-  pinMode(GATESD_PIN, INPUT);
+  halPinMode(GATESD_PIN, OUTPUT);
+  halDigitalWrite(GATESD_PIN, LOW);
+  halDelayMicroseconds(10000);
+  // halDigitalWrite(GATESD_PIN, HIGH);
+  halPinMode(GATESD_PIN, INPUT);
 }
 
 // returns true if the gate shutdown signal is currently latched
 bool AtverterH::isGateShutdown() {
-  return !digitalRead(GATESD_PIN);
+  return !halDigitalRead(GATESD_PIN);
 }
 
 // returns the appropriate shutdown code, or -1 if gates not shutdown
@@ -472,65 +514,97 @@ void AtverterH::setThermalShutdown(int temperature_C) {
 }
 
 // checks if last sensed current is greater than thermal limit
+// an open thermistor reads as far below the table, and could hide a hot switch, so it shuts down too
 void AtverterH::checkThermalShutdown() {
-  if (getT1() > _thermalLimitC || getT2() > _thermalLimitC)
+  if (getT1() > _thermalLimitC || getT2() > _thermalLimitC
+    || getRawT1() < THERMISTOR_OPEN_RAW || getRawT2() < THERMISTOR_OPEN_RAW)
     shutdownGates(OVERTEMPERATURE);
 }
 
 // Compensation for Classical Feedback ---------------------------------------
 
-// set discrete compensator coefficients
-// must specify size of numerator and denominator due to how array pointers are passed to functions
-void AtverterH::setComp(int num[], int den[], int numSize, int denSize) {
-  _compNum = num;
-  _compDen = den;
-  _compNumSize = numSize;
-  _compDenSize = denSize;
+// set biquad cascade coefficients: {b0, b1, b2, a1, a2} for each section in turn, in Q15 >> postShift
+// the array is used in place, so keep it alive (e.g. static); put a section with an integrator last, as the
+// output saturation and resetComp() act on the last section's outputs
+void AtverterH::setComp(const int coefficients[], int sections, int postShift) {
+  _compCoefficients = coefficients;
+  _compSections = constrain(sections, 0, COMP_MAX_SECTIONS);
+  _compShift = 15 - constrain(postShift, 0, COMP_MAX_POST_SHIFT);
+  resetComp();
+}
+
+// compensator output saturation, DUTY_RAW_MIN to DUTY_RAW_MAX unless set
+void AtverterH::setCompLimits(int minOut, int maxOut) {
+  _compMin = minOut;
+  _compMax = maxOut;
 }
 
 // update past compensator inputs and outputs
 // must do this even if using gradient descent for smooth transition to classical feedback
+// the history is circular: the head moves on rather than the values, and the outputs hold their last values
+// until calculateCompOut() works out the new ones
 void AtverterH::updateCompPast(int inputNow) {
-// update array of past compensator inputs
-  for (int n = _compNumSize - 1; n > 0; n--) {
-    _compIn[n] = _compIn[n-1];
-  }
-  _compIn[0] = inputNow; // set the current compensator input
-  // update array of past compensator outputs
-  for (int n = _compDenSize - 1; n > 0; n--) {
-    _compOut[n] = _compOut[n-1];
+  int last = _compHead;
+  _compHead = _compHead == 2 ? 0 : _compHead + 1;
+  _compHistory[0][_compHead] = inputNow; // set the current compensator input
+  for (int k = 1; k <= _compSections; k++) {
+    _compHistory[k][_compHead] = _compHistory[k][last];
   }
 }
 
 // returns compensator output for classical feedback discrete compensation
-// usage: compNum = {A, B, C}, compDen = {D, E, F}, x = compIn, y = compOut
-//   D*y[n] + E*y[n-1] + F*y[n-2] = A*x[n] + B*x[n-1] + C*x[n-2]
-//   y[n] = (A*x[n] + B*x[n-1] + C*x[n-2] - E*y[n-1] - F*y[n-2])/D
+// each section k takes the output of section k-1 (row 0 is the input), x = its input, y = its output:
+//   y[n] = (b0*x[n] + b1*x[n-1] + b2*x[n-2] - a1*y[n-1] - a2*y[n-2]) >> (15 - postShift)
+// in a long accumulator, the 16x16 bit products promoted before they can overflow an AVR int; the bits shifted
+// out are carried to the next update, so an integrator still moves on errors smaller than one output step.
+// The last output is saturated to the limits (setCompLimits()) and stored saturated, which keeps an integrator
+// in the last section from winding up
 long AtverterH::calculateCompOut() {
-  // accumulate compensator weighted input terms via addition
+  int n1 = _compHead == 0 ? 2 : _compHead - 1; // indices of x[n-1] and x[n-2]
+  int n2 = n1 == 0 ? 2 : n1 - 1;
+  const int *c = _compCoefficients;
   long compAcc = 0;
-  for (int n = 0; n < _compNumSize; n++) {
-    compAcc = compAcc + _compIn[n]*_compNum[n];
+  if (_compSections == 0) // not set up
+    return compAcc;
+  for (int k = 1; k <= _compSections; k++, c += COMP_SECTION_COEFFICIENTS) {
+    const int *x = _compHistory[k-1];
+    int *y = _compHistory[k];
+    compAcc = _compResidue[k-1] + (long)c[0]*x[_compHead] + (long)c[1]*x[n1] + (long)c[2]*x[n2]
+      - (long)c[3]*y[n1] - (long)c[4]*y[n2];
+    long out = compAcc >> _compShift; // floor, the residue below is never negative
+    _compResidue[k-1] = compAcc & ((1L << _compShift) - 1);
+    compAcc = constrain(out, -32767L, 32767L); // section outputs are stored as int
+    y[_compHead] = (int)compAcc;
   }
-  // accumulate compensator weighted past output terms via subtraction
-  for (int n = 1; n < _compDenSize; n++) {
-    compAcc = compAcc - _compOut[n]*_compDen[n];
+  if (compAcc < _compMin || compAcc > _compMax) {
+    compAcc = constrain(compAcc, (long)_compMin, (long)_compMax);
+    _compHistory[_compSections][_compHead] = (int)compAcc; // anti-windup: the history only has what was applied
+    _compResidue[_compSections-1] = 0;
   }
-  compAcc = compAcc/_compDen[0]; // divide by the first denominator coefficient
-  _compOut[0] = compAcc; // the compensator output, y[n]
   return compAcc;
 }
 
 // resets the compensator past values when switching between CV and CC
+// bumpless: no input history and the last section's outputs at the present dutyRaw, so the first output after
+// this is the duty cycle already set plus what the new input asks for
 void AtverterH::resetComp() {
-  // reset array of past compensator inputs
-  for (int n = 0; n < _compNumSize; n++) {
-    _compIn[n] = 0;
+  for (int k = 0; k < _compSections; k++) {
+    for (int n = 0; n < 3; n++) {
+      _compHistory[k][n] = 0;
+    }
+    _compResidue[k] = 0;
   }
-  // reset array of past compensator outputs
-  for (int n = 0; n < _compDenSize; n++) {
-    _compOut[n] = getDutyCycle()*10; // backward convert dutyRaw = duty*1024/100 = duty*10
+  holdCompOutput(getDutyCycleRaw());
+}
+
+// sets the last section's output history to out, e.g. the present dutyRaw
+void AtverterH::holdCompOutput(int out) {
+  if (_compSections == 0) // not set up
+    return;
+  for (int n = 0; n < 3; n++) {
+    _compHistory[_compSections][n] = out;
   }
+  _compResidue[_compSections-1] = 0;
 }
 
 // Gradient Descent ----------------------------------------------------------
@@ -538,90 +612,117 @@ void AtverterH::resetComp() {
 // set the gradient descent counter overflow to control step speed
 void AtverterH::setGradDescCountMax(int settlingCount, int averagingCount) {
   _gradDescSettleMax = settlingCount;
-  _gradDescAverageMax = averagingCount;
+  _gradDescAverageMax = averagingCount > 0 ? averagingCount : 1;
   _gradDescCount = 0;
+  _gradDescErrorAcc = 0;
+  _gradDescSamples = 0;
+}
+
+// set the step: gain*(average error)/256 in dutyRaw, at least minStep and at most maxStep in size
+// gain 0 steps by minStep in the direction of the average error, the default being 1 % like setDutyCycle() steps
+void AtverterH::setGradDescGain(int gain, int minStep, int maxStep) {
+  _gradDescGain = gain;
+  _gradDescStepMin = constrain(minStep, 0, DUTY_RAW_SCALE);
+  _gradDescStepMax = constrain(maxStep, _gradDescStepMin, DUTY_RAW_SCALE);
+}
+
+// set the share of the last step added to the next one (Q8, 0 to 255), 0 for none
+void AtverterH::setGradDescMomentum(int momentum) {
+  _gradDescMomentum = constrain(momentum, 0, (1 << GRAD_DESC_Q) - 1);
+  _gradDescLastStep = 0;
 }
 
 // set gradient descent to step next call to gradDescStep(), using the given error as only error
 void AtverterH::triggerGradDescStep() {
-  _gradDescCount = _gradDescSettleMax + _gradDescAverageMax;
+  _gradDescCount = _gradDescSettleMax + _gradDescAverageMax - 1;
   _gradDescErrorAcc = 0;
+  _gradDescSamples = 0;
 }
 
-// steps duty cycle based on the sign of the error
+// steps dutyRaw by the error averaged over the last averaging period, after the settling period
+// the decision and the step's size both come from the average, so a noisy last sample cannot turn the step around
 void AtverterH::gradDescStep(int error) {
   _gradDescCount++; // use a counter to control the speed of gradient descent
-  if (_gradDescCount < _gradDescSettleMax)
+  if (_gradDescCount <= _gradDescSettleMax)
     return;
   _gradDescErrorAcc = _gradDescErrorAcc + error;
-  if (_gradDescCount > _gradDescSettleMax + _gradDescAverageMax) {
-    // store the duty cycle value to compensator output array in case we switch to classical feedback
-    long duty = getDutyCycle();
-    _compOut[0] = (int)(duty*1024/100);
-    // reset counter, calculate and process average error
-    _gradDescCount = 0;
-    int avgError = _gradDescErrorAcc/_gradDescAverageMax;
-    _gradDescErrorAcc = 0;
-    if (avgError > 0) { // ascend or descend by 1% duty cycle depending on the sign of the error
-      setDutyCycle((int)(duty + 1));
-    } else if (error < 0) {
-      setDutyCycle((int)(duty - 1));
-    }
-  }
+  _gradDescSamples++;
+  if (_gradDescCount < _gradDescSettleMax + _gradDescAverageMax)
+    return;
+  // reset counter, calculate and process average error
+  int avgError = (int)(_gradDescErrorAcc/_gradDescSamples);
+  _gradDescCount = 0;
+  _gradDescErrorAcc = 0;
+  _gradDescSamples = 0;
+  long step = (long)_gradDescGain*avgError/(1 << GRAD_DESC_Q); // toward zero, both ways alike
+  if (avgError > 0 && step < _gradDescStepMin)
+    step = _gradDescStepMin;
+  else if (avgError < 0 && step > -_gradDescStepMin)
+    step = -_gradDescStepMin;
+  step += (long)_gradDescMomentum*_gradDescLastStep/(1 << GRAD_DESC_Q); // dies out rather than creeping on at -1
+  step = constrain(step, -(long)_gradDescStepMax, (long)_gradDescStepMax);
+  int dutyRaw = getDutyCycleRaw();
+  setDutyCycleRaw((int)(dutyRaw + step));
+  _gradDescLastStep = getDutyCycleRaw() - dutyRaw; // what the duty cycle limits let through
+  // store the duty cycle value to compensator output array in case we switch to classical feedback
+  holdCompOutput(getDutyCycleRaw()); // dutyRaw, the compensator's output unit, as resetComp() uses
 }
 
 // Communications ------------------------------------------------------------
 
 // process the parsed RX command, overrides base class virtual function
-// Atverter readable registers: RV1, RV2, RI1, RI2, RT1, RT2, RVCC, RDUT
+// Atverter readable registers: RV1, RV2, RI1, RI2, RT1, RT2, RVCC, RDUT, RDRP, RTCK
 // Atverter writable registers: WISD, WTSD
 void AtverterH::interpretRXCommand(char* command, char* value, int receiveProtocol) {
   if (strcmp(command, "RV1") == 0) { // read voltage at terminal 1
-    sprintf(getTXBuffer(receiveProtocol), "WV1:%u", getV1());
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WV1:%u", getV1());
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "RV2") == 0) { // read voltage at terminal 2
-    sprintf(getTXBuffer(receiveProtocol), "WV2:%u", getV2());
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WV2:%u", getV2());
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "RI1") == 0) { // read current at terminal 1
-    sprintf(getTXBuffer(receiveProtocol), "WI1:%d", getI1());
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WI1:%d", getI1());
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "RI2") == 0) { // read current at terminal 2
-    sprintf(getTXBuffer(receiveProtocol), "WI2:%d", getI2());
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WI2:%d", getI2());
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "RT1") == 0) { // read FET temperature of side 1
-    sprintf(getTXBuffer(receiveProtocol), "WT1:%d", getT2());
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WT1:%d", getT1());
     respondToMaster(receiveProtocol);
-  } else if (strcmp(command, "RT2") == 0) { // read FET temperature of side 1
-    sprintf(getTXBuffer(receiveProtocol), "WT2:%d", getT2());
+  } else if (strcmp(command, "RT2") == 0) { // read FET temperature of side 2
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WT2:%d", getT2());
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "RVCC") == 0) { // read the ~5V VCC bus voltage
-    sprintf(getTXBuffer(receiveProtocol), "WVCC:%d", getVCC());
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WVCC:%d", getVCC());
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "RDUT") == 0) { // read the duty cycle
-    sprintf(getTXBuffer(receiveProtocol), "WDUT:%d", getDutyCycle());
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WDUT:%d", getDutyCycle());
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "RDRP") == 0) { // read the stored droop resistance
-    sprintf(getTXBuffer(receiveProtocol), "WDRP:%d", getRDroop());
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WDRP:%d", getRDroop());
+    respondToMaster(receiveProtocol);
+  } else if (strcmp(command, "RTCK") == 0) { // read the control tick counter, for host clock sync
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WTCK:%lu", getTicks());
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "WIS1") == 0) { // write the terminal 1 current shutdown limit (mA)
-    int temp = atoi(value);
+    int temp = value ? atoi(value) : 0;
     setCurrentShutdown1(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WIS1:=%d", temp);
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WIS1:=%d", temp);
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "WIS2") == 0) { // write the terminal 2 current shutdown limit (mA)
-    int temp = atoi(value);
+    int temp = value ? atoi(value) : 0;
     setCurrentShutdown2(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WIS2:=%d", temp);
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WIS2:=%d", temp);
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "WTSD") == 0) { // write the thermal shutdown limit (°C)
-    int temp = atoi(value);
+    int temp = value ? atoi(value) : 0;
     setThermalShutdown(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WTSD:=%d", temp);
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WTSD:=%d", temp);
     respondToMaster(receiveProtocol);
   } else if (strcmp(command, "WDRP") == 0) { // set the stored droop resistance
-    int temp = atoi(value);
+    int temp = value ? atoi(value) : 0;
     setRDroop(temp);
-    sprintf(getTXBuffer(receiveProtocol), "WDRP:=%d", temp);
+    snprintf(getTXBuffer(receiveProtocol), COMMBUFFERSIZE, "WDRP:=%d", temp);
     respondToMaster(receiveProtocol);
   } else { // send command data to the callback listener functions, registered from primary .ino file
     for (int n = 0; n < _commandCallbacksEnd; n++) {
@@ -10,12 +10,7 @@
 #define AtverterH_h
 
 // #include "Arduino.h"
-#include "PicroBoard.h"
-
-// In Arduino IDE, go to Sketch -> Include Library -> Manage Libraries
-#include <FastPwmPin.h> // Add zip library from: https://github.com/maxint-rd/FastPwmPin
-#include <TimerOne.h> // In Library Manager, search for "TimerOne"
-#include <avdweb_AnalogReadFast.h> // In Library Manager, search for "AnalogReadFast"
+#include "PicroBoard.h" // brings PicroHAL.h, which includes FastPwmPin, TimerOne and AnalogReadFast on the AVR
 
 // pins for turning on the LEDs
 const int LED2_PIN = 2; // PD2
@@ -124,9 +119,29 @@ const int TTABLE[14][2] = {
   880, 100
 };
 
+// thermistor readings below this are an open thermistor (about -45 °C at 33k to ground), not a temperature
+const int THERMISTOR_OPEN_RAW = 4;
+
 // droop resistance multiplication factor to avoid floating point math (multiple of 2)
 const int RDROOPFACTOR = 1024;
 
+// duty cycle in raw form, the unit of the compensator's input to the switch: dutyRaw = duty*1024/100
+const int DUTY_RAW_SCALE = 1024; // 100 %
+const int DUTY_RAW_MIN = 10; // 1 %, setDutyCycle()'s lower limit
+const int DUTY_RAW_MAX = 1014; // 99 %, its upper limit
+
+// compensator: a cascade of biquad sections, each H(z) = (b0 + b1 z^-1 + b2 z^-2)/(1 + a1 z^-1 + a2 z^-2)
+//  coefficients {b0, b1, b2, a1, a2} per section, in Q15 (32768 = 1) shifted right by the post shift,
+//  e.g. post shift 1 gives -2 to 2 in steps of 2^-14; inputs and outputs are integers (raw ADC error in, dutyRaw out)
+const int COMP_MAX_SECTIONS = 3; // biquads in cascade
+const int COMP_SECTION_COEFFICIENTS = 5; // b0, b1, b2, a1, a2
+const int COMP_MAX_POST_SHIFT = 3; // coefficients from -16 to 16
+
+// gradient descent: every step moves dutyRaw by the averaged error times the gain, then adds the momentum share
+//  of the last step; the gain and momentum are Q8 (256 = 1), the step's size is clamped to the step limits
+const int GRAD_DESC_Q = 8;
+const int GRAD_DESC_STEP_DEFAULT = DUTY_RAW_SCALE/100; // 1 %, the fixed step with no gain
+
 class AtverterH : public PicroBoard
 {
   public:
@@ -138,14 +153,19 @@ class AtverterH : public PicroBoard
     void initializeSensors(int avgWindowLength); // initialize sensor average array to sensor read
     void initializeInterruptTimer(long periodus, // starts periodic control timer
       void (*interruptFunction)(void)); // inputs: period (ms), controller function reference
+    unsigned long getTicks(); // control timer interrupts since initializeInterruptTimer(), wraps after 2^32
+    long getTickPeriod(); // control timer period in microseconds
+    void skipTicks(unsigned long ticks); // counts interrupts whose controller a simulation left out, e.g. PlantSim's time warp
     void enableGateDrivers(); // resets protection latch, enabling the gate drivers
     void enableGateDrivers(int holdProtectMicroseconds); // resets protection latch, enabling the gate drivers
     void startPWM(int initialDuty); // sets initial duty cycle and enables gate drivers
   // duty cycle
     void setDutyCycle(int dutyCycle); // sets duty cycle (0 to 100)
     void setDutyCycleFloat(float dutyCycleFloat); // sets duty cycle (0.0 to 1.0)
-    int getDutyCycle(); // gets the current duty cycle (0 to 100)
+    int getDutyCycle(); // gets the current duty cycle (0 to 100), the nearest % to the one the switch averages
     float getDutyCycleFloat(); // gets the current duty cycle (0.0 to 1.0)
+    void setDutyCycleRaw(int dutyRaw); // sets duty cycle (DUTY_RAW_MIN to DUTY_RAW_MAX), the switch dithers between whole %
+    int getDutyCycleRaw(); // gets the current duty cycle (0 to DUTY_RAW_SCALE)
   // alternate drive signal
     void checkBootstrapRefresh(); // check bootstrap counter to see if need to refresh caps
     void refreshBootstrap(); // refresh the bootstrap capacitors and reset bootstrap counter
@@ -189,7 +209,7 @@ class AtverterH : public PicroBoard
     unsigned int raw2mV(int raw); // converts ADC reading to mV voltage scaled by resistor divider
     int raw2mVADC(int raw); // converts ADC reading to mV voltage at ADC
     int raw2mA(int raw); // converts raw ADC current sense output to mA
-    int raw2degC(int raw); // converts raw ADC current sense output to °C
+    int raw2degC(int raw); // converts raw ADC thermistor output to °C, saturating at the table ends
     int mV2raw(unsigned int mV); // converts a mV value to raw 10-bit form
     int mA2raw(int mA); // converts a mA value to raw 10-bit form
   // droop resistance conversions
@@ -198,21 +218,28 @@ class AtverterH : public PicroBoard
     unsigned int getRDroopRaw(); // gets the stored droop resisance in raw form
     int getVDroopRaw(int iOut); // get the droop voltage as (droop resistance)*(output current)
   // compensation for classical feedback
-    void setComp(int num[], int den[], int numSize, int denSize); // set discrete compensator coefficients
+    void setComp(const int coefficients[], int sections, int postShift); // set biquad cascade coefficients
+    void setCompLimits(int minOut, int maxOut); // compensator output saturation, the duty cycle limits by default
     void updateCompPast(int inputNow); // update past compensator inputs and outputs
     long calculateCompOut(); // returns compensator output for classical feedback discrete compensation
     void resetComp(); // resets the compensator past values when switching between CV and CC
   // gradient descent functions
     void setGradDescCountMax(int settlingCount, int averagingCount); // set the gd counter max, controls gd speed
     void triggerGradDescStep(); // set gradient descent to step next call to gradDescStep()
-    void gradDescStep(int error); // steps duty cycle based on the sign of the error 
+    void setGradDescGain(int gain, int minStep, int maxStep); // Q8 dutyRaw per raw error, step size limits in dutyRaw
+    void setGradDescMomentum(int momentum); // Q8 share of the last step carried into the next (0 to 255)
+    void gradDescStep(int error); // steps dutyRaw by the averaged error, positive error raises the duty cycle
   // communications
     void interpretRXCommand(char* command, char* value, int receiveProtocol) override; // process RX command
   // legacy functions
     void initializePWMTimer(); // not needed with FastPWM library
   private:
+    // control timer
+    long _tickPeriodus = 0; // period given to initializeInterruptTimer()
     // switch operation
-    int _dutyCycle = 50; // the most recently set duty cycle (0 to 100)
+    int _dutyCycle = 50; // the switch's duty cycle (0 to 100), as most recently set or dithered
+    int _dutyCycleRaw = 512; // the same before rounding to the switch's %, see setDutyCycleRaw()
+    int _dutyCycleResidue = 0; // the part of a % setDutyCycleRaw() owes the switch, in 1/1024ths
     long _bootstrapCounter = 0; // counter to refresh the gate driver bootstrap caps
     long _bootstrapCounterMax; // reset value for bootstrap counter
     // sensors and averaging
@@ -231,20 +258,29 @@ class AtverterH : public PicroBoard
     int _thermalLimitC = 80; // the upper °C thermal limit before gate shutoff
     // convenience variables for controls and compensation
     long _rDroop = 0; // stored droop resistance value
-    int _compIn[8] = {0,0,0,0,0,0,0,0}; // compensator input values (raw 0-1023), current to oldest 
-    int _compOut[8] = {0,0,0,0,0,0,0,0}; // compensator output values (raw 0-1023), current to oldest 
-    int *_compNum; // discrete compensation difference equation numerator
-    int *_compDen; // discrete compensation difference equation denominator
-    int _compNumSize; // length of compensator numerator
-    int _compDenSize; // length of compensator denominator
+    const int *_compCoefficients = 0; // biquad coefficients, COMP_SECTION_COEFFICIENTS per section
+    int _compSections = 0; // biquads in cascade
+    int _compShift = 15; // right shift of the accumulators, 15 less the post shift
+    int _compHistory[COMP_MAX_SECTIONS + 1][3]; // input (row 0) and section outputs, circular, newest at _compHead
+    int _compHead = 0; // index of x[n] and y[n] in _compHistory's rows
+    long _compResidue[COMP_MAX_SECTIONS]; // accumulator bits shifted out last update, added back in the next
+    int _compMin = DUTY_RAW_MIN; // output saturation
+    int _compMax = DUTY_RAW_MAX;
     int _gradDescCount = 0; // counter for gradient descent contorllers to control step speed
     int _gradDescSettleMax = SENSOR_V_WINDOW_MAX; // gd counter max, controls step speed, hold during 1st period
     int _gradDescAverageMax = SENSOR_V_WINDOW_MAX; // gd counter max, controls step speed, average during 2nd period
-    int _gradDescErrorAcc = 0; // error accumulator for gradient descent averaging
+    long _gradDescErrorAcc = 0; // error accumulator for gradient descent averaging
+    int _gradDescSamples = 0; // errors in the accumulator
+    int _gradDescGain = 0; // Q8 dutyRaw per raw error, 0 for fixed steps of the minimum size
+    int _gradDescStepMin = GRAD_DESC_STEP_DEFAULT; // dutyRaw, the smallest step a nonzero average error takes
+    int _gradDescStepMax = GRAD_DESC_STEP_DEFAULT; // dutyRaw, the largest step
+    int _gradDescMomentum = 0; // Q8
+    int _gradDescLastStep = 0; // dutyRaw
     // diagnostics
     int _shutdownCode = 0;
     // functions
     void updateSensorRaw(int index, int sample); // updates the raw averaged sensor value
+    void holdCompOutput(int out); // sets the last section's output history to out, e.g. the present dutyRaw
 };
 
 #endif
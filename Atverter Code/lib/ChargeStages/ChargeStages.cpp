@@ -0,0 +1,108 @@
+/*
+  ChargeStages.cpp - The MPPT sketch's bulk, absorption and float charge stages
+  Released into the public domain.
+*/
+
+#include "ChargeStages.h"
+
+ChargeStages::ChargeStages() {
+}
+
+// sets the voltage bulk charges up to and absorption holds, mV at 25 °C
+void ChargeStages::setAbsorptionVoltage(int32_t mV) {
+  _absorptionVoltage = mV;
+}
+
+int32_t ChargeStages::getAbsorptionVoltage() {
+  return _absorptionVoltage;
+}
+
+// sets the voltage float holds, mV at 25 °C
+void ChargeStages::setFloatVoltage(int32_t mV) {
+  _floatVoltage = mV;
+}
+
+int32_t ChargeStages::getFloatVoltage() {
+  return _floatVoltage;
+}
+
+// sets the voltage below which float goes back to bulk, mV at 25 °C
+void ChargeStages::setRebulkVoltage(int32_t mV) {
+  _rebulkVoltage = mV;
+}
+
+int32_t ChargeStages::getRebulkVoltage() {
+  return _rebulkVoltage;
+}
+
+// sets the charge current below which absorption ends, mA
+void ChargeStages::setTailCurrent(int32_t mA) {
+  _tailCurrent = mA;
+}
+
+int32_t ChargeStages::getTailCurrent() {
+  return _tailCurrent;
+}
+
+// sets the longest absorption, seconds at the absorption voltage
+void ChargeStages::setAbsorptionTime(int32_t seconds) {
+  _absorptionTime = seconds;
+}
+
+int32_t ChargeStages::getAbsorptionTime() {
+  return _absorptionTime;
+}
+
+// sets how far the voltages move per °C from 25 °C, mV
+void ChargeStages::setTemperatureCompensation(int32_t mVPerC) {
+  _temperatureCompensation = mVPerC;
+}
+
+int32_t ChargeStages::getTemperatureCompensation() {
+  return _temperatureCompensation;
+}
+
+// starts a stage over with its timers cleared
+void ChargeStages::setStage(int stage) {
+  _stage = stage < 0 || stage >= NUM_CHARGESTAGES ? CHARGE_BULK : stage;
+  _stageSeconds = 0;
+  _regulatedSeconds = 0;
+  _tailSeconds = 0;
+  _rebulkSeconds = 0;
+}
+
+int ChargeStages::getStage() {
+  return _stage;
+}
+
+// one second of charging at the battery voltage (mV), the current into it (mA) and the temperature (°C)
+int ChargeStages::update(int32_t voltage, int32_t current, int temperature) {
+  int celsius = temperature < CHARGE_MIN_C ? CHARGE_MIN_C : temperature > CHARGE_MAX_C ? CHARGE_MAX_C : temperature;
+  _compensation = _temperatureCompensation*(celsius - CHARGE_REFERENCE_C);
+  _averageCurrent += current - (_averageCurrent >> CHARGE_TAIL_FILTER_SHIFT); // in every stage, ready for the tail
+  _stageSeconds++;
+  bool regulated = voltage >= getSetpoint() - CHARGE_REGULATION_MARGIN;
+  _rebulkSeconds = voltage < _rebulkVoltage + _compensation ? _rebulkSeconds + 1 : 0;
+  if (_stage == CHARGE_BULK) {
+    if (regulated)
+      setStage(CHARGE_ABSORPTION);
+  } else if (_rebulkSeconds >= CHARGE_REBULK_HOLD_S) { // a load took more than the panel gave
+    setStage(CHARGE_BULK);
+  } else if (_stage == CHARGE_ABSORPTION) {
+    _regulatedSeconds = regulated ? _regulatedSeconds + 1 : _regulatedSeconds;
+    _tailSeconds = regulated && (_averageCurrent >> CHARGE_TAIL_FILTER_SHIFT) < _tailCurrent ? _tailSeconds + 1 : 0;
+    if (_tailSeconds >= CHARGE_TAIL_HOLD_S || _regulatedSeconds >= _absorptionTime)
+      setStage(CHARGE_FLOAT);
+  }
+  return _stage;
+}
+
+// the voltage the battery may be charged to in this stage, mV at the last update's temperature
+int32_t ChargeStages::getSetpoint() {
+  return (_stage == CHARGE_FLOAT ? _floatVoltage : _absorptionVoltage) + _compensation;
+}
+
+// seconds since the stage started
+int32_t ChargeStages::getStageSeconds() {
+  return _stageSeconds;
+}
@@ -0,0 +1,93 @@
+/*
+  ChargeStages.h - The MPPT sketch's bulk, absorption and float charge stages
+  Released into the public domain.
+
+  One update per second, from the battery voltage, the charge current and a
+  temperature. It decides the stage and the voltage the battery may be
+  charged to:
+    bulk        the battery takes all the panel gives (MPPT), up to the
+                absorption voltage, where absorption starts
+    absorption  the battery is held at the absorption voltage until the
+                charge current, averaged, stays below the tail current
+                for CHARGE_TAIL_HOLD_S, or until the absorption time has passed
+                at that voltage
+    float       the battery is held at the lower float voltage, and goes
+                back to bulk once it stays below the rebulk voltage for
+                CHARGE_REBULK_HOLD_S (a load took more than the panel gave)
+  The voltages are set at 25 °C and move by the temperature compensation
+  per °C away from it, between 0 and 50 °C. The setpoint is a limit, not a
+  target: below it the sketch keeps tracking the maximum power point, so
+  no harvest is lost until the battery is full.
+
+  Kept apart from the sketch like IncrementalConductance, integer C++ for
+  the AVR and the host alike.
+*/
+
+#ifndef ChargeStages_h
+#define ChargeStages_h
+
+#include <stdint.h>
+
+// 12 V lead-acid (6 cells)
+const int32_t CHARGE_DEFAULT_ABSORPTION_VOLTAGE = 14400; // mV at 25 °C
+const int32_t CHARGE_DEFAULT_FLOAT_VOLTAGE = 13600; // mV at 25 °C
+const int32_t CHARGE_DEFAULT_REBULK_VOLTAGE = 12600; // mV at 25 °C
+const int32_t CHARGE_DEFAULT_TAIL_CURRENT = 1000; // mA, 2 % of a 50 Ah battery
+const int32_t CHARGE_DEFAULT_ABSORPTION_TIME = 7200; // s at the absorption voltage
+const int32_t CHARGE_DEFAULT_TEMPERATURE_COMPENSATION = -30; // mV/°C, -5 per cell
+const int32_t CHARGE_REGULATION_MARGIN = 100; // mV below the setpoint that counts as at it
+const int CHARGE_TAIL_HOLD_S = 60;
+const int CHARGE_TAIL_FILTER_SHIFT = 4; // the tail takes the charge current averaged over some 2^4 s
+const int CHARGE_REBULK_HOLD_S = 30;
+const int CHARGE_REFERENCE_C = 25;
+const int CHARGE_MIN_C = 0; // the compensation stops at these
+const int CHARGE_MAX_C = 50;
+
+// charge stages, for convenience and bookkeeping
+enum ChargeStageIds
+{   CHARGE_BULK = 0, // MPPT, up to the absorption voltage
+    CHARGE_ABSORPTION, // held at the absorption voltage
+    CHARGE_FLOAT, // held at the float voltage
+    NUM_CHARGESTAGES
+};
+
+const char * const CHARGE_STAGE_NAMES[NUM_CHARGESTAGES] = {"bulk", "absorption", "float"};
+
+class ChargeStages
+{
+  public:
+    ChargeStages(); // constructor
+    void setAbsorptionVoltage(int32_t mV); // at 25 °C
+    int32_t getAbsorptionVoltage();
+    void setFloatVoltage(int32_t mV); // at 25 °C
+    int32_t getFloatVoltage();
+    void setRebulkVoltage(int32_t mV); // at 25 °C
+    int32_t getRebulkVoltage();
+    void setTailCurrent(int32_t mA);
+    int32_t getTailCurrent();
+    void setAbsorptionTime(int32_t seconds);
+    int32_t getAbsorptionTime();
+    void setTemperatureCompensation(int32_t mVPerC); // per battery, usually negative
+    int32_t getTemperatureCompensation();
+    void setStage(int stage); // starts a stage over, e.g. bulk at power up
+    int getStage();
+    int update(int32_t voltage, int32_t current, int temperature); // once a second (mV, mA in, °C), returns the stage
+    int32_t getSetpoint(); // mV the battery may be charged to now: absorption or float, temperature compensated
+    int32_t getStageSeconds(); // updates since the stage started
+  private:
+    int32_t _absorptionVoltage = CHARGE_DEFAULT_ABSORPTION_VOLTAGE;
+    int32_t _floatVoltage = CHARGE_DEFAULT_FLOAT_VOLTAGE;
+    int32_t _rebulkVoltage = CHARGE_DEFAULT_REBULK_VOLTAGE;
+    int32_t _tailCurrent = CHARGE_DEFAULT_TAIL_CURRENT;
+    int32_t _absorptionTime = CHARGE_DEFAULT_ABSORPTION_TIME;
+    int32_t _temperatureCompensation = CHARGE_DEFAULT_TEMPERATURE_COMPENSATION;
+    int32_t _compensation = 0; // mV at the last update's temperature
+    int _stage = CHARGE_BULK;
+    int32_t _stageSeconds = 0;
+    int32_t _regulatedSeconds = 0; // in absorption at the absorption voltage
+    int32_t _averageCurrent = 0; // mA << CHARGE_TAIL_FILTER_SHIFT, first order
+    int _tailSeconds = 0; // in a row below the tail current at the setpoint
+    int _rebulkSeconds = 0; // in a row below the rebulk voltage
+};
+
+#endif
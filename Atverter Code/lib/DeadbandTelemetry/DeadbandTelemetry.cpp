@@ -0,0 +1,108 @@
+/*
+  DeadbandTelemetry.cpp - Decides which telemetry records and fields are worth sending
+  Released into the public domain.
+*/
+
+#include "DeadbandTelemetry.h"
+
+DeadbandTelemetry::DeadbandTelemetry() {
+}
+
+// sets the number of fields per record, subscribes every field with a deadband of 0
+void DeadbandTelemetry::begin(int numFields) {
+  if (numFields > DEADBAND_FIELDS_MAX)
+    numFields = DEADBAND_FIELDS_MAX;
+  _numFields = numFields;
+  for (int n = 0; n < DEADBAND_FIELDS_MAX; n++) {
+    _deadbands[n] = 0;
+    _lastSent[n] = 0;
+    _deltas[n] = 0;
+  }
+  _sentMask = 0;
+  _sinceKeyframe = 0;
+  _keyframeRequested = true;
+}
+
+// turns the deadband mode on or off; switching it on starts with a keyframe
+void DeadbandTelemetry::setEnabled(bool enabled) {
+  if (enabled && !_enabled)
+    _keyframeRequested = true;
+  _enabled = enabled;
+}
+
+// true if records are filtered
+bool DeadbandTelemetry::isEnabled() {
+  return _enabled;
+}
+
+// sets the largest change of a field that does not trigger a record, DEADBAND_UNSUBSCRIBED for never
+void DeadbandTelemetry::setDeadband(int field, long deadband) {
+  if (field >= 0 && field < _numFields)
+    _deadbands[field] = deadband < 0 ? DEADBAND_UNSUBSCRIBED : deadband;
+}
+
+// gets the deadband of a field
+long DeadbandTelemetry::getDeadband(int field) {
+  if (field < 0 || field >= _numFields)
+    return DEADBAND_UNSUBSCRIBED;
+  return _deadbands[field];
+}
+
+// sets how many records may pass before a keyframe is sent regardless
+void DeadbandTelemetry::setHeartbeat(int records) {
+  _heartbeat = records < 1 ? 1 : records;
+}
+
+// gets the records between keyframes
+int DeadbandTelemetry::getHeartbeat() {
+  return _heartbeat;
+}
+
+// makes the next record a keyframe
+void DeadbandTelemetry::requestKeyframe() {
+  _keyframeRequested = true;
+}
+
+// compares one record's values with what the receiver holds, returns the record to send
+int DeadbandTelemetry::update(const long values[]) {
+  _sinceKeyframe++;
+  if (!_enabled || _keyframeRequested || _sinceKeyframe >= _heartbeat) {
+    for (int n = 0; n < _numFields; n++)
+      _lastSent[n] = values[n];
+    _sentMask = (uint16_t)((1UL << _numFields) - 1);
+    _sinceKeyframe = 0;
+    _keyframeRequested = false;
+    _sequence++;
+    return RECORD_KEYFRAME;
+  }
+  _sentMask = 0;
+  for (int n = 0; n < _numFields; n++) {
+    if (_deadbands[n] == DEADBAND_UNSUBSCRIBED)
+      continue;
+    long delta = values[n] - _lastSent[n];
+    if (delta > _deadbands[n] || delta < -_deadbands[n]) {
+      _deltas[n] = delta;
+      _lastSent[n] = values[n];
+      _sentMask |= (uint16_t)(1U << n);
+    }
+  }
+  if (_sentMask == 0)
+    return RECORD_NONE;
+  _sequence++;
+  return RECORD_DELTA;
+}
+
+// true if the field is part of the record update() asked for
+bool DeadbandTelemetry::isFieldSent(int field) {
+  return field >= 0 && field < _numFields && (_sentMask & (1U << field));
+}
+
+// change of a field since it was last sent, valid for the fields of a delta record
+long DeadbandTelemetry::getDelta(int field) {
+  return _deltas[field];
+}
+
+// sequence number of the record update() asked for
+uint8_t DeadbandTelemetry::getSequence() {
+  return _sequence;
+}
@@ -0,0 +1,69 @@
+/*
+  DeadbandTelemetry.h - Decides which telemetry records and fields are worth sending
+  Released into the public domain.
+
+  At night or in stable sun most records repeat the previous one. With the
+  deadband mode enabled, a record is only sent when some field has moved more
+  than its deadband away from the value last sent for it, and then only those
+  fields, as differences from their last sent values (a delta record). Every
+  heartbeat records a complete keyframe is sent instead, so the receiver
+  recovers from a lost line and knows the device is alive. Each sent record
+  carries a sequence number (0 to 255) for the receiver to notice gaps, and a
+  receiver that lost track can ask for a keyframe right away.
+
+  A receiver that holds every field at its last value between records sees
+  each field within its deadband at every record instant, and every record of
+  a transient exactly as the firmware measured it.
+
+  Knows nothing about the fields' names or the UART: update() is given the
+  values of each record in a fixed order, and the caller prints what it says.
+  Plain integer C++, so it builds for the AVR and the host alike.
+*/
+
+#ifndef DeadbandTelemetry_h
+#define DeadbandTelemetry_h
+
+#include <stdint.h>
+
+const int DEADBAND_FIELDS_MAX = 12; // three longs of RAM each; at most 16 for the sent field mask
+const long DEADBAND_UNSUBSCRIBED = -1; // the field never triggers a record and only travels in keyframes
+const int DEADBAND_DEFAULT_HEARTBEAT = 60; // records between keyframes
+
+// kinds of record update() can ask for, for convenience and bookkeeping
+enum DeadbandRecordTypes
+{   RECORD_NONE = 0, // nothing moved, send nothing
+    RECORD_KEYFRAME, // every field, absolute values
+    RECORD_DELTA, // the fields that moved, as differences
+    NUM_RECORDTYPES
+};
+
+class DeadbandTelemetry
+{
+  public:
+    DeadbandTelemetry(); // constructor
+    void begin(int numFields); // every field subscribed with a deadband of 0, deadband mode off
+    void setEnabled(bool enabled); // off: every record is a keyframe, like before the deadband mode
+    bool isEnabled(); // true if records are filtered
+    void setDeadband(int field, long deadband); // largest change that is not sent, or DEADBAND_UNSUBSCRIBED
+    long getDeadband(int field); // deadband of a field
+    void setHeartbeat(int records); // records between keyframes, at least 1
+    int getHeartbeat(); // records between keyframes
+    void requestKeyframe(); // the next record is a keyframe, e.g. when the receiver lost a line
+    int update(const long values[]); // one record's values, returns the DeadbandRecordTypes to send
+    bool isFieldSent(int field); // after update(): the field is part of the record
+    long getDelta(int field); // after update(): change since the field was last sent, for RECORD_DELTA
+    uint8_t getSequence(); // after update(): sequence number of the record
+  private:
+    int _numFields = 0;
+    bool _enabled = false;
+    long _deadbands[DEADBAND_FIELDS_MAX]; // per field, DEADBAND_UNSUBSCRIBED for none
+    long _lastSent[DEADBAND_FIELDS_MAX]; // value the receiver holds for each field
+    long _deltas[DEADBAND_FIELDS_MAX]; // of the last delta record
+    uint16_t _sentMask = 0; // bit n set if field n is part of the last record
+    int _heartbeat = DEADBAND_DEFAULT_HEARTBEAT;
+    int _sinceKeyframe = 0; // records since the last keyframe, sent or not
+    bool _keyframeRequested = true; // the receiver has no values yet
+    uint8_t _sequence = 255; // of the last sent record, the first one is 0
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+  IncrementalConductance.cpp - The MPPT sketch's incremental conductance step
+  Released into the public domain.
+*/
+
+#include "IncrementalConductance.h"
+
+IncrementalConductance::IncrementalConductance() {
+}
+
+// sets the change of voltage within which the step goes by the change of current alone, at least 1 mV
+void IncrementalConductance::setVoltageErrorRange(int32_t mV) {
+  _voltageErrorRange = mV < 1 ? 1 : mV; // divides in step()
+}
+
+int32_t IncrementalConductance::getVoltageErrorRange() {
+  return _voltageErrorRange;
+}
+
+// sets the change of current the step ignores, mA
+void IncrementalConductance::setCurrentErrorRange(int32_t mA) {
+  _currentErrorRange = mA;
+}
+
+int32_t IncrementalConductance::getCurrentErrorRange() {
+  return _currentErrorRange;
+}
+
+// sets the duty cycle step, %
+void IncrementalConductance::setDutyCycleIncrement(int increment) {
+  _dutyCycleIncrement = increment;
+}
+
+int IncrementalConductance::getDutyCycleIncrement() {
+  return _dutyCycleIncrement;
+}
+
+// sets the duty cycle the next step moves from
+void IncrementalConductance::setDutyCycle(uint16_t dutyCycle) {
+  _dutyCycle = dutyCycle;
+}
+
+// gets the duty cycle after the last step
+uint16_t IncrementalConductance::getDutyCycle() {
+  return _dutyCycle;
+}
+
+// sets the measurements the next step takes its changes from
+void IncrementalConductance::setPrevious(int32_t voltage, int32_t current) {
+  _prevVoltage = voltage;
+  _prevCurrent = current;
+}
+
+// one step on the battery side voltage (mV) and current (mA), as the sketch has always done it
+int IncrementalConductance::step(int32_t voltage, int32_t current) {
+  int decision;
+  _dV = voltage - _prevVoltage;
+  _dI = current - _prevCurrent;
+  if ((-_voltageErrorRange < _dV) && (_dV < _voltageErrorRange)) {
+    if (_dI > _currentErrorRange)
+      decision = IC_UP_FLAT;
+    else if (_dI < -_currentErrorRange)
+      decision = IC_DOWN_FLAT;
+    else
+      decision = IC_HOLD_FLAT;
+  } else {
+    double slope = (double)_dI / _dV;
+    double conductance = (double)current / voltage;
+    int32_t errorRatio = _currentErrorRange / _voltageErrorRange; // an integer division, as it always was
+    if ((slope > -(conductance + errorRatio)) && (slope > -(conductance - errorRatio)))
+      decision = IC_UP_SLOPE;
+    else if ((slope < -(conductance + errorRatio)) && (slope < -(conductance - errorRatio)))
+      decision = IC_DOWN_SLOPE;
+    else
+      decision = IC_HOLD_SLOPE;
+  }
+  if (decision == IC_UP_FLAT || decision == IC_UP_SLOPE)
+    _dutyCycle += _dutyCycleIncrement;
+  else if (decision == IC_DOWN_FLAT || decision == IC_DOWN_SLOPE)
+    _dutyCycle += -_dutyCycleIncrement;
+  _prevVoltage = voltage;
+  _prevCurrent = current;
+  return decision;
+}
+
+int32_t IncrementalConductance::getDV() {
+  return _dV;
+}
+
+int32_t IncrementalConductance::getDI() {
+  return _dI;
+}
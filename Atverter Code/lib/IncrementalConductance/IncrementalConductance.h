@@ -0,0 +1,68 @@
+/*
+  IncrementalConductance.h - The MPPT sketch's incremental conductance step
+  Released into the public domain.
+
+  One step per MPPT period: given the battery side voltage and current, it
+  compares the change in current over the change in voltage since the last
+  step with the conductance and moves the duty cycle one increment up, one
+  down, or leaves it. Changes smaller than the error ranges count as none.
+
+  Kept apart from the sketch so the host can replay recorded telemetry
+  through exactly this code (atv-golden) and check that a rewrite of the
+  control path decides the same, record by record. Integer C++ with the
+  sketch's floating point comparisons, so it builds for the AVR and the host
+  alike; double is a 32-bit float on the AVR, so replays are exact for the
+  native build and the same on the AVR away from the comparison edges.
+*/
+
+#ifndef IncrementalConductance_h
+#define IncrementalConductance_h
+
+#include <stdint.h>
+
+const int32_t IC_DEFAULT_VOLTAGE_ERROR_RANGE = 10; // mV
+const int32_t IC_DEFAULT_CURRENT_ERROR_RANGE = 10; // mA
+const int IC_DEFAULT_DUTY_CYCLE_INCREMENT = 1; // %
+
+// what a step decided, for convenience and bookkeeping
+enum IcDecisions
+{   IC_HOLD_FLAT = 0, // dV ~= 0 and dI ~= 0
+    IC_UP_FLAT, // dV ~= 0, dI ~> 0: duty cycle up
+    IC_DOWN_FLAT, // dV ~= 0, dI ~< 0: duty cycle down
+    IC_HOLD_SLOPE, // dI/dV ~= -I/V
+    IC_UP_SLOPE, // dI/dV ~> -I/V: duty cycle up
+    IC_DOWN_SLOPE, // dI/dV ~< -I/V: duty cycle down
+    NUM_ICDECISIONS
+};
+
+const char * const IC_DECISION_NAMES[NUM_ICDECISIONS] = {"dV ~= 0, dI ~= 0", "dV ~= 0, dI ~> 0", "dV ~= 0, dI ~< 0",
+  "dI/dV ~= -avg", "dI/dV ~> -avg", "dI/dV ~< -avg"};
+
+class IncrementalConductance
+{
+  public:
+    IncrementalConductance(); // constructor
+    void setVoltageErrorRange(int32_t mV); // dV within which the step goes by dI alone, at least 1
+    int32_t getVoltageErrorRange();
+    void setCurrentErrorRange(int32_t mA); // dI the step ignores
+    int32_t getCurrentErrorRange();
+    void setDutyCycleIncrement(int increment); // duty cycle step, %
+    int getDutyCycleIncrement();
+    void setDutyCycle(uint16_t dutyCycle); // where the steps go on from, e.g. the duty cycle given to startPWM()
+    uint16_t getDutyCycle(); // the duty cycle to set after a step, not limited to 1 to 99
+    void setPrevious(int32_t voltage, int32_t current); // the last step's measurements, e.g. to start a replay
+    int step(int32_t voltage, int32_t current); // one MPPT period (mV, mA), returns the IcDecisions
+    int32_t getDV(); // change of voltage in the last step
+    int32_t getDI(); // change of current in the last step
+  private:
+    int32_t _voltageErrorRange = IC_DEFAULT_VOLTAGE_ERROR_RANGE;
+    int32_t _currentErrorRange = IC_DEFAULT_CURRENT_ERROR_RANGE;
+    int _dutyCycleIncrement = IC_DEFAULT_DUTY_CYCLE_INCREMENT;
+    uint16_t _dutyCycle = 50; // wraps like the sketch's uint16_t did
+    int32_t _prevVoltage = 0;
+    int32_t _prevCurrent = 0;
+    int32_t _dV = 0;
+    int32_t _dI = 0;
+};
+
+#endif
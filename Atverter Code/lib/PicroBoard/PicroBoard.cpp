@@ -13,6 +13,10 @@ PicroBoard::PicroBoard() {
 
 // adds a serial command callback to the array
 void PicroBoard::addCommandCallback(CommandCallback callback) {
+  for (int n = 0; n < _commandCallbacksEnd; n++) {
+    if (_commandCallbacks[n] == callback)
+      return; // setup() again after a reset, without answering every command twice
+  }
   if (_commandCallbacksEnd < COMMANDCALLBACKSMAXLENGTH) {
     _commandCallbacks[_commandCallbacksEnd] = callback;
     _commandCallbacksEnd++;
@@ -22,7 +26,9 @@ void PicroBoard::addCommandCallback(CommandCallback callback) {
 // parses the given rxBuffer and calls the appropriate valueFunction cooresponding to the command
 void PicroBoard::parseRXLine(char* buffer, int receiveProtocol) {
   char* command = strtok(buffer, ":");
-  char* value = strtok(NULL, "\n");
+  char* value = strtok(NULL, "\n"); // NULL without a value, the callbacks check for it
+  if (command == NULL) // an empty line, or nothing but colons
+    return;
   interpretRXCommand(command, value, receiveProtocol);
 }
 
@@ -102,12 +108,15 @@ void PicroBoard::startI2C(int address, ReceiveEventI2C receiveCallback, RequestE
 // function to handle when an I2C message comes in
 void PicroBoard::receiveEventI2C(int howMany) {
   // Serial.println("received");
+  int length = 0;
   for (int i = 0; i < howMany; i++) {
-    _rxBufferI2C[i] = Wire.read();
-    _rxBufferI2C[i + 1] = '\0'; //add null after ea. char
+    char c = Wire.read();
+    if (length < COMMBUFFERSIZE - 1) // a longer message is cut, like readUART() cuts a long line
+      _rxBufferI2C[length++] = c;
   }
+  _rxBufferI2C[length] = '\0';
   //RPi first byte is cmd byte so shift everything to the left 1 pos so temp contains our string
-  for (int i = 0; i < howMany; ++i)
+  for (int i = 0; i < length; ++i)
     _rxBufferI2C[i] = _rxBufferI2C[i + 1];
   parseRXLineI2C();
 }
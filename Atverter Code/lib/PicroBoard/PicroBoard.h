@@ -9,8 +9,7 @@
 #ifndef PicroBoard_h
 #define PicroBoard_h
 
-#include "Arduino.h"
-#include <Wire.h>
+#include "PicroHAL.h" // Arduino core, Serial and Wire on the AVR, in-memory fakes elsewhere
 
 // In Arduino IDE, go to Sketch -> Include Library -> Add .ZIP Library
 
@@ -31,6 +30,12 @@ enum CommunicationsProtocol
 const int COMMBUFFERSIZE = 16; // length of all character buffers (both receive and transmit)
 const int COMMANDCALLBACKSMAXLENGTH = 10; // max length of command callback array
 
+// spare bytes after each character buffer, none on the converter; the fuzz build sets some and fills them with
+// canaries, so a write that runs one buffer into the next is seen even though it stays inside the board
+#ifndef COMMBUFFERGUARD
+#define COMMBUFFERGUARD 0
+#endif
+
 class PicroBoard
 {
   public:
@@ -56,11 +61,11 @@ class PicroBoard
   protected:
     CommandCallback _commandCallbacks[COMMANDCALLBACKSMAXLENGTH]; // callback listeners to call at end of interpretRXCommand
     int _commandCallbacksEnd = 0; // moving end index of _commandCallbacks
-    char _rxBufferUART [COMMBUFFERSIZE]; // receive holding buffer for UART packets
+    char _rxBufferUART [COMMBUFFERSIZE + COMMBUFFERGUARD]; // receive holding buffer for UART packets
     int _rxCntUART = 0; // end index of _rxBufferUART
-    char _rxBufferI2C [COMMBUFFERSIZE]; // receive holding buffer for I2C packets
+    char _rxBufferI2C [COMMBUFFERSIZE + COMMBUFFERGUARD]; // receive holding buffer for I2C packets
     int _rxCntI2C = 0; // end index of _rxBufferUART
-    char _txBuffer [NUM_COMM_MODULES][COMMBUFFERSIZE]; // transmit holding buffer prior to transmission  
+    char _txBuffer [NUM_COMM_MODULES][COMMBUFFERSIZE + COMMBUFFERGUARD]; // transmit holding buffer prior to transmission  
 };
 
 #endif
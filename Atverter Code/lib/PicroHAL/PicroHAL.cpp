@@ -0,0 +1,390 @@
+/*
+  PicroHAL.cpp - In-memory fakes of the Picrogrid board hardware, for native builds
+  Released into the public domain.
+*/
+
+#include "PicroHAL.h"
+
+#ifndef __AVR__
+
+NativeSerial Serial;
+NativeWire Wire;
+
+// the simulated ATmega328P
+static int pinModes[HAL_NATIVE_PINS];
+static int pinLevels[HAL_NATIVE_PINS]; // written to output pins
+static int pinInputs[HAL_NATIVE_PINS]; // driven onto input pins from outside
+static int analogValues[HAL_NATIVE_PINS];
+static int pwmDuty[HAL_NATIVE_PINS];
+static unsigned long pwmFrequency[HAL_NATIVE_PINS];
+static void (*pinWriteCallback)(int, int) = NULL;
+static int vccmV = 5000;
+static uint8_t eeprom[HAL_EEPROM_SIZE];
+static void (*timerISR)(void) = NULL;
+static long timerPeriodus = 0;
+static uint64_t microsNow = 0;
+static bool interruptsEnabled = true;
+static uint8_t stageMark = 0;
+
+static bool validPin(int pin) {
+  return pin >= 0 && pin < HAL_NATIVE_PINS;
+}
+
+// NativeSerial --------------------------------------------------------------
+
+void NativeSerial::begin(long baud) {
+  _baud = baud;
+}
+
+int NativeSerial::available() {
+  return (int)(_rx.size() - _rxRead);
+}
+
+int NativeSerial::read() {
+  if (_rxRead >= _rx.size())
+    return -1;
+  return (unsigned char)_rx[_rxRead++];
+}
+
+size_t NativeSerial::write(uint8_t c) {
+  if (_tx.size() >= HAL_NATIVE_UART_TX_MAX) {
+    _txDropped++;
+    return 1;
+  }
+  _tx += (char)c;
+  return 1;
+}
+
+size_t NativeSerial::write(const char* text) {
+  size_t n = 0;
+  while (text[n] != '\0')
+    write((uint8_t)text[n++]);
+  return n;
+}
+
+size_t NativeSerial::print(const char* text) {
+  return write(text);
+}
+
+size_t NativeSerial::print(const std::string& text) {
+  return write(text.c_str());
+}
+
+size_t NativeSerial::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t NativeSerial::print(unsigned char n, int base) {
+  return printNumber(n, base, false);
+}
+
+size_t NativeSerial::print(int n, int base) {
+  return print((long)n, base);
+}
+
+size_t NativeSerial::print(unsigned int n, int base) {
+  return printNumber(n, base, false);
+}
+
+// like Arduino's Print, only base 10 shows a sign
+size_t NativeSerial::print(long n, int base) {
+  if (base == DEC && n < 0)
+    return printNumber(0UL - (unsigned long)n, base, true);
+  return printNumber((unsigned long)n, base, false);
+}
+
+size_t NativeSerial::print(unsigned long n, int base) {
+  return printNumber(n, base, false);
+}
+
+size_t NativeSerial::print(double n, int digits) {
+  char text[48];
+  snprintf(text, sizeof(text), "%.*f", digits, n);
+  return write(text);
+}
+
+size_t NativeSerial::println() {
+  return write("\r\n");
+}
+
+long NativeSerial::getBaud() {
+  return _baud;
+}
+
+unsigned long NativeSerial::getDropped() {
+  return _txDropped;
+}
+
+size_t NativeSerial::printNumber(unsigned long n, int base, bool negative) {
+  char text[8*sizeof(long) + 2];
+  char* end = text + sizeof(text) - 1;
+  char* digit = end;
+  *digit = '\0';
+  if (base < 2)
+    base = DEC;
+  do {
+    int d = (int)(n % base);
+    *--digit = (char)(d < 10 ? '0' + d : 'A' + d - 10);
+    n /= base;
+  } while (n > 0);
+  if (negative)
+    *--digit = '-';
+  return write(digit);
+}
+
+// NativeWire ----------------------------------------------------------------
+
+void NativeWire::begin(int address) {
+  _address = address;
+}
+
+void NativeWire::onReceive(void (*callback)(int)) {
+  _receiveCallback = callback;
+}
+
+void NativeWire::onRequest(void (*callback)(void)) {
+  _requestCallback = callback;
+}
+
+int NativeWire::available() {
+  return (int)(_rx.size() - _rxRead);
+}
+
+int NativeWire::read() {
+  if (_rxRead >= _rx.size())
+    return -1;
+  return (unsigned char)_rx[_rxRead++];
+}
+
+size_t NativeWire::write(uint8_t c) {
+  _tx += (char)c;
+  return 1;
+}
+
+size_t NativeWire::write(const char* text) {
+  size_t n = strlen(text);
+  _tx.append(text, n);
+  return n;
+}
+
+int NativeWire::getAddress() {
+  return _address;
+}
+
+// GPIO ----------------------------------------------------------------------
+
+void halPinMode(int pin, int mode) {
+  if (validPin(pin))
+    pinModes[pin] = mode;
+}
+
+void halDigitalWrite(int pin, int level) {
+  if (!validPin(pin))
+    return;
+  pinLevels[pin] = level ? HIGH : LOW;
+  if (pinWriteCallback)
+    pinWriteCallback(pin, pinLevels[pin]);
+}
+
+int halDigitalRead(int pin) {
+  if (!validPin(pin))
+    return LOW;
+  return pinModes[pin] == OUTPUT ? pinLevels[pin] : pinInputs[pin];
+}
+
+void halDelayMicroseconds(unsigned int us) {
+  microsNow += us;
+}
+
+// ADC -----------------------------------------------------------------------
+
+int halAnalogRead(int pin) {
+  return validPin(pin) ? analogValues[pin] : 0;
+}
+
+// what the ADC reads for 1.1 V against the supply, readVCC() inverts it
+int halReadBandgap() {
+  halDelayMicroseconds(2000); // the Vref settling wait
+  return (int)(1125300L/vccmV);
+}
+
+// PWM -----------------------------------------------------------------------
+
+void halSetPwm(int pin, unsigned long frequency, int dutyCycle) {
+  if (!validPin(pin))
+    return;
+  pwmFrequency[pin] = frequency;
+  pwmDuty[pin] = dutyCycle;
+}
+
+// Control timer -------------------------------------------------------------
+
+void halStartTimer(long periodus, void (*isr)(void)) {
+  timerPeriodus = periodus;
+  timerISR = isr;
+}
+
+uint8_t halDisableInterrupts() {
+  uint8_t state = interruptsEnabled ? 1 : 0;
+  interruptsEnabled = false;
+  return state;
+}
+
+void halRestoreInterrupts(uint8_t state) {
+  interruptsEnabled = state != 0;
+}
+
+// EEPROM --------------------------------------------------------------------
+
+uint8_t halEepromRead(int address) {
+  if (address < 0 || address >= HAL_EEPROM_SIZE)
+    return 0xFF;
+  return eeprom[address];
+}
+
+void halEepromWrite(int address, uint8_t value) {
+  if (address >= 0 && address < HAL_EEPROM_SIZE)
+    eeprom[address] = value;
+}
+
+// Profiling -----------------------------------------------------------------
+
+void halMarkStage(uint8_t stage) {
+  stageMark = stage;
+}
+
+// The outside world ---------------------------------------------------------
+
+// back to a freshly powered board
+void halNativeReset() {
+  halNativeRestart();
+  for (int n = 0; n < HAL_NATIVE_PINS; n++) {
+    pinInputs[n] = LOW;
+    analogValues[n] = 0;
+  }
+  pinWriteCallback = NULL;
+  vccmV = 5000;
+  memset(eeprom, 0xFF, sizeof(eeprom)); // erased cells read 0xFF
+}
+
+// what a reset of the MCU clears; the board around it (inputs, ADC inputs, VCC, pin callback) and the EEPROM stay
+void halNativeRestart() {
+  for (int n = 0; n < HAL_NATIVE_PINS; n++) {
+    pinModes[n] = INPUT;
+    pinLevels[n] = LOW;
+    pwmDuty[n] = -1;
+    pwmFrequency[n] = 0;
+  }
+  timerISR = NULL;
+  timerPeriodus = 0;
+  microsNow = 0;
+  interruptsEnabled = true;
+  stageMark = 0;
+  Serial = NativeSerial();
+  Wire = NativeWire();
+}
+
+void halNativeSetInput(int pin, int level) {
+  if (validPin(pin))
+    pinInputs[pin] = level ? HIGH : LOW;
+}
+
+void halNativeSetAnalog(int pin, int raw) {
+  if (validPin(pin))
+    analogValues[pin] = constrain(raw, 0, 1023);
+}
+
+void halNativeSetVCC(int mV) {
+  if (mV > 0)
+    vccmV = mV;
+}
+
+void halNativeOnPinWrite(void (*callback)(int pin, int level)) {
+  pinWriteCallback = callback;
+}
+
+int halNativeGetPinMode(int pin) {
+  return validPin(pin) ? pinModes[pin] : INPUT;
+}
+
+int halNativeGetPinLevel(int pin) {
+  return validPin(pin) ? pinLevels[pin] : LOW;
+}
+
+int halNativeGetPwmDuty(int pin) {
+  return validPin(pin) ? pwmDuty[pin] : -1;
+}
+
+unsigned long halNativeGetPwmFrequency(int pin) {
+  return validPin(pin) ? pwmFrequency[pin] : 0;
+}
+
+// one timer interrupt; like the AVR, the ISR runs with interrupts disabled
+bool halNativeTick() {
+  if (!timerISR)
+    return false;
+  microsNow += timerPeriodus;
+  interruptsEnabled = false;
+  timerISR();
+  interruptsEnabled = true;
+  return true;
+}
+
+// timer interrupts whose ISR a simulation left out, as it would have changed nothing
+bool halNativeSkipTicks(long ticks) {
+  if (!timerISR)
+    return false;
+  microsNow += (uint64_t)timerPeriodus*ticks;
+  return true;
+}
+
+long halNativeGetTimerPeriod() {
+  return timerPeriodus;
+}
+
+uint64_t halNativeMicros() {
+  return microsNow;
+}
+
+bool halNativeInterruptsEnabled() {
+  return interruptsEnabled;
+}
+
+void halNativeUARTReceive(const char* text) {
+  halNativeUARTReceive(text, strlen(text));
+}
+
+void halNativeUARTReceive(const char* data, size_t length) {
+  Serial._rx.erase(0, Serial._rxRead);
+  Serial._rxRead = 0;
+  Serial._rx.append(data, length);
+}
+
+std::string halNativeUARTTake() {
+  std::string output;
+  output.swap(Serial._tx);
+  return output;
+}
+
+// a master write: the bytes are read back by the onReceive callback, like TwoWire does
+void halNativeI2CWrite(const char* data, int length) {
+  if (length > HAL_NATIVE_I2C_BUFFER)
+    length = HAL_NATIVE_I2C_BUFFER; // the TWI driver NACKs the rest
+  Wire._rx.assign(data, length);
+  Wire._rxRead = 0;
+  if (Wire._receiveCallback)
+    Wire._receiveCallback(length);
+}
+
+uint8_t halNativeGetStage() {
+  return stageMark;
+}
+
+std::string halNativeI2CRead() {
+  Wire._tx.clear();
+  if (Wire._requestCallback)
+    Wire._requestCallback();
+  return Wire._tx;
+}
+
+#endif
@@ -0,0 +1,260 @@
+/*
+  PicroHAL.h - Hardware access for Picrogrid boards: ADC, GPIO, PWM, control timer, UART, I2C, EEPROM
+  Released into the public domain.
+
+  Board libraries call these instead of the Arduino core and the AVR
+  registers. On the AVR every function is an inline wrapper around the call
+  the board libraries used to make (digitalWrite(), analogReadFast(),
+  FastPwmPin, Timer1, the ADMUX/ADCSRA sequence, EEPROM), so the firmware
+  compiles to the same code as before. Serial and Wire stay the UART and I2C
+  interface, as in every sketch.
+
+  Anywhere else (PlatformIO's [env:native], the host CMake build) the same
+  names are in-memory fakes: pin levels, ADC readings and the bandgap are
+  set by the caller, PWM settings and UART output are recorded, the EEPROM is
+  an array, and time only moves when halNativeTick() fires the control
+  interrupt (or halNativeSkipTicks() passes over some) or the firmware waits
+  in halDelayMicroseconds(). The firmware then runs as fast as the host can
+  call it, without sleeping.
+*/
+
+#ifndef PicroHAL_h
+#define PicroHAL_h
+
+#ifdef __AVR__
+
+#include "Arduino.h"
+#include <Wire.h>
+#include <EEPROM.h>
+
+// In Arduino IDE, go to Sketch -> Include Library -> Manage Libraries
+#include <FastPwmPin.h> // Add zip library from: https://github.com/maxint-rd/FastPwmPin
+#include <TimerOne.h> // In Library Manager, search for "TimerOne"
+#include <avdweb_AnalogReadFast.h> // In Library Manager, search for "AnalogReadFast"
+
+// GPIO ----------------------------------------------------------------------
+
+inline void halPinMode(int pin, int mode) {
+  pinMode(pin, mode);
+}
+
+inline void halDigitalWrite(int pin, int level) {
+  digitalWrite(pin, level);
+}
+
+inline int halDigitalRead(int pin) {
+  return digitalRead(pin);
+}
+
+inline void halDelayMicroseconds(unsigned int us) {
+  delayMicroseconds(us);
+}
+
+// ADC -----------------------------------------------------------------------
+
+// 10-bit reading of an analog pin (0 to 1023)
+inline int halAnalogRead(int pin) {
+  return analogReadFast(pin);
+}
+
+// 10-bit reading of the 1.1 V bandgap against AVcc, for readVCC()
+inline int halReadBandgap() {
+  // set the reference to Vcc and the measurement to the internal 1.1V reference
+  #if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+    ADMUX = _BV(REFS0) | _BV(MUX4) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+  #elif defined (__AVR_ATtiny24__) || defined(__AVR_ATtiny44__) || defined(__AVR_ATtiny84__)
+     ADMUX = _BV(MUX5) | _BV(MUX0) ;
+  #else
+    ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+  #endif
+
+  delayMicroseconds(2000); // Wait for Vref to settle (originally 2 ms delay)
+  ADCSRA |= _BV(ADSC); // Start conversion
+  while (bit_is_set(ADCSRA,ADSC)); // measuring
+
+  uint8_t low  = ADCL; // must read ADCL first - it then locks ADCH
+  uint8_t high = ADCH; // unlocks both
+
+  return (high<<8) | low;
+}
+
+// PWM -----------------------------------------------------------------------
+
+// starts or updates the hardware PWM on a pin, duty cycle 0 to 100
+inline void halSetPwm(int pin, unsigned long frequency, int dutyCycle) {
+  FastPwmPin::enablePwmPin(pin, frequency, dutyCycle);
+}
+
+// Control timer -------------------------------------------------------------
+
+// calls isr every periodus microseconds from the Timer1 interrupt
+inline void halStartTimer(long periodus, void (*isr)(void)) {
+  Timer1.initialize(periodus); // arg: period in microseconds
+  Timer1.attachInterrupt(isr); // arg: interrupt function to call
+}
+
+// keeps interrupts out, returns the state for halRestoreInterrupts()
+inline uint8_t halDisableInterrupts() {
+  uint8_t oldSREG = SREG;
+  noInterrupts();
+  return oldSREG;
+}
+
+// restoring SREG instead of interrupts() keeps this safe inside an ISR
+inline void halRestoreInterrupts(uint8_t state) {
+  SREG = state;
+}
+
+// Profiling -----------------------------------------------------------------
+
+// tells an emulator which stage of the code runs (atv-isrtime), two cycles; GPIOR0 is otherwise unused
+inline void halMarkStage(uint8_t stage) {
+  GPIOR0 = stage;
+}
+
+// EEPROM --------------------------------------------------------------------
+
+const int HAL_EEPROM_SIZE = 1024; // ATmega328P
+
+inline uint8_t halEepromRead(int address) {
+  return EEPROM.read(address);
+}
+
+// only writes if the byte changes, the cells last ~100k writes
+inline void halEepromWrite(int address, uint8_t value) {
+  EEPROM.update(address, value);
+}
+
+#else // native
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Arduino core names the board libraries and sketches use
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+const int HAL_NATIVE_PINS = 22; // D0 to D13, A0 to A7 of the ATmega328P
+const int HAL_EEPROM_SIZE = 1024;
+const size_t HAL_NATIVE_UART_TX_MAX = 1 << 20; // bytes kept until halNativeUARTTake(), the rest are counted
+const int HAL_NATIVE_I2C_BUFFER = 32; // TwoWire's BUFFER_LENGTH, the slave takes no more bytes of a write
+
+// HardwareSerial as far as the firmware uses it; output is kept for halNativeUARTTake()
+class NativeSerial
+{
+  public:
+    void begin(long baud); // records the baud rate
+    int available(); // bytes given to halNativeUARTReceive() not read yet
+    int read(); // next received byte, or -1
+    size_t write(uint8_t c);
+    size_t write(const char* text);
+    size_t print(const char* text);
+    size_t print(const std::string& text);
+    size_t print(char c);
+    size_t print(unsigned char n, int base = DEC);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+    size_t println();
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    void flush() {}
+    long getBaud(); // from begin()
+    unsigned long getDropped(); // output bytes beyond HAL_NATIVE_UART_TX_MAX
+  private:
+    friend void halNativeReset();
+    friend void halNativeUARTReceive(const char* data, size_t length);
+    friend std::string halNativeUARTTake();
+    long _baud = 0;
+    std::string _rx; // received, _rxRead onwards not read yet
+    size_t _rxRead = 0;
+    std::string _tx; // written since the last halNativeUARTTake()
+    unsigned long _txDropped = 0;
+    size_t printNumber(unsigned long n, int base, bool negative);
+};
+
+// TwoWire as far as PicroBoard uses it, in slave mode
+class NativeWire
+{
+  public:
+    void begin(int address); // records the slave address
+    void onReceive(void (*callback)(int));
+    void onRequest(void (*callback)(void));
+    int available();
+    int read(); // next byte of the master's write, or -1
+    size_t write(uint8_t c);
+    size_t write(const char* text);
+    int getAddress(); // from begin()
+  private:
+    friend void halNativeReset();
+    friend void halNativeI2CWrite(const char* data, int length);
+    friend std::string halNativeI2CRead();
+    int _address = -1;
+    void (*_receiveCallback)(int) = NULL;
+    void (*_requestCallback)(void) = NULL;
+    std::string _rx; // the master's write being handled
+    size_t _rxRead = 0;
+    std::string _tx; // the answer to the master's read being handled
+};
+
+extern NativeSerial Serial;
+extern NativeWire Wire;
+
+// the HAL, same signatures as on the AVR
+void halPinMode(int pin, int mode);
+void halDigitalWrite(int pin, int level);
+int halDigitalRead(int pin); // output pins read back what was written, input pins what halNativeSetInput() set
+void halDelayMicroseconds(unsigned int us); // moves the fake clock, does not sleep
+int halAnalogRead(int pin);
+int halReadBandgap();
+void halSetPwm(int pin, unsigned long frequency, int dutyCycle);
+void halStartTimer(long periodus, void (*isr)(void));
+uint8_t halDisableInterrupts();
+void halRestoreInterrupts(uint8_t state);
+uint8_t halEepromRead(int address);
+void halEepromWrite(int address, uint8_t value);
+void halMarkStage(uint8_t stage);
+
+// the outside world, for benchmarks and simulators
+void halNativeReset(); // every pin low and an input, ADC at 0, VCC 5000 mV, EEPROM erased, no timer
+void halNativeRestart(); // a reset of the MCU (watchdog, brown-out): pins, timer, UART and I2C as at power up
+void halNativeSetInput(int pin, int level); // what an input pin reads
+void halNativeSetAnalog(int pin, int raw); // what halAnalogRead() returns for a pin (0 to 1023)
+void halNativeSetVCC(int mV); // supply the bandgap is measured against
+void halNativeOnPinWrite(void (*callback)(int pin, int level)); // called for each halDigitalWrite(), e.g. to model latches
+int halNativeGetPinMode(int pin);
+int halNativeGetPinLevel(int pin); // last level written
+int halNativeGetPwmDuty(int pin); // last duty cycle given to halSetPwm(), -1 if never
+unsigned long halNativeGetPwmFrequency(int pin);
+bool halNativeTick(); // advances the clock by one timer period and runs the ISR, false if no timer runs
+bool halNativeSkipTicks(long ticks); // advances the clock by ticks timer periods without running the ISR
+long halNativeGetTimerPeriod(); // from halStartTimer(), 0 if none
+uint64_t halNativeMicros(); // fake time since halNativeReset() or halNativeRestart()
+bool halNativeInterruptsEnabled();
+void halNativeUARTReceive(const char* text); // bytes for Serial.read()
+void halNativeUARTReceive(const char* data, size_t length); // same as above, NUL bytes included
+std::string halNativeUARTTake(); // everything printed since the last call
+void halNativeI2CWrite(const char* data, int length); // a master write (at most HAL_NATIVE_I2C_BUFFER bytes), runs the onReceive callback
+std::string halNativeI2CRead(); // a master read, runs the onRequest callback and returns the answer
+uint8_t halNativeGetStage(); // last halMarkStage()
+
+#endif
+
+#endif
@@ -17,21 +17,39 @@
 // #define SENSOR_I_WINDOW_MAX 128
 // #define SENSOR_V_WINDOW_MAX 128
 
-#include <Arduino.h>
+#include <PicroHAL.h> // the Arduino core on the AVR, in-memory fakes in [env:native]
 #include <AtverterH.h>
+#include <DeadbandTelemetry.h>
+#include <IncrementalConductance.h>
+#include <ChargeStages.h>
 
 #define INTERRUPT_TIME 1000
+#define SLOW_INTERRUPT_COUNT 1000 // the slow loop and its record run once every SLOW_INTERRUPT_COUNT + 1 ticks
 #define DUTY_CYCLE_INCREMENT 1
 #define VOLTAGE_ERROR_RANGE 10
 #define CURRENT_ERROR_RANGE 10
 
 #define LOW_SIDE_MAX_VOLTAGE 18000
-#define LOW_SIDE_MAX_CURRENT 15000
-#define HIGH_SIDE_MAX_CURRENT 15000
+#define LOW_SIDE_MAX_CURRENT 6000
+#define HIGH_SIDE_MAX_CURRENT 6000
 #define MAX_TEMP 60
 
-#define LOW_VOLTAGE_RESET 9000
-#define HIGH_VOLTAGE_RESET 15000
+#define ABSORPTION_VOLTAGE 14400 // mV at 25 °C, 12 V lead-acid; bulk charges up to it, absorption holds it
+#define FLOAT_VOLTAGE 13600 // mV at 25 °C, held once absorption is over
+#define REBULK_VOLTAGE 12600 // mV at 25 °C, float goes back to bulk below it
+#define TAIL_CURRENT 1000 // mA, absorption ends when the charge current stays below it
+#define ABSORPTION_TIME 7200 // s at the absorption voltage, absorption ends then at the latest
+#define TEMPERATURE_COMPENSATION -30 // mV/°C from 25 °C, of the thermistors
+
+#define CONTROL_MODE CONTROL_MPPT_VREF // ControlModes at power up
+#define VREF_INCREMENT 500 // mV the IC step moves the panel voltage reference by
+#define VREF_MIN 10000 // mV, the panel voltage reference stays within these
+#define VREF_MAX 50000
+#define CV1_DEADBAND 4 // raw, about 0.25 V: panel voltage errors the CV1 loop leaves alone, so ADC noise does not move the duty under the IC step
+#define CV2_GAIN 16 // Q8 raw of panel voltage reference per raw of battery voltage over the setpoint, per tick
+#define CV2_RELEASE 4 // raw, about 0.25 V: a battery this far under the setpoint gives the panel back to MPPT at once
+
+#define I2C_ADDRESS 0x08 // slave address for host commands over I2C
 
 #define DEBUG 0
 
@@ -40,24 +58,117 @@ AtverterH atverterH;
 // Variables for buck control
 int ledState = HIGH;
 long slowInterruptCounter = 0;
-uint16_t dutyCycle;
 
 // Variables for IC
+IncrementalConductance mppt; // the IC step with its duty cycle, tuned by the defines above until mpptCommand() changes it
 int32_t lowCurrent;
-int32_t prevLowCurrent;
 int32_t lowVoltage;
-int32_t prevLowVoltage;
 
 int32_t highCurrent;
 int32_t highVoltage;
 
-int32_t dV;
-int32_t dI;
+long slowInterruptCount = SLOW_INTERRUPT_COUNT; // the slow loop, the IC step and the record run every slowInterruptCount + 1 ticks
+
+// what sets the duty cycle, for convenience and bookkeeping
+enum ControlModes
+{   CONTROL_DUTY = 0,  // the IC step moves the duty cycle itself, once a second
+    CONTROL_MPPT_VREF, // the IC step moves the panel voltage reference, the CV1 loop holds the panel to it every tick
+    CONTROL_CV1,       // the CV1 loop holds the panel to the host's reference (WVRF), the IC step is ignored
+    NUM_CONTROLMODES
+};
+
+// Variables for charging
+ChargeStages charger; // the charge stage and the battery voltage setpoint, updated in the slow loop
+volatile int batteryReferenceRaw; // the setpoint as an ADC reading, the CV2 limit compares it every tick
+long chargeLimit = 0; // Q8 raw, how far the CV2 limit holds the panel voltage reference above MPPT's
+volatile int panelReferenceMaxRaw; // VREF_MAX as an ADC reading, the CV2 limit raises the reference up to it
+
+// Variables for the CV1 loop
+// PI on the panel voltage error (V1 - reference, raw) as one biquad, {b0, b1, b2, a1, a2} in Q14 (post shift 1):
+//  y[n] = y[n-1] + 0.192*x[n] - 0.064*x[n-1], y is dutyRaw (1024 = 100 %);
+//  more duty draws the panel down, so a panel above its reference raises the duty
+#define CV1_POST_SHIFT 1
+const int CV1_COMP[COMP_SECTION_COEFFICIENTS] = {3146, -1049, 0, -16384, 0};
+volatile int controlMode = CONTROL_MODE; // ControlModes, changed by controlCommand()
+unsigned int panelReference; // mV, where the CV1 loop holds V1
+volatile int panelReferenceRaw; // the same as an ADC reading, compared every tick
+int panelReferenceIncrement = VREF_INCREMENT; // mV per IC step
+
+// record fields in the order transmitData() prints them, same as the host's TelemetryChannel
+enum RecordFields
+{   FIELD_LOW_SIDE_VOLTAGE = 0,
+    FIELD_LOW_SIDE_CURRENT,
+    FIELD_LOW_SIDE_POWER,
+    FIELD_HIGH_SIDE_VOLTAGE,
+    FIELD_HIGH_SIDE_CURRENT,
+    FIELD_HIGH_SIDE_POWER,
+    FIELD_DUTY_CYCLE,
+    FIELD_TEMPERATURE_1,
+    FIELD_TEMPERATURE_2,
+    NUM_RECORDFIELDS
+};
+
+const char * const RECORD_FIELD_NAMES[NUM_RECORDFIELDS] = {
+    "LowSideVoltage",
+    "LowSideCurrent",
+    "LowSidePower",
+    "HighSideVoltage",
+    "HighSideCurrent",
+    "HighSidePower",
+    "DutyCycle",
+    "Temperature1",
+    "Temperature2"};
+
+// default deadbands for the deadband telemetry mode (WTXM:1), in each field's unit:
+//  about 2 ADC steps of voltage (63 mV each) and 3 of current (15 mA each), 1 % of duty, 1 °C;
+//  the IC step's own 1 % dither at the maximum power point is held, anything further is sent;
+//  power is not watched on its own, the host recomputes it from voltage and current
+const long RECORD_DEADBANDS[NUM_RECORDFIELDS] = {
+    130,
+    45,
+    DEADBAND_UNSUBSCRIBED,
+    130,
+    45,
+    DEADBAND_UNSUBSCRIBED,
+    1,
+    1,
+    1};
+
+// Variables for telemetry
+volatile bool recordPending = false; // set by controlUpdate(), cleared once loop() has printed the record
+unsigned long recordTick; // control tick the record's values were sampled in
+DeadbandTelemetry deadband; // which records and fields transmitData() sends
+
+// stages of controlUpdate(), marked with halMarkStage() for the ISR timing harness (atv-isrtime)
+enum IsrStages
+{   STAGE_OUTSIDE = 0, // loop(), and the ISR's entry and exit around controlUpdate()
+    STAGE_SENSORS,     // voltage and current averages
+    STAGE_PROTECTION,  // current, thermal and overvoltage shutdown, bootstrap refresh
+    STAGE_STATUS,      // shutdown report and the slow loop count
+    STAGE_SLOW,        // VCC, thermistors and LED, once a second
+    STAGE_MPPT,        // the IC step and the record, once a second
+    STAGE_COMPENSATOR, // the CV2 limit and the CV1 loop's compensator update, every tick in cascaded control
+    NUM_ISRSTAGES
+};
 
 // Function prototypes
 void setup();
 void controlUpdate();
 void transmitData();
+void telemetryCommand(const char* command, const char* value, int receiveProtocol);
+void mpptCommand(const char* command, const char* value, int receiveProtocol);
+void controlCommand(const char* command, const char* value, int receiveProtocol);
+void chargeCommand(const char* command, const char* value, int receiveProtocol);
+void setControlMode(int mode);
+void setPanelReference(long mV);
+void holdPanelVoltage();
+void regulatePanelVoltage();
+void stepPanelReference(int decision);
+void setChargeStage(int stage);
+void limitBatteryVoltage();
+int chargeTemperature();
+void receiveI2C(int howMany);
+void requestI2C();
 
 void setup(void)
 {
@@ -67,21 +178,336 @@ void setup(void)
     atverterH.setCurrentShutdown2(HIGH_SIDE_MAX_CURRENT); // set gate shutdown at 6A peak current
     atverterH.setThermalShutdown(MAX_TEMP);                     // set gate shutdown at 60°C temperature
 
-    dutyCycle = 50;
-    atverterH.startPWM(dutyCycle);
+    mppt.setVoltageErrorRange(VOLTAGE_ERROR_RANGE);
+    mppt.setCurrentErrorRange(CURRENT_ERROR_RANGE);
+    mppt.setDutyCycleIncrement(DUTY_CYCLE_INCREMENT);
+    mppt.setDutyCycle(50);
+    charger.setAbsorptionVoltage(ABSORPTION_VOLTAGE);
+    charger.setFloatVoltage(FLOAT_VOLTAGE);
+    charger.setRebulkVoltage(REBULK_VOLTAGE);
+    charger.setTailCurrent(TAIL_CURRENT);
+    charger.setAbsorptionTime(ABSORPTION_TIME);
+    charger.setTemperatureCompensation(TEMPERATURE_COMPENSATION);
+    setChargeStage(CHARGE_BULK);
+    atverterH.startPWM(mppt.getDutyCycle());
+    atverterH.setComp(CV1_COMP, 1, CV1_POST_SHIFT); // saturates at the duty cycle limits
+    holdPanelVoltage(); // the CV1 loop starts from the panel voltage at the start duty cycle
     atverterH.initializeInterruptTimer(INTERRUPT_TIME, &controlUpdate); // Get interrupts enabled
     atverterH.applyHoldHigh2();                                         // hold side 2 high for a buck converter with side 1 input
 
+    deadband.begin(NUM_RECORDFIELDS); // every record is sent until the host turns on the deadband mode
+    for (int n = 0; n < NUM_RECORDFIELDS; n++)
+        deadband.setDeadband(n, RECORD_DEADBANDS[n]);
+    atverterH.addCommandCallback(telemetryCommand);
+    atverterH.addCommandCallback(mpptCommand);
+    atverterH.addCommandCallback(controlCommand);
+    atverterH.addCommandCallback(chargeCommand);
+
     atverterH.startUART(); // send messages to computer via basic UART serial
+    atverterH.startI2C(I2C_ADDRESS, receiveI2C, requestI2C); // accept the same commands over I2C
 }
 
 void loop(void)
 {
+    atverterH.readUART(); // answer host commands (RV1, WIS1, WDRP, ...) between control interrupts
+    if (recordPending)
+    {
+        // printed here rather than in controlUpdate(): a record is longer than the UART buffer, and
+        // waiting for it to drain inside the ISR would skip control ticks and stall the tick counter
+        transmitData();
+        recordPending = false;
+    }
+}
+
+// Wire callbacks must be plain functions, forward them to the board
+void receiveI2C(int howMany)
+{
+    atverterH.receiveEventI2C(howMany);
+}
+
+void requestI2C()
+{
+    atverterH.requestEventI2C();
+}
+
+// telemetry commands, called for every command AtverterH does not know itself
+//  RTXM/WTXM: deadband mode off (0) or on (1)
+//  RHBT/WHBT: records between keyframes in deadband mode
+//  RDBn/WDBn: deadband of field n (RecordFields), -1 to not watch the field
+//  WKEY: send the next record as a keyframe
+void telemetryCommand(const char* command, const char* value, int receiveProtocol)
+{
+    char* response = atverterH.getTXBuffer(receiveProtocol);
+    long temp = value ? atol(value) : 0;
+    if (strcmp(command, "RTXM") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WTXM:%d", deadband.isEnabled() ? 1 : 0);
+    else if (strcmp(command, "WTXM") == 0)
+    {
+        deadband.setEnabled(temp != 0);
+        snprintf(response, COMMBUFFERSIZE, "WTXM:=%ld", temp);
+    }
+    else if (strcmp(command, "RHBT") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WHBT:%d", deadband.getHeartbeat());
+    else if (strcmp(command, "WHBT") == 0)
+    {
+        deadband.setHeartbeat((int)temp);
+        snprintf(response, COMMBUFFERSIZE, "WHBT:=%ld", temp);
+    }
+    else if (strncmp(command, "RDB", 3) == 0)
+    {
+        int field = atoi(command + 3);
+        snprintf(response, COMMBUFFERSIZE, "WDB%d:%ld", field, deadband.getDeadband(field));
+    }
+    else if (strncmp(command, "WDB", 3) == 0)
+    {
+        int field = atoi(command + 3);
+        deadband.setDeadband(field, temp);
+        snprintf(response, COMMBUFFERSIZE, "WDB%d:=%ld", field, temp);
+    }
+    else if (strcmp(command, "WKEY") == 0)
+    {
+        deadband.requestKeyframe();
+        snprintf(response, COMMBUFFERSIZE, "WKEY:=%ld", temp);
+    }
+    else
+        return;
+    atverterH.respondToMaster(receiveProtocol);
+}
+
+// IC tuning commands, for tuning runs (e.g. atv-tune on the plant simulator) and in the field
+//  RVER/WVER: dV within which the IC step goes by dI alone, mV (1 to 1000)
+//  RCER/WCER: dI the IC step ignores, mA (0 to 1000)
+//  RDCI/WDCI: duty cycle step, % (1 to 10)
+//  RMPI/WMPI: ticks between IC steps and records, less one (99 to 10000)
+void mpptCommand(const char* command, const char* value, int receiveProtocol)
+{
+    char* response = atverterH.getTXBuffer(receiveProtocol);
+    long temp = value ? atol(value) : 0;
+    if (strcmp(command, "RVER") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WVER:%ld", (long)mppt.getVoltageErrorRange());
+    else if (strcmp(command, "WVER") == 0)
+    {
+        mppt.setVoltageErrorRange(constrain(temp, 1, 1000));
+        snprintf(response, COMMBUFFERSIZE, "WVER:=%ld", (long)mppt.getVoltageErrorRange());
+    }
+    else if (strcmp(command, "RCER") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WCER:%ld", (long)mppt.getCurrentErrorRange());
+    else if (strcmp(command, "WCER") == 0)
+    {
+        mppt.setCurrentErrorRange(constrain(temp, 0, 1000));
+        snprintf(response, COMMBUFFERSIZE, "WCER:=%ld", (long)mppt.getCurrentErrorRange());
+    }
+    else if (strcmp(command, "RDCI") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WDCI:%d", mppt.getDutyCycleIncrement());
+    else if (strcmp(command, "WDCI") == 0)
+    {
+        mppt.setDutyCycleIncrement(constrain(temp, 1, 10));
+        snprintf(response, COMMBUFFERSIZE, "WDCI:=%d", mppt.getDutyCycleIncrement());
+    }
+    else if (strcmp(command, "RMPI") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WMPI:%ld", slowInterruptCount);
+    else if (strcmp(command, "WMPI") == 0)
+    {
+        uint8_t oldSREG = halDisableInterrupts(); // a long, read by controlUpdate()
+        slowInterruptCount = constrain(temp, 99, 10000);
+        halRestoreInterrupts(oldSREG);
+        snprintf(response, COMMBUFFERSIZE, "WMPI:=%ld", slowInterruptCount);
+    }
+    else
+        return;
+    atverterH.respondToMaster(receiveProtocol);
+}
+
+// control commands, choosing between the IC step on the duty cycle and the cascade of the IC step and the CV1 loop
+//  RCTL/WCTL: ControlModes (0 to 2)
+//  RVRF/WVRF: panel voltage reference, mV (VREF_MIN to VREF_MAX); MPPT goes on from it in mode 1
+//  RVRI/WVRI: reference step per IC step, mV (10 to 5000)
+void controlCommand(const char* command, const char* value, int receiveProtocol)
+{
+    char* response = atverterH.getTXBuffer(receiveProtocol);
+    long temp = value ? atol(value) : 0;
+    if (strcmp(command, "RCTL") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WCTL:%d", controlMode);
+    else if (strcmp(command, "WCTL") == 0)
+    {
+        setControlMode((int)constrain(temp, 0, NUM_CONTROLMODES - 1));
+        snprintf(response, COMMBUFFERSIZE, "WCTL:=%d", controlMode);
+    }
+    else if (strcmp(command, "RVRF") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WVRF:%u", panelReference);
+    else if (strcmp(command, "WVRF") == 0)
+    {
+        uint8_t oldSREG = halDisableInterrupts(); // read by controlUpdate()
+        setPanelReference(temp);
+        halRestoreInterrupts(oldSREG);
+        snprintf(response, COMMBUFFERSIZE, "WVRF:=%u", panelReference);
+    }
+    else if (strcmp(command, "RVRI") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WVRI:%d", panelReferenceIncrement);
+    else if (strcmp(command, "WVRI") == 0)
+    {
+        panelReferenceIncrement = (int)constrain(temp, 10, 5000);
+        snprintf(response, COMMBUFFERSIZE, "WVRI:=%d", panelReferenceIncrement);
+    }
+    else
+        return;
+    atverterH.respondToMaster(receiveProtocol);
+}
+
+// charge commands, the stages and their setpoints; the voltages are at 25 °C
+//  RCHG/WCHG: ChargeStageIds (0 to 2), writing starts the stage over
+//  RABV/WABV: absorption voltage, mV (10000 to 16000)
+//  RFLV/WFLV: float voltage, mV (10000 to 16000)
+//  RRBV/WRBV: rebulk voltage, mV (9000 to 16000)
+//  RTLC/WTLC: tail current, mA (0 to 5000)
+//  RABT/WABT: longest absorption, s (60 to 36000)
+//  RTCO/WTCO: temperature compensation, mV/°C (-100 to 0)
+void chargeCommand(const char* command, const char* value, int receiveProtocol)
+{
+    char* response = atverterH.getTXBuffer(receiveProtocol);
+    long temp = value ? atol(value) : 0;
+    if (strcmp(command, "RCHG") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WCHG:%d", charger.getStage());
+    else if (strcmp(command, "WCHG") == 0)
+    {
+        setChargeStage((int)constrain(temp, 0, NUM_CHARGESTAGES - 1));
+        snprintf(response, COMMBUFFERSIZE, "WCHG:=%d", charger.getStage());
+    }
+    else if (strcmp(command, "RABV") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WABV:%ld", (long)charger.getAbsorptionVoltage());
+    else if (strcmp(command, "WABV") == 0)
+    {
+        charger.setAbsorptionVoltage(constrain(temp, 10000, 16000));
+        snprintf(response, COMMBUFFERSIZE, "WABV:=%ld", (long)charger.getAbsorptionVoltage());
+    }
+    else if (strcmp(command, "RFLV") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WFLV:%ld", (long)charger.getFloatVoltage());
+    else if (strcmp(command, "WFLV") == 0)
+    {
+        charger.setFloatVoltage(constrain(temp, 10000, 16000));
+        snprintf(response, COMMBUFFERSIZE, "WFLV:=%ld", (long)charger.getFloatVoltage());
+    }
+    else if (strcmp(command, "RRBV") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WRBV:%ld", (long)charger.getRebulkVoltage());
+    else if (strcmp(command, "WRBV") == 0)
+    {
+        charger.setRebulkVoltage(constrain(temp, 9000, 16000));
+        snprintf(response, COMMBUFFERSIZE, "WRBV:=%ld", (long)charger.getRebulkVoltage());
+    }
+    else if (strcmp(command, "RTLC") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WTLC:%ld", (long)charger.getTailCurrent());
+    else if (strcmp(command, "WTLC") == 0)
+    {
+        charger.setTailCurrent(constrain(temp, 0, 5000));
+        snprintf(response, COMMBUFFERSIZE, "WTLC:=%ld", (long)charger.getTailCurrent());
+    }
+    else if (strcmp(command, "RABT") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WABT:%ld", (long)charger.getAbsorptionTime());
+    else if (strcmp(command, "WABT") == 0)
+    {
+        charger.setAbsorptionTime(constrain(temp, 60, 36000));
+        snprintf(response, COMMBUFFERSIZE, "WABT:=%ld", (long)charger.getAbsorptionTime());
+    }
+    else if (strcmp(command, "RTCO") == 0)
+        snprintf(response, COMMBUFFERSIZE, "WTCO:%ld", (long)charger.getTemperatureCompensation());
+    else if (strcmp(command, "WTCO") == 0)
+    {
+        charger.setTemperatureCompensation(constrain(temp, -100, 0));
+        snprintf(response, COMMBUFFERSIZE, "WTCO:=%ld", (long)charger.getTemperatureCompensation());
+    }
+    else
+        return;
+    atverterH.respondToMaster(receiveProtocol);
+}
+
+// changes what sets the duty cycle without a bump: whichever takes over starts from the duty cycle the other left
+void setControlMode(int mode)
+{
+    uint8_t oldSREG = halDisableInterrupts(); // the CV1 loop runs in controlUpdate()
+    if (mode == CONTROL_DUTY)
+        mppt.setDutyCycle(atverterH.getDutyCycle()); // the IC step goes on from where the CV1 loop left the duty
+    else if (controlMode == CONTROL_DUTY)
+        holdPanelVoltage(); // the CV1 loop starts at the panel voltage of the present duty cycle
+    controlMode = mode;
+    halRestoreInterrupts(oldSREG);
+}
+
+// sets the CV1 loop's reference, limited to VREF_MIN to VREF_MAX
+void setPanelReference(long mV)
+{
+    panelReference = (unsigned int)constrain(mV, VREF_MIN, VREF_MAX);
+    panelReferenceRaw = atverterH.mV2raw(panelReference);
+}
+
+// the CV1 loop takes the panel voltage as it is and the duty cycle as its output, so nothing moves
+void holdPanelVoltage()
+{
+    setPanelReference(atverterH.getV1());
+    chargeLimit = 0; // the CV2 limit builds up again from here if the battery is over its setpoint
+    atverterH.resetComp(); // output history at the present duty cycle, no error history
+}
+
+// one tick of the CV1 loop: PI from the panel voltage error to the duty cycle, the reference raised by the CV2 limit
+void regulatePanelVoltage()
+{
+    int error = atverterH.getRawV1() - (panelReferenceRaw + (int)(chargeLimit >> 8));
+    if (error >= -CV1_DEADBAND && error <= CV1_DEADBAND)
+        error = 0;
+    atverterH.updateCompPast(error);
+    atverterH.setDutyCycleRaw((int)atverterH.calculateCompOut()); // within the duty cycle limits, without wind-up
+}
+
+// the IC step's decision as a move of the panel voltage reference: more duty is a lower panel voltage
+void stepPanelReference(int decision)
+{
+    if (decision == IC_UP_FLAT || decision == IC_UP_SLOPE)
+        setPanelReference((long)panelReference - panelReferenceIncrement);
+    else if (decision == IC_DOWN_FLAT || decision == IC_DOWN_SLOPE)
+        setPanelReference((long)panelReference + panelReferenceIncrement);
+}
+
+// starts a charge stage, with the setpoint it brings (interrupts off, the CV2 limit reads it every tick)
+void setChargeStage(int stage)
+{
+    uint8_t oldSREG = halDisableInterrupts();
+    charger.setStage(stage);
+    batteryReferenceRaw = atverterH.mV2raw(charger.getSetpoint());
+    panelReferenceMaxRaw = atverterH.mV2raw(VREF_MAX);
+    halRestoreInterrupts(oldSREG);
+}
+
+// one tick of the CV2 limit: integrates the battery voltage over the setpoint into a rise of the panel voltage
+// reference, away from the maximum power point, no further than the converter idling, and lets go of it as soon
+// as the battery drops under the setpoint
+void limitBatteryVoltage()
+{
+    int error = atverterH.getRawV2() - batteryReferenceRaw;
+    if (error <= -CV2_RELEASE)
+    {
+        chargeLimit = 0; // a load came on: all the panel gives again, at once
+        return;
+    }
+    if (error > 0 && atverterH.getRawI2() >= 0)
+        error = -1; // over the setpoint and nothing goes in (I2 reads into the converter): back off to where it idles
+    else if (error > CV2_RELEASE)
+        error = CV2_RELEASE; // rises no faster than the CV1 loop follows
+    long headroom = ((long)panelReferenceMaxRaw - panelReferenceRaw) << 8;
+    chargeLimit = constrain(chargeLimit + (long)error*CV2_GAIN, 0L, headroom);
+}
+
+// the temperature the charge voltages are compensated for, °C: the cooler thermistor, nearer the battery's ambient
+int chargeTemperature()
+{
+    int t1 = atverterH.getT1();
+    int t2 = atverterH.getT2();
+    return t1 < t2 ? t1 : t2;
 }
 
 void controlUpdate(void)
 {
+    halMarkStage(STAGE_SENSORS);
     atverterH.updateVISensors();       // read voltage and current sensors and update moving average
+    halMarkStage(STAGE_PROTECTION);
     atverterH.checkCurrentShutdown();  // checks average current and shut down gates if necessary
     atverterH.checkThermalShutdown();  // checks switch temperature and shut down gates if necessary
     atverterH.checkBootstrapRefresh(); // refresh bootstrap capacitors on a timer
@@ -93,6 +519,7 @@ void controlUpdate(void)
         atverterH.shutdownGates(4);
         Serial.print("Low Side Overvoltage\n");
     }
+    halMarkStage(STAGE_STATUS);
     if (atverterH.isGateShutdown())
     // check if safety shutdown is active
     {
@@ -104,15 +531,19 @@ void controlUpdate(void)
     else
     // if not in safety shutdown, continue
     {
-        if((atverterH.getV2() < LOW_VOLTAGE_RESET) || (atverterH.getV2() > HIGH_VOLTAGE_RESET)) {
-            // if outside of normal operating range, reset
-            atverterH.setDutyCycle(50);
+        if (controlMode != CONTROL_DUTY)
+        {
+            halMarkStage(STAGE_COMPENSATOR);
+            limitBatteryVoltage(); // the charge stage's setpoint caps the battery, MPPT runs below it
+            regulatePanelVoltage(); // the inner loop of the cascade, every tick
+            halMarkStage(STAGE_STATUS);
         }
          
         slowInterruptCounter++;
-        if (slowInterruptCounter > 1000)
+        if (slowInterruptCounter > slowInterruptCount)
         // runs every 1000 interrupt calls (1 second)
         {
+            halMarkStage(STAGE_SLOW);
             slowInterruptCounter = 0;
             atverterH.updateVCC();            // read on-board VCC voltage, update stored average (shouldn't change)
             atverterH.updateTSensors();       // occasionally read thermistors and update temperature moving average
@@ -124,6 +555,7 @@ void controlUpdate(void)
 
             // Perform IC operations
             // -----------------------------------------------------------------------------------------------------------------------------------
+            halMarkStage(STAGE_MPPT);
 
             // get sensor vales
             lowCurrent = -atverterH.getI2();
@@ -131,121 +563,96 @@ void controlUpdate(void)
             highCurrent = atverterH.getI1();
             highVoltage = atverterH.getV1();
 
-            // calculate derivatives
-            dV = lowVoltage - prevLowVoltage;
-            dI = lowCurrent - prevLowCurrent;
+            // the charge stage and its setpoint for the CV2 limit
+            charger.update(lowVoltage, lowCurrent, chargeTemperature());
+            batteryReferenceRaw = atverterH.mV2raw(charger.getSetpoint());
+            panelReferenceMaxRaw = atverterH.mV2raw(VREF_MAX); // VCC may have moved
 
-            if ((-VOLTAGE_ERROR_RANGE < dV) && (dV < VOLTAGE_ERROR_RANGE))
-            {
-#if DEBUG
-                Serial.print("dV ~= 0\t");
-#endif
-                if (dI > CURRENT_ERROR_RANGE)
-                {
-#if DEBUG
-                    Serial.print("dI ~> 0\t");
-                    Serial.print("Duty cycle +\t");
-#endif
-                    dutyCycle += DUTY_CYCLE_INCREMENT; // inc. duty cycle
-                }
-                else if (dI < -CURRENT_ERROR_RANGE)
-                {
-#if DEBUG
-                    Serial.print("dI ~< 0\t");
-                    Serial.print("Duty cycle -\t");
-#endif
-                    dutyCycle += -DUTY_CYCLE_INCREMENT; // dec. duty cycle
-                }
-                else
-                {
+            // step the duty cycle, or the panel voltage reference, by the incremental conductance of the battery side
+            if (controlMode != CONTROL_DUTY)
+                mppt.setDutyCycle(atverterH.getDutyCycle()); // the duty cycle is the CV1 loop's, not the IC step's
+            int decision = mppt.step(lowVoltage, lowCurrent);
 #if DEBUG
-                    Serial.print("dI ~= 0\t");
-                    Serial.print("Duty cycle 0\t");
-#endif
-                    dutyCycle += 0; // no change
-                }
-            }
-            else
+            Serial.print(IC_DECISION_NAMES[decision]);
+            Serial.print("\t");
+            if (decision >= IC_HOLD_SLOPE)
             {
-#if DEBUG
-                Serial.print("dV != 0\t");
-
                 Serial.print("dI/dV = ");
-                Serial.print((double)dI / dV);
+                Serial.print((double)mppt.getDI() / mppt.getDV());
                 Serial.print("\t");
 
                 Serial.print("avgI/avgV = ");
                 Serial.print((double)-lowCurrent / lowVoltage);
                 Serial.print("\t");
-#endif
-
-                if (((double)dI / dV > -((double)lowCurrent / lowVoltage + CURRENT_ERROR_RANGE / VOLTAGE_ERROR_RANGE)) && ((double)dI / dV > -((double)lowCurrent / lowVoltage - CURRENT_ERROR_RANGE / VOLTAGE_ERROR_RANGE)))
-                {
-#if DEBUG
-                    Serial.print("dI/dV ~> -avg\t");
-                    Serial.print("Duty cycle +\t");
-#endif
-                    dutyCycle += DUTY_CYCLE_INCREMENT;
-                }
-                else if (((double)dI / dV < -((double)lowCurrent / lowVoltage + CURRENT_ERROR_RANGE / VOLTAGE_ERROR_RANGE)) && ((double)dI / dV < -((double)lowCurrent / lowVoltage - CURRENT_ERROR_RANGE / VOLTAGE_ERROR_RANGE)))
-                {
-#if DEBUG
-                    Serial.print("dI/dV ~< -avg\t");
-                    Serial.print("Duty cycle -\t");
-#endif
-                    dutyCycle += -DUTY_CYCLE_INCREMENT;
-                }
-                else
-                {
-#if DEBUG
-                    Serial.print("dI/dV ~= -avg\t");
-                    Serial.print("Duty cycle 0\t");
-#endif
-                    dutyCycle += 0;
-                }
             }
-#if DEBUG
             Serial.print("\r\n");
 #endif
-            // save previous values for voltage/current
-            prevLowCurrent = lowCurrent;
-            prevLowVoltage = lowVoltage;
 
-            atverterH.setDutyCycle(dutyCycle); // set new duty cycle
-            transmitData();                    // send relevent data over UART
+            if (controlMode == CONTROL_DUTY)
+            {
+                if (lowVoltage > charger.getSetpoint() && lowCurrent > 0)
+                    // no CV2 limit without the cascade: one increment down instead of the IC step, once a second
+                    mppt.setDutyCycle(atverterH.getDutyCycle() - mppt.getDutyCycleIncrement());
+                atverterH.setDutyCycle(mppt.getDutyCycle()); // set new duty cycle
+            }
+            else if (controlMode == CONTROL_MPPT_VREF && chargeLimit == 0)
+                stepPanelReference(decision); // the CV1 loop follows from the next tick; held while the CV2 limit is on
+            recordTick = atverterH.getTicks(); // timestamp for the record
+            recordPending = true;              // loop() sends relevent data over UART
         }
     }
+    halMarkStage(STAGE_OUTSIDE);
 }
 
 void transmitData()
 {
-    Serial.print("LowSideVoltage: ");
-    Serial.print(lowVoltage);
-    Serial.print("\t");
-
-    Serial.print("LowSideCurrent: ");
-    Serial.print(lowCurrent);
-    Serial.print("\t");
-
-    Serial.print("LowSidePower: ");
-    Serial.print(lowVoltage * lowCurrent / 1000);
-    Serial.print("\t");
-
-    Serial.print("HighSideVoltage: ");
-    Serial.print(highVoltage);
-    Serial.print("\t");
+    long values[NUM_RECORDFIELDS];
+    values[FIELD_LOW_SIDE_VOLTAGE] = lowVoltage;
+    values[FIELD_LOW_SIDE_CURRENT] = lowCurrent;
+    values[FIELD_LOW_SIDE_POWER] = lowVoltage * lowCurrent / 1000;
+    values[FIELD_HIGH_SIDE_VOLTAGE] = highVoltage;
+    values[FIELD_HIGH_SIDE_CURRENT] = highCurrent;
+    values[FIELD_HIGH_SIDE_POWER] = highVoltage * highCurrent / 1000;
+    values[FIELD_DUTY_CYCLE] = atverterH.getDutyCycle();
+    values[FIELD_TEMPERATURE_1] = atverterH.getT1();
+    values[FIELD_TEMPERATURE_2] = atverterH.getT2();
+
+    int record = deadband.update(values);
+    if (record == RECORD_NONE)
+    // nothing moved beyond its deadband, the host holds the last values
+    {
+        return;
+    }
 
-    Serial.print("HighSideCurrent: ");
-    Serial.print(highCurrent);
+    // control tick the values were sampled in, the host maps it to wall time (see ClockSync.h)
+    Serial.print("Tick: ");
+    Serial.print(recordTick);
     Serial.print("\t");
 
-    Serial.print("HighSidePower: ");
-    Serial.print(highVoltage * highCurrent / 1000);
-    Serial.print("\t");
+    if (deadband.isEnabled())
+    // sequence number so the host notices a lost line; keyframes also give the record period
+    {
+        Serial.print(record == RECORD_KEYFRAME ? "Seq: " : "Delta: ");
+        Serial.print(deadband.getSequence());
+        Serial.print("\t");
+        if (record == RECORD_KEYFRAME)
+        {
+            Serial.print("Period: ");
+            Serial.print(slowInterruptCount + 1);
+            Serial.print("\t");
+        }
+    }
 
-    Serial.print("DutyCycle: ");
-    Serial.print(atverterH.getDutyCycle());
-    Serial.print("\t");
+    // every field in a keyframe, only the fields that moved (as differences) in a delta record
+    for (int n = 0; n < NUM_RECORDFIELDS; n++)
+    {
+        if (!deadband.isFieldSent(n))
+            continue;
+        Serial.print(RECORD_FIELD_NAMES[n]);
+        Serial.print(": ");
+        Serial.print(record == RECORD_DELTA ? deadband.getDelta(n) : values[n]);
+        Serial.print("\t");
+    }
 
     Serial.print("\r\n");
 
@@ -253,11 +660,11 @@ void transmitData()
     Serial.print("DEBUG info: \t");
 
     Serial.print("dV: ");
-    Serial.print(dV);
+    Serial.print(mppt.getDV());
     Serial.print("\t");
 
     Serial.print("dI: ");
-    Serial.print(dI);
+    Serial.print(mppt.getDI());
     Serial.print("\t");
 
     Serial.println("-------------------------------------------------------------------------------------------------------");
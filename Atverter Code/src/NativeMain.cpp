@@ -0,0 +1,161 @@
+/*
+  NativeMain.cpp - Runs the sketch on the build machine against PicroHAL's fakes
+  Released into the public domain.
+
+  usage: pio run -e native -t exec, or firmware-native [seconds] from the
+  host CMake build (default: 3600 simulated seconds)
+
+  The Arduino core calls setup() and loop() on the AVR; here main() does,
+  and fires the control timer interrupt itself, one tick after another with
+  no waiting, calling loop() once between ticks. The sensors read a panel
+  near its maximum power point charging a battery, with a few LSB of noise.
+  The gate driver's protection latch is modelled on the GPIO writes, so the
+  safety checks behave as on the board.
+
+  Prints how fast the sketch's tick (sensor averaging, safety checks, the
+  MPPT step every second, the record) and AtverterH's classical compensator
+  run, in ticks per second and as a multiple of real time, and what the CV1
+  loop's update alone costs.
+*/
+
+#ifndef __AVR__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include <AtverterH.h>
+
+void setup();
+void loop();
+extern AtverterH atverterH; // the sketch's board
+
+// sensor readings, 10-bit ADC at VCC = 5000 mV
+const int PANEL_VOLTAGE_RAW = 276; // 17.5 V through the 13x divider
+const int BATTERY_VOLTAGE_RAW = 196; // 12.4 V
+const int PANEL_CURRENT_RAW = 512 + 205; // 3 A out of terminal 1
+const int BATTERY_CURRENT_RAW = 512 - 270; // 4 A into terminal 2
+const int THERMISTOR_RAW = 301; // 30 °C
+
+// the gate driver's protection latch: pulling GATESD low latches it, PRORESET releases it
+static void protectionLatch(int pin, int level) {
+  if (pin == GATESD_PIN && level == LOW && halNativeGetPinMode(GATESD_PIN) == OUTPUT)
+    halNativeSetInput(GATESD_PIN, LOW);
+  else if (pin == PRORESET_PIN && level == HIGH)
+    halNativeSetInput(GATESD_PIN, HIGH);
+}
+
+static uint32_t noiseState = 12345;
+
+// -2 to 2 LSB, xorshift
+static int noise() {
+  noiseState ^= noiseState << 13;
+  noiseState ^= noiseState >> 17;
+  noiseState ^= noiseState << 5;
+  return (int)(noiseState % 5) - 2;
+}
+
+static void senseInputs() {
+  halNativeSetAnalog(V1_PIN, PANEL_VOLTAGE_RAW + noise());
+  halNativeSetAnalog(V2_PIN, BATTERY_VOLTAGE_RAW + noise());
+  halNativeSetAnalog(I1_PIN, PANEL_CURRENT_RAW + noise());
+  halNativeSetAnalog(I2_PIN, BATTERY_CURRENT_RAW + noise());
+}
+
+static void resetBoard() {
+  halNativeReset();
+  halNativeOnPinWrite(protectionLatch);
+  halNativeSetInput(GATESD_PIN, HIGH); // not latched at power up
+  halNativeSetAnalog(T1_PIN, THERMISTOR_RAW);
+  halNativeSetAnalog(T2_PIN, THERMISTOR_RAW);
+  senseInputs();
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* name, long ticks, double seconds, long tickus, const char* note) {
+  double rate = ticks/seconds;
+  printf("%-24s %10ld %12.0f %9.1f %10.0fx  %s\n", name, ticks, rate, 1e9/rate, rate*tickus/1e6, note);
+}
+
+// the sketch as flashed: setup(), then the control interrupt and loop() in turn
+static void benchSketch(long ticks) {
+  resetBoard();
+  setup();
+  long tickus = halNativeGetTimerPeriod();
+  size_t uartBytes = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (long n = 0; n < ticks; n++) {
+    senseInputs();
+    halNativeTick();
+    loop();
+    if ((n & 0xFFFF) == 0)
+      uartBytes += halNativeUARTTake().size();
+  }
+  double seconds = secondsSince(start);
+  uartBytes += halNativeUARTTake().size();
+  char note[96];
+  snprintf(note, sizeof(note), "%lu UART bytes, duty %d%%, pwm %d%%", (unsigned long)uartBytes,
+    atverterH.getDutyCycle(), halNativeGetPwmDuty(PWM_PIN));
+  report("AtverterH_MPPT tick", ticks, seconds, tickus, note);
+}
+
+// AtverterH's biquad cascade compensator regulating the battery voltage, as in a CV sketch: a lead section and a PI;
+// nothing follows the duty cycle here, so the output sits at a limit; only the cost per tick matters
+static void benchCompensator(long ticks) {
+  resetBoard();
+  static const int coefficients[2*COMP_SECTION_COEFFICIENTS] = {
+    16384, -12288, 0, -8192, 0, // lead: (1 - 0.75 z^-1)/(1 - 0.5 z^-1), Q14
+    3146, -1049, 0, -16384, 0}; // PI, Q14
+  static AtverterH board; // static like a sketch's: the sensor averages start from zeroed storage
+  board.setupPinMode();
+  board.initializeSensors();
+  board.startPWM(50);
+  board.setComp(coefficients, 2, 1);
+  int target = BATTERY_VOLTAGE_RAW;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (long n = 0; n < ticks; n++) {
+    senseInputs();
+    board.updateVISensors();
+    board.checkCurrentShutdown();
+    board.updateCompPast(target - board.getRawV2());
+    board.setDutyCycleRaw((int)board.calculateCompOut()); // dutyRaw, saturated at the duty cycle limits
+  }
+  double seconds = secondsSince(start);
+  char note[64];
+  snprintf(note, sizeof(note), "duty %d%%", board.getDutyCycle());
+  report("compensator tick", ticks, seconds, 1000, note);
+}
+
+// the CV1 loop's update on its own, the part atv-isrtime times as the compensator stage on the AVR: one PI section
+// and the dithered duty cycle, on errors that keep it inside the duty cycle limits
+static void benchCompensatorUpdate(long ticks) {
+  resetBoard();
+  static const int coefficients[COMP_SECTION_COEFFICIENTS] = {3146, -1049, 0, -16384, 0}; // the sketch's CV1_COMP
+  static AtverterH board;
+  board.startPWM(50);
+  board.setComp(coefficients, 1, 1);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (long n = 0; n < ticks; n++) {
+    board.updateCompPast((int)(n & 7) - 3 - (board.getDutyCycleRaw() > 512)); // hunts around 50 %
+    board.setDutyCycleRaw((int)board.calculateCompOut());
+  }
+  double seconds = secondsSince(start);
+  char note[64];
+  snprintf(note, sizeof(note), "duty %d%%", board.getDutyCycle());
+  report("compensator update", ticks, seconds, 1000, note);
+}
+
+int main(int argc, char** argv) {
+  double simulatedSeconds = argc > 1 ? atof(argv[1]) : 3600.0;
+  long ticks = (long)(simulatedSeconds*1000.0); // INTERRUPT_TIME of 1000 us
+  printf("%-24s %10s %12s %9s %11s\n", "loop", "ticks", "ticks/s", "ns/tick", "real time");
+  benchSketch(ticks);
+  benchCompensator(ticks);
+  benchCompensatorUpdate(ticks);
+  return 0;
+}
+
+#endif
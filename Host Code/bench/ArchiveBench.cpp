@@ -0,0 +1,108 @@
+/*
+  ArchiveBench.cpp - Size and speed benchmark for the telemetry archive codec
+  Released into the public domain.
+
+  usage: bench-archive [samples]   (default: one week of 1 Hz data)
+  Reports bytes per sample per channel, encode rate and decode rate in values
+  per second (timestamps and all channels). Run it on the Pi as well as x86.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "Telemetry.h"
+#include "TelemetryArchive.h"
+#include "SyntheticTelemetry.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+  long totalSamples = argc > 1 ? atol(argv[1]) : 7L*86400;
+  int blockSamples = ARCHIVE_BLOCK_SAMPLES;
+  int numBlocks = (int)((totalSamples + blockSamples - 1)/blockSamples);
+  totalSamples = (long)numBlocks*blockSamples;
+
+  // generate the raw columns
+  SyntheticTelemetry generator(12345, 1745442745000000LL);
+  std::vector<int64_t> timestamps(totalSamples);
+  std::vector<int32_t> columnData[NUM_CHANNELS];
+  for (int c = 0; c < NUM_CHANNELS; c++)
+    columnData[c].resize(totalSamples);
+  TelemetrySample sample;
+  for (long n = 0; n < totalSamples; n++) {
+    generator.next(sample);
+    timestamps[n] = sample.timestampUs;
+    for (int c = 0; c < NUM_CHANNELS; c++)
+      columnData[c][n] = sample.values[c];
+  }
+
+  // encode every block
+  std::vector<std::vector<uint8_t> > encoded(numBlocks);
+  std::vector<uint8_t> scratch(maxEncodedBlockSize(blockSamples));
+  long channelBytes = 0;
+  long payloadBytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int b = 0; b < numBlocks; b++) {
+    const int32_t* columns[NUM_CHANNELS];
+    for (int c = 0; c < NUM_CHANNELS; c++)
+      columns[c] = columnData[c].data() + (long)b*blockSamples;
+    size_t size = encodeBlock(timestamps.data() + (long)b*blockSamples, columns, NUM_CHANNELS,
+      blockSamples, scratch.data());
+    encoded[b].assign(scratch.begin(), scratch.begin() + size);
+    encoded[b].resize(size + ARCHIVE_DECODE_PADDING, 0);
+    payloadBytes += size;
+  }
+  double encodeSeconds = secondsSince(start);
+  // channel-only size: everything after the timestamp section
+  for (int b = 0; b < numBlocks; b++) {
+    uint32_t firstColumn;
+    memcpy(&firstColumn, encoded[b].data(), 4);
+    channelBytes += (long)(encoded[b].size() - ARCHIVE_DECODE_PADDING) - firstColumn;
+  }
+
+  // decode everything, several passes so short runs still time reliably
+  std::vector<int64_t> outTimestamps(blockSamples);
+  std::vector<int32_t> outValues(blockSamples);
+  int passes = (int)(200000000L/(totalSamples*(NUM_CHANNELS + 1))) + 1;
+  long checksum = 0;
+  bool ok = true;
+  start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; pass++) {
+    for (int b = 0; b < numBlocks; b++) {
+      size_t size = encoded[b].size() - ARCHIVE_DECODE_PADDING;
+      ok &= decodeTimestamps(encoded[b].data(), size, NUM_CHANNELS, blockSamples, outTimestamps.data());
+      checksum += outTimestamps[blockSamples - 1];
+      for (int c = 0; c < NUM_CHANNELS; c++) {
+        ok &= decodeColumn(encoded[b].data(), size, NUM_CHANNELS, blockSamples, c, outValues.data());
+        checksum += outValues[blockSamples - 1];
+      }
+    }
+  }
+  double decodeSeconds = secondsSince(start);
+
+  // verify the last block round-trips
+  long base = (long)(numBlocks - 1)*blockSamples;
+  for (int n = 0; n < blockSamples; n++)
+    ok &= outTimestamps[n] == timestamps[base + n];
+  ok &= decodeColumn(encoded[numBlocks - 1].data(), encoded[numBlocks - 1].size() - ARCHIVE_DECODE_PADDING,
+    NUM_CHANNELS, blockSamples, 0, outValues.data());
+  for (int n = 0; n < blockSamples; n++)
+    ok &= outValues[n] == columnData[0][base + n];
+
+  double values = (double)totalSamples*(NUM_CHANNELS + 1);
+  printf("samples:                 %ld (%d blocks of %d)\n", totalSamples, numBlocks, blockSamples);
+  printf("data.json equivalent:    ~%ld bytes\n", totalSamples*150);
+  printf("archive payload:         %ld bytes\n", payloadBytes);
+  printf("bytes/sample/channel:    %.3f (channels only), %.3f (with timestamps)\n",
+    (double)channelBytes/totalSamples/NUM_CHANNELS, (double)payloadBytes/totalSamples/NUM_CHANNELS);
+  printf("encode:                  %.1f M values/s\n", values/encodeSeconds/1e6);
+  printf("decode:                  %.1f M values/s (%d passes, checksum %ld)\n",
+    values*passes/decodeSeconds/1e6, passes, checksum);
+  printf("round trip:              %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
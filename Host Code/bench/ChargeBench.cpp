@@ -0,0 +1,190 @@
+/*
+  ChargeBench.cpp - The sketch's bulk, absorption and float charge stages on the plant simulator
+  Released into the public domain.
+
+  usage: bench-charge [--mode N] [--trace FILE]
+  Runs AtverterH_MPPT.cpp on PlantSim's averaged buck model at 1000 W/m2
+  (some 3.7 A of charge) into a small LiFePO4 battery, 1 Ah at 90 % state
+  of charge with 0.05 Ohm of internal resistance and leads, so that all
+  three stages pass in minutes. The charge setpoints are set over the UART
+  for it: absorption 13.9 V, float 13.4 V, rebulk 13.3 V, 0.3 A of tail
+  current, 10 min of absorption at the most and no temperature compensation.
+  The control mode is the sketch's at power up unless --mode gives a WCTL
+  value.
+
+  The battery charges through bulk and absorption into float, and floats
+  for 4 min with 1.5 A of load on it, down to the float voltage. Then the
+  load steps to 6 A, more than the panel gives, for 2 min. Printed: the stage changes as they happen,
+  then per stage its seconds, the tracking efficiency and the battery
+  voltage against the setpoint; for the load step how long the panel took
+  to get to 95 % of its maximum power and stay there for 100 ms, the
+  lowest battery voltage and how long the sketch took to go back to bulk.
+  --trace writes every second as CSV.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include <ChargeStages.h>
+#include "SketchRunner.h"
+
+extern ChargeStages charger; // from AtverterH_MPPT.cpp
+
+const double IRRADIANCE = 1000.0; // W/m2
+const double CAPACITY_AH = 1.0;
+const double INITIAL_SOC = 0.9;
+const double BATTERY_OHM = 0.05;
+const char * const CHARGE_SETUP[] = {"WABV:13900\n", "WFLV:13400\n", "WRBV:13300\n", "WTLC:300\n", "WABT:600\n",
+  "WTCO:0\n"};
+const int CHARGE_LIMIT_S = 1800; // to get into float
+const int FLOAT_S = 240;
+const double FLOAT_LOAD_A = 1.5;
+const double STEP_LOAD_A = 6.0;
+const int STEP_S = 120;
+const double TRACKED = 0.95; // of the maximum power, after the load step
+const int TRACKED_HOLD_TICKS = 100;
+
+struct StageResult
+{
+  int seconds;
+  double pvJ;
+  double mppJ;
+  double batteryV; // sum, then mean
+  double maxBatteryV;
+  double setpointError; // mean absolute of the battery voltage from the setpoint, once at it
+  int regulatedSeconds; // seconds the error is taken over
+};
+
+static StageResult stages[NUM_CHARGESTAGES];
+static FILE* trace = nullptr;
+static long elapsedS = 0;
+
+// one second of the sketch, booked to the stage it started in
+static int runSecond(PlantSim& plant) {
+  int stage = charger.getStage();
+  double setpoint = charger.getSetpoint()/1000.0;
+  SketchSecond second = runSketchSecond(plant);
+  const PlantState& state = plant.getState();
+  StageResult& result = stages[stage];
+  result.seconds++;
+  result.pvJ += second.pvJ;
+  result.mppJ += second.mppJ;
+  result.batteryV += state.batteryV;
+  result.maxBatteryV = fmax(result.maxBatteryV, state.batteryV);
+  if (stage != CHARGE_BULK && state.batteryV >= setpoint - CHARGE_REGULATION_MARGIN/1000.0) {
+    result.setpointError += fabs(state.batteryV - setpoint);
+    result.regulatedSeconds++;
+  }
+  if (trace) {
+    fprintf(trace, "%ld,%s,%.3f,%.3f,%.3f,%.3f,%.3f,%.4f,%d\n", elapsedS, CHARGE_STAGE_NAMES[stage], state.panelV,
+      second.pvJ, second.mppJ, state.batteryV, state.batteryA, state.soc, second.duty);
+  }
+  elapsedS++;
+  if (charger.getStage() != stage)
+    printf("%6lds  %-10s -> %-10s  battery %.3f V, %.2f A, state of charge %.1f %%\n", elapsedS,
+      CHARGE_STAGE_NAMES[stage], CHARGE_STAGE_NAMES[charger.getStage()], state.batteryV, state.batteryA,
+      100.0*state.soc);
+  return charger.getStage();
+}
+
+int main(int argc, char** argv) {
+  int mode = -1;
+  for (int n = 1; n < argc; n++) {
+    const char* option = argv[n];
+    const char* value = n + 1 < argc ? argv[++n] : nullptr;
+    if (value && strcmp(option, "--mode") == 0) {
+      mode = atoi(value);
+    } else if (value && strcmp(option, "--trace") == 0) {
+      trace = fopen(value, "w");
+      if (!trace) {
+        perror(value);
+        return 1;
+      }
+      fprintf(trace, "second,stage,panel_v,pv_j,mpp_j,battery_v,battery_a,soc,duty\n");
+    } else {
+      fprintf(stderr, "usage: %s [--mode 0|1] [--trace FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+  PlantParams params;
+  params.buckModel = BUCK_AVERAGED;
+  params.battery.chemistry = BATTERY_LIFEPO4;
+  params.battery.capacityAh = CAPACITY_AH;
+  params.battery.initialSoc = INITIAL_SOC;
+  params.battery.internalOhm = BATTERY_OHM;
+  static PlantSim plant; // static like the sketch's board
+  plant.configure(params);
+  plant.setIrradiance(IRRADIANCE);
+  startSketch(plant);
+  for (const char* command : CHARGE_SETUP)
+    halNativeUARTReceive(command);
+  if (mode >= 0)
+    halNativeUARTReceive(("WCTL:" + std::to_string(mode) + "\n").c_str());
+  printf("averaged buck model, %.0f W/m2, %s battery of %.1f Ah from %.0f %% with %.2f Ohm\n\n", IRRADIANCE,
+    BATTERY_CHEMISTRY_NAMES[params.battery.chemistry], CAPACITY_AH, 100.0*INITIAL_SOC, BATTERY_OHM);
+
+  while (elapsedS < CHARGE_LIMIT_S && charger.getStage() != CHARGE_FLOAT)
+    runSecond(plant);
+  if (charger.getStage() != CHARGE_FLOAT) {
+    printf("no float after %d s\n", CHARGE_LIMIT_S);
+    return 1;
+  }
+  plant.setLoad(FLOAT_LOAD_A);
+  for (int s = 0; s < FLOAT_S; s++)
+    runSecond(plant);
+
+  // the load step, tick by tick until the panel is back at its maximum power point
+  plant.setLoad(STEP_LOAD_A);
+  double minBatteryV = plant.getState().batteryV;
+  long trackedTicks = -1;
+  long inBand = 0;
+  for (long n = 0; n < SKETCH_TICKS_PER_SECOND*STEP_S && trackedTicks < 0; n++) {
+    plant.step();
+    if (plant.getState().powered)
+      loop();
+    const PlantState& state = plant.getState();
+    minBatteryV = fmin(minBatteryV, state.batteryV);
+    inBand = state.panelV*state.panelA >= TRACKED*state.mppW ? inBand + 1 : 0;
+    if (inBand >= TRACKED_HOLD_TICKS)
+      trackedTicks = n - TRACKED_HOLD_TICKS + 1;
+    if (n % SKETCH_TICKS_PER_SECOND == SKETCH_TICKS_PER_SECOND - 1)
+      elapsedS++;
+  }
+  halNativeUARTTake();
+  long stepS = elapsedS;
+  long rebulkS = -1;
+  while (elapsedS < stepS + STEP_S) {
+    bool floating = charger.getStage() != CHARGE_BULK;
+    if (runSecond(plant) == CHARGE_BULK && floating && rebulkS < 0)
+      rebulkS = elapsedS - stepS;
+    minBatteryV = fmin(minBatteryV, plant.getState().batteryV);
+  }
+
+  printf("\n%-10s %8s %8s %9s %9s %10s\n", "stage", "seconds", "track %", "battery V", "max V", "error V");
+  for (int stage = 0; stage < NUM_CHARGESTAGES; stage++) {
+    const StageResult& result = stages[stage];
+    char error[16] = "-";
+    if (result.regulatedSeconds > 0)
+      snprintf(error, sizeof(error), "%.3f", result.setpointError/result.regulatedSeconds);
+    printf("%-10s %8d %8.2f %9.3f %9.3f %10s\n", CHARGE_STAGE_NAMES[stage], result.seconds,
+      result.mppJ > 0.0 ? 100.0*result.pvJ/result.mppJ : 0.0, result.seconds ? result.batteryV/result.seconds : 0.0,
+      result.maxBatteryV, error);
+  }
+  printf("\nload step %.1f to %.1f A: panel at %.0f %% of its maximum power after ", FLOAT_LOAD_A, STEP_LOAD_A,
+    100.0*TRACKED);
+  if (trackedTicks < 0)
+    printf("-");
+  else
+    printf("%ld ms", trackedTicks);
+  printf(", battery down to %.3f V, back in bulk after ", minBatteryV);
+  if (rebulkS < 0)
+    printf("-\n");
+  else
+    printf("%ld s\n", rebulkS);
+  if (trace)
+    fclose(trace);
+  return 0;
+}
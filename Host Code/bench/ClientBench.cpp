@@ -0,0 +1,65 @@
+/*
+  ClientBench.cpp - Command throughput of AtverterClient against a simulated converter
+  Released into the public domain.
+
+  usage: bench-client [seconds-per-run]   (default: 2)
+  Runs batches of register reads through a pty DeviceSimulator at 38400 baud,
+  with windows of 1 (one command at a time, what a naive client does) up to
+  8, once on a clean link and once with 1% of commands dropped. A final run
+  without wire delays shows the host-side overhead alone.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "AtverterClient.h"
+#include "DeviceSimulator.h"
+
+const int BATCH = 64;
+const int BENCH_TURNAROUND_US = 300; // loop() latency between control interrupts
+
+static double steadySeconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void runCase(const char* title, int baud, double dropRate, int window, double seconds) {
+  DeviceSimulator simulator(baud, BENCH_TURNAROUND_US, dropRate);
+  SerialTransport transport;
+  if (!simulator.start() || !transport.open(simulator.getSlavePath().c_str(), baud > 0 ? baud : 38400)) {
+    fprintf(stderr, "cannot start the simulator\n");
+    exit(1);
+  }
+  AtverterClient client(transport);
+  client.setWindow(window);
+  client.setTimeout(100); // above the ~55 ms a telemetry record occupies the wire
+  AtverterRequest requests[BATCH];
+  long commands = 0;
+  long failed = 0;
+  double start = steadySeconds();
+  while (steadySeconds() - start < seconds) {
+    for (int n = 0; n < BATCH; n++) {
+      requests[n] = AtverterRequest();
+      requests[n].reg = n%(REG_DROOP + 1); // every readable register
+    }
+    client.execute(requests, BATCH);
+    for (int n = 0; n < BATCH; n++)
+      failed += requests[n].status != REQUEST_OK;
+    commands += BATCH;
+  }
+  double elapsed = steadySeconds() - start;
+  printf("%-22s window %d  %8.0f commands/s  retries %5ld  failed %ld  ignored lines %ld\n", title,
+    client.getWindow(), commands/elapsed, client.getRetries(), failed, client.getIgnoredLines());
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+  const int windows[] = {1, 2, 4, 8};
+  for (int window : windows)
+    runCase("38400 baud", 38400, 0.0, window, seconds);
+  for (int window : windows)
+    runCase("38400 baud, 1% drops", 38400, 0.01, window, seconds);
+  runCase("no wire delay", 0, 0.0, 1, seconds);
+  runCase("no wire delay", 0, 0.0, 8, seconds);
+  return 0;
+}
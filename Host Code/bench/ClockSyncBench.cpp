@@ -0,0 +1,133 @@
+/*
+  ClockSyncBench.cpp - Timestamp accuracy of ClockSync against arrival time stamping
+  Released into the public domain.
+
+  usage: bench-clocksync [hours]   (default: 2)
+  Simulates a converter whose control tick runs off by a given drift, printing
+  one record a second from loop() at 38400 baud, and the daemon's side of the
+  link: USB adapter latency on both directions, poll() wake-ups with an
+  occasional scheduling stall, and "RTCK:" exchanges as often as ClockSync
+  asks for them, each sent when a record has arrived like atverterd does.
+
+  For every record after the fit locks it compares the true sampling instant
+  with the arrival time (what UART.py and older atverterd stored) and with
+  ClockSync::toHostUs() of the record's tick. Bias is the mean error, jitter
+  the 99th percentile of the distance from the mean; jitter is what spoils
+  derivatives and comparisons between converters.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "ClockSync.h"
+
+const int BENCH_BAUD = 38400;
+const double BYTE_US = 10e6/BENCH_BAUD;
+const double TICK_US = 1000.0; // INTERRUPT_TIME
+const int RECORD_BYTES = 180; // a transmitData() line with the Tick field
+const int UART_BUFFER_BYTES = 64; // HardwareSerial TX buffer, loop() blocks until the rest fits
+
+struct Link
+{
+  const char* name;
+  double usbUs; // adapter latency, uniform from 0 to this in each direction
+};
+
+struct Errors
+{
+  double biasUs;
+  double jitterUs; // p99 of |error - bias|
+  double maxUs; // largest |error|
+};
+
+static Errors summarize(std::vector<double> errors) {
+  Errors result = {0.0, 0.0, 0.0};
+  if (errors.empty())
+    return result;
+  for (double error : errors)
+    result.biasUs += error;
+  result.biasUs /= errors.size();
+  std::vector<double> spread;
+  for (double error : errors) {
+    spread.push_back(fabs(error - result.biasUs));
+    result.maxUs = std::max(result.maxUs, fabs(error));
+  }
+  std::sort(spread.begin(), spread.end());
+  result.jitterUs = spread[spread.size()*99/100];
+  return result;
+}
+
+static void simulate(const Link& link, double driftPpm, double hours, unsigned seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::exponential_distribution<double> wake(1.0/100.0); // poll() wake-up, ~100 us
+  auto usb = [&]() { return unit(random)*link.usbUs; };
+  auto hostDelay = [&]() { return wake(random) + (unit(random) < 0.02 ? 2000.0 + unit(random)*18000.0 : 0.0); };
+
+  double periodUs = TICK_US*(1.0 + driftPpm*1e-6); // host microseconds per device tick
+  double bootUs = 5e9 + unit(random)*periodUs; // host time of tick 0
+  auto tickTime = [&](double ticks) { return bootUs + ticks*periodUs; };
+
+  ClockSync sync;
+  sync.setBaud(BENCH_BAUD);
+  sync.setTickPeriod(TICK_US);
+  std::vector<double> arrivalErrors, syncedErrors;
+  double lockUs = -1.0;
+  long records = (long)(hours*3600.0);
+  for (long n = 1; n <= records; n++) {
+    // the ISR samples at tick 1000*n, loop() prints within ~0.5 ms
+    uint32_t tick = (uint32_t)(1000*n + 12345);
+    double sampleUs = tickTime(tick);
+    double printStartUs = sampleUs + unit(random)*500.0;
+    double printEndUs = printStartUs + RECORD_BYTES*BYTE_US; // last byte on the wire
+    double loopBlockedUntilUs = printEndUs - UART_BUFFER_BYTES*BYTE_US;
+    double recordArrivalUs = printEndUs + usb() + hostDelay();
+    if (sync.isLocked()) {
+      if (lockUs < 0.0)
+        lockUs = sampleUs - tickTime(12345);
+      arrivalErrors.push_back(recordArrivalUs - sampleUs);
+      syncedErrors.push_back(sync.toHostUs(tick) - sampleUs);
+    }
+    // like atverterd, start an exchange once the record is in, then the UART is quiet for a second
+    if (sync.isDue(recordArrivalUs)) {
+      double sentUs = recordArrivalUs + wake(random);
+      sync.beginExchange(sentUs);
+      double arriveUs = sentUs + 6*BYTE_US + usb();
+      double readUs = arriveUs;
+      if (arriveUs >= printStartUs && arriveUs < loopBlockedUntilUs)
+        readUs = loopBlockedUntilUs; // loop() is stuck in transmitData()
+      readUs += unit(random)*500.0; // the control ISR holds loop() for ~half of every tick
+      uint32_t readTick = (uint32_t)floor((readUs - bootUs)/periodUs);
+      double answerStartUs = std::max(readUs + 100.0, arriveUs < printEndUs ? printEndUs : 0.0);
+      double answerUs = answerStartUs + (7 + snprintf(NULL, 0, "%u", readTick))*BYTE_US + usb() + hostDelay();
+      sync.completeExchange(readTick, answerUs);
+    }
+  }
+  Errors arrival = summarize(arrivalErrors);
+  Errors synced = summarize(syncedErrors);
+  printf("%-22s %7.0f %8.1f %9.0f %9.0f %9.0f %9.1f %9.1f %9.1f %9.1f %6.0f\n", link.name, driftPpm,
+    lockUs/1e6, arrival.biasUs, arrival.jitterUs, arrival.maxUs, synced.biasUs, synced.jitterUs, synced.maxUs,
+    sync.getDriftPpm() - driftPpm, sync.getRoundTripUs());
+}
+
+int main(int argc, char** argv) {
+  double hours = argc > 1 ? atof(argv[1]) : 2.0;
+  const Link links[] = {
+    {"GPIO UART", 0.0},
+    {"USB, 1 ms frames", 1000.0}, // ATmega16U2, CH340, FTDI with low_latency
+    {"USB, 16 ms latency", 16000.0}}; // FTDI default latency timer
+  const double drifts[] = {0.0, 150.0, 5000.0}; // exact, crystal, ceramic resonator
+  printf("%-22s %7s %8s %29s %39s %6s\n", "", "", "", "arrival time, us", "tick via ClockSync, us", "");
+  printf("%-22s %7s %8s %9s %9s %9s %9s %9s %9s %9s %6s\n", "link", "ppm", "lock s", "bias", "jitter",
+    "max", "bias", "jitter", "max", "ppm err", "rtt");
+  unsigned seed = 1;
+  for (const Link& link : links) {
+    for (double drift : drifts)
+      simulate(link, drift, hours, seed++);
+  }
+  return 0;
+}
@@ -0,0 +1,269 @@
+/*
+  DayBench.cpp - Whole days of the MPPT sketch on the plant simulator, time-warped
+  Released into the public domain.
+
+  usage: bench-day [options]
+    --sky LIST        one day per entry, clear or cloudy (default: clear,cloudy)
+    --seed N          clouds and sensor noise (default: 1)
+    --chemistry NAME  lead-acid or lifepo4 (default: lead-acid)
+    --soc X           state of charge at midnight of the first day, 0 to 1 (default: 0.5)
+    --load A          drawn from the battery day and night (default: 0.3)
+    --full            run every control tick, for comparison with the warped run
+    --checkpoint H    checkpoint the first day at hour H, run to the end, then
+                      go back to the checkpoint, run again and check both runs
+                      end on the same digest
+    --trace FILE      the plant and the duty cycle once a minute, as CSV
+
+  Runs AtverterH_MPPT.cpp from midnight through the days listed on a clear
+  sky irradiance curve (sunrise at 6:00, sunset at 18:00, 1000 W/m2 at
+  noon), on cloudy days shaded by clouds of random depth and length drawn
+  from the seed, with the ambient temperature swinging between 8 °C before
+  dawn and 22 °C in the afternoon. TimeWarp.h passes over the control ticks
+  that change nothing, a day takes a few seconds on one core.
+
+  Prints per day the panel energy, the energy at the maximum power point and
+  the tracking efficiency, what went into and came out of the battery, the
+  state of charge, the hottest FET, how many seconds the gates were shut
+  down, the share of control ticks that ran, how many blocks turned into
+  events, the time taken and a digest of the run: FNV-1a over every second's
+  duty cycle and energies and the state of charge, bit for bit, the same for
+  the same options and seed on any run.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Checkpoint.h"
+#include "TimeWarp.h"
+
+const int DAY_S = 86400;
+const double SUNRISE_H = 6.0;
+const double SUNSET_H = 18.0;
+const double PEAK_IRRADIANCE = 1000.0;
+
+// skies, for convenience and bookkeeping
+enum Skies
+{   SKY_CLEAR = 0,
+    SKY_CLOUDY,
+    NUM_SKIES
+};
+
+const char * const SKY_NAMES[NUM_SKIES] = {"clear", "cloudy"};
+
+// W/m2 of a clear sky at a second of the day
+static double clearSky(int second) {
+  double hour = second/3600.0;
+  if (hour <= SUNRISE_H || hour >= SUNSET_H)
+    return 0.0;
+  double elevation = sin(M_PI*(hour - SUNRISE_H)/(SUNSET_H - SUNRISE_H));
+  return PEAK_IRRADIANCE*pow(elevation, 1.2); // a longer path through the air low in the sky
+}
+
+// ambient °C, lowest before dawn and highest in the afternoon
+static double ambient(int second) {
+  return 15.0 - 7.0*cos(2.0*M_PI*(second/3600.0 - 3.0)/24.0);
+}
+
+// the fraction of the clear sky each second of a day lets through
+static std::vector<double> skyFraction(int sky, std::mt19937& random) {
+  std::vector<double> fraction(DAY_S, 1.0);
+  if (sky != SKY_CLOUDY)
+    return fraction;
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::exponential_distribution<double> gap(1.0/90.0); // s between cloud edges
+  double shade = 0.0;
+  double target = 0.0;
+  double nextEdge = gap(random);
+  for (int t = 0; t < DAY_S; t++) {
+    if (t >= nextEdge) {
+      target = target > 0.0 || unit(random) > 0.6 ? 0.0 : 0.3 + 0.6*unit(random);
+      nextEdge = t + 1.0 + gap(random);
+    }
+    shade += (target - shade)*0.3; // cloud edges take a few seconds
+    fraction[t] = 1.0 - shade;
+  }
+  return fraction;
+}
+
+// FNV-1a, 64 bit
+static void digest(uint64_t& hash, const void* data, size_t length) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t n = 0; n < length; n++) {
+    hash ^= bytes[n];
+    hash *= 1099511628211ULL;
+  }
+}
+
+// what one day added up to
+struct DayTotals
+{
+  double pvJ = 0.0;
+  double mppJ = 0.0;
+  double chargeJ = 0.0; // into the battery
+  double dischargeJ = 0.0; // out of it, the load included
+  double fetMaxC = -273.15;
+  int shutdownS = 0;
+};
+
+int main(int argc, char** argv) {
+  std::vector<int> skies = {SKY_CLEAR, SKY_CLOUDY};
+  uint32_t seed = 1;
+  PlantParams params;
+  params.battery.loadA = 0.3;
+  WarpParams warp;
+  double checkpointH = -1.0;
+  FILE* trace = nullptr;
+  for (int n = 1; n < argc; n++) {
+    const char* option = argv[n];
+    if (strcmp(option, "--full") == 0) {
+      warp.enabled = false;
+      continue;
+    }
+    const char* value = n + 1 < argc ? argv[++n] : nullptr;
+    if (value && strcmp(option, "--sky") == 0) {
+      skies.clear();
+      std::string list = value;
+      size_t start = 0;
+      while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        std::string name = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        int sky = NUM_SKIES;
+        for (int k = 0; k < NUM_SKIES; k++)
+          sky = name == SKY_NAMES[k] ? k : sky;
+        if (sky == NUM_SKIES) {
+          fprintf(stderr, "unknown sky %s\n", name.c_str());
+          return 1;
+        }
+        skies.push_back(sky);
+        if (end == std::string::npos)
+          break;
+        start = end + 1;
+      }
+    } else if (value && strcmp(option, "--seed") == 0) {
+      seed = strtoul(value, nullptr, 10);
+    } else if (value && strcmp(option, "--chemistry") == 0) {
+      if (strcmp(value, "lead-acid") == 0)
+        params.battery.chemistry = BATTERY_LEAD_ACID;
+      else if (strcmp(value, "lifepo4") == 0)
+        params.battery.chemistry = BATTERY_LIFEPO4;
+      else {
+        fprintf(stderr, "unknown chemistry %s\n", value);
+        return 1;
+      }
+    } else if (value && strcmp(option, "--soc") == 0) {
+      params.battery.initialSoc = constrain(atof(value), 0.0, 1.0);
+    } else if (value && strcmp(option, "--load") == 0) {
+      params.battery.loadA = atof(value);
+    } else if (value && strcmp(option, "--checkpoint") == 0) {
+      checkpointH = atof(value);
+    } else if (value && strcmp(option, "--trace") == 0) {
+      trace = fopen(value, "w");
+      if (!trace) {
+        perror(value);
+        return 1;
+      }
+      fprintf(trace, "day,second,irradiance,ambient_c,panel_v,panel_a,mpp_w,duty,battery_v,battery_a,soc,fet1_c,latched\n");
+    } else {
+      fprintf(stderr, "usage: %s [--sky clear,cloudy,...] [--seed N] [--chemistry lead-acid|lifepo4] [--soc X] "
+        "[--load A] [--full] [--checkpoint H] [--trace FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+  params.seed = seed;
+
+  static PlantSim plant; // static like the sketch's board
+  plant.configure(params);
+  plant.setAmbient(ambient(0));
+  plant.setIrradiance(0.0);
+  startSketch(plant);
+  TimeWarp warped(plant, warp);
+  std::mt19937 random(seed);
+  Checkpoint checkpoint;
+  int checkpointS = checkpointH >= 0.0 ? (int)lround(checkpointH*3600.0) : -1;
+  bool rerun = false;
+  std::string firstDigest;
+  uint64_t hash = 14695981039346656037ULL;
+
+  printf("%d day%s from midnight, %s, %s, load %.2f A, seed %u\n\n", (int)skies.size(), skies.size() == 1 ? "" : "s",
+    warp.enabled ? "time-warped" : "every tick", BATTERY_CHEMISTRY_NAMES[params.battery.chemistry],
+    params.battery.loadA, seed);
+  printf("%4s %-7s %8s %8s %7s %8s %8s %11s %7s %6s %7s %7s %7s %8s %s\n", "day", "sky", "PV Wh", "MPP Wh", "track %",
+    "in Wh", "out Wh", "SOC", "FET °C", "off s", "ticks %", "events", "wall s", "speed", "digest");
+  double totalWall = 0.0;
+  for (size_t day = 0; day < skies.size(); day++) {
+    std::vector<double> fraction = skyFraction(skies[day], random);
+    DayTotals totals;
+    double startSoc = plant.getState().soc;
+    WarpStats startStats = warped.getStats();
+    int firstSecond = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int t = 0; t < DAY_S; t++) {
+      if (day == 0 && t == checkpointS) {
+        rerun = checkpoint.save(&firstDigest) > 0;
+        if (rerun) {
+          trace = nullptr; // the first run wrote it
+          start = std::chrono::steady_clock::now();
+          firstSecond = t;
+        }
+      }
+      if (t%60 == 0)
+        plant.setAmbient(ambient(t));
+      plant.setIrradiance(clearSky(t)*fraction[t]);
+      SketchSecond second = warped.runSecond();
+      const PlantState& state = plant.getState();
+      totals.pvJ += second.pvJ;
+      totals.mppJ += second.mppJ;
+      totals.chargeJ += second.batteryJ > 0.0 ? second.batteryJ : 0.0;
+      totals.dischargeJ += second.batteryJ < 0.0 ? -second.batteryJ : 0.0;
+      totals.fetMaxC = state.fet1C > totals.fetMaxC ? state.fet1C : totals.fetMaxC;
+      totals.fetMaxC = state.fet2C > totals.fetMaxC ? state.fet2C : totals.fetMaxC;
+      totals.shutdownS += state.latched ? 1 : 0;
+      digest(hash, &second.duty, sizeof(second.duty));
+      digest(hash, &second.pvJ, sizeof(second.pvJ));
+      digest(hash, &second.batteryJ, sizeof(second.batteryJ));
+      digest(hash, &state.soc, sizeof(state.soc));
+      if (trace && t%60 == 59) {
+        fprintf(trace, "%d,%d,%.1f,%.1f,%.3f,%.3f,%.2f,%d,%.3f,%.3f,%.4f,%.1f,%d\n", (int)day + 1, t + 1,
+          state.irradiance, state.ambientC, state.panelV, state.panelA, state.mppW, second.duty, state.batteryV,
+          state.batteryA, state.soc, state.fet1C, state.latched ? 1 : 0);
+      }
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    totalWall += wall;
+    const WarpStats& stats = warped.getStats();
+    long long ran = stats.ticksRun - startStats.ticksRun;
+    long long skipped = stats.ticksSkipped - startStats.ticksSkipped;
+    char soc[16];
+    snprintf(soc, sizeof(soc), "%.3f-%.3f", startSoc, plant.getState().soc);
+    printf("%4d %-7s %8.1f %8.1f %7.2f %8.1f %8.1f %11s %7.1f %6d %7.2f %7lld %7.2f %7.0fx %016llx\n", (int)day + 1,
+      SKY_NAMES[skies[day]], totals.pvJ/3600.0, totals.mppJ/3600.0,
+      totals.mppJ > 0.0 ? 100.0*totals.pvJ/totals.mppJ : 0.0, totals.chargeJ/3600.0, totals.dischargeJ/3600.0, soc,
+      totals.fetMaxC, totals.shutdownS, 100.0*ran/(ran + skipped), stats.events - startStats.events, wall,
+      (DAY_S - firstSecond)/wall, (unsigned long long)hash);
+    fflush(stdout);
+  }
+  plant.detach();
+  if (trace)
+    fclose(trace);
+
+  char finalDigest[24];
+  snprintf(finalDigest, sizeof(finalDigest), "%016llx", (unsigned long long)hash);
+  if (checkpointS >= 0 && !rerun) {
+    printf("\n%.2f s; back to the checkpoint at %02d:%02d of day 1\n", totalWall, checkpointS/3600, checkpointS%3600/60);
+    checkpoint.restore(finalDigest);
+  }
+  if (rerun) {
+    bool same = firstDigest == finalDigest;
+    printf("\nrerun from the checkpoint in %.2f s: digest %s, first run %s, %s\n", totalWall, finalDigest,
+      firstDigest.c_str(), same ? "the same" : "DIFFERENT");
+    return same ? 0 : 2;
+  }
+  printf("\n%.2f s for %d simulated day%s\n", totalWall, (int)skies.size(), skies.size() == 1 ? "" : "s");
+  return 0;
+}
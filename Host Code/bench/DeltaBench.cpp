@@ -0,0 +1,359 @@
+/*
+  DeltaBench.cpp - UART bandwidth and fidelity of the deadband telemetry mode
+  Released into the public domain.
+
+  usage: bench-delta [hours] [sketch seconds]   (defaults: 6, 1800)
+  First runs the sketch itself (AtverterH_MPPT.cpp on PlantSim, the
+  quasi-static buck model) twice per scenario, every record sent and with
+  WTXM:1, and measures what its transmitData() puts on the wire:
+    clear          1000 W/m2 from power up
+    cloud steps    1000 and 300 W/m2 in turn, two minutes each
+  The runs are the same but for the UART, so the deadband run's records,
+  rebuilt by TelemetryDeltaDecoder like atverterd, are checked against the
+  full run's. "duty moves" counts records whose duty cycle differs from the
+  one before: anything the sketch reports that moves every second costs a
+  delta record every second.
+
+  Then feeds the firmware's DeadbandTelemetry (built from the Atverter Code
+  tree) with one record a second of a synthetic converter, hours long,
+  prints each record the way transmitData() does, and runs the lines
+  through parseTelemetryLine() and TelemetryDeltaDecoder. Scenarios:
+    night      panel dark, battery resting, ADC noise only
+    clear sky  slow irradiance drift around noon, the MPPT duty seldom moves
+    clouds     cloud edges every ~20 s swinging the panel current by 70 %
+    clouds, 1% lost   the same with one line in a hundred lost; the decoder
+                      asks for a keyframe (WKEY:1) as soon as it notices
+
+  Compares the bytes on the wire with every record sent in full, and each
+  rebuilt record with the record the firmware measured: the largest error of
+  every channel (within the channel's deadband by design; power is rebuilt
+  from the held voltage and current), and for transients, records where a
+  watched field jumped by more than four deadbands since the last second,
+  how many the rebuilt series shows exactly. "rebuilt" stays under 100 %: the
+  records after the last line are only filled in once the next one arrives,
+  and the records between a lost line and the next keyframe are gone.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "DeadbandTelemetry.h"
+#include "ProcessPool.h"
+#include "SketchRunner.h"
+#include "Telemetry.h"
+#include "TelemetryDelta.h"
+
+const long PERIOD_TICKS = 1001; // SLOW_INTERRUPT_COUNT + 1
+const int HEARTBEAT = 60;
+// RECORD_DEADBANDS of AtverterH_MPPT.cpp
+const long DEADBANDS[NUM_CHANNELS] = {130, 45, DEADBAND_UNSUBSCRIBED, 130, 45, DEADBAND_UNSUBSCRIBED, 1, 1, 1};
+const long VOLTAGE_STEP = 63; // mV per ADC step
+const long CURRENT_STEP = 15; // mA per ADC step
+
+enum SketchScenarios
+{   SKETCH_CLEAR = 0,
+    SKETCH_CLOUD_STEPS,
+    NUM_SKETCHSCENARIOS
+};
+
+const char * const SKETCH_SCENARIO_NAMES[NUM_SKETCHSCENARIOS] = {"clear", "cloud steps"};
+
+enum Scenarios
+{   SCENARIO_NIGHT = 0,
+    SCENARIO_CLEAR,
+    SCENARIO_CLOUDS,
+    SCENARIO_CLOUDS_LOSSY,
+    NUM_SCENARIOS
+};
+
+const char * const SCENARIO_NAMES[NUM_SCENARIOS] = {"night", "clear sky", "clouds", "clouds, 1% lost"};
+
+// The Sketch ----------------------------------------------------------------
+
+// W/m2 at a time since power up, as bench-mppt's scenarios
+static double sketchIrradiance(int scenario, double seconds) {
+  if (scenario == SKETCH_CLOUD_STEPS)
+    return ((long)(seconds/120.0) % 2) == 0 ? 1000.0 : 300.0;
+  return 1000.0;
+}
+
+// what the sketch printed in one run from power up; the sketch's globals live on from one setup() to the next
+// like nothing on the ATmega does, so each run goes in a process of its own
+static std::string runSketch(int scenario, int seconds, bool deadbandMode) {
+  static PlantSim plant; // static like the sketch's board
+  plant.configure(PlantParams());
+  plant.setIrradiance(sketchIrradiance(scenario, 0.0));
+  startSketch(plant);
+  if (deadbandMode)
+    halNativeUARTReceive("WTXM:1\n"); // read by the first loop(), before the first record
+  std::string uart;
+  for (int t = 0; t < seconds; t++) {
+    plant.setIrradiance(sketchIrradiance(scenario, t));
+    runSketchSecond(plant, &uart);
+  }
+  plant.detach();
+  return uart;
+}
+
+// the records of a run, parsed; command replies and other lines are left out
+static std::vector<TelemetryLine> parseRecords(const std::string& uart, double& recordBytes) {
+  std::vector<TelemetryLine> records;
+  recordBytes = 0.0;
+  size_t start = 0;
+  for (size_t end = uart.find('\n'); end != std::string::npos; start = end + 1, end = uart.find('\n', start)) {
+    std::string line = uart.substr(start, end - start);
+    size_t bytes = line.size() + 1;
+    TelemetryLine parsed;
+    int type = parseTelemetryLine(&line[0], parsed);
+    if (type != LINE_RECORD && type != LINE_DELTA_RECORD)
+      continue;
+    recordBytes += bytes;
+    records.push_back(parsed);
+  }
+  return records;
+}
+
+struct SketchResult
+{
+  double fullBytes; // per second, every record sent
+  double deadbandBytes; // per second, deadband mode
+  long records; // of the full run
+  long deltaLines; // delta records of the deadband run
+  long keyframes;
+  long dutyMoves; // records of the full run whose duty cycle differs from the one before
+  long rebuilt; // deadband records rebuilt and found in the full run
+  long maxError[NUM_CHANNELS];
+};
+
+// compares the output of a run with every record sent and a run in deadband mode
+static SketchResult compareSketchRuns(const std::string& fullUart, const std::string& deadbandUart, int seconds) {
+  SketchResult result;
+  memset(&result, 0, sizeof(result));
+  double bytes;
+  std::vector<TelemetryLine> full = parseRecords(fullUart, bytes);
+  result.fullBytes = bytes/seconds;
+  std::vector<TelemetryLine> lines = parseRecords(deadbandUart, bytes);
+  result.deadbandBytes = bytes/seconds;
+  result.records = (long)full.size();
+  for (size_t n = 1; n < full.size(); n++)
+    result.dutyMoves += full[n].sample.values[DUTY_CYCLE] != full[n - 1].sample.values[DUTY_CYCLE];
+
+  TelemetryDeltaDecoder decoder;
+  std::vector<TelemetryLine> rebuilt;
+  for (const TelemetryLine& line : lines) {
+    result.deltaLines += line.type == LINE_DELTA_RECORD;
+    result.keyframes += line.type == LINE_RECORD;
+    decoder.decode(line, rebuilt);
+  }
+  size_t match = 0;
+  for (const TelemetryLine& record : rebuilt) {
+    while (match < full.size() && full[match].ticks < record.ticks)
+      match++;
+    if (match == full.size() || full[match].ticks != record.ticks)
+      continue; // the runs went apart, counted as not rebuilt
+    result.rebuilt++;
+    for (int channel = 0; channel < NUM_CHANNELS; channel++) {
+      long error = labs((long)record.sample.values[channel] - full[match].sample.values[channel]);
+      result.maxError[channel] = std::max(result.maxError[channel], error);
+    }
+  }
+  return result;
+}
+
+// The Synthetic Converter ---------------------------------------------------
+
+// one record a second of what the firmware measures
+static std::vector<std::vector<long>> simulate(int scenario, long records, unsigned seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::uniform_int_distribution<int> adcNoise(-1, 1); // moving average of a noisy ADC
+  std::exponential_distribution<double> cloudEdge(1.0/20.0);
+  std::vector<std::vector<long>> series;
+  double irradiance = scenario == SCENARIO_NIGHT ? 0.0 : 0.95;
+  double target = irradiance;
+  double nextEdge = 0.0;
+  double battery = 12700.0;
+  double temperature = 22.0;
+  long duty = 50;
+  for (long n = 0; n < records; n++) {
+    if (scenario == SCENARIO_CLEAR) {
+      irradiance = 0.95 - 0.05*cos(n*2.0*M_PI/(12*3600.0)); // around noon
+    } else if (scenario >= SCENARIO_CLOUDS) {
+      if (n >= nextEdge) {
+        target = target > 0.6 ? 0.3 : 1.0;
+        nextEdge = n + 2.0 + cloudEdge(random);
+      }
+      irradiance += (target - irradiance)*0.5; // the edge takes a few seconds
+    }
+    double panelCurrent = 5000.0*irradiance;
+    double panelVoltage = irradiance > 0.0 ? 17500.0 + 600.0*log(irradiance) : 300.0;
+    double power = panelVoltage*panelCurrent/1000.0*0.95; // mW into the battery
+    battery += power/1000.0*0.0002; // slow charge
+    temperature += ((20.0 + 25.0*irradiance) - temperature)/600.0;
+    // perturb and observe only steps once the power moved enough to clear its error ranges
+    long optimum = lround(battery/panelVoltage*100.0);
+    if (irradiance > 0.0 && labs(optimum - duty) >= 2)
+      duty += optimum > duty ? 1 : -1;
+
+    std::vector<long> values(NUM_CHANNELS);
+    values[LOW_SIDE_VOLTAGE] = lround(battery/VOLTAGE_STEP + adcNoise(random))*VOLTAGE_STEP;
+    values[LOW_SIDE_CURRENT] = lround(power/battery*1000.0/CURRENT_STEP + adcNoise(random))*CURRENT_STEP;
+    values[LOW_SIDE_POWER] = values[LOW_SIDE_VOLTAGE]*values[LOW_SIDE_CURRENT]/1000;
+    values[HIGH_SIDE_VOLTAGE] = lround(panelVoltage/VOLTAGE_STEP + adcNoise(random))*VOLTAGE_STEP;
+    values[HIGH_SIDE_CURRENT] = std::max(0L, lround(panelCurrent/CURRENT_STEP + adcNoise(random))*CURRENT_STEP);
+    values[HIGH_SIDE_POWER] = values[HIGH_SIDE_VOLTAGE]*values[HIGH_SIDE_CURRENT]/1000;
+    values[DUTY_CYCLE] = duty;
+    values[TEMPERATURE_1] = lround(temperature + 0.4*unit(random) - 0.2);
+    values[TEMPERATURE_2] = lround(temperature - 1.0 + 0.4*unit(random) - 0.2);
+    series.push_back(values);
+  }
+  return series;
+}
+
+// prints a record like transmitData(), returns the line without "\r\n"
+static std::string format(DeadbandTelemetry& deadband, int record, uint32_t tick, const std::vector<long>& values) {
+  char field[64];
+  snprintf(field, sizeof(field), "Tick: %u\t", tick);
+  std::string line = field;
+  if (deadband.isEnabled()) {
+    snprintf(field, sizeof(field), "%s: %u\t", record == RECORD_KEYFRAME ? "Seq" : "Delta", deadband.getSequence());
+    line += field;
+    if (record == RECORD_KEYFRAME) {
+      snprintf(field, sizeof(field), "Period: %ld\t", PERIOD_TICKS);
+      line += field;
+    }
+  }
+  for (int n = 0; n < NUM_CHANNELS; n++) {
+    if (!deadband.isFieldSent(n))
+      continue;
+    snprintf(field, sizeof(field), "%s: %ld\t", CHANNEL_NAMES[n], record == RECORD_DELTA ? deadband.getDelta(n) : values[n]);
+    line += field;
+  }
+  return line;
+}
+
+struct Result
+{
+  double fullBytes; // per second, every record sent
+  double deadbandBytes; // per second, deadband mode
+  double linesPerHour;
+  long maxError[NUM_CHANNELS];
+  long transients;
+  long transientsExact;
+  long rebuilt; // records the decoder handed out
+  long gaps;
+};
+
+static Result run(int scenario, double hours, unsigned seed) {
+  long records = (long)(hours*3600.0);
+  std::vector<std::vector<long>> series = simulate(scenario, records, seed);
+  std::mt19937 random(seed + 1000);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  double lossRate = scenario == SCENARIO_CLOUDS_LOSSY ? 0.01 : 0.0;
+
+  Result result;
+  memset(&result, 0, sizeof(result));
+  DeadbandTelemetry full, deadband;
+  full.begin(NUM_CHANNELS);
+  deadband.begin(NUM_CHANNELS);
+  for (int n = 0; n < NUM_CHANNELS; n++)
+    deadband.setDeadband(n, DEADBANDS[n]);
+  deadband.setHeartbeat(HEARTBEAT);
+  deadband.setEnabled(true);
+
+  TelemetryDeltaDecoder decoder;
+  std::vector<TelemetryLine> rebuilt;
+  long lines = 0;
+  uint32_t firstTick = 4000000000u; // the counter wraps during the run
+  for (long n = 0; n < records; n++) {
+    uint32_t tick = firstTick + (uint32_t)(n*PERIOD_TICKS);
+    const std::vector<long>& values = series[n];
+    result.fullBytes += format(full, full.update(&values[0]), tick, values).size() + 2;
+    int record = deadband.update(&values[0]);
+    if (record == RECORD_NONE)
+      continue;
+    std::string line = format(deadband, record, tick, values);
+    result.deadbandBytes += line.size() + 2;
+    lines++;
+    if (unit(random) < lossRate)
+      continue;
+    TelemetryLine parsed;
+    parseTelemetryLine(&line[0], parsed);
+    if (!decoder.decode(parsed, rebuilt))
+      deadband.requestKeyframe(); // WKEY:1, in time for the next record
+  }
+  result.fullBytes /= records;
+  result.deadbandBytes /= records;
+  result.linesPerHour = lines/hours;
+  result.rebuilt = (long)rebuilt.size();
+  result.gaps = decoder.getGaps();
+
+  for (const TelemetryLine& record : rebuilt) {
+    long n = (long)((uint32_t)(record.ticks - firstTick)/PERIOD_TICKS);
+    const std::vector<long>& truth = series[n];
+    for (int channel = 0; channel < NUM_CHANNELS; channel++)
+      result.maxError[channel] = std::max(result.maxError[channel], labs(record.sample.values[channel] - truth[channel]));
+    if (n == 0)
+      continue;
+    for (int channel = 0; channel < NUM_CHANNELS; channel++) {
+      if (DEADBANDS[channel] == DEADBAND_UNSUBSCRIBED)
+        continue;
+      if (labs(truth[channel] - series[n - 1][channel]) > 4*std::max(DEADBANDS[channel], 1L)) {
+        result.transients++;
+        if (record.sample.values[channel] == truth[channel])
+          result.transientsExact++;
+      }
+    }
+  }
+  return result;
+}
+
+int main(int argc, char** argv) {
+  double hours = argc > 1 ? atof(argv[1]) : 6.0;
+  int sketchSeconds = argc > 2 ? atoi(argv[2]) : 1800;
+  printf("the sketch on PlantSim, %d s\n", sketchSeconds);
+  printf("%-16s %8s %8s %7s %8s %8s %8s %8s %10s %8s\n", "scenario", "full B/s", "dband B/s", "ratio",
+    "records", "deltas", "keyframes", "rebuilt", "duty moves", "duty err");
+  std::vector<std::string> uarts = runInProcesses(2*NUM_SKETCHSCENARIOS, (int)sysconf(_SC_NPROCESSORS_ONLN),
+    [sketchSeconds](int job) { return runSketch(job/2, sketchSeconds, job % 2 == 1); });
+  for (int scenario = 0; scenario < NUM_SKETCHSCENARIOS; scenario++) {
+    SketchResult result = compareSketchRuns(uarts[2*scenario], uarts[2*scenario + 1], sketchSeconds);
+    printf("%-16s %8.1f %8.2f %6.1fx %8ld %8ld %8ld %7.1f%% %10ld %8ld\n", SKETCH_SCENARIO_NAMES[scenario],
+      result.fullBytes, result.deadbandBytes, result.fullBytes/result.deadbandBytes, result.records,
+      result.deltaLines, result.keyframes, result.records ? 100.0*result.rebuilt/result.records : 0.0,
+      result.dutyMoves, result.maxError[DUTY_CYCLE]);
+  }
+
+  printf("\nsynthetic converter, %.1f h\n", hours);
+  printf("%-16s %8s %8s %7s %8s %8s %8s %9s %10s\n", "scenario", "full B/s", "dband B/s", "ratio",
+    "lines/h", "rebuilt", "gaps", "transient", "exact");
+  std::vector<Result> results;
+  for (int scenario = 0; scenario < NUM_SCENARIOS; scenario++) {
+    Result result = run(scenario, hours, 1 + scenario);
+    results.push_back(result);
+    printf("%-16s %8.1f %8.2f %6.1fx %8.0f %7.1f%% %8ld %9ld %9.1f%%\n", SCENARIO_NAMES[scenario],
+      result.fullBytes, result.deadbandBytes, result.fullBytes/result.deadbandBytes, result.linesPerHour,
+      100.0*result.rebuilt/(hours*3600.0), result.gaps, result.transients,
+      result.transients > 0 ? 100.0*result.transientsExact/result.transients : 100.0);
+  }
+  printf("\nlargest error of a rebuilt record\n%-16s", "channel");
+  for (int scenario = 0; scenario < NUM_SCENARIOS; scenario++)
+    printf(" %16s", SCENARIO_NAMES[scenario]);
+  printf(" %9s\n", "deadband");
+  for (int channel = 0; channel < NUM_CHANNELS; channel++) {
+    printf("%-16s", CHANNEL_NAMES[channel]);
+    for (const Result& result : results)
+      printf(" %16ld", result.maxError[channel]);
+    if (DEADBANDS[channel] == DEADBAND_UNSUBSCRIBED)
+      printf(" %9s\n", "derived");
+    else
+      printf(" %9ld\n", DEADBANDS[channel]);
+  }
+  return 0;
+}
@@ -0,0 +1,195 @@
+/*
+  DeviceSimulator.h - Pseudo-terminal stand-in for an AtverterH UART
+  Released into the public domain.
+
+  Answers the command set of AtverterH::interpretRXCommand() on the slave side
+  of a pty, the way the firmware would over a 38400 baud link:
+    - lines are cut at 15 characters (COMMBUFFERSIZE - 1) and split at ':'
+    - every byte takes 10 bit times on the wire, in each direction
+    - each command costs a fixed turnaround in loop() before its answer starts
+    - a telemetry record is printed once per second, between answers
+    - a fraction of commands can be dropped, like RX overruns while the
+      control ISR is busy printing
+  A baud rate of 0 turns all wire and turnaround delays off.
+*/
+
+#ifndef DeviceSimulator_h
+#define DeviceSimulator_h
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+
+class DeviceSimulator
+{
+  public:
+    DeviceSimulator(int baud, int turnaroundUs, double dropRate) : _baud(baud), _turnaroundUs(turnaroundUs),
+      _dropRate(dropRate) {}
+    ~DeviceSimulator() { stop(); }
+
+    // creates the pty and starts answering, returns the slave path for SerialPort
+    bool start() {
+      _master = posix_openpt(O_RDWR | O_NOCTTY);
+      if (_master < 0 || grantpt(_master) != 0 || unlockpt(_master) != 0)
+        return false;
+      _slavePath = ptsname(_master);
+      // keep the slave raw even before the client opens it, so nothing is echoed back
+      int slave = open(_slavePath.c_str(), O_RDWR | O_NOCTTY);
+      if (slave < 0)
+        return false;
+      struct termios settings;
+      tcgetattr(slave, &settings);
+      cfmakeraw(&settings);
+      tcsetattr(slave, TCSANOW, &settings);
+      _slaveHold = slave;
+      fcntl(_master, F_SETFL, O_NONBLOCK);
+      _running = true;
+      _thread = std::thread([this]() { run(); });
+      return true;
+    }
+
+    void stop() {
+      if (_running) {
+        _running = false;
+        _thread.join();
+      }
+      if (_slaveHold >= 0)
+        close(_slaveHold);
+      if (_master >= 0)
+        close(_master);
+      _slaveHold = _master = -1;
+    }
+
+    const std::string& getSlavePath() { return _slavePath; }
+    long getCommands() { return _commands; }
+    long getDropped() { return _dropped; }
+
+  private:
+    struct Output
+    {
+      double time; // when the last byte has left the simulated wire
+      std::string text;
+    };
+    int _baud;
+    int _turnaroundUs;
+    double _dropRate;
+    int _master = -1;
+    int _slaveHold = -1;
+    std::string _slavePath;
+    std::thread _thread;
+    std::atomic<bool> _running{false};
+    std::atomic<long> _commands{0};
+    std::atomic<long> _dropped{0};
+    uint32_t _random = 12345;
+    // register file
+    int _v1 = 18250, _v2 = 12710, _i1 = 2210, _i2 = 3080, _t1 = 31, _t2 = 29, _vcc = 5012, _duty = 47;
+    int _droop = 0, _shutdown1 = 15000, _shutdown2 = 15000, _thermal = 60;
+
+    static double now() {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    double wireSeconds(size_t bytes) { return _baud > 0 ? bytes*10.0/_baud : 0.0; }
+
+    // answers one line like AtverterH::interpretRXCommand(); empty for unknown commands
+    std::string answer(char* line) {
+      char* command = strtok(line, ":");
+      char* value = strtok(NULL, "\n");
+      if (!command)
+        return "";
+      char text[32];
+      int temp = value ? atoi(value) : 0;
+      if (strcmp(command, "RV1") == 0) snprintf(text, sizeof(text), "WV1:%u", _v1);
+      else if (strcmp(command, "RV2") == 0) snprintf(text, sizeof(text), "WV2:%u", _v2);
+      else if (strcmp(command, "RI1") == 0) snprintf(text, sizeof(text), "WI1:%d", _i1);
+      else if (strcmp(command, "RI2") == 0) snprintf(text, sizeof(text), "WI2:%d", _i2);
+      else if (strcmp(command, "RT1") == 0) snprintf(text, sizeof(text), "WT1:%d", _t1);
+      else if (strcmp(command, "RT2") == 0) snprintf(text, sizeof(text), "WT2:%d", _t2);
+      else if (strcmp(command, "RVCC") == 0) snprintf(text, sizeof(text), "WVCC:%d", _vcc);
+      else if (strcmp(command, "RDUT") == 0) snprintf(text, sizeof(text), "WDUT:%d", _duty);
+      else if (strcmp(command, "RDRP") == 0) snprintf(text, sizeof(text), "WDRP:%d", _droop);
+      else if (strcmp(command, "WIS1") == 0) snprintf(text, sizeof(text), "WIS1:=%d", _shutdown1 = temp);
+      else if (strcmp(command, "WIS2") == 0) snprintf(text, sizeof(text), "WIS2:=%d", _shutdown2 = temp);
+      else if (strcmp(command, "WTSD") == 0) snprintf(text, sizeof(text), "WTSD:=%d", _thermal = temp);
+      else if (strcmp(command, "WDRP") == 0) snprintf(text, sizeof(text), "WDRP:=%d", _droop = temp);
+      else return "";
+      return std::string(text) + "\r\n";
+    }
+
+    void run() {
+      std::string received;
+      std::deque<Output> outputs;
+      double rxFree = 0.0; // when the simulated RX wire is idle again
+      double deviceFree = 0.0; // when loop() is ready for the next command
+      double txFree = 0.0; // when the simulated TX wire is idle again
+      double nextTelemetry = now() + 1.0;
+      while (_running) {
+        double t = now();
+        // release everything whose bytes have finished "transmitting"
+        while (!outputs.empty() && outputs.front().time <= t) {
+          const std::string& text = outputs.front().text;
+          if (write(_master, text.data(), text.size()) < 0 && errno != EAGAIN)
+            return;
+          outputs.pop_front();
+        }
+        if (t >= nextTelemetry) {
+          const char* record = "LowSideVoltage: 12710\tLowSideCurrent: 3080\tLowSidePower: 39146\t"
+            "HighSideVoltage: 18250\tHighSideCurrent: 2210\tHighSidePower: 40332\tDutyCycle: 47\t"
+            "Temperature1: 31\tTemperature2: 29\t\r\n";
+          txFree = (txFree > t ? txFree : t) + wireSeconds(strlen(record));
+          outputs.push_back({txFree, record});
+          nextTelemetry += 1.0;
+        }
+        int waitMs = 100;
+        if (!outputs.empty())
+          waitMs = (int)((outputs.front().time - t)*1000.0);
+        struct pollfd fd = {_master, POLLIN, 0};
+        if (poll(&fd, 1, waitMs < 0 ? 0 : waitMs) > 0) {
+          char buffer[256];
+          ssize_t got = read(_master, buffer, sizeof(buffer));
+          if (got > 0)
+            received.append(buffer, got);
+        }
+        // complete lines, cut at 15 characters like PicroBoard::readUART()
+        size_t start = 0;
+        while (true) {
+          size_t end = start;
+          while (end < received.size() && received[end] != '\n' && end - start < 14)
+            end++;
+          if (end >= received.size())
+            break;
+          std::string line = received.substr(start, end - start + 1);
+          start = end + 1;
+          t = now();
+          rxFree = (rxFree > t ? rxFree : t) + wireSeconds(line.size());
+          _commands++;
+          _random = _random*1664525u + 1013904223u;
+          if ((_random >> 8)/16777216.0 < _dropRate) {
+            _dropped++;
+            continue;
+          }
+          char buffer[16];
+          snprintf(buffer, sizeof(buffer), "%s", line.c_str());
+          std::string reply = answer(buffer);
+          deviceFree = (deviceFree > rxFree ? deviceFree : rxFree) + _turnaroundUs*(_baud > 0 ? 1e-6 : 0.0);
+          if (reply.empty())
+            continue;
+          txFree = (txFree > deviceFree ? txFree : deviceFree) + wireSeconds(reply.size());
+          outputs.push_back({txFree, reply});
+        }
+        received.erase(0, start);
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,267 @@
+/*
+  En50530Bench.cpp - Static and dynamic MPPT efficiency of the sketch after EN 50530
+  Released into the public domain.
+
+  usage: bench-en50530 [--json FILE] [--jobs N]
+    --json FILE   results as JSON (default: en50530.json, - for stdout)
+    --jobs N      profiles run at once (default: one per core)
+
+  Runs AtverterH_MPPT.cpp on PlantSim (quasi-static buck model, lead-acid
+  battery, 25 °C ambient) through the EN 50530 irradiance profiles:
+    static        constant 5 % to 100 % of 1000 W/m2; 300 s to settle from
+                  power up, then 600 s measured
+    dynamic 10-50 % (100 to 500 W/m2) trapezoids with ramps of 0.5 to
+                  50 W/m2/s, 10 s dwell at each end, repeated as in the
+                  standard (2 times for the slowest ramp, 10 for the fastest)
+    dynamic 30-100 % (300 to 1000 W/m2) the same with ramps of 10 to
+                  100 W/m2/s
+    start-up      2-10 % (20 to 100 W/m2), the low irradiance ramps of the
+                  morning and evening, 0.5 and 1 W/m2/s
+  Every dynamic profile starts with 300 s at its low level that are not
+  measured. The plant follows the profile every 100 ms.
+
+  The MPPT efficiency of a profile is the panel energy over the energy the
+  panel had at its maximum power point over the same time; the conversion
+  efficiency, battery energy over panel energy, is reported beside it. The
+  summary weights the static results with the European (EU) and Californian
+  (CEC) weights. Profiles are independent and the sketch is process-global,
+  so each runs in a forked process.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "ProcessPool.h"
+#include "SketchRunner.h"
+
+const double STC_IRRADIANCE = 1000.0;
+const int STATIC_SETTLE_S = 300;
+const int STATIC_MEASURE_S = 600;
+const int DYNAMIC_SETTLE_S = 300;
+const double DYNAMIC_DWELL_S = 10.0;
+
+// kinds of profile, for convenience and bookkeeping
+enum ProfileKinds
+{   PROFILE_STATIC = 0,
+    PROFILE_DYNAMIC,
+    NUM_PROFILEKINDS
+};
+
+const char * const PROFILE_KIND_NAMES[NUM_PROFILEKINDS] = {"static", "dynamic"};
+
+struct Profile
+{
+  int kind;
+  const char* group; // what the summary averages over
+  double low; // W/m2, the level of a static profile
+  double high;
+  double slope; // W/m2/s
+  int repeats;
+};
+
+// one trapezoid: ramp up, dwell, ramp down, dwell
+static double cycleSeconds(const Profile& profile) {
+  return 2.0*(profile.high - profile.low)/profile.slope + 2.0*DYNAMIC_DWELL_S;
+}
+
+static int measuredSeconds(const Profile& profile) {
+  if (profile.kind == PROFILE_STATIC)
+    return STATIC_MEASURE_S;
+  return (int)(cycleSeconds(profile)*profile.repeats + 0.5);
+}
+
+static int settleSeconds(const Profile& profile) {
+  return profile.kind == PROFILE_STATIC ? STATIC_SETTLE_S : DYNAMIC_SETTLE_S;
+}
+
+// W/m2 at a time since power up
+static double irradiance(const Profile& profile, double seconds) {
+  double t = seconds - settleSeconds(profile);
+  if (profile.kind == PROFILE_STATIC || t <= 0.0)
+    return profile.low;
+  double ramp = (profile.high - profile.low)/profile.slope;
+  double cycle = cycleSeconds(profile);
+  if (t >= cycle*profile.repeats)
+    return profile.low;
+  t -= cycle*(long)(t/cycle);
+  if (t < ramp)
+    return profile.low + profile.slope*t;
+  t -= ramp;
+  if (t < DYNAMIC_DWELL_S)
+    return profile.high;
+  t -= DYNAMIC_DWELL_S;
+  if (t < ramp)
+    return profile.high - profile.slope*t;
+  return profile.low;
+}
+
+static std::vector<Profile> profiles() {
+  std::vector<Profile> list;
+  const double STATIC_PERCENT[] = {5, 10, 20, 25, 30, 50, 75, 100};
+  for (double percent : STATIC_PERCENT)
+    list.push_back({PROFILE_STATIC, "static", percent*STC_IRRADIANCE/100.0, 0.0, 0.0, 1});
+  const double LOW_SLOPES[] = {0.5, 1, 2, 3, 5, 7, 10, 14, 20, 30, 50};
+  const int LOW_REPEATS[] = {2, 2, 3, 4, 6, 8, 10, 10, 10, 10, 10};
+  for (size_t n = 0; n < sizeof(LOW_SLOPES)/sizeof(LOW_SLOPES[0]); n++)
+    list.push_back({PROFILE_DYNAMIC, "dynamic 10-50 %", 100.0, 500.0, LOW_SLOPES[n], LOW_REPEATS[n]});
+  const double HIGH_SLOPES[] = {10, 14, 20, 30, 50, 100};
+  for (double slope : HIGH_SLOPES)
+    list.push_back({PROFILE_DYNAMIC, "dynamic 30-100 %", 300.0, 1000.0, slope, 10});
+  list.push_back({PROFILE_DYNAMIC, "start-up 2-10 %", 20.0, 100.0, 0.5, 2});
+  list.push_back({PROFILE_DYNAMIC, "start-up 2-10 %", 20.0, 100.0, 1.0, 2});
+  return list;
+}
+
+static std::string profileName(const Profile& profile) {
+  char name[64];
+  if (profile.kind == PROFILE_STATIC)
+    snprintf(name, sizeof(name), "static %g W/m2", profile.low);
+  else
+    snprintf(name, sizeof(name), "%g-%g W/m2 at %g W/m2/s", profile.low, profile.high, profile.slope);
+  return name;
+}
+
+// runs in a child process, returns the profile's JSON object
+static std::string runProfile(const Profile& profile) {
+  static PlantSim plant; // static like the sketch's board
+  plant.configure(PlantParams());
+  plant.setIrradiance(irradiance(profile, 0.0));
+  startSketch(plant);
+  std::function<double(double)> level = [&profile](double seconds) { return irradiance(profile, seconds); };
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int t = 0; t < settleSeconds(profile); t++)
+    runSketchSecond(plant, nullptr, level);
+  double pvJ = 0.0, mppJ = 0.0, batteryJ = 0.0;
+  int measured = measuredSeconds(profile);
+  for (int t = 0; t < measured; t++) {
+    SketchSecond second = runSketchSecond(plant, nullptr, level);
+    pvJ += second.pvJ;
+    mppJ += second.mppJ;
+    batteryJ += second.batteryJ;
+  }
+  double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  plant.detach();
+
+  char json[512];
+  snprintf(json, sizeof(json), "{\"profile\":\"%s\",\"kind\":\"%s\",\"group\":\"%s\",\"low_wm2\":%g,\"high_wm2\":%g,"
+    "\"slope_wm2s\":%g,\"repeats\":%d,\"settle_s\":%d,\"measured_s\":%d,\"pv_wh\":%.4f,\"mpp_wh\":%.4f,"
+    "\"battery_wh\":%.4f,\"mppt_efficiency\":%.5f,\"conversion_efficiency\":%.5f,\"wall_s\":%.3f}",
+    profileName(profile).c_str(), PROFILE_KIND_NAMES[profile.kind], profile.group, profile.low,
+    profile.kind == PROFILE_STATIC ? profile.low : profile.high, profile.slope, profile.repeats,
+    settleSeconds(profile), measured, pvJ/3600.0, mppJ/3600.0, batteryJ/3600.0, mppJ > 0.0 ? pvJ/mppJ : 0.0,
+    pvJ > 0.0 ? batteryJ/pvJ : 0.0, wallS);
+  return json;
+}
+
+// a number field of one of runProfile()'s objects
+static double field(const std::string& json, const char* name) {
+  std::string key = std::string("\"") + name + "\":";
+  size_t at = json.find(key);
+  return at == std::string::npos ? 0.0 : atof(json.c_str() + at + key.size());
+}
+
+// static MPPT efficiency weighted over irradiance levels, the way the EU and CEC efficiencies are
+static double weighted(const std::vector<Profile>& list, const std::vector<std::string>& results,
+    const double* levels, const double* weights, int count) {
+  double sum = 0.0;
+  for (int w = 0; w < count; w++) {
+    for (size_t n = 0; n < list.size(); n++) {
+      if (list[n].kind == PROFILE_STATIC && list[n].low == levels[w])
+        sum += weights[w]*field(results[n], "mppt_efficiency");
+    }
+  }
+  return sum;
+}
+
+int main(int argc, char** argv) {
+  const char* jsonPath = "en50530.json";
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int jobs = cores > 0 ? (int)cores : 1;
+  for (int n = 1; n < argc; n++) {
+    if (strcmp(argv[n], "--json") == 0 && n + 1 < argc) {
+      jsonPath = argv[++n];
+    } else if (strcmp(argv[n], "--jobs") == 0 && n + 1 < argc) {
+      jobs = atoi(argv[++n]);
+    } else {
+      fprintf(stderr, "usage: %s [--json FILE] [--jobs N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<Profile> list = profiles();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<std::string> results = runInProcesses((int)list.size(), jobs,
+    [&list](int n) { return runProfile(list[n]); });
+  double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-34s %8s %8s %8s %8s %10s\n", "profile", "sim s", "MPPT %", "conv %", "PV Wh", "real time");
+  double simulatedS = 0.0;
+  int failed = 0;
+  for (size_t n = 0; n < list.size(); n++) {
+    if (results[n].empty()) {
+      printf("%-34s failed\n", profileName(list[n]).c_str());
+      failed++;
+      continue;
+    }
+    double seconds = field(results[n], "settle_s") + field(results[n], "measured_s");
+    simulatedS += seconds;
+    printf("%-34s %8.0f %8.2f %8.2f %8.3f %9.0fx\n", profileName(list[n]).c_str(), field(results[n], "measured_s"),
+      100.0*field(results[n], "mppt_efficiency"), 100.0*field(results[n], "conversion_efficiency"),
+      field(results[n], "pv_wh"), seconds/field(results[n], "wall_s"));
+  }
+
+  const double EU_LEVELS[] = {50, 100, 200, 300, 500, 1000};
+  const double EU_WEIGHTS[] = {0.03, 0.06, 0.13, 0.10, 0.48, 0.20};
+  const double CEC_LEVELS[] = {100, 200, 300, 500, 750, 1000};
+  const double CEC_WEIGHTS[] = {0.04, 0.05, 0.12, 0.21, 0.53, 0.05};
+  double eu = weighted(list, results, EU_LEVELS, EU_WEIGHTS, 6);
+  double cec = weighted(list, results, CEC_LEVELS, CEC_WEIGHTS, 6);
+  printf("\nstatic MPPT efficiency, EU weighted   %6.2f %%\n", 100.0*eu);
+  printf("static MPPT efficiency, CEC weighted  %6.2f %%\n", 100.0*cec);
+  std::vector<std::string> groups;
+  std::string summary;
+  for (size_t n = 0; n < list.size(); n++) {
+    if (list[n].kind != PROFILE_DYNAMIC || std::find(groups.begin(), groups.end(), list[n].group) != groups.end())
+      continue;
+    groups.push_back(list[n].group);
+    double pvJ = 0.0, mppJ = 0.0;
+    for (size_t m = 0; m < list.size(); m++) {
+      if (strcmp(list[m].group, list[n].group) == 0) {
+        pvJ += field(results[m], "pv_wh");
+        mppJ += field(results[m], "mpp_wh");
+      }
+    }
+    double efficiency = mppJ > 0.0 ? pvJ/mppJ : 0.0;
+    printf("%-37s %6.2f %%\n", (std::string(list[n].group) + " MPPT efficiency").c_str(), 100.0*efficiency);
+    char entry[128];
+    snprintf(entry, sizeof(entry), "%s\"%s\":%.5f", summary.empty() ? "" : ",", list[n].group, efficiency);
+    summary += entry;
+  }
+  printf("%zu profiles, %.0f simulated s in %.1f s with %d jobs\n", list.size(), simulatedS, wallS, jobs);
+
+  FILE* json = strcmp(jsonPath, "-") == 0 ? stdout : fopen(jsonPath, "w");
+  if (!json) {
+    perror(jsonPath);
+    return 1;
+  }
+  fprintf(json, "{\"standard\":\"EN 50530\",\"plant\":{\"buck_model\":\"%s\",\"battery\":\"%s\",\"ambient_c\":25},"
+    "\"static_eu\":%.5f,\"static_cec\":%.5f,\"dynamic\":{%s},\"wall_s\":%.3f,\"profiles\":[",
+    BUCK_MODEL_NAMES[BUCK_QUASI_STATIC], BATTERY_CHEMISTRY_NAMES[BATTERY_LEAD_ACID], eu, cec, summary.c_str(), wallS);
+  bool first = true;
+  for (size_t n = 0; n < results.size(); n++) {
+    if (results[n].empty())
+      continue;
+    fprintf(json, "%s\n  %s", first ? "" : ",", results[n].c_str());
+    first = false;
+  }
+  fprintf(json, "\n]}\n");
+  if (json != stdout)
+    fclose(json);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,504 @@
+/*
+  FaultBench.cpp - Randomized fault-injection campaigns against the sketch's protection logic
+  Released into the public domain.
+
+  usage: bench-faults [options]
+    --campaigns N   faults to inject, one per run (default: 1000)
+    --jobs N        runs at once (default: one per core)
+    --seed N        for the faults (default: 1)
+    --worst N       worst cases listed (default: 10)
+    --csv FILE      every run with its outcome
+    --replay ID     runs one campaign in this process and prints its outcome
+    --trace FILE    with --replay, the plant and the firmware every tick from the fault on
+
+  Runs AtverterH_MPPT.cpp on PlantSim (quasi-static buck model) at three
+  operating points, warmed up for 60 s, then injects one fault per run at a
+  random tick of the next 5 s (PlantSim's FaultKinds, the same number of
+  runs for each):
+    ADC spike           a V, I or T input off by up to 1023 codes, 1 to 20 ticks
+    ADC stuck           a V, I or T input at a code, 1 ms to 20 s or for good
+    thermistor open     T1 or T2 reads 0, 1 s to 20 s or for good
+    thermistor short    T1 or T2 reads 1023, the same
+    VCC sag             3.0 to 4.8 V for 1 ms to 10 s
+    brown-out           the MCU in reset for 1 ms to 2 s, then setup() again
+    battery disconnect  1 ms to 20 s or for good
+    output short        5 mOhm to 1 Ohm across side 2 for 1 ms to 5 s
+  and watches the next 30 s after the fault ends (or starts, for good).
+
+  Measured per run, in control ticks (1 ms) from the start of the fault:
+    detection   the first reaction of the firmware: the gate shutdown, or the
+                sketch's CV2 limit (V2 read over the charge stage's setpoint)
+    shutdown    the gate driver latched, with the shutdown code
+    exposure    ticks the converter kept switching while the plant was
+                outside its safe area: V2 above LOW_SIDE_MAX_VOLTAGE (18 V),
+                more than 6.5 A through either side, a FET above 60 °C
+    recovery    after a fault that ends: seconds until the tracking
+                efficiency (panel power over maximum power) is back to 95 %
+                of what it was before the fault for 5 s, or latched if the
+                gates are still shut down at the end
+  A run whose process dies (a trap in the firmware) counts as crashed. The
+  warm-up runs once per operating point in this process and every run forks
+  from it. The report groups the runs by fault kind and lists the worst
+  cases, crashes first, then the longest exposure, then runs that never
+  recovered, then the slowest detection; --replay reruns one of them.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ProcessPool.h"
+#include "SketchRunner.h"
+
+extern long chargeLimit; // from AtverterH_MPPT.cpp, above 0 while the CV2 limit holds the battery voltage off
+
+const int WARMUP_S = 60;
+const long FAULT_WINDOW_TICKS = 5000; // the fault starts within this after the warm-up
+const int OBSERVE_S = 30; // after the fault ends
+const double PERMANENT_SHARE = 0.25; // of the stuck, thermistor and disconnect faults
+const double SAFE_V2 = 18.0; // the sketch's LOW_SIDE_MAX_VOLTAGE
+const double SAFE_A = 6.5;
+const double SAFE_FET_C = 60.0; // the sketch's MAX_TEMP
+const double RECOVERED = 0.95; // of the tracking efficiency before the fault
+const int RECOVERED_HOLD_S = 5;
+
+struct OperatingPoint
+{
+  const char* name;
+  double irradiance; // W/m2
+  double ambientC;
+  int chemistry; // BatteryChemistries
+};
+
+const OperatingPoint OPERATING_POINTS[] = {
+  {"1000 W/m2", 1000.0, 25.0, BATTERY_LEAD_ACID},
+  {"400 W/m2", 400.0, 25.0, BATTERY_LEAD_ACID},
+  {"1000 W/m2 LiFePO4 35C", 1000.0, 35.0, BATTERY_LIFEPO4},
+};
+
+const int NUM_OPERATING_POINTS = sizeof(OPERATING_POINTS)/sizeof(OPERATING_POINTS[0]);
+
+const int ADC_PINS[] = {V1_PIN, V2_PIN, I1_PIN, I2_PIN, T1_PIN, T2_PIN};
+const char * const ADC_PIN_NAMES[] = {"V1", "V2", "I1", "I2", "T1", "T2"};
+
+struct Campaign
+{
+  int id;
+  int point; // OPERATING_POINTS
+  Fault fault;
+};
+
+struct Outcome
+{
+  bool crashed = false;
+  long detectTicks = -1; // -1 for no reaction
+  long shutdownTicks = -1;
+  int shutdownCode = -1;
+  long exposureTicks = 0;
+  double peakV2 = 0.0;
+  double peakA = 0.0;
+  double peakFetC = 0.0;
+  bool latched = false; // at the end
+  int recoveredS = -1; // -1 if not, or if the fault does not end
+};
+
+static const char* pinName(int pin) {
+  for (size_t n = 0; n < sizeof(ADC_PINS)/sizeof(ADC_PINS[0]); n++) {
+    if (ADC_PINS[n] == pin)
+      return ADC_PIN_NAMES[n];
+  }
+  return "-";
+}
+
+static long logUniformTicks(std::mt19937& random, double lowTicks, double highTicks) {
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  return lround(exp(log(lowTicks) + (log(highTicks) - log(lowTicks))*unit(random)));
+}
+
+static Campaign makeCampaign(int id, uint32_t seed) {
+  std::seed_seq sequence = {seed, (uint32_t)id};
+  std::mt19937 random(sequence);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  Campaign campaign;
+  campaign.id = id;
+  campaign.point = id % NUM_OPERATING_POINTS;
+  Fault& fault = campaign.fault;
+  fault.kind = (id/NUM_OPERATING_POINTS) % NUM_FAULTKINDS;
+  fault.startTick = (long)WARMUP_S*SKETCH_TICKS_PER_SECOND + (long)(unit(random)*FAULT_WINDOW_TICKS);
+  bool permanent = unit(random) < PERMANENT_SHARE;
+  int pin = ADC_PINS[random() % (sizeof(ADC_PINS)/sizeof(ADC_PINS[0]))];
+  int thermistor = unit(random) < 0.5 ? T1_PIN : T2_PIN;
+  switch (fault.kind) {
+    case FAULT_ADC_SPIKE:
+      fault.pin = pin;
+      fault.ticks = 1 + random() % 20;
+      fault.value = (unit(random) < 0.5 ? -1.0 : 1.0)*(1.0 + floor(unit(random)*1023.0));
+      break;
+    case FAULT_ADC_STUCK:
+      fault.pin = pin;
+      fault.ticks = permanent ? -1 : logUniformTicks(random, 1.0, 20000.0);
+      fault.value = unit(random) < 0.5 ? (unit(random) < 0.5 ? 0.0 : 1023.0) : floor(unit(random)*1024.0);
+      break;
+    case FAULT_THERMISTOR_OPEN:
+    case FAULT_THERMISTOR_SHORT:
+      fault.pin = thermistor;
+      fault.ticks = permanent ? -1 : logUniformTicks(random, 1000.0, 20000.0);
+      break;
+    case FAULT_VCC_SAG:
+      fault.ticks = logUniformTicks(random, 1.0, 10000.0);
+      fault.value = 3.0 + 1.8*unit(random);
+      break;
+    case FAULT_BROWN_OUT:
+      fault.ticks = logUniformTicks(random, 1.0, 2000.0);
+      break;
+    case FAULT_BATTERY_DISCONNECT:
+      fault.ticks = permanent ? -1 : logUniformTicks(random, 1.0, 20000.0);
+      break;
+    default: // FAULT_OUTPUT_SHORT
+      fault.ticks = logUniformTicks(random, 1.0, 5000.0);
+      fault.value = exp(log(0.005) + (log(1.0) - log(0.005))*unit(random));
+      break;
+  }
+  return campaign;
+}
+
+static std::string describe(const Campaign& campaign) {
+  const Fault& fault = campaign.fault;
+  char text[160];
+  char length[32];
+  if (fault.ticks < 0)
+    snprintf(length, sizeof(length), "for good");
+  else
+    snprintf(length, sizeof(length), "%ld ms", fault.ticks);
+  long offset = fault.startTick - (long)WARMUP_S*SKETCH_TICKS_PER_SECOND;
+  switch (fault.kind) {
+    case FAULT_ADC_SPIKE:
+      snprintf(text, sizeof(text), "%s %s %+.0f, %s", FAULT_KIND_NAMES[fault.kind], pinName(fault.pin), fault.value,
+        length);
+      break;
+    case FAULT_ADC_STUCK:
+      snprintf(text, sizeof(text), "%s %s at %.0f, %s", FAULT_KIND_NAMES[fault.kind], pinName(fault.pin), fault.value,
+        length);
+      break;
+    case FAULT_THERMISTOR_OPEN:
+    case FAULT_THERMISTOR_SHORT:
+      snprintf(text, sizeof(text), "%s %s, %s", FAULT_KIND_NAMES[fault.kind], pinName(fault.pin), length);
+      break;
+    case FAULT_VCC_SAG:
+      snprintf(text, sizeof(text), "%s to %.2f V, %s", FAULT_KIND_NAMES[fault.kind], fault.value, length);
+      break;
+    case FAULT_OUTPUT_SHORT:
+      snprintf(text, sizeof(text), "%s %.3f Ohm, %s", FAULT_KIND_NAMES[fault.kind], fault.value, length);
+      break;
+    default:
+      snprintf(text, sizeof(text), "%s, %s", FAULT_KIND_NAMES[fault.kind], length);
+      break;
+  }
+  return std::string(text) + " at +" + std::to_string(offset) + " ms";
+}
+
+// the operating point's plant, the sketch started on it and run to the end of the warm-up;
+// tracking is the panel over its maximum power over the last seconds of it
+static PlantSim& warmUp(int point, double& tracking) {
+  const OperatingPoint& operating = OPERATING_POINTS[point];
+  PlantParams params;
+  params.battery.chemistry = operating.chemistry;
+  static PlantSim plant; // static like the sketch's board
+  plant.configure(params);
+  plant.setAmbient(operating.ambientC);
+  plant.setIrradiance(operating.irradiance);
+  startSketch(plant);
+  double pvJ = 0.0, mppJ = 0.0;
+  for (int t = 0; t < WARMUP_S; t++) {
+    SketchSecond second = runSketchSecond(plant);
+    if (t >= WARMUP_S - RECOVERED_HOLD_S) {
+      pvJ += second.pvJ;
+      mppJ += second.mppJ;
+    }
+  }
+  tracking = mppJ > 0.0 ? pvJ/mppJ : 0.0;
+  return plant;
+}
+
+// injects the fault into the warmed-up plant and watches the sketch tick by tick
+static Outcome run(PlantSim& plant, double tracking, const Fault& fault, FILE* trace) {
+  plant.injectFault(fault);
+  Outcome outcome;
+  long endTick = fault.ticks < 0 ? fault.startTick : fault.startTick + fault.ticks;
+  long lastTick = endTick + (long)OBSERVE_S*SKETCH_TICKS_PER_SECOND;
+  double pvJ = 0.0, mppJ = 0.0; // over the current second after the fault
+  int held = 0;
+  while (plant.getState().ticks < lastTick) {
+    plant.step();
+    const PlantState& state = plant.getState();
+    if (state.powered)
+      loop();
+    long tick = state.ticks - 1; // the one just run
+    if (tick < fault.startTick)
+      continue;
+    long since = tick - fault.startTick;
+    bool shutdown = state.powered && atverterH.isGateShutdown();
+    if (shutdown && outcome.shutdownTicks < 0) {
+      outcome.shutdownTicks = since;
+      outcome.shutdownCode = atverterH.getShutdownCode();
+    }
+    unsigned int v2 = atverterH.getV2();
+    bool limited = state.powered && !shutdown && chargeLimit > 0;
+    if ((shutdown || limited) && outcome.detectTicks < 0)
+      outcome.detectTicks = since;
+    double amps = std::max(fabs(state.inductorA), fabs(state.panelA));
+    double fetC = std::max(state.fet1C, state.fet2C);
+    outcome.peakV2 = std::max(outcome.peakV2, state.batteryV);
+    outcome.peakA = std::max(outcome.peakA, amps);
+    outcome.peakFetC = std::max(outcome.peakFetC, fetC);
+    if (state.duty > 0.0 && (state.batteryV > SAFE_V2 || amps > SAFE_A || fetC > SAFE_FET_C))
+      outcome.exposureTicks++;
+    if (trace) {
+      fprintf(trace, "%ld,%d,%d,%.3f,%.3f,%.3f,%.3f,%.2f,%d,%d,%u,%d\n", since, state.powered ? 1 : 0,
+        state.latched ? 1 : 0, state.duty, state.panelV, state.batteryV, state.inductorA, fetC,
+        atverterH.getShutdownCode(), atverterH.getDutyCycle(), v2, atverterH.getT1());
+    }
+    if (tick >= endTick && fault.ticks >= 0) { // after the fault: is the panel back near its maximum power?
+      pvJ += state.panelV*state.panelA;
+      mppJ += state.mppW;
+      if ((tick - endTick + 1) % SKETCH_TICKS_PER_SECOND == 0) {
+        held = mppJ > 0.0 && pvJ/mppJ >= RECOVERED*tracking ? held + 1 : 0;
+        if (held >= RECOVERED_HOLD_S && outcome.recoveredS < 0)
+          outcome.recoveredS = (int)((tick - endTick + 1)/SKETCH_TICKS_PER_SECOND) - RECOVERED_HOLD_S;
+        pvJ = mppJ = 0.0;
+      }
+    }
+    if (tick % SKETCH_TICKS_PER_SECOND == 0)
+      halNativeUARTTake(); // the shutdown message repeats every tick
+  }
+  outcome.latched = plant.getState().latched;
+  return outcome;
+}
+
+static std::string serialize(const Outcome& outcome) {
+  char text[200];
+  snprintf(text, sizeof(text), "%ld %ld %d %ld %.4f %.4f %.3f %d %d", outcome.detectTicks, outcome.shutdownTicks,
+    outcome.shutdownCode, outcome.exposureTicks, outcome.peakV2, outcome.peakA, outcome.peakFetC,
+    outcome.latched ? 1 : 0, outcome.recoveredS);
+  return text;
+}
+
+static Outcome parse(const std::string& text) {
+  Outcome outcome;
+  int latched = 0;
+  if (sscanf(text.c_str(), "%ld %ld %d %ld %lf %lf %lf %d %d", &outcome.detectTicks, &outcome.shutdownTicks,
+      &outcome.shutdownCode, &outcome.exposureTicks, &outcome.peakV2, &outcome.peakA, &outcome.peakFetC, &latched,
+      &outcome.recoveredS) != 9)
+    outcome.crashed = true;
+  outcome.latched = latched != 0;
+  return outcome;
+}
+
+static std::string verdict(const Campaign& campaign, const Outcome& outcome) {
+  if (outcome.crashed)
+    return "crashed";
+  char text[200];
+  std::string detect = outcome.detectTicks < 0 ? "no reaction" : "detected " + std::to_string(outcome.detectTicks) + " ms";
+  std::string shutdown = outcome.shutdownTicks < 0 ? "" : ", shutdown " + std::to_string(outcome.shutdownTicks)
+    + " ms (code " + std::to_string(outcome.shutdownCode) + ")";
+  std::string recovery;
+  if (outcome.latched)
+    recovery = ", latched";
+  else if (campaign.fault.ticks >= 0)
+    recovery = outcome.recoveredS < 0 ? ", not recovered" : ", recovered " + std::to_string(outcome.recoveredS) + " s";
+  snprintf(text, sizeof(text), "%s%s, exposure %ld ms%s", detect.c_str(), shutdown.c_str(), outcome.exposureTicks,
+    recovery.c_str());
+  return text;
+}
+
+// crashes, then exposure, then not recovering from a fault that ended, then slow detection
+static bool worse(const std::pair<const Campaign*, const Outcome*>& a, const std::pair<const Campaign*, const Outcome*>& b) {
+  const Outcome& x = *a.second;
+  const Outcome& y = *b.second;
+  if (x.crashed != y.crashed)
+    return x.crashed;
+  if (x.exposureTicks != y.exposureTicks)
+    return x.exposureTicks > y.exposureTicks;
+  bool xLost = a.first->fault.ticks >= 0 && x.recoveredS < 0;
+  bool yLost = b.first->fault.ticks >= 0 && y.recoveredS < 0;
+  if (xLost != yLost)
+    return xLost;
+  long xDetect = x.detectTicks < 0 ? 1L << 40 : x.detectTicks;
+  long yDetect = y.detectTicks < 0 ? 1L << 40 : y.detectTicks;
+  return xDetect > yDetect;
+}
+
+static long percentile(std::vector<long> values, double fraction) {
+  if (values.empty())
+    return -1;
+  std::sort(values.begin(), values.end());
+  return values[(size_t)(fraction*(values.size() - 1) + 0.5)];
+}
+
+static std::string ticksOrDash(long ticks) {
+  return ticks < 0 ? "-" : std::to_string(ticks);
+}
+
+int main(int argc, char** argv) {
+  int count = 1000;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int jobs = cores > 0 ? (int)cores : 1;
+  uint32_t seed = 1;
+  int worstCount = 10;
+  const char* csvPath = nullptr;
+  int replay = -1;
+  const char* tracePath = nullptr;
+  for (int n = 1; n < argc; n++) {
+    const char* option = argv[n];
+    const char* value = n + 1 < argc ? argv[++n] : nullptr;
+    if (value && strcmp(option, "--campaigns") == 0)
+      count = atoi(value);
+    else if (value && strcmp(option, "--jobs") == 0)
+      jobs = atoi(value);
+    else if (value && strcmp(option, "--seed") == 0)
+      seed = (uint32_t)atol(value);
+    else if (value && strcmp(option, "--worst") == 0)
+      worstCount = atoi(value);
+    else if (value && strcmp(option, "--csv") == 0)
+      csvPath = value;
+    else if (value && strcmp(option, "--replay") == 0)
+      replay = atoi(value);
+    else if (value && strcmp(option, "--trace") == 0)
+      tracePath = value;
+    else {
+      fprintf(stderr, "usage: %s [--campaigns N] [--jobs N] [--seed N] [--worst N] [--csv FILE]"
+        " [--replay ID [--trace FILE]]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (replay >= 0) {
+    Campaign campaign = makeCampaign(replay, seed);
+    FILE* trace = nullptr;
+    if (tracePath) {
+      trace = fopen(tracePath, "w");
+      if (!trace) {
+        perror(tracePath);
+        return 1;
+      }
+      fprintf(trace, "tick,powered,latched,duty,panel_v,battery_v,inductor_a,fet_c,shutdown_code,duty_set,v2_mv,t1_c\n");
+    }
+    printf("campaign %d, %s: %s\n", campaign.id, OPERATING_POINTS[campaign.point].name, describe(campaign).c_str());
+    fflush(stdout);
+    double tracking;
+    PlantSim& plant = warmUp(campaign.point, tracking);
+    Outcome outcome = run(plant, tracking, campaign.fault, trace);
+    printf("%s\n", verdict(campaign, outcome).c_str());
+    if (trace)
+      fclose(trace);
+    return 0;
+  }
+
+  std::vector<Campaign> campaigns;
+  for (int id = 0; id < count; id++)
+    campaigns.push_back(makeCampaign(id, seed));
+  std::vector<Outcome> outcomes(count);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  double simulatedS = 0.0;
+  for (int point = 0; point < NUM_OPERATING_POINTS; point++) {
+    std::vector<int> ids;
+    for (const Campaign& campaign : campaigns) {
+      if (campaign.point == point) {
+        ids.push_back(campaign.id);
+        long ticks = campaign.fault.startTick + std::max(campaign.fault.ticks, 0L) + (long)OBSERVE_S*SKETCH_TICKS_PER_SECOND;
+        simulatedS += ticks/(double)SKETCH_TICKS_PER_SECOND - WARMUP_S;
+      }
+    }
+    if (ids.empty())
+      continue;
+    double tracking;
+    PlantSim& plant = warmUp(point, tracking); // every run forks from here
+    std::vector<std::string> results = runInProcesses((int)ids.size(), jobs, [&](int n) {
+      return serialize(run(plant, tracking, campaigns[ids[n]].fault, nullptr));
+    });
+    for (size_t n = 0; n < ids.size(); n++)
+      outcomes[ids[n]] = parse(results[n]);
+  }
+  double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%d fault-injection runs at %d operating points: %.1f simulated h after the warm-ups in %.1f s with %d jobs\n\n",
+    count, NUM_OPERATING_POINTS, simulatedS/3600.0, wallS, jobs);
+  printf("%-18s %5s %5s %8s %6s %6s  %9s %9s %8s %8s %8s %8s\n", "fault", "runs", "crash", "shutdown", "limit",
+    "none", "detect50", "detectmax", "sdmax", "expmax", "latched", "lost");
+  for (int kind = 0; kind < NUM_FAULTKINDS; kind++) {
+    int runs = 0, crashed = 0, shutdowns = 0, limits = 0, none = 0, latched = 0, lost = 0;
+    std::vector<long> detects, shutdownTicks;
+    long exposureMax = 0;
+    for (int id = 0; id < count; id++) {
+      const Outcome& outcome = outcomes[id];
+      if (campaigns[id].fault.kind != kind)
+        continue;
+      runs++;
+      if (outcome.crashed) {
+        crashed++;
+        continue;
+      }
+      if (outcome.shutdownTicks >= 0)
+        shutdowns++;
+      else if (outcome.detectTicks >= 0)
+        limits++;
+      else
+        none++;
+      if (outcome.detectTicks >= 0)
+        detects.push_back(outcome.detectTicks);
+      if (outcome.shutdownTicks >= 0)
+        shutdownTicks.push_back(outcome.shutdownTicks);
+      exposureMax = std::max(exposureMax, outcome.exposureTicks);
+      latched += outcome.latched ? 1 : 0;
+      lost += !outcome.latched && campaigns[id].fault.ticks >= 0 && outcome.recoveredS < 0 ? 1 : 0;
+    }
+    if (!runs)
+      continue;
+    printf("%-18s %5d %5d %8d %6d %6d  %9s %9s %8s %8ld %8d %8d\n", FAULT_KIND_NAMES[kind], runs, crashed, shutdowns,
+      limits, none, ticksOrDash(percentile(detects, 0.5)).c_str(), ticksOrDash(percentile(detects, 1.0)).c_str(),
+      ticksOrDash(percentile(shutdownTicks, 1.0)).c_str(), exposureMax, latched, lost);
+  }
+  printf("\n(ms from the fault; shutdown, limit and none are the first reaction; expmax is the longest the converter\n"
+    " switched outside its safe area; latched at the end; lost: running, but not back to %.0f %% of the tracking\n"
+    " before the fault %d s after it ended)\n\n", RECOVERED*100.0, OBSERVE_S);
+
+  std::vector<std::pair<const Campaign*, const Outcome*>> ranked;
+  for (int id = 0; id < count; id++)
+    ranked.push_back(std::make_pair(&campaigns[id], &outcomes[id]));
+  std::sort(ranked.begin(), ranked.end(), worse);
+  printf("worst cases (bench-faults --replay ID%s)\n", seed != 1 ? (" --seed " + std::to_string(seed)).c_str() : "");
+  for (int n = 0; n < worstCount && n < (int)ranked.size(); n++) {
+    const Campaign& campaign = *ranked[n].first;
+    printf("%5d  %-22s %-44s %s\n", campaign.id, OPERATING_POINTS[campaign.point].name, describe(campaign).c_str(),
+      verdict(campaign, *ranked[n].second).c_str());
+  }
+
+  if (csvPath) {
+    FILE* csv = fopen(csvPath, "w");
+    if (!csv) {
+      perror(csvPath);
+      return 1;
+    }
+    fprintf(csv, "id,point,kind,pin,start_ms,length_ms,value,crashed,detect_ms,shutdown_ms,shutdown_code,exposure_ms,"
+      "peak_v2,peak_a,peak_fet_c,latched,recovered_s\n");
+    for (int id = 0; id < count; id++) {
+      const Campaign& campaign = campaigns[id];
+      const Outcome& outcome = outcomes[id];
+      fprintf(csv, "%d,%s,%s,%s,%ld,%ld,%.4f,%d,%ld,%ld,%d,%ld,%.3f,%.3f,%.2f,%d,%d\n", id,
+        OPERATING_POINTS[campaign.point].name, FAULT_KIND_NAMES[campaign.fault.kind], pinName(campaign.fault.pin),
+        campaign.fault.startTick - (long)WARMUP_S*SKETCH_TICKS_PER_SECOND, campaign.fault.ticks, campaign.fault.value,
+        outcome.crashed ? 1 : 0, outcome.detectTicks, outcome.shutdownTicks, outcome.shutdownCode,
+        outcome.exposureTicks, outcome.peakV2, outcome.peakA, outcome.peakFetC, outcome.latched ? 1 : 0,
+        outcome.recoveredS);
+    }
+    fclose(csv);
+  }
+  return 0;
+}
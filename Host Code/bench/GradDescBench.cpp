@@ -0,0 +1,271 @@
+/*
+  GradDescBench.cpp - Setpoint steps of AtverterH's gradient descent controller on the plant simulator
+  Released into the public domain.
+
+  usage: bench-graddesc [--trace FILE]
+  Closes AtverterH::gradDescStep() around PlantSim's averaged buck model,
+  every control tick, on three setpoints:
+    cv1  the panel voltage, 30 V and 4 V up
+    cv2  the battery voltage, 0.4 V up on 0.25 Ohm of battery and leads
+    cc2  the battery's charge current, 1 A down
+  The cv2 and cc2 runs start with the panel well above its maximum power
+  point, where the duty cycle can move the power both ways. Each controller
+  holds the setpoint where the plant is for 0.5 s, and then the setpoint
+  steps and steps back, 1 s each. The controllers:
+    legacy        gradDescStep() as it was: up by 1 % when the average error
+                  is positive, down by 1 % when the last error is negative
+    fixed         1 % steps the way the average error points
+    proportional  steps of the average error times a gain, 1 raw to 10 %
+    momentum      half the gain, and half of the last step added
+  All of them hold for the sensor's averaging window and then average over
+  as many ticks (SENSOR_V_WINDOW_MAX ticks for the voltages, and
+  SENSOR_I_WINDOW_MAX for the current).
+
+  The steps go out from and back to the value the loop held over its last
+  100 ms before them. Printed per step: how long the regulated value took to get within the
+  band and stay there for 100 ms, its overshoot, the mean absolute error
+  and the duty cycle moves per second over the last 200 ms. --trace writes
+  every tick as CSV.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AtverterH.h>
+#include "PlantSim.h"
+
+const int HOLD_TICKS = 500;
+const int STEP_TICKS = 1000; // each way
+const int SETTLED_HOLD_TICKS = 100;
+const int TAIL_TICKS = 200; // where the steady error and the duty cycle moves are taken
+const int AVERAGE_TICKS = 100; // of the regulated value the loop holds before the first step
+const double BATTERY_OHM = 0.25;
+const int PROPORTIONAL_MIN_STEP = 1; // dutyRaw
+const int PROPORTIONAL_MAX_STEP = DUTY_RAW_SCALE/10;
+const int MOMENTUM = 128; // Q8, half the last step
+
+enum Setpoints
+{   SETPOINT_CV1 = 0,
+    SETPOINT_CV2,
+    SETPOINT_CC2,
+    NUM_SETPOINTS
+};
+
+const char * const SETPOINT_NAMES[NUM_SETPOINTS] = {"cv1", "cv2", "cc2"};
+const char * const SETPOINT_UNITS[NUM_SETPOINTS] = {"V", "V", "A"};
+const int START_DUTY[NUM_SETPOINTS] = {42, 34, 35}; // panel at some 32, 37 and 37 V, the cells at 56 °C
+const double STEP[NUM_SETPOINTS] = {4.0, 0.4, -1.0};
+const double BAND[NUM_SETPOINTS] = {0.75, 0.2, 0.35}; // a little more than one % of duty cycle moves each
+// Q8 dutyRaw per raw error, some 0.7 of the gain that would take out the average error in one step
+const int GAIN[NUM_SETPOINTS] = {160, 900, 55};
+
+enum Controllers
+{   CONTROLLER_LEGACY = 0,
+    CONTROLLER_FIXED,
+    CONTROLLER_PROPORTIONAL,
+    CONTROLLER_MOMENTUM,
+    NUM_CONTROLLERS
+};
+
+const char * const CONTROLLER_NAMES[NUM_CONTROLLERS] = {"legacy", "fixed", "proportional", "momentum"};
+
+struct StepResult
+{
+  double startValue;
+  double target;
+  long settledTicks; // -1 if never
+  double overshoot; // past the target, in the setpoint's unit
+  double meanError; // absolute, over TAIL_TICKS
+  double movesPerS; // duty cycle changes over TAIL_TICKS
+};
+
+static AtverterH board; // static like a sketch's
+static int loopSetpoint = SETPOINT_CV1;
+static int loopController = CONTROLLER_LEGACY;
+static bool loopClosed = false;
+static int referenceRaw = 0;
+
+// gradDescStep() before the averaged decision and the dutyRaw steps, kept to compare against
+static int legacyCount = 0;
+static int legacyErrorAcc = 0;
+static int legacySettleMax = SENSOR_V_WINDOW_MAX;
+static int legacyAverageMax = SENSOR_V_WINDOW_MAX;
+
+static void legacyGradDescStep(int error) {
+  legacyCount++;
+  if (legacyCount < legacySettleMax)
+    return;
+  legacyErrorAcc = legacyErrorAcc + error;
+  if (legacyCount > legacySettleMax + legacyAverageMax) {
+    long duty = board.getDutyCycle();
+    legacyCount = 0;
+    int avgError = legacyErrorAcc/legacyAverageMax;
+    legacyErrorAcc = 0;
+    if (avgError > 0) {
+      board.setDutyCycle((int)(duty + 1));
+    } else if (error < 0) {
+      board.setDutyCycle((int)(duty - 1));
+    }
+  }
+}
+
+// the regulated reading, raw, signed so that more duty cycle raises it
+static int reading() {
+  if (loopSetpoint == SETPOINT_CV1)
+    return -board.getRawV1();
+  if (loopSetpoint == SETPOINT_CV2)
+    return board.getRawV2();
+  return -board.getRawI2(); // terminal 2 reads out of the converter
+}
+
+static void controlTick() {
+  board.updateVISensors();
+  if (!loopClosed)
+    return;
+  int error = referenceRaw - reading();
+  if (loopController == CONTROLLER_LEGACY)
+    legacyGradDescStep(error);
+  else
+    board.gradDescStep(error);
+}
+
+static double regulated(PlantSim& plant) {
+  const PlantState& state = plant.getState();
+  if (loopSetpoint == SETPOINT_CV1)
+    return state.panelV;
+  if (loopSetpoint == SETPOINT_CV2)
+    return state.batteryV;
+  return state.inductorA;
+}
+
+// raw reading change for a step in the setpoint's unit, signed like reading()
+static int stepRaw(double step) {
+  if (loopSetpoint == SETPOINT_CV1)
+    return -board.mV2raw((unsigned int)lround(fabs(step)*1000.0))*(step < 0.0 ? -1 : 1);
+  if (loopSetpoint == SETPOINT_CV2)
+    return board.mV2raw((unsigned int)lround(fabs(step)*1000.0))*(step < 0.0 ? -1 : 1);
+  return board.mA2raw((int)lround(step*1000.0));
+}
+
+static StepResult runStep(PlantSim& plant, double from, double step, FILE* trace, long& tick) {
+  StepResult result;
+  result.startValue = from;
+  result.target = from + step;
+  referenceRaw += stepRaw(step);
+  result.settledTicks = -1;
+  result.overshoot = 0.0;
+  result.meanError = 0.0;
+  long inBand = 0;
+  int moves = 0;
+  int lastDuty = board.getDutyCycle();
+  for (long n = 0; n < STEP_TICKS; n++, tick++) {
+    plant.step();
+    double value = regulated(plant);
+    double error = value - result.target;
+    result.overshoot = fmax(result.overshoot, step > 0.0 ? error : -error);
+    inBand = fabs(error) <= BAND[loopSetpoint] ? inBand + 1 : 0;
+    if (result.settledTicks < 0 && inBand >= SETTLED_HOLD_TICKS)
+      result.settledTicks = n - SETTLED_HOLD_TICKS + 1;
+    if (n >= STEP_TICKS - TAIL_TICKS) {
+      result.meanError += fabs(error)/TAIL_TICKS;
+      moves += board.getDutyCycle() != lastDuty;
+    }
+    lastDuty = board.getDutyCycle();
+    if (trace) {
+      fprintf(trace, "%s,%s,%ld,%.4f,%.4f,%d,%d\n", SETPOINT_NAMES[loopSetpoint], CONTROLLER_NAMES[loopController],
+        tick, value, result.target, board.getDutyCycleRaw(), board.getDutyCycle());
+    }
+  }
+  result.movesPerS = moves*1000.0/TAIL_TICKS;
+  return result;
+}
+
+static void run(int setpoint, int controller, FILE* trace, StepResult results[2]) {
+  PlantParams params;
+  params.buckModel = BUCK_AVERAGED;
+  params.battery.internalOhm = BATTERY_OHM;
+  static PlantSim plant; // static like the board
+  plant.configure(params);
+  plant.setIrradiance(1000.0);
+  plant.attach();
+  loopSetpoint = setpoint;
+  loopController = controller;
+  loopClosed = false;
+  board.setupPinMode();
+  board.initializeSensors();
+  board.startPWM(START_DUTY[setpoint]);
+  board.initializeInterruptTimer(1000, controlTick);
+  board.applyHoldHigh2();
+
+  int window = setpoint == SETPOINT_CC2 ? SENSOR_I_WINDOW_MAX : SENSOR_V_WINDOW_MAX;
+  legacyCount = legacyErrorAcc = 0;
+  legacySettleMax = legacyAverageMax = window;
+  board.setGradDescCountMax(window, window);
+  if (controller == CONTROLLER_FIXED)
+    board.setGradDescGain(0, GRAD_DESC_STEP_DEFAULT, GRAD_DESC_STEP_DEFAULT);
+  else if (controller == CONTROLLER_PROPORTIONAL)
+    board.setGradDescGain(GAIN[setpoint], PROPORTIONAL_MIN_STEP, PROPORTIONAL_MAX_STEP);
+  else if (controller == CONTROLLER_MOMENTUM) // the same gain in steady steps, gain/(1 - momentum)
+    board.setGradDescGain(GAIN[setpoint]*((1 << GRAD_DESC_Q) - MOMENTUM) >> GRAD_DESC_Q, PROPORTIONAL_MIN_STEP,
+      PROPORTIONAL_MAX_STEP);
+  board.setGradDescMomentum(controller == CONTROLLER_MOMENTUM ? MOMENTUM : 0);
+
+  long tick = 0;
+  for (int n = 0; n < HOLD_TICKS; n++, tick++)
+    plant.step();
+  referenceRaw = reading();
+  loopClosed = true;
+  double held = 0.0;
+  for (int n = 0; n < HOLD_TICKS; n++, tick++) {
+    plant.step();
+    if (n >= HOLD_TICKS - AVERAGE_TICKS)
+      held += regulated(plant)/AVERAGE_TICKS;
+  }
+  results[0] = runStep(plant, held, STEP[setpoint], trace, tick);
+  results[1] = runStep(plant, results[0].target, -STEP[setpoint], trace, tick);
+  plant.detach();
+}
+
+int main(int argc, char** argv) {
+  FILE* trace = nullptr;
+  for (int n = 1; n < argc; n++) {
+    const char* option = argv[n];
+    const char* value = n + 1 < argc ? argv[++n] : nullptr;
+    if (value && strcmp(option, "--trace") == 0) {
+      trace = fopen(value, "w");
+      if (!trace) {
+        perror(value);
+        return 1;
+      }
+      fprintf(trace, "setpoint,controller,tick,value,target,duty_raw,duty\n");
+    } else {
+      fprintf(stderr, "usage: %s [--trace FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+  printf("averaged buck model, 1 kHz control ticks, %.2f Ohm battery; settled: within the band for %d ms\n\n",
+    BATTERY_OHM, SETTLED_HOLD_TICKS);
+  printf("%-8s %-13s %-5s %8s %8s %6s %10s %10s %10s %8s\n", "setpoint", "controller", "step", "from", "to",
+    "band", "settled ms", "overshoot", "mean error", "moves/s");
+  for (int setpoint = 0; setpoint < NUM_SETPOINTS; setpoint++) {
+    for (int controller = 0; controller < NUM_CONTROLLERS; controller++) {
+      StepResult results[2];
+      run(setpoint, controller, trace, results);
+      for (int k = 0; k < 2; k++) {
+        const StepResult& result = results[k];
+        char settled[16];
+        snprintf(settled, sizeof(settled), result.settledTicks < 0 ? "-" : "%ld", result.settledTicks);
+        printf("%-8s %-13s %-5s %7.2f%s %7.2f%s %5.2f%s %10s %9.2f%s %9.3f%s %8.0f\n", SETPOINT_NAMES[setpoint],
+          CONTROLLER_NAMES[controller], k == 0 ? "out" : "back", result.startValue, SETPOINT_UNITS[setpoint],
+          result.target, SETPOINT_UNITS[setpoint], BAND[setpoint], SETPOINT_UNITS[setpoint], settled,
+          result.overshoot, SETPOINT_UNITS[setpoint], result.meanError, SETPOINT_UNITS[setpoint], result.movesPerS);
+      }
+      fflush(stdout);
+    }
+  }
+  if (trace)
+    fclose(trace);
+  return 0;
+}
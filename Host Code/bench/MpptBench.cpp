@@ -0,0 +1,223 @@
+/*
+  MpptBench.cpp - The MPPT sketch closed around a simulated panel, buck stage and battery
+  Released into the public domain.
+
+  usage: bench-mppt [--trace FILE] [--uart FILE] [--seeds N]
+  Runs AtverterH_MPPT.cpp (built from the Atverter Code tree against
+  PicroHAL's native fakes) on PlantSim, one control interrupt and one loop()
+  after another, through these scenarios:
+    clear          1000 W/m2 from power up
+    cloud steps    1000 and 300 W/m2 in turn, two minutes each
+    morning ramp   100 to 1000 W/m2 over 15 minutes
+    clear, LiFePO4 as clear, into a LiFePO4 battery
+  every one with the quasi-static buck model, the cloud steps again with the
+  averaged model and the first seconds of clear with the switching model, to
+  show the faster models agree with the detailed ones.
+
+  Prints per run how much faster than real time it ran, the energy the
+  panel gave and the battery took, the tracking efficiency (panel energy
+  over what the panel could have given at its maximum power point), how long
+  the panel took after power up and after each irradiance step to stay within
+  2 % of its maximum power for 10 s, and the duty cycle range over the last
+  minute. --trace writes the duty cycle trajectory and the plant state,
+  once a second, as CSV. --uart writes what the sketch printed in the first
+  cloud steps run, a capture for atv-golden. --seeds runs every scenario
+  again with sensor noise seeds 2 to N and ends with each one's tracking
+  efficiency over the seeds, as one seed's IC steps can land on a better or
+  worse voltage by chance.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "SketchRunner.h"
+
+const double CONVERGED = 0.98; // of the maximum power
+const int CONVERGED_HOLD_S = 10;
+const int DUTY_WINDOW_S = 60;
+
+enum Scenarios
+{   SCENARIO_CLEAR = 0,
+    SCENARIO_CLOUD_STEPS,
+    SCENARIO_RAMP,
+    SCENARIO_CLEAR_LIFEPO4,
+    NUM_SCENARIOS
+};
+
+const char * const SCENARIO_NAMES[NUM_SCENARIOS] = {"clear", "cloud steps", "morning ramp", "clear, LiFePO4"};
+
+struct Run
+{
+  int scenario;
+  int buckModel;
+  int seconds;
+};
+
+const Run RUNS[] = {
+  {SCENARIO_CLEAR, BUCK_QUASI_STATIC, 600},
+  {SCENARIO_CLOUD_STEPS, BUCK_QUASI_STATIC, 960},
+  {SCENARIO_RAMP, BUCK_QUASI_STATIC, 1200},
+  {SCENARIO_CLEAR_LIFEPO4, BUCK_QUASI_STATIC, 600},
+  {SCENARIO_CLOUD_STEPS, BUCK_AVERAGED, 360},
+  {SCENARIO_CLEAR, BUCK_SWITCHING, 30},
+};
+
+// W/m2 at a time since power up
+static double irradiance(int scenario, double seconds) {
+  switch (scenario) {
+    case SCENARIO_CLOUD_STEPS:
+      return ((long)(seconds/120.0) % 2) == 0 ? 1000.0 : 300.0;
+    case SCENARIO_RAMP:
+      return seconds < 900.0 ? 100.0 + 900.0*seconds/900.0 : 1000.0;
+    default:
+      return 1000.0;
+  }
+}
+
+// when the irradiance changes in steps, for the convergence times
+static std::vector<int> steps(int scenario, int seconds) {
+  std::vector<int> times = {0};
+  if (scenario == SCENARIO_CLOUD_STEPS) {
+    for (int t = 120; t < seconds; t += 120)
+      times.push_back(t);
+  }
+  return times;
+}
+
+// first second after start from which the panel stays near its maximum power for CONVERGED_HOLD_S, -1 if never
+static int convergence(const std::vector<double>& ratio, int start, int end) {
+  int held = 0;
+  for (int t = start; t < end && t < (int)ratio.size(); t++) {
+    held = ratio[t] >= CONVERGED ? held + 1 : 0;
+    if (held >= CONVERGED_HOLD_S)
+      return t - CONVERGED_HOLD_S + 1 - start;
+  }
+  return -1;
+}
+
+// returns the tracking efficiency, %
+static double run(const Run& spec, uint32_t seed, FILE* trace, FILE* uart) {
+  PlantParams params;
+  params.buckModel = spec.buckModel;
+  params.seed = seed;
+  if (spec.scenario == SCENARIO_CLEAR_LIFEPO4)
+    params.battery.chemistry = BATTERY_LIFEPO4;
+  static PlantSim plant; // static like the sketch's board
+  plant.configure(params);
+  plant.setIrradiance(irradiance(spec.scenario, 0.0));
+  startSketch(plant);
+
+  std::vector<double> ratio; // panel over maximum power, each second
+  std::vector<int> duty;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int t = 0; t < spec.seconds; t++) {
+    plant.setIrradiance(irradiance(spec.scenario, t));
+    std::string output;
+    SketchSecond second = runSketchSecond(plant, uart ? &output : nullptr); // the records go nowhere but --uart
+    if (uart)
+      fwrite(output.data(), 1, output.size(), uart);
+    const PlantState& state = plant.getState();
+    ratio.push_back(second.mppJ > 0.0 ? second.pvJ/second.mppJ : 1.0);
+    duty.push_back(second.duty);
+    if (trace) {
+      fprintf(trace, "%s,%s,%d,%.0f,%.3f,%.3f,%.2f,%.2f,%d,%.3f,%.3f,%.1f,%d\n", SCENARIO_NAMES[spec.scenario],
+        BUCK_MODEL_NAMES[spec.buckModel], t + 1, state.irradiance, state.panelV, state.panelA,
+        state.panelV*state.panelA, state.mppW, second.duty, state.batteryV, state.batteryA,
+        state.fet1C, state.latched ? 1 : 0);
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  plant.detach();
+
+  std::vector<int> stepTimes = steps(spec.scenario, spec.seconds);
+  std::string converged;
+  for (size_t n = 0; n < stepTimes.size(); n++) {
+    int end = n + 1 < stepTimes.size() ? stepTimes[n + 1] : spec.seconds;
+    int time = convergence(ratio, stepTimes[n], end);
+    converged += n ? "/" : "";
+    converged += time < 0 ? "-" : std::to_string(time);
+  }
+  int dutyMin = 100, dutyMax = 0;
+  for (int t = spec.seconds > DUTY_WINDOW_S ? spec.seconds - DUTY_WINDOW_S : 0; t < spec.seconds; t++) {
+    dutyMin = duty[t] < dutyMin ? duty[t] : dutyMin;
+    dutyMax = duty[t] > dutyMax ? duty[t] : dutyMax;
+  }
+  double tracking = 100.0*plant.getPvEnergyJ()/plant.getMppEnergyJ();
+  printf("%-15s %-13s %6d %9.0fx %8.3f %8.3f %8.2f %8.2f  %5d-%-3d %s\n", SCENARIO_NAMES[spec.scenario],
+    BUCK_MODEL_NAMES[spec.buckModel], spec.seconds, spec.seconds/seconds, plant.getPvEnergyJ()/3600.0,
+    plant.getBatteryEnergyJ()/3600.0, tracking, 100.0*plant.getBatteryEnergyJ()/plant.getPvEnergyJ(),
+    dutyMin, dutyMax, converged.c_str());
+  fflush(stdout);
+  return tracking;
+}
+
+int main(int argc, char** argv) {
+  FILE* trace = nullptr;
+  FILE* uart = nullptr;
+  int seeds = 1;
+  for (int n = 1; n < argc; n++) {
+    if (strcmp(argv[n], "--trace") == 0 && n + 1 < argc) {
+      trace = fopen(argv[++n], "w");
+      if (!trace) {
+        perror(argv[n]);
+        return 1;
+      }
+      fprintf(trace, "scenario,model,second,irradiance,panel_v,panel_a,panel_w,mpp_w,duty,battery_v,battery_a,fet1_c,latched\n");
+    } else if (strcmp(argv[n], "--uart") == 0 && n + 1 < argc) {
+      uart = fopen(argv[++n], "w");
+      if (!uart) {
+        perror(argv[n]);
+        return 1;
+      }
+    } else if (strcmp(argv[n], "--seeds") == 0 && n + 1 < argc) {
+      seeds = atoi(argv[++n]);
+      if (seeds < 1) {
+        fprintf(stderr, "--seeds: at least 1\n");
+        return 1;
+      }
+    } else {
+      fprintf(stderr, "usage: %s [--trace FILE] [--uart FILE] [--seeds N]\n", argv[0]);
+      return 1;
+    }
+  }
+  PvModule pv;
+  double mppV;
+  double mppW = pv.maxPower(&mppV);
+  printf("panel at 1000 W/m2, 25 °C: Voc %.1f V, Pmpp %.1f W at %.1f V\n\n", pv.openCircuitVoltage(), mppW, mppV);
+  printf("%-15s %-13s %6s %10s %8s %8s %8s %8s  %9s %s\n", "scenario", "buck model", "sim s", "real time",
+    "PV Wh", "batt Wh", "track %", "conv %", "duty", "converged s");
+  const size_t runs = sizeof(RUNS)/sizeof(RUNS[0]);
+  std::vector<double> tracking[runs];
+  bool uartWritten = false;
+  for (int seed = 1; seed <= seeds; seed++) {
+    for (size_t n = 0; n < runs; n++) {
+      bool captured = uart && !uartWritten && RUNS[n].scenario == SCENARIO_CLOUD_STEPS;
+      tracking[n].push_back(run(RUNS[n], (uint32_t)seed, seed == 1 ? trace : nullptr, captured ? uart : nullptr));
+      uartWritten = uartWritten || captured;
+    }
+  }
+  if (seeds > 1) {
+    printf("\ntracking over %d sensor noise seeds:\n", seeds);
+    printf("%-15s %-13s %8s %8s %8s\n", "scenario", "buck model", "mean %", "min %", "max %");
+    for (size_t n = 0; n < runs; n++) {
+      double sum = 0.0, low = 100.0, high = 0.0;
+      for (double value : tracking[n]) {
+        sum += value;
+        low = value < low ? value : low;
+        high = value > high ? value : high;
+      }
+      printf("%-15s %-13s %8.2f %8.2f %8.2f\n", SCENARIO_NAMES[RUNS[n].scenario], BUCK_MODEL_NAMES[RUNS[n].buckModel],
+        sum/seeds, low, high);
+    }
+  }
+  if (trace)
+    fclose(trace);
+  if (uart)
+    fclose(uart);
+  return 0;
+}
@@ -0,0 +1,105 @@
+/*
+  QueryBench.cpp - Latency benchmark for the telemetry query engine
+  Released into the public domain.
+
+  usage: bench-query [archive-root] [days]   (default: /tmp/atv-query-bench, 365)
+  Fills <archive-root>/bench with a year of synthetic 1 Hz records (only the
+  first time), then times year-long queries with one thread and with one
+  thread per core, from the raw segments alone and with the rollup tiers.
+  The target is 100 ms on a Raspberry Pi 4.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "SyntheticTelemetry.h"
+#include "TelemetryQuery.h"
+#include "TelemetryStore.h"
+
+const int64_t BENCH_START_US = 1735689600LL*1000000; // 2025-01-01 UTC
+
+static double steadySeconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// writes days of 1 Hz records unless the directory already holds segments; opening the store
+// builds the rollups of segments written before they existed
+static bool fillStore(const std::string& root, int days) {
+  std::vector<std::string> segments;
+  TelemetryStore store;
+  if (listSegments(root + "/bench", "raw", segments) && (int)segments.size() >= days) {
+    double start = steadySeconds();
+    if (!store.open(root.c_str(), "bench"))
+      return false;
+    store.close();
+    printf("rollups up to date in %.2f s\n", steadySeconds() - start);
+    return true;
+  }
+  printf("writing %d days of synthetic records to %s/bench ...\n", days, root.c_str());
+  if (!store.open(root.c_str(), "bench"))
+    return false;
+  SyntheticTelemetry generator(2025, BENCH_START_US);
+  TelemetrySample sample;
+  for (long n = 0; n < days*86400L; n++) {
+    generator.next(sample);
+    if (!store.append(sample))
+      return false;
+  }
+  store.close();
+  return true;
+}
+
+static void timeQuery(const char* title, const std::string& directory, const char* queryString,
+    int threads, bool rollups, int64_t endUs) {
+  TelemetryQuery query;
+  std::string error;
+  if (!parseQuery(queryString, endUs, query, error)) {
+    fprintf(stderr, "%s: %s\n", title, error.c_str());
+    return;
+  }
+  query.useRollups = rollups;
+  TelemetryQueryEngine engine(threads);
+  AggregateBuckets result;
+  QueryStats stats;
+  double best = 1e9;
+  for (int repeat = 0; repeat < 5; repeat++) {
+    if (!engine.run(directory, query, result, stats, error)) {
+      fprintf(stderr, "%s: %s\n", title, error.c_str());
+      return;
+    }
+    best = stats.elapsedSeconds < best ? stats.elapsedSeconds : best;
+  }
+  printf("%-34s %-6s %2d threads %8.1f ms  blocks %ld: %ld pruned, %ld header, %ld decoded, %ld rollup rows\n",
+    title, stats.fromRollup ? "rollup" : "raw", threads, best*1000.0, stats.blocks, stats.blocksPruned,
+    stats.blocksFromHeader, stats.blocksDecoded, stats.rollupRows);
+}
+
+int main(int argc, char** argv) {
+  std::string root = argc > 1 ? argv[1] : "/tmp/atv-query-bench";
+  int days = argc > 2 ? atoi(argv[2]) : 365;
+  if (!fillStore(root, days)) {
+    fprintf(stderr, "cannot write %s\n", root.c_str());
+    return 1;
+  }
+  std::string directory = root + "/bench";
+  int64_t endUs = BENCH_START_US + days*86400LL*1000000;
+  int cores = (int)std::thread::hardware_concurrency();
+  struct { const char* title; const char* query; } queries[] = {
+    {"hourly mean power, whole range", "start=now-365d&bucket=1h&channels=LowSidePower,HighSidePower&agg=mean"},
+    {"daily min/max voltages", "start=now-365d&bucket=1d&channels=LowSideVoltage,HighSideVoltage&agg=min,max"},
+    {"monthly max, header only", "start=now-365d&bucket=30d&channels=all&agg=max"},
+    {"daytime duty stddev (filtered)", "start=now-365d&bucket=1d&channels=DutyCycle&agg=stddev"
+      "&filter=HighSidePower:10000:"},
+    {"last week, 15 min buckets", "start=now-7d&bucket=15m&channels=all&agg=mean,min,max"},
+  };
+  for (auto& q : queries) {
+    timeQuery(q.title, directory, q.query, 1, false, endUs);
+    if (cores > 1)
+      timeQuery(q.title, directory, q.query, cores, false, endUs);
+    timeQuery(q.title, directory, q.query, 1, true, endUs);
+  }
+  return 0;
+}
@@ -0,0 +1,162 @@
+/*
+  RetentionBench.cpp - Disk usage and ingest latency under retention and compaction
+  Released into the public domain.
+
+  usage: bench-retention [directory] [years]   (default: /tmp/atv-retention-bench, 3)
+  First simulates a multi-year deployment with the default policy: synthetic
+  1 Hz records flushed every 600 samples like atverterd, with a maintenance
+  pass after every simulated day, printing the directory size every quarter.
+  The size should level off once the raw and 1 min retention windows are full.
+
+  Then times ingest (600 appends plus a flush, then a 1 ms pause) for a few
+  seconds: alone, and while the maintenance thread compacts a 30 day backlog
+  at its default IO budget and unthrottled.
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "StoreMaintenance.h"
+#include "SyntheticTelemetry.h"
+#include "TelemetryStore.h"
+
+const int64_t DAY_US = 86400LL*1000000;
+const int BENCH_FLUSH_SAMPLES = 600; // atverterd's default --flush-seconds at 1 Hz
+
+static double steadySeconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void directoryUsage(const std::string& directory, long long& bytes, int& files) {
+  bytes = 0;
+  files = 0;
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+    return;
+  while (struct dirent* entry = readdir(dir)) {
+    struct stat info;
+    if (entry->d_name[0] != '.' && stat((directory + "/" + entry->d_name).c_str(), &info) == 0) {
+      bytes += info.st_size;
+      files++;
+    }
+  }
+  closedir(dir);
+}
+
+static void clearDirectory(const std::string& directory) {
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+    return;
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.')
+      unlink((directory + "/" + entry->d_name).c_str());
+  }
+  closedir(dir);
+}
+
+// appends one day of records, flushing like the daemon
+static void ingestDay(TelemetryStore& store, SyntheticTelemetry& generator) {
+  TelemetrySample sample;
+  for (int n = 1; n <= 86400; n++) {
+    generator.next(sample);
+    store.append(sample);
+    if (n%BENCH_FLUSH_SAMPLES == 0)
+      store.flush();
+  }
+}
+
+// appends chunks of records with a pause in between for some seconds; returns the time of every chunk
+static std::vector<double> ingestTimed(TelemetryStore& store, SyntheticTelemetry& generator, double seconds) {
+  std::vector<double> chunks;
+  TelemetrySample sample;
+  double end = steadySeconds() + seconds;
+  while (steadySeconds() < end) {
+    double start = steadySeconds();
+    for (int n = 0; n < BENCH_FLUSH_SAMPLES; n++) {
+      generator.next(sample);
+      store.append(sample);
+    }
+    store.flush();
+    chunks.push_back(steadySeconds() - start);
+    usleep(1000);
+  }
+  return chunks;
+}
+
+static void printLatency(const char* title, std::vector<double> chunks) {
+  std::sort(chunks.begin(), chunks.end());
+  printf("%-32s p50 %8.1f us  p99 %8.1f us  max %8.1f us per 600 records\n", title,
+    chunks[chunks.size()/2]*1e6, chunks[chunks.size()*99/100]*1e6, chunks.back()*1e6);
+}
+
+int main(int argc, char** argv) {
+  std::string root = argc > 1 ? argv[1] : "/tmp/atv-retention-bench";
+  int years = argc > 2 ? atoi(argv[2]) : 3;
+  std::string directory = root + "/bench";
+  makeDirectories(directory);
+
+  // multi-year deployment, simulated time
+  clearDirectory(directory);
+  int64_t startUs = 1735689600LL*1000000; // 2025-01-01 UTC
+  SyntheticTelemetry generator(2025, startUs);
+  StoreMaintenance maintenance;
+  maintenance.setBytesPerSecond(0);
+  maintenance.addDirectory(directory);
+  TelemetryStore store;
+  store.open(root.c_str(), "bench");
+  printf("%6s %12s %8s %10s %10s\n", "day", "MB on disk", "files", "deleted", "compacted");
+  for (int day = 1; day <= years*365; day++) {
+    ingestDay(store, generator);
+    maintenance.runOnce(startUs + day*DAY_US);
+    if (day%91 == 0 || day == years*365) {
+      long long bytes;
+      int files;
+      directoryUsage(directory, bytes, files);
+      MaintenanceStats stats = maintenance.getStats();
+      printf("%6d %12.2f %8d %10ld %10ld\n", day, bytes/1048576.0, files, stats.filesDeleted,
+        stats.filesCompacted);
+      fflush(stdout);
+    }
+  }
+  store.close();
+
+  // ingest latency with and without the maintenance thread, in wall clock time
+  int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  struct { const char* title; long bytesPerSecond; } cases[] = {
+    {"ingest alone", -1},
+    {"ingest, maintenance at 1 MB/s", MAINTENANCE_DEFAULT_BYTES_PER_SECOND},
+    {"ingest, maintenance unthrottled", 0}};
+  for (auto& c : cases) {
+    clearDirectory(directory);
+    SyntheticTelemetry backlog(7, nowUs - 32*DAY_US);
+    TelemetryStore store;
+    store.open(root.c_str(), "bench");
+    for (int day = 0; day < 30; day++)
+      ingestDay(store, backlog);
+    StoreMaintenance background;
+    RetentionPolicy keepAll;
+    keepAll.rawUs = 0;
+    background.setPolicy(keepAll);
+    background.setBytesPerSecond(c.bytesPerSecond);
+    background.addDirectory(directory);
+    if (c.bytesPerSecond >= 0)
+      background.start();
+    std::vector<double> chunks = ingestTimed(store, backlog, 3.0);
+    background.stop();
+    store.close();
+    MaintenanceStats stats = background.getStats();
+    printLatency(c.title, chunks);
+    if (c.bytesPerSecond >= 0)
+      printf("  compacted %ld files meanwhile, %.1f MB read, %.1f MB written\n", stats.filesCompacted,
+        stats.bytesRead/1048576.0, stats.bytesWritten/1048576.0);
+  }
+  return 0;
+}
@@ -0,0 +1,120 @@
+/*
+  RollupBench.cpp - Ingest cost of the rollup tiers
+  Released into the public domain.
+
+  usage: bench-rollup [directory] [days]   (default: /tmp/atv-rollup-bench, 30)
+  Appends days of synthetic 1 Hz records to a TelemetryStore, flushing every
+  600 samples like atverterd, once without rollups, once with the default
+  tiers and once with every tier. Reports nanoseconds per sample, the overhead
+  over the raw store alone and the bytes each tier adds on disk. Reopening the
+  store with every tier shows the cost of a rebuild from the raw segments.
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "SyntheticTelemetry.h"
+#include "TelemetryStore.h"
+
+const int64_t BENCH_START_US = 1735689600LL*1000000; // 2025-01-01 UTC
+const int BENCH_FLUSH_SAMPLES = 600; // atverterd's default --flush-seconds at 1 Hz
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// bytes of the files in a directory whose name starts with prefix
+static long long directoryBytes(const std::string& directory, const char* prefix) {
+  long long bytes = 0;
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+    return 0;
+  while (struct dirent* entry = readdir(dir)) {
+    struct stat info;
+    std::string path = directory + "/" + entry->d_name;
+    if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0 && stat(path.c_str(), &info) == 0)
+      bytes += info.st_size;
+  }
+  closedir(dir);
+  return bytes;
+}
+
+static void clearDirectory(const std::string& directory) {
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+    return;
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.')
+      unlink((directory + "/" + entry->d_name).c_str());
+  }
+  closedir(dir);
+}
+
+// returns ns per sample
+static double ingest(const std::string& root, const std::vector<TelemetrySample>& samples, uint32_t tiers) {
+  std::string directory = root + "/bench";
+  clearDirectory(directory);
+  TelemetryStore store;
+  if (!store.open(root.c_str(), "bench", tiers)) {
+    fprintf(stderr, "cannot open %s\n", directory.c_str());
+    exit(1);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (size_t n = 0; n < samples.size(); n++) {
+    store.append(samples[n]);
+    if ((n + 1)%BENCH_FLUSH_SAMPLES == 0)
+      store.flush();
+  }
+  store.close();
+  return secondsSince(start)*1e9/samples.size();
+}
+
+int main(int argc, char** argv) {
+  std::string root = argc > 1 ? argv[1] : "/tmp/atv-rollup-bench";
+  int days = argc > 2 ? atoi(argv[2]) : 30;
+  std::vector<TelemetrySample> samples(days*86400L);
+  SyntheticTelemetry generator(2025, BENCH_START_US);
+  for (TelemetrySample& sample : samples)
+    generator.next(sample);
+  if (!makeDirectories(root + "/bench")) {
+    fprintf(stderr, "cannot create %s/bench\n", root.c_str());
+    return 1;
+  }
+  std::string directory = root + "/bench";
+
+  double raw = ingest(root, samples, 0);
+  printf("%-16s %8.1f ns/sample\n", "raw only", raw);
+  double standard = ingest(root, samples, DEFAULT_TIERS);
+  printf("%-16s %8.1f ns/sample  +%.1f ns for the rollups\n", "default tiers", standard, standard - raw);
+  double all = ingest(root, samples, ALL_TIERS);
+  printf("%-16s %8.1f ns/sample  +%.1f ns for the rollups\n", "every tier", all, all - raw);
+
+  long long rawBytes = directoryBytes(directory, "raw-");
+  printf("\n%-8s %12.1f KB/day\n", "raw", rawBytes/1024.0/days);
+  for (int t = 0; t < NUM_TIERS; t++) {
+    std::string prefix = rollupPrefix(t) + "-";
+    printf("%-8s %12.1f KB/day\n", TIER_NAMES[t], directoryBytes(directory, prefix.c_str())/1024.0/days);
+  }
+
+  // drop the rollups and rebuild them from the raw segments, as after an upgrade
+  std::vector<std::string> files;
+  for (int t = 0; t < NUM_TIERS; t++) {
+    listSegments(directory, rollupPrefix(t).c_str(), files);
+    for (const std::string& path : files)
+      unlink(path.c_str());
+  }
+  auto start = std::chrono::steady_clock::now();
+  TelemetryStore store;
+  store.open(root.c_str(), "bench", ALL_TIERS);
+  store.close();
+  printf("\nrebuilt every tier from %d days of raw segments in %.2f s (%.1f ns/sample)\n", days,
+    secondsSince(start), secondsSince(start)*1e9/samples.size());
+  return 0;
+}
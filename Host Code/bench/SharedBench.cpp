@@ -0,0 +1,100 @@
+/*
+  SharedBench.cpp - Read latency of the shared memory seqlock
+  Released into the public domain.
+
+  usage: bench-shared [seconds-per-run]   (default: 1)
+  Times SharedTelemetryReader::read() on its own, with the writer publishing
+  at atverterd's real rate (1 Hz per device) and with a writer thread
+  publishing as fast as it can, which is the worst case for retries. Every
+  snapshot is checked for tearing: the writer fills all channels of a record
+  with its timestamp.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "SharedTelemetry.h"
+
+const char * const BENCH_SHM_NAME = "/atverter-bench";
+const int BENCH_DEVICES = 4;
+
+static double steadySeconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void publishRecord(SharedTelemetryWriter& writer, int slot, uint64_t count) {
+  TelemetrySample sample;
+  sample.timestampUs = (int64_t)count; // stands in for a wall clock
+  for (int channel = 0; channel < NUM_CHANNELS; channel++)
+    sample.values[channel] = (int32_t)count;
+  writer.publish(slot, sample, (1u << NUM_CHANNELS) - 1);
+}
+
+// writerPauseUs < 0: no writer thread, 0: writer spins
+static void runCase(const char* title, SharedTelemetryWriter& writer, int writerPauseUs, double seconds) {
+  std::atomic<bool> running{true};
+  std::thread thread;
+  if (writerPauseUs >= 0) {
+    thread = std::thread([&]() {
+      uint64_t count = 1000;
+      while (running) {
+        publishRecord(writer, 0, ++count);
+        if (writerPauseUs > 0)
+          std::this_thread::sleep_for(std::chrono::microseconds(writerPauseUs));
+      }
+    });
+  }
+  SharedTelemetryReader reader;
+  if (!reader.open(BENCH_SHM_NAME)) {
+    fprintf(stderr, "cannot open %s\n", BENCH_SHM_NAME);
+    exit(1);
+  }
+  long reads = 0;
+  long busy = 0; // tryRead() calls that collided with the writer
+  long torn = 0; // accepted snapshots with mixed records, must stay 0
+  double start = steadySeconds();
+  double elapsed = 0.0;
+  SharedTelemetryRecord record;
+  while ((elapsed = steadySeconds() - start) < seconds) {
+    for (int n = 0; n < 1000; n++) {
+      while (!reader.tryRead(0, record))
+        busy++;
+      reads++;
+      for (int channel = 0; channel < NUM_CHANNELS; channel++) {
+        if (record.sample.values[channel] != (int32_t)record.sample.timestampUs)
+          torn++;
+      }
+    }
+  }
+  running = false;
+  if (thread.joinable())
+    thread.join();
+  printf("%-28s %10.1f ns/read %12.0f reads/s %12.4f%% busy %6ld torn\n", title, elapsed*1e9/reads,
+    reads/elapsed, 100.0*busy/(reads + busy), torn);
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+  SharedTelemetryWriter writer;
+  if (!writer.open(BENCH_SHM_NAME, BENCH_DEVICES)) {
+    fprintf(stderr, "cannot create %s\n", BENCH_SHM_NAME);
+    return 1;
+  }
+  for (int slot = 0; slot < BENCH_DEVICES; slot++) {
+    char name[16];
+    snprintf(name, sizeof(name), "dev%d", slot);
+    writer.setDeviceName(slot, name);
+    publishRecord(writer, slot, 1000);
+  }
+  printf("record size %zu bytes, slot size %zu bytes\n", sizeof(SharedTelemetryRecord),
+    sizeof(SharedTelemetrySlot));
+  runCase("no writer", writer, -1, seconds);
+  runCase("writer at 1 Hz", writer, 1000000, seconds);
+  runCase("writer at 1 kHz", writer, 1000, seconds);
+  runCase("writer spinning", writer, 0, seconds);
+  writer.close();
+  return 0;
+}
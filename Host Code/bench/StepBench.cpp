@@ -0,0 +1,193 @@
+/*
+  StepBench.cpp - Step responses of the sketch's duty and cascaded control on the plant simulator
+  Released into the public domain.
+
+  usage: bench-step [--model NAME] [--trace FILE]
+  Runs AtverterH_MPPT.cpp on PlantSim (the averaged buck model by default,
+  for the input capacitor and inductor; --model quasi-static or switching)
+  once per control mode and disturbance, every run tracking for 60 s at
+  1000 W/m2 first, then:
+    battery step    10 A of load onto a battery with 0.1 Ohm of leads and
+                    internal resistance, a 1 V step down of V2
+    irradiance step 1000 to 300 W/m2, a cloud edge
+    reference step  the panel voltage reference 5 V down in CV1 mode (WVRF)
+  The control modes are the sketch's ControlModes: duty (WCTL:0), the IC
+  step on the duty cycle once a second, and cascade (WCTL:1), the IC step
+  on the panel voltage reference and the CV1 loop on the duty cycle every
+  tick.
+
+  Printed per run, from the control tick of the step on: the largest
+  deviation of the panel voltage from where it was before the step, how
+  long it took to get back within 0.75 V of that (or of the new reference)
+  and stay there for 100 ms, and the tracking efficiency over the 10 s
+  after the step. The reference step also gets its 10 to 90 % rise time and
+  overshoot. --trace writes every tick of the first 2 s after each step as
+  CSV.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "SketchRunner.h"
+
+const int WARMUP_S = 60;
+const int OBSERVE_TICKS = 10000; // after the step
+const int TRACE_TICKS = 2000;
+// around the panel voltage before the step or the new reference: more than the 0.6 V of a 1 % duty step at 25 V,
+// as the CV1 loop may dither between the two steps either side of its reference
+const double SETTLED_V = 0.75;
+const int SETTLED_HOLD_TICKS = 100;
+const double STEP_LOAD_A = 10.0;
+const double STEP_LEAD_OHM = 0.1; // battery internal resistance plus leads
+const double STEP_IRRADIANCE = 300.0; // W/m2, from 1000
+const int STEP_REFERENCE_MV = -5000;
+
+enum Disturbances
+{   DISTURBANCE_BATTERY = 0,
+    DISTURBANCE_IRRADIANCE,
+    DISTURBANCE_REFERENCE,
+    NUM_DISTURBANCES
+};
+
+const char * const DISTURBANCE_NAMES[NUM_DISTURBANCES] = {"battery step", "irradiance step", "reference step"};
+
+// the sketch's ControlModes compared, WCTL values
+const int MODES[] = {0, 1};
+const char * const MODE_NAMES[] = {"duty", "cascade"};
+
+struct StepResult
+{
+  double beforeV; // panel voltage before the step, mean of the last 100 ticks
+  double targetV; // where it should settle: beforeV, or the new reference
+  double peakV; // largest deviation from beforeV
+  long settledTicks; // -1 if never
+  double riseTicks; // 10 to 90 % of a reference step, -1 if not one
+  double overshootV;
+  double trackPercent; // over OBSERVE_TICKS
+};
+
+// one control interrupt and one loop(); host commands sent before are read by the loop()
+static void tick(PlantSim& plant) {
+  plant.step();
+  if (plant.getState().powered)
+    loop();
+}
+
+static StepResult run(int disturbance, int mode, int buckModel, FILE* trace) {
+  PlantParams params;
+  params.buckModel = buckModel;
+  params.battery.internalOhm = STEP_LEAD_OHM;
+  static PlantSim plant; // static like the sketch's board
+  plant.configure(params);
+  plant.setIrradiance(1000.0);
+  startSketch(plant);
+  halNativeUARTReceive(("WCTL:" + std::to_string(mode) + "\n").c_str());
+  for (int t = 0; t < WARMUP_S; t++)
+    runSketchSecond(plant);
+
+  StepResult result;
+  if (disturbance == DISTURBANCE_REFERENCE) {
+    halNativeUARTReceive("WCTL:2\n"); // CV1 at the panel voltage MPPT left, then a second to settle there
+    runSketchSecond(plant);
+  }
+  double sum = 0.0;
+  for (int n = 0; n < 100; n++) {
+    tick(plant);
+    sum += plant.getState().panelV;
+  }
+  result.beforeV = result.targetV = sum/100.0;
+  halNativeUARTTake();
+
+  if (disturbance == DISTURBANCE_BATTERY)
+    plant.setLoad(STEP_LOAD_A);
+  else if (disturbance == DISTURBANCE_IRRADIANCE)
+    plant.setIrradiance(STEP_IRRADIANCE);
+  else {
+    long referenceMV = (long)lround(result.beforeV*1000.0) + STEP_REFERENCE_MV;
+    halNativeUARTReceive(("WVRF:" + std::to_string(referenceMV) + "\n").c_str());
+    result.targetV = referenceMV/1000.0;
+  }
+
+  double pvJ = plant.getPvEnergyJ();
+  double mppJ = plant.getMppEnergyJ();
+  double stepV = result.targetV - result.beforeV;
+  long rise10 = -1, rise90 = -1;
+  long inBand = 0;
+  result.peakV = result.overshootV = 0.0;
+  result.settledTicks = -1;
+  for (long n = 0; n < OBSERVE_TICKS; n++) {
+    tick(plant);
+    const PlantState& state = plant.getState();
+    double deviation = state.panelV - result.beforeV;
+    result.peakV = fabs(deviation) > fabs(result.peakV) ? deviation : result.peakV;
+    if (stepV != 0.0) {
+      double progress = deviation/stepV;
+      rise10 = rise10 < 0 && progress >= 0.1 ? n : rise10;
+      rise90 = rise90 < 0 && progress >= 0.9 ? n : rise90;
+      result.overshootV = progress > 1.0 && fabs(deviation - stepV) > result.overshootV ?
+        fabs(deviation - stepV) : result.overshootV;
+    }
+    inBand = fabs(state.panelV - result.targetV) <= SETTLED_V ? inBand + 1 : 0;
+    if (result.settledTicks < 0 && inBand >= SETTLED_HOLD_TICKS)
+      result.settledTicks = n - SETTLED_HOLD_TICKS + 1;
+    if (trace && n < TRACE_TICKS) {
+      fprintf(trace, "%s,%s,%ld,%.3f,%.3f,%.3f,%.3f,%.3f,%d\n", DISTURBANCE_NAMES[disturbance],
+        MODE_NAMES[mode], n, state.panelV, state.panelA, state.batteryV, state.batteryA, state.mppW,
+        atverterH.getDutyCycle());
+    }
+    if (n % SKETCH_TICKS_PER_SECOND == 0)
+      halNativeUARTTake(); // the records and replies go nowhere
+  }
+  result.riseTicks = rise10 >= 0 && rise90 >= 0 ? rise90 - rise10 : -1;
+  result.trackPercent = 100.0*(plant.getPvEnergyJ() - pvJ)/(plant.getMppEnergyJ() - mppJ);
+  plant.detach();
+  return result;
+}
+
+int main(int argc, char** argv) {
+  int buckModel = BUCK_AVERAGED;
+  FILE* trace = nullptr;
+  for (int n = 1; n < argc; n++) {
+    const char* option = argv[n];
+    const char* value = n + 1 < argc ? argv[++n] : nullptr;
+    if (value && strcmp(option, "--model") == 0) {
+      for (buckModel = 0; buckModel < NUM_BUCKMODELS && strcmp(value, BUCK_MODEL_NAMES[buckModel]) != 0; buckModel++)
+        ;
+      if (buckModel == NUM_BUCKMODELS) {
+        fprintf(stderr, "unknown buck model %s\n", value);
+        return 1;
+      }
+    } else if (value && strcmp(option, "--trace") == 0) {
+      trace = fopen(value, "w");
+      if (!trace) {
+        perror(value);
+        return 1;
+      }
+      fprintf(trace, "disturbance,mode,tick,panel_v,panel_a,battery_v,battery_a,mpp_w,duty\n");
+    } else {
+      fprintf(stderr, "usage: %s [--model quasi-static|averaged|switching] [--trace FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+  printf("%s buck model, %d s of tracking at 1000 W/m2 before each step\n\n", BUCK_MODEL_NAMES[buckModel], WARMUP_S);
+  printf("%-16s %-8s %9s %9s %9s %10s %9s %10s %8s\n", "disturbance", "mode", "before V", "target V", "peak dV",
+    "settled ms", "rise ms", "overshoot", "track %");
+  for (int disturbance = 0; disturbance < NUM_DISTURBANCES; disturbance++) {
+    for (int m = 0; m < 2; m++) {
+      if (disturbance == DISTURBANCE_REFERENCE && MODES[m] == 0)
+        continue; // no reference to step without the CV1 loop
+      StepResult result = run(disturbance, MODES[m], buckModel, trace);
+      std::string settled = result.settledTicks < 0 ? "-" : std::to_string(result.settledTicks);
+      std::string rise = result.riseTicks < 0 ? "-" : std::to_string((long)result.riseTicks);
+      printf("%-16s %-8s %9.2f %9.2f %+9.2f %10s %9s %9.2fV %8.2f\n", DISTURBANCE_NAMES[disturbance],
+        MODE_NAMES[m], result.beforeV, result.targetV, result.peakV, settled.c_str(), rise.c_str(),
+        result.overshootV, result.trackPercent);
+      fflush(stdout);
+    }
+  }
+  if (trace)
+    fclose(trace);
+  return 0;
+}
@@ -0,0 +1,59 @@
+/*
+  SyntheticTelemetry.h - Repeatable fake MPPT telemetry for host benchmarks
+  Released into the public domain.
+
+  Produces 1 Hz records shaped like a 24 V panel charging a 12 V battery:
+  a slow irradiance curve, small sensor noise, +/-1 duty steps from the IC
+  loop, and the tens-of-milliseconds timestamp jitter UART.py sees.
+*/
+
+#ifndef SyntheticTelemetry_h
+#define SyntheticTelemetry_h
+
+#include <stdint.h>
+#include <math.h>
+
+#include "Telemetry.h"
+
+class SyntheticTelemetry
+{
+  public:
+    SyntheticTelemetry(uint32_t seed, int64_t startUs) : _state(seed ? seed : 1), _timeUs(startUs) {}
+    // fills sample with the next record and advances time by ~1 s
+    void next(TelemetrySample& sample) {
+      _timeUs += 1000000 + (int64_t)(random()%40000) - 20000;
+      double dayPhase = (double)(_index++%86400)/86400.0;
+      double sun = sin(dayPhase*M_PI);
+      if (sun < 0.0)
+        sun = 0.0;
+      if ((random()%100) == 0)
+        _duty += (random()%2) ? 1 : -1;
+      if (_duty < 30)
+        _duty = 30;
+      if (_duty > 70)
+        _duty = 70;
+      sample.timestampUs = _timeUs;
+      sample.values[HIGH_SIDE_VOLTAGE] = 17000 + (int32_t)(4000*sun) + noise(30);
+      sample.values[HIGH_SIDE_CURRENT] = (int32_t)(4500*sun) + noise(25);
+      sample.values[LOW_SIDE_VOLTAGE] = 12600 + (int32_t)(800*sun) + noise(20);
+      sample.values[LOW_SIDE_CURRENT] = (int32_t)(7000*sun) + noise(40);
+      sample.values[DUTY_CYCLE] = _duty;
+      fillDerivedPower(sample);
+    }
+  private:
+    uint32_t _state;
+    int64_t _timeUs;
+    long _index = 0;
+    int32_t _duty = 50;
+    uint32_t random() { // xorshift32, identical on every platform
+      _state ^= _state << 13;
+      _state ^= _state >> 17;
+      _state ^= _state << 5;
+      return _state;
+    }
+    int32_t noise(int32_t amplitude) {
+      return (int32_t)(random()%(2*amplitude + 1)) - amplitude;
+    }
+};
+
+#endif
@@ -0,0 +1,40 @@
+/*
+  FuzzCommands.cpp - Fuzzes AtverterH::interpretRXCommand() and the sketch's command callbacks directly
+  Released into the public domain.
+
+  Skips the line framing of the UART and I2C paths to reach commands and
+  values they cannot deliver (longer than a buffer, without a value, with
+  control characters). An input is a protocol byte (even for the UART, odd
+  for I2C), the command, and after a NUL byte the value; without the NUL the
+  value is NULL, as parseRXLine() passes it for a command without a colon.
+  Command and value are copied into buffers of their exact length, so
+  reading past either is caught.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "FuzzSketch.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  static bool started = startFuzzSketch();
+  (void)started;
+  if (size < 1)
+    return 0;
+  int receiveProtocol = (data[0] & 1) ? I2C_INDEX : UART_INDEX;
+  const uint8_t* end = data + size;
+  const uint8_t* separator = (const uint8_t*)memchr(data + 1, '\0', size - 1);
+  std::vector<char> command(data + 1, separator ? separator : end);
+  command.push_back('\0');
+  std::vector<char> value;
+  if (separator) {
+    value.assign(separator + 1, end);
+    value.push_back('\0');
+  }
+  atverterH.interpretRXCommand(command.data(), separator ? value.data() : NULL, receiveProtocol);
+  checkBoardBuffers();
+  halNativeI2CRead();
+  halNativeUARTTake();
+  return 0;
+}
@@ -0,0 +1,199 @@
+/*
+  FuzzDriver.cpp - A stand-in for libFuzzer's main() where the compiler has no -fsanitize=fuzzer (GCC)
+  Released into the public domain.
+
+  Runs every input of the corpus directories or files given, then random
+  mutations of them (bytes flipped, set, inserted, deleted, dictionary
+  tokens spliced in) without coverage feedback. It takes the libFuzzer
+  options the CMake targets pass: -runs=N, -seed=N, -max_len=N and
+  -dict=FILE. The sanitizers are set to abort on their first report, like
+  the buffer checks of the harnesses, and the input that aborted is written
+  to crash-<run> before the process dies; replay it by giving the file alone.
+*/
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+static std::vector<uint8_t> currentInput; // the input running, for the crash file
+static std::string crashName;
+
+extern "C" const char* __asan_default_options() {
+  return "abort_on_error=1";
+}
+
+extern "C" const char* __ubsan_default_options() {
+  return "abort_on_error=1:print_stacktrace=1";
+}
+
+static void writeCrash(int signal) {
+  int file = open(crashName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (file >= 0) {
+    ssize_t written = write(file, currentInput.data(), currentInput.size());
+    close(file);
+    if (written == (ssize_t)currentInput.size())
+      fprintf(stderr, "the input is in %s\n", crashName.c_str());
+  }
+  ::signal(signal, SIG_DFL);
+  raise(signal);
+}
+
+static bool readFile(const std::string& path, std::vector<uint8_t>& data) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  data.clear();
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    data.insert(data.end(), buffer, buffer + n);
+  fclose(file);
+  return true;
+}
+
+static void addCorpus(const std::string& path, std::vector<std::vector<uint8_t>>& corpus) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    fprintf(stderr, "cannot read %s\n", path.c_str());
+    return;
+  }
+  if (!S_ISDIR(info.st_mode)) {
+    corpus.emplace_back();
+    readFile(path, corpus.back());
+    return;
+  }
+  DIR* dir = opendir(path.c_str());
+  if (!dir)
+    return;
+  std::vector<std::string> names;
+  while (struct dirent* entry = readdir(dir))
+    if (entry->d_name[0] != '.')
+      names.push_back(path + "/" + entry->d_name);
+  closedir(dir);
+  std::sort(names.begin(), names.end()); // the same order, so a seed reproduces its runs
+  for (const std::string& name : names)
+    addCorpus(name, corpus);
+}
+
+// libFuzzer's dictionary format: one "token" per line, with \\, \" and \xNN escapes, # starts a comment
+static void readDictionary(const char* path, std::vector<std::string>& tokens) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "cannot read %s\n", path);
+    exit(1);
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    const char* c = strchr(line, '"');
+    if (!c || line[strspn(line, " \t")] == '#')
+      continue;
+    std::string token;
+    for (c++; *c && *c != '"'; c++) {
+      if (*c == '\\' && c[1] == 'x' && c[2] && c[3]) {
+        token += (char)strtol(std::string(c + 2, 2).c_str(), NULL, 16);
+        c += 3;
+      } else if (*c == '\\' && c[1]) {
+        token += *++c;
+      } else {
+        token += *c;
+      }
+    }
+    tokens.push_back(token);
+  }
+  fclose(file);
+}
+
+static void mutate(std::vector<uint8_t>& data, size_t maxLength, const std::vector<std::string>& tokens, std::mt19937& random) {
+  int mutations = 1 + random() % 4;
+  for (int n = 0; n < mutations; n++) {
+    size_t at = data.empty() ? 0 : random() % (data.size() + 1);
+    switch (random() % 5) {
+      case 0: // flip a bit
+        if (at < data.size())
+          data[at] ^= 1 << (random() % 8);
+        break;
+      case 1: // set a byte, often to one the parsers care about
+        if (at < data.size()) {
+          static const uint8_t special[] = {'\0', '\n', '\r', ':', '-', '0', '9', 0x7f, 0xff};
+          data[at] = random() % 2 ? special[random() % sizeof(special)] : (uint8_t)random();
+        }
+        break;
+      case 2: // insert bytes
+        data.insert(data.begin() + at, 1 + random() % 8, (uint8_t)random());
+        break;
+      case 3: // delete bytes
+        if (at < data.size())
+          data.erase(data.begin() + at, data.begin() + std::min(data.size(), at + 1 + random() % 8));
+        break;
+      case 4: // a dictionary token
+        if (!tokens.empty()) {
+          const std::string& token = tokens[random() % tokens.size()];
+          data.insert(data.begin() + at, token.begin(), token.end());
+        }
+        break;
+    }
+  }
+  if (data.size() > maxLength)
+    data.resize(maxLength);
+}
+
+int main(int argc, char** argv) {
+  long runs = 100000;
+  unsigned long seed = 1;
+  size_t maxLength = 256;
+  std::vector<std::string> tokens;
+  std::vector<std::vector<uint8_t>> corpus;
+  for (int n = 1; n < argc; n++) {
+    const char* option = argv[n];
+    if (strncmp(option, "-runs=", 6) == 0)
+      runs = atol(option + 6);
+    else if (strncmp(option, "-seed=", 6) == 0)
+      seed = strtoul(option + 6, NULL, 10);
+    else if (strncmp(option, "-max_len=", 9) == 0)
+      maxLength = atol(option + 9);
+    else if (strncmp(option, "-dict=", 6) == 0)
+      readDictionary(option + 6, tokens);
+    else if (option[0] == '-') {
+      fprintf(stderr, "usage: %s [-runs=N] [-seed=N] [-max_len=N] [-dict=FILE] [corpus dir or input]...\n", argv[0]);
+      return 1;
+    } else
+      addCorpus(option, corpus);
+  }
+  signal(SIGABRT, writeCrash);
+  signal(SIGSEGV, writeCrash);
+
+  clock_t start = clock();
+  size_t seeds = corpus.size();
+  for (size_t n = 0; n < seeds; n++) {
+    currentInput = corpus[n];
+    crashName = "crash-corpus-" + std::to_string(n);
+    LLVMFuzzerTestOneInput(currentInput.data(), currentInput.size());
+  }
+  if (corpus.empty())
+    corpus.emplace_back();
+  std::mt19937 random(seed);
+  for (long run = 0; run < runs; run++) {
+    currentInput = corpus[random() % corpus.size()];
+    mutate(currentInput, maxLength, tokens, random);
+    crashName = "crash-" + std::to_string(run);
+    LLVMFuzzerTestOneInput(currentInput.data(), currentInput.size());
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%zu corpus inputs and %ld mutations in %.2f s, %.0f execs/s, seed %lu\n", seeds, runs, seconds,
+    seconds > 0 ? (seeds + runs) / seconds : 0.0, seed);
+  return 0;
+}
@@ -0,0 +1,34 @@
+/*
+  FuzzI2C.cpp - Fuzzes the sketch's I2C slave: PicroBoard::receiveEventI2C() and requestEventI2C()
+  Released into the public domain.
+
+  The first byte of an input is the byte count Wire hands to the receive
+  event (TwoWire never gives more than its 32 byte buffer, the harness goes
+  up to 255 to check the event does not trust it), the rest is the master's
+  write, the register byte first. A master read follows, like the Pi's
+  command then answer.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FuzzSketch.h"
+
+static bool startI2C() {
+  startFuzzSketch();
+  Wire.onReceive(NULL); // the harness calls the receive event itself, with its own byte count
+  return true;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  static bool started = startI2C();
+  (void)started;
+  if (size < 1)
+    return 0;
+  halNativeI2CWrite((const char*)data + 1, (int)size - 1);
+  atverterH.receiveEventI2C(data[0]);
+  checkBoardBuffers();
+  halNativeI2CRead();
+  halNativeUARTTake();
+  return 0;
+}
@@ -0,0 +1,84 @@
+/*
+  FuzzSketch.h - The MPPT sketch as a fuzz target, set up once per process
+  Released into the public domain.
+
+  The harnesses run setup() of AtverterH_MPPT.cpp on PicroHAL's fakes the
+  first time they are called and never again, so an input costs only its
+  own parsing. What one input's commands change (limits, the deadband mode,
+  the IC tuning) stays for the next ones, like it does on the converter;
+  every setting is range checked, so a crash still reproduces from its
+  input alone.
+
+  AddressSanitizer sees a write past the end of the board, not a write from
+  one of its buffers into the next member. The fuzz build gives every buffer
+  COMMBUFFERGUARD spare bytes, startFuzzSketch() fills them with canaries and
+  checkBoardBuffers() stops on the first input that changed one, or that left
+  a transmit or I2C receive buffer without its terminator.
+*/
+
+#ifndef FuzzSketch_h
+#define FuzzSketch_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <AtverterH.h>
+
+// the sketch's entry point and board, from AtverterH_MPPT.cpp
+void setup();
+extern AtverterH atverterH;
+
+#if COMMBUFFERGUARD < 1
+#error "the fuzz harnesses need -DCOMMBUFFERGUARD=<bytes> to see a buffer run into the next"
+#endif
+
+const char CANARY = (char)0xA5;
+
+static char* guardOf(char* buffer) {
+  return buffer + COMMBUFFERSIZE;
+}
+
+inline void fillCanaries() {
+  memset(guardOf(atverterH.getRXBufferUART()), CANARY, COMMBUFFERGUARD);
+  memset(guardOf(atverterH.getRXBufferI2C()), CANARY, COMMBUFFERGUARD);
+  memset(guardOf(atverterH.getTXBuffer(UART_INDEX)), CANARY, COMMBUFFERGUARD);
+  memset(guardOf(atverterH.getTXBuffer(I2C_INDEX)), CANARY, COMMBUFFERGUARD);
+}
+
+inline bool startFuzzSketch() {
+  halNativeReset();
+  setup();
+  halNativeUARTTake();
+  fillCanaries();
+  return true;
+}
+
+static void checkGuard(char* buffer, const char* name) {
+  const char* guard = guardOf(buffer);
+  for (int i = 0; i < COMMBUFFERGUARD; i++) {
+    if (guard[i] != CANARY) {
+      fprintf(stderr, "%s ran past its %d bytes, byte %d after it changed\n", name, COMMBUFFERSIZE, i);
+      abort();
+    }
+  }
+}
+
+static void checkTerminator(const char* buffer, const char* name) {
+  if (strnlen(buffer, COMMBUFFERSIZE) >= COMMBUFFERSIZE) {
+    fprintf(stderr, "%s has no terminator within its %d bytes, a write ran past it\n", name, COMMBUFFERSIZE);
+    abort();
+  }
+}
+
+inline void checkBoardBuffers() {
+  checkGuard(atverterH.getRXBufferUART(), "the UART receive buffer");
+  checkGuard(atverterH.getRXBufferI2C(), "the I2C receive buffer");
+  checkGuard(atverterH.getTXBuffer(UART_INDEX), "the UART transmit buffer");
+  checkGuard(atverterH.getTXBuffer(I2C_INDEX), "the I2C transmit buffer");
+  checkTerminator(atverterH.getTXBuffer(UART_INDEX), "the UART transmit buffer");
+  checkTerminator(atverterH.getTXBuffer(I2C_INDEX), "the I2C transmit buffer");
+  checkTerminator(atverterH.getRXBufferI2C(), "the I2C receive buffer");
+}
+
+#endif
@@ -0,0 +1,26 @@
+/*
+  FuzzUART.cpp - Fuzzes the sketch's UART input: PicroBoard::readUART() and every command behind it
+  Released into the public domain.
+
+  An input is the bytes the host sends; a line left open at the end is
+  closed with a newline, so the next input starts on a fresh line.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FuzzSketch.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  static bool started = startFuzzSketch();
+  (void)started;
+  halNativeUARTReceive((const char*)data, size);
+  atverterH.readUART();
+  if (size > 0 && data[size - 1] != '\n') {
+    halNativeUARTReceive("\n");
+    atverterH.readUART();
+  }
+  checkBoardBuffers();
+  halNativeUARTTake();
+  return 0;
+}
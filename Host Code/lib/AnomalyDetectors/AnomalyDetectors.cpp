@@ -0,0 +1,255 @@
+/*
+  AnomalyDetectors.cpp - Streaming O(1) fault detectors for MPPT telemetry
+  Released into the public domain.
+*/
+
+#include "AnomalyDetectors.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// fills and publishes an alert
+static void publish(AlertSink& sink, int64_t timestampUs, int kind, int channel, bool active,
+    double value, const char* message) {
+  Alert alert;
+  alert.timestampUs = timestampUs;
+  alert.kind = kind;
+  alert.channel = channel;
+  alert.active = active;
+  alert.value = value;
+  snprintf(alert.message, sizeof(alert.message), "%s", message);
+  sink.publishAlert(alert);
+}
+
+// detectors that do not care about shutdowns ignore them
+void AnomalyDetector::onShutdown(int64_t timestampUs, int code, AlertSink& sink) {
+  (void)timestampUs;
+  (void)code;
+  (void)sink;
+}
+
+// Duty Cycle ----------------------------------------------------------------
+
+DutyCycleDetector::DutyCycleDetector(int pinnedSamples, int32_t minPanelPower, int reversalWindow,
+    int reversalLimit, int32_t swingLimit) {
+  _pinnedSamples = pinnedSamples;
+  _minPanelPower = minPanelPower;
+  _reversalWindow = reversalWindow < 1 ? 1 : (reversalWindow > 256 ? 256 : reversalWindow);
+  _reversalLimit = reversalLimit;
+  _swingLimit = swingLimit;
+  memset(_reversals, 0, sizeof(_reversals));
+}
+
+// tracks how long the duty sits still, and how often it reverses direction in a window
+void DutyCycleDetector::onSample(const TelemetrySample& sample, AlertSink& sink) {
+  int32_t duty = sample.values[DUTY_CYCLE];
+  char message[96];
+  // pinned: count samples without a change while there is power to track
+  if (duty == _lastDuty && sample.values[HIGH_SIDE_POWER] >= _minPanelPower) {
+    _unchangedCount++;
+  } else {
+    _unchangedCount = 0;
+  }
+  if (!_pinnedActive && _unchangedCount >= _pinnedSamples) {
+    snprintf(message, sizeof(message), "duty pinned at %d for %d samples", (int)duty, _unchangedCount);
+    publish(sink, sample.timestampUs, ALERT_DUTY_PINNED, DUTY_CYCLE, true, duty, message);
+    _pinnedActive = true;
+  } else if (_pinnedActive && duty != _lastDuty) {
+    publish(sink, sample.timestampUs, ALERT_DUTY_PINNED, DUTY_CYCLE, false, duty, "duty moving again");
+    _pinnedActive = false;
+  }
+  // limit cycle: direction reversals with a wide swing from the reversal point before, in a sliding window;
+  // the narrow ones are the IC step dithering at the maximum power point and do not count
+  int reversal = 0;
+  if (_lastDuty >= 0 && duty != _lastDuty) {
+    int direction = duty > _lastDuty ? 1 : -1;
+    if (_lastDirection != 0 && direction != _lastDirection) {
+      _swing = _lastDuty > _lastExtreme ? _lastDuty - _lastExtreme : _lastExtreme - _lastDuty;
+      _lastExtreme = _lastDuty;
+      reversal = _swing >= _swingLimit;
+    }
+    _lastDirection = direction;
+  }
+  _reversalCount += reversal - _reversals[_reversalIndex];
+  _reversals[_reversalIndex] = (uint8_t)reversal;
+  _reversalIndex = (_reversalIndex + 1)%_reversalWindow;
+  bool cycling = _reversalCount >= _reversalLimit;
+  if (cycling && !_cycleActive) {
+    snprintf(message, sizeof(message), "duty limit cycle: %d wide reversals in %d samples, swing %d",
+      _reversalCount, _reversalWindow, (int)_swing);
+    publish(sink, sample.timestampUs, ALERT_DUTY_LIMIT_CYCLE, DUTY_CYCLE, true, _swing, message);
+    _cycleActive = true;
+  } else if (_cycleActive && _reversalCount < _reversalLimit/2) {
+    publish(sink, sample.timestampUs, ALERT_DUTY_LIMIT_CYCLE, DUTY_CYCLE, false, _swing, "duty settled");
+    _cycleActive = false;
+  }
+  _lastDuty = duty;
+}
+
+// Stuck Sensor --------------------------------------------------------------
+
+static const int WATCHED_CHANNELS[4] = {LOW_SIDE_VOLTAGE, LOW_SIDE_CURRENT, HIGH_SIDE_VOLTAGE,
+  HIGH_SIDE_CURRENT};
+
+StuckSensorDetector::StuckSensorDetector(int stuckSamples) {
+  _stuckSamples = stuckSamples;
+  for (int n = 0; n < NUM_WATCHED; n++) {
+    _last[n] = INT32_MIN;
+    _runLength[n] = 0;
+    _active[n] = false;
+  }
+}
+
+// counts exact repeats of each sensor channel
+void StuckSensorDetector::onSample(const TelemetrySample& sample, AlertSink& sink) {
+  for (int n = 0; n < NUM_WATCHED; n++) {
+    int channel = WATCHED_CHANNELS[n];
+    int32_t value = sample.values[channel];
+    if (value == _last[n]) {
+      _runLength[n]++;
+    } else {
+      if (_active[n]) {
+        char message[96];
+        snprintf(message, sizeof(message), "%s changing again", CHANNEL_NAMES[channel]);
+        publish(sink, sample.timestampUs, ALERT_STUCK_SENSOR, channel, false, value, message);
+        _active[n] = false;
+      }
+      _runLength[n] = 0;
+      _last[n] = value;
+    }
+    if (!_active[n] && _runLength[n] >= _stuckSamples) {
+      char message[96];
+      snprintf(message, sizeof(message), "%s stuck at %d for %d samples", CHANNEL_NAMES[channel],
+        (int)value, _runLength[n]);
+      publish(sink, sample.timestampUs, ALERT_STUCK_SENSOR, channel, true, value, message);
+      _active[n] = true;
+    }
+  }
+}
+
+// Efficiency ----------------------------------------------------------------
+
+EfficiencyDropDetector::EfficiencyDropDetector(int32_t minPanelPower, double dropLimit, double floor,
+    int fastSamples, int baselineSamples) {
+  _minPanelPower = minPanelPower;
+  _dropLimit = dropLimit;
+  _floor = floor;
+  _fastAlpha = 1.0/(fastSamples > 0 ? fastSamples : 1);
+  _baselineAlpha = 1.0/(baselineSamples > 0 ? baselineSamples : 1);
+  _warmupSamples = fastSamples*2;
+}
+
+// compares a fast and a slow exponential average of LowSidePower/HighSidePower
+void EfficiencyDropDetector::onSample(const TelemetrySample& sample, AlertSink& sink) {
+  int32_t panelPower = sample.values[HIGH_SIDE_POWER];
+  if (panelPower < _minPanelPower)
+    return; // leave the averages alone overnight
+  double efficiency = (double)sample.values[LOW_SIDE_POWER]/panelPower;
+  if (_samples == 0) {
+    _fast = efficiency;
+    _baseline = efficiency;
+  }
+  _samples++;
+  _fast += (efficiency - _fast)*_fastAlpha;
+  // the baseline only learns from healthy periods so a slow fault cannot drag it down
+  if (!_active)
+    _baseline += (efficiency - _baseline)*_baselineAlpha;
+  if (_samples < _warmupSamples)
+    return;
+  bool low = _fast < _baseline - _dropLimit || _fast < _floor;
+  char message[96];
+  if (low && !_active) {
+    snprintf(message, sizeof(message), "efficiency %.1f%% (baseline %.1f%%)", _fast*100.0, _baseline*100.0);
+    publish(sink, sample.timestampUs, ALERT_EFFICIENCY_DROP, LOW_SIDE_POWER, true, _fast, message);
+    _active = true;
+  } else if (!low && _active && _fast > _baseline - _dropLimit/2 && _fast > _floor) {
+    snprintf(message, sizeof(message), "efficiency recovered to %.1f%%", _fast*100.0);
+    publish(sink, sample.timestampUs, ALERT_EFFICIENCY_DROP, LOW_SIDE_POWER, false, _fast, message);
+    _active = false;
+  }
+}
+
+// Repeated Shutdown ---------------------------------------------------------
+
+RepeatedShutdownDetector::RepeatedShutdownDetector(int countLimit, int64_t windowUs) {
+  _countLimit = countLimit < 2 ? 2 : (countLimit > EVENTS_MAX ? EVENTS_MAX : countLimit);
+  _windowUs = windowUs;
+}
+
+// clears the alert once the window holds fewer events than the limit
+void RepeatedShutdownDetector::onSample(const TelemetrySample& sample, AlertSink& sink) {
+  if (!_active)
+    return;
+  int oldest = (_eventIndex - _countLimit + EVENTS_MAX)%EVENTS_MAX;
+  if (sample.timestampUs - _events[oldest] > _windowUs) {
+    publish(sink, sample.timestampUs, ALERT_REPEATED_SHUTDOWN, -1, false, 0, "no recent shutdowns");
+    _active = false;
+  }
+}
+
+// remembers the last events; alerts when the countLimit-th previous one is inside the window
+void RepeatedShutdownDetector::onShutdown(int64_t timestampUs, int code, AlertSink& sink) {
+  _events[_eventIndex] = timestampUs;
+  _eventIndex = (_eventIndex + 1)%EVENTS_MAX;
+  if (_eventCount < EVENTS_MAX)
+    _eventCount++;
+  if (_active || _eventCount < _countLimit)
+    return;
+  int oldest = (_eventIndex - _countLimit + EVENTS_MAX)%EVENTS_MAX;
+  if (timestampUs - _events[oldest] <= _windowUs) {
+    char message[96];
+    snprintf(message, sizeof(message), "%d shutdowns within %lld s, last code %d", _countLimit,
+      (long long)(_windowUs/1000000), code);
+    publish(sink, timestampUs, ALERT_REPEATED_SHUTDOWN, -1, true, code, message);
+    _active = true;
+  }
+}
+
+// Pipeline ------------------------------------------------------------------
+
+// appends a detector
+void AnomalyPipeline::addDetector(std::unique_ptr<AnomalyDetector> detector) {
+  _detectors.push_back(std::move(detector));
+}
+
+// adds every built-in detector with default thresholds
+void AnomalyPipeline::addDefaultDetectors() {
+  addDetector(std::unique_ptr<AnomalyDetector>(new DutyCycleDetector()));
+  addDetector(std::unique_ptr<AnomalyDetector>(new StuckSensorDetector()));
+  addDetector(std::unique_ptr<AnomalyDetector>(new EfficiencyDropDetector()));
+  addDetector(std::unique_ptr<AnomalyDetector>(new RepeatedShutdownDetector()));
+}
+
+// adds one built-in detector by its getName(), with default thresholds
+bool AnomalyPipeline::addDetectorByName(const char* name) {
+  std::unique_ptr<AnomalyDetector> detector;
+  if (strcmp(name, "duty") == 0)
+    detector.reset(new DutyCycleDetector());
+  else if (strcmp(name, "stuck") == 0)
+    detector.reset(new StuckSensorDetector());
+  else if (strcmp(name, "efficiency") == 0)
+    detector.reset(new EfficiencyDropDetector());
+  else if (strcmp(name, "shutdown") == 0)
+    detector.reset(new RepeatedShutdownDetector());
+  else
+    return false;
+  addDetector(std::move(detector));
+  return true;
+}
+
+// feeds one record to every detector
+void AnomalyPipeline::onSample(const TelemetrySample& sample, AlertSink& sink) {
+  for (auto& detector : _detectors)
+    detector->onSample(sample, sink);
+}
+
+// feeds one shutdown event to every detector
+void AnomalyPipeline::onShutdown(int64_t timestampUs, int code, AlertSink& sink) {
+  for (auto& detector : _detectors)
+    detector->onShutdown(timestampUs, code, sink);
+}
+
+// number of detectors in the pipeline
+int AnomalyPipeline::getNumDetectors() {
+  return (int)_detectors.size();
+}
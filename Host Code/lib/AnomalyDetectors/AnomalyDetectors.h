@@ -0,0 +1,159 @@
+/*
+  AnomalyDetectors.h - Streaming O(1) fault detectors for MPPT telemetry
+  Released into the public domain.
+
+  Every detector sees each record once, keeps a fixed amount of state and
+  raises/clears alerts through an AlertSink. New detectors subclass
+  AnomalyDetector and are added to an AnomalyPipeline; atverterd runs one
+  pipeline per device.
+*/
+
+#ifndef AnomalyDetectors_h
+#define AnomalyDetectors_h
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#include "Telemetry.h"
+
+// alert kinds for convenience and bookkeeping
+enum AlertKinds
+{   ALERT_DUTY_PINNED = 0, // duty unchanged for a long time while the panel produces power
+    ALERT_DUTY_LIMIT_CYCLE, // duty keeps reversing direction with a large swing
+    ALERT_STUCK_SENSOR, // a sensor channel repeats the exact same value
+    ALERT_EFFICIENCY_DROP, // LowSidePower/HighSidePower fell below its own baseline
+    ALERT_REPEATED_SHUTDOWN, // several gate shutdowns in a short window
+    NUM_ALERTKINDS
+};
+
+const char * const ALERT_NAMES[NUM_ALERTKINDS] = {
+  "duty_pinned",
+  "duty_limit_cycle",
+  "stuck_sensor",
+  "efficiency_drop",
+  "repeated_shutdown"};
+
+struct Alert
+{
+  int64_t timestampUs; // timestamp of the record that raised or cleared the alert
+  int kind; // AlertKinds
+  int channel; // TelemetryChannel involved, or -1
+  bool active; // true when raised, false when cleared
+  double value; // the measurement that crossed the threshold
+  char message[96]; // human readable summary
+};
+
+// receives alerts from detectors, e.g. atverterd's /alerts channel and metrics
+class AlertSink
+{
+  public:
+    virtual ~AlertSink() {}
+    virtual void publishAlert(const Alert& alert) = 0;
+};
+
+class AnomalyDetector
+{
+  public:
+    virtual ~AnomalyDetector() {}
+    virtual const char* getName() = 0; // short name used to enable/disable the detector
+    virtual void onSample(const TelemetrySample& sample, AlertSink& sink) = 0; // one call per record
+    virtual void onShutdown(int64_t timestampUs, int code, AlertSink& sink); // one call per shutdown event
+};
+
+// duty pinned at one value, or limit cycling with a wide swing; the IC step moves the duty 1 % a record
+// (DUTY_CYCLE_INCREMENT), so tracking dithers with a swing of 1 or 2 and a swing of 3 or more is hunting
+class DutyCycleDetector : public AnomalyDetector
+{
+  public:
+    DutyCycleDetector(int pinnedSamples = 900, int32_t minPanelPower = 5000, int reversalWindow = 60,
+      int reversalLimit = 10, int32_t swingLimit = 3);
+    const char* getName() override { return "duty"; }
+    void onSample(const TelemetrySample& sample, AlertSink& sink) override;
+  private:
+    int _pinnedSamples; // samples without a duty change before alerting
+    int32_t _minPanelPower; // mW, below this the duty is allowed to sit still (night)
+    int _reversalWindow; // samples in the sliding reversal window (max 256)
+    int _reversalLimit; // wide reversals in the window that count as a limit cycle, at most reversalWindow/swingLimit
+    int32_t _swingLimit; // duty swing (max - min of the last 2 extremes) that makes a reversal wide
+    int32_t _lastDuty = -1;
+    int _lastDirection = 0; // -1, 0, +1
+    int32_t _lastExtreme = 0; // duty at the last reversal
+    int32_t _swing = 0; // distance between the last two reversal points
+    int _unchangedCount = 0;
+    uint8_t _reversals[256]; // ring of per-sample wide reversal flags
+    int _reversalIndex = 0;
+    int _reversalCount = 0; // running sum of _reversals
+    bool _pinnedActive = false;
+    bool _cycleActive = false;
+};
+
+// a voltage or current channel repeating the exact same value; the firmware's moving
+// averages normally dither by a few counts, so an exact repeat means a dead sensor
+class StuckSensorDetector : public AnomalyDetector
+{
+  public:
+    StuckSensorDetector(int stuckSamples = 300);
+    const char* getName() override { return "stuck"; }
+    void onSample(const TelemetrySample& sample, AlertSink& sink) override;
+  private:
+    static const int NUM_WATCHED = 4;
+    int _stuckSamples;
+    int32_t _last[NUM_WATCHED];
+    int _runLength[NUM_WATCHED];
+    bool _active[NUM_WATCHED];
+};
+
+// conversion efficiency: a fast average falling well below a slow baseline, or below a floor
+class EfficiencyDropDetector : public AnomalyDetector
+{
+  public:
+    EfficiencyDropDetector(int32_t minPanelPower = 10000, double dropLimit = 0.10, double floor = 0.60,
+      int fastSamples = 60, int baselineSamples = 3600);
+    const char* getName() override { return "efficiency"; }
+    void onSample(const TelemetrySample& sample, AlertSink& sink) override;
+  private:
+    int32_t _minPanelPower; // mW, efficiency is meaningless near zero power
+    double _dropLimit; // alert when fast average < baseline - dropLimit
+    double _floor; // alert when fast average < floor
+    double _fastAlpha;
+    double _baselineAlpha;
+    double _fast = 0.0;
+    double _baseline = 0.0;
+    long _samples = 0; // samples with enough power, for warm-up
+    int _warmupSamples;
+    bool _active = false;
+};
+
+// several shutdown events within a window
+class RepeatedShutdownDetector : public AnomalyDetector
+{
+  public:
+    RepeatedShutdownDetector(int countLimit = 3, int64_t windowUs = 600LL*1000000);
+    const char* getName() override { return "shutdown"; }
+    void onSample(const TelemetrySample& sample, AlertSink& sink) override;
+    void onShutdown(int64_t timestampUs, int code, AlertSink& sink) override;
+  private:
+    static const int EVENTS_MAX = 16;
+    int _countLimit; // events in the window that raise the alert (max 16)
+    int64_t _windowUs;
+    int64_t _events[EVENTS_MAX]; // ring of recent event timestamps
+    int _eventIndex = 0;
+    int _eventCount = 0;
+    bool _active = false;
+};
+
+class AnomalyPipeline
+{
+  public:
+    void addDetector(std::unique_ptr<AnomalyDetector> detector); // appends a detector
+    void addDefaultDetectors(); // adds every detector above with default thresholds
+    bool addDetectorByName(const char* name); // adds one built-in detector by getName(), with defaults
+    void onSample(const TelemetrySample& sample, AlertSink& sink); // feeds every detector
+    void onShutdown(int64_t timestampUs, int code, AlertSink& sink); // feeds every detector
+    int getNumDetectors(); // number of detectors in the pipeline
+  private:
+    std::vector<std::unique_ptr<AnomalyDetector> > _detectors;
+};
+
+#endif
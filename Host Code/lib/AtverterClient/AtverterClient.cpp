@@ -0,0 +1,345 @@
+/*
+  AtverterClient.cpp - Host side of the AtverterH command protocol
+  Released into the public domain.
+*/
+
+#include "AtverterClient.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <chrono>
+
+static double steadySeconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Serial Transport ----------------------------------------------------------
+
+// opens the port in raw mode
+bool SerialTransport::open(const char* path, int baud) {
+  return _port.open(path, baud);
+}
+
+// closes the port
+void SerialTransport::close() {
+  _port.close();
+}
+
+// sends one command line; PicroBoard::parseRXLine() splits it at ':' and '\n'
+bool SerialTransport::sendCommand(const char* command) {
+  char line[CLIENT_COMMAND_MAX + 2];
+  int length = snprintf(line, sizeof(line), "%s\n", command);
+  if (length < 0 || length > CLIENT_COMMAND_MAX)
+    return false;
+  return _port.write(line, length);
+}
+
+// next line from the UART, waiting up to timeoutMs for it
+int SerialTransport::readLine(std::string& line, int timeoutMs) {
+  double deadline = steadySeconds() + timeoutMs/1000.0;
+  while (true) {
+    if (_port.nextLine(line))
+      return 1;
+    int waitMs = (int)((deadline - steadySeconds())*1000.0 + 0.999);
+    if (waitMs <= 0)
+      return 0;
+    struct pollfd fd = {_port.getFd(), POLLIN, 0};
+    int ready = poll(&fd, 1, waitMs);
+    if (ready < 0 && errno != EINTR)
+      return -1;
+    if (ready > 0 && _port.readAvailable() < 0)
+      return -1;
+  }
+}
+
+// I2C Transport -------------------------------------------------------------
+
+I2cTransport::~I2cTransport() {
+  close();
+}
+
+// opens the bus and selects the converter as slave
+bool I2cTransport::open(const char* path, int address) {
+  close();
+  _fd = ::open(path, O_RDWR);
+  if (_fd < 0)
+    return false;
+  if (ioctl(_fd, I2C_SLAVE, address) < 0) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+// closes the bus
+void I2cTransport::close() {
+  if (_fd >= 0)
+    ::close(_fd);
+  _fd = -1;
+  _answers.clear();
+}
+
+// writes the command, then reads the answer the firmware prepared while receiving it
+bool I2cTransport::sendCommand(const char* command) {
+  if (_fd < 0)
+    return false;
+  // the firmware drops the first byte, the "command byte" of SMBus style masters
+  char message[CLIENT_COMMAND_MAX + 2];
+  int length = snprintf(message, sizeof(message), "%c%s", 0, command);
+  if (length < 0 || length > CLIENT_COMMAND_MAX)
+    return false;
+  if (::write(_fd, message, length) != length)
+    return false;
+  // PicroBoard::requestEventI2C() sends the TX buffer without a terminator; the rest reads as 0xFF
+  char answer[CLIENT_COMMAND_MAX + 1]; // the firmware's whole TX buffer
+  ssize_t got = ::read(_fd, answer, sizeof(answer));
+  if (got <= 0)
+    return false;
+  size_t size = 0;
+  while (size < (size_t)got && answer[size] != '\0' && (uint8_t)answer[size] != 0xFF)
+    size++;
+  if (size > 0)
+    _answers.push_back(std::string(answer, size));
+  return true;
+}
+
+// returns the stored answer; an empty TX buffer means the command was not understood, and
+// no answer will come later, so that simply runs into the timeout
+int I2cTransport::readLine(std::string& line, int timeoutMs) {
+  if (_fd < 0)
+    return -1;
+  if (_answers.empty()) {
+    usleep(timeoutMs*1000);
+    return 0;
+  }
+  line = _answers.front();
+  _answers.pop_front();
+  return 1;
+}
+
+// Client --------------------------------------------------------------------
+
+AtverterClient::AtverterClient(AtverterTransport& transport) : _transport(transport) {
+  setWindow(CLIENT_DEFAULT_WINDOW);
+}
+
+// timeout of each attempt
+void AtverterClient::setTimeout(int milliseconds) {
+  _timeoutMs = milliseconds > 0 ? milliseconds : 1;
+}
+
+// sends per request, 1 disables retries
+void AtverterClient::setAttempts(int attempts) {
+  _attempts = attempts > 0 ? attempts : 1;
+}
+
+// commands in flight, clamped to what the transport supports
+void AtverterClient::setWindow(int window) {
+  int maxWindow = _transport.getMaxWindow();
+  _window = window < 1 ? 1 : (window > maxWindow ? maxWindow : window);
+}
+
+int AtverterClient::getWindow() {
+  return _window;
+}
+
+int AtverterClient::getAttempts() {
+  return _attempts;
+}
+
+// commands sent again after a timeout
+long AtverterClient::getRetries() {
+  return _retries;
+}
+
+// lines that answered no request: telemetry, shutdown messages, late answers
+long AtverterClient::getIgnoredLines() {
+  return _ignoredLines;
+}
+
+// formats and sends the command for one request
+bool AtverterClient::sendRequest(AtverterRequest& request) {
+  const AtverterRegister& info = REGISTERS[request.reg];
+  char command[CLIENT_COMMAND_MAX + 1];
+  if (request.write)
+    snprintf(command, sizeof(command), "%s:%ld", info.writeCommand, (long)request.value);
+  else
+    snprintf(command, sizeof(command), "%s:", info.readCommand);
+  request.attempts++;
+  return _transport.sendCommand(command);
+}
+
+// completes the oldest in-flight request a line answers; "KEY:value" answers a read,
+// "KEY:=value" echoes a write
+bool AtverterClient::matchResponse(const std::string& line, AtverterRequest* requests,
+    std::deque<InFlight>& inFlight) {
+  size_t colon = line.find(':');
+  if (colon == std::string::npos)
+    return false;
+  bool echo = colon + 1 < line.size() && line[colon + 1] == '=';
+  for (auto it = inFlight.begin(); it != inFlight.end(); ++it) {
+    AtverterRequest& request = requests[it->index];
+    if (request.write != echo || line.compare(0, colon, REGISTERS[request.reg].responseKey) != 0)
+      continue;
+    const char* text = line.c_str() + colon + 1 + (echo ? 1 : 0);
+    char* end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0')
+      request.status = REQUEST_BAD_RESPONSE;
+    else if (request.write && value != request.value)
+      request.status = REQUEST_BAD_RESPONSE; // e.g. the firmware clamped the limit
+    else
+      request.status = REQUEST_OK;
+    if (!request.write)
+      request.value = (int32_t)value;
+    inFlight.erase(it);
+    return true;
+  }
+  return false;
+}
+
+// pipelines a batch of requests, keeping up to getWindow() of them in flight
+bool AtverterClient::execute(AtverterRequest* requests, int count) {
+  std::deque<InFlight> inFlight;
+  int next = 0;
+  int done = 0;
+  bool allOk = true;
+  for (int n = 0; n < count; n++) {
+    requests[n].status = REQUEST_PENDING;
+    requests[n].attempts = 0;
+  }
+  std::string line;
+  while (done < count) {
+    // fill the window
+    while ((int)inFlight.size() < _window && next < count) {
+      AtverterRequest& request = requests[next];
+      if (request.reg < 0 || request.reg >= NUM_REGISTERS
+        || (request.write ? REGISTERS[request.reg].writeCommand : REGISTERS[request.reg].readCommand) == NULL) {
+        request.status = REQUEST_UNSUPPORTED;
+        done++;
+      } else if (!sendRequest(request)) {
+        request.status = REQUEST_LINK_ERROR;
+        done++;
+      } else {
+        inFlight.push_back({next, steadySeconds() + _timeoutMs/1000.0});
+      }
+      next++;
+    }
+    if (inFlight.empty())
+      continue;
+    // wait for an answer until the oldest request times out
+    int waitMs = (int)((inFlight.front().deadline - steadySeconds())*1000.0 + 0.999);
+    int got = _transport.readLine(line, waitMs > 0 ? waitMs : 0);
+    if (got > 0) {
+      if (matchResponse(line, requests, inFlight))
+        done++;
+      else
+        _ignoredLines++;
+      continue;
+    }
+    if (got < 0) { // the link is gone, fail everything still open
+      for (InFlight& f : inFlight)
+        requests[f.index].status = REQUEST_LINK_ERROR;
+      for (int n = next; n < count; n++)
+        requests[n].status = REQUEST_LINK_ERROR;
+      return false;
+    }
+    if (steadySeconds() < inFlight.front().deadline)
+      continue;
+    // the oldest request timed out: send it again or give up
+    InFlight expired = inFlight.front();
+    inFlight.pop_front();
+    AtverterRequest& request = requests[expired.index];
+    if (request.attempts < _attempts && sendRequest(request)) {
+      _retries++;
+      inFlight.push_back({expired.index, steadySeconds() + _timeoutMs/1000.0});
+    } else {
+      request.status = REQUEST_TIMEOUT;
+      done++;
+    }
+  }
+  for (int n = 0; n < count; n++)
+    allOk = allOk && requests[n].status == REQUEST_OK;
+  return allOk;
+}
+
+// one read, returns a RequestStatus
+int AtverterClient::readRegister(int reg, int32_t& value) {
+  AtverterRequest request;
+  request.reg = reg;
+  execute(&request, 1);
+  if (request.status == REQUEST_OK)
+    value = request.value;
+  return request.status;
+}
+
+// one write, returns a RequestStatus
+int AtverterClient::writeRegister(int reg, int32_t value) {
+  AtverterRequest request;
+  request.reg = reg;
+  request.write = true;
+  request.value = value;
+  execute(&request, 1);
+  return request.status;
+}
+
+// Typed Registers -----------------------------------------------------------
+
+bool AtverterClient::getV1(int32_t& mV) {
+  return readRegister(REG_V1, mV) == REQUEST_OK;
+}
+
+bool AtverterClient::getV2(int32_t& mV) {
+  return readRegister(REG_V2, mV) == REQUEST_OK;
+}
+
+bool AtverterClient::getI1(int32_t& mA) {
+  return readRegister(REG_I1, mA) == REQUEST_OK;
+}
+
+bool AtverterClient::getI2(int32_t& mA) {
+  return readRegister(REG_I2, mA) == REQUEST_OK;
+}
+
+bool AtverterClient::getT1(int32_t& degC) {
+  return readRegister(REG_T1, degC) == REQUEST_OK;
+}
+
+bool AtverterClient::getT2(int32_t& degC) {
+  return readRegister(REG_T2, degC) == REQUEST_OK;
+}
+
+bool AtverterClient::getVCC(int32_t& mV) {
+  return readRegister(REG_VCC, mV) == REQUEST_OK;
+}
+
+bool AtverterClient::getDutyCycle(int32_t& percent) {
+  return readRegister(REG_DUTY_CYCLE, percent) == REQUEST_OK;
+}
+
+bool AtverterClient::getRDroop(int32_t& mOhm) {
+  return readRegister(REG_DROOP, mOhm) == REQUEST_OK;
+}
+
+bool AtverterClient::setRDroop(int32_t mOhm) {
+  return writeRegister(REG_DROOP, mOhm) == REQUEST_OK;
+}
+
+bool AtverterClient::setCurrentShutdown1(int32_t mA) {
+  return writeRegister(REG_CURRENT_SHUTDOWN1, mA) == REQUEST_OK;
+}
+
+bool AtverterClient::setCurrentShutdown2(int32_t mA) {
+  return writeRegister(REG_CURRENT_SHUTDOWN2, mA) == REQUEST_OK;
+}
+
+bool AtverterClient::setThermalShutdown(int32_t degC) {
+  return writeRegister(REG_THERMAL_SHUTDOWN, degC) == REQUEST_OK;
+}
@@ -0,0 +1,187 @@
+/*
+  AtverterClient.h - Host side of the AtverterH command protocol
+  Released into the public domain.
+
+  AtverterH::interpretRXCommand() answers "RV1:" with "WV1:<mV>", and a write
+  like "WIS1:6000" with the echo "WIS1:=6000". The protocol has no request ids,
+  so responses are matched to outstanding requests by their key (and by the
+  "=" that marks a write echo), oldest first. Telemetry and shutdown lines that
+  share the UART are skipped.
+
+  Requests are pipelined: up to getWindow() commands are in flight at once, so
+  the link is not idle while the firmware turns a command around. A request
+  without a response before the timeout is sent again, up to getAttempts()
+  times; every command is a plain register read or write, so a repeat is
+  harmless even if the first response was only late.
+
+  The same client runs over the UART (SerialTransport) or over I2C
+  (I2cTransport, /dev/i2c-N). I2C is strictly request/response, so its window
+  is always 1.
+*/
+
+#ifndef AtverterClient_h
+#define AtverterClient_h
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+#include "SerialPort.h"
+
+const int CLIENT_COMMAND_MAX = 15; // PicroBoard COMMBUFFERSIZE - 1, including the newline
+const int CLIENT_DEFAULT_TIMEOUT_MS = 250; // the firmware can stall ~50 ms printing telemetry
+const int CLIENT_DEFAULT_ATTEMPTS = 3;
+const int CLIENT_DEFAULT_WINDOW = 4; // commands in flight
+const int I2C_DEFAULT_ADDRESS = 0x08; // I2C_ADDRESS in AtverterH_MPPT.cpp
+
+// registers for convenience and bookkeeping
+enum AtverterRegisters
+{   REG_V1 = 0, // terminal 1 voltage, mV, read only
+    REG_V2, // terminal 2 voltage, mV, read only
+    REG_I1, // terminal 1 current, mA, read only
+    REG_I2, // terminal 2 current, mA, read only
+    REG_T1, // side 1 FET temperature, °C, read only
+    REG_T2, // side 2 FET temperature, °C, read only
+    REG_VCC, // ~5V VCC bus voltage, mV, read only
+    REG_DUTY_CYCLE, // duty cycle, %, read only
+    REG_DROOP, // droop resistance, mOhm, read and write
+    REG_CURRENT_SHUTDOWN1, // terminal 1 current shutdown limit, mA, write only
+    REG_CURRENT_SHUTDOWN2, // terminal 2 current shutdown limit, mA, write only
+    REG_THERMAL_SHUTDOWN, // thermal shutdown limit, °C, write only
+    NUM_REGISTERS
+};
+
+struct AtverterRegister
+{
+  const char* name;
+  const char* readCommand; // NULL if the register cannot be read
+  const char* writeCommand; // NULL if the register cannot be written
+  const char* responseKey; // key of the firmware's answer
+};
+
+const AtverterRegister REGISTERS[NUM_REGISTERS] = {
+  {"V1", "RV1", NULL, "WV1"},
+  {"V2", "RV2", NULL, "WV2"},
+  {"I1", "RI1", NULL, "WI1"},
+  {"I2", "RI2", NULL, "WI2"},
+  {"T1", "RT1", NULL, "WT1"},
+  {"T2", "RT2", NULL, "WT2"},
+  {"VCC", "RVCC", NULL, "WVCC"},
+  {"DutyCycle", "RDUT", NULL, "WDUT"},
+  {"RDroop", "RDRP", "WDRP", "WDRP"},
+  {"CurrentShutdown1", NULL, "WIS1", "WIS1"},
+  {"CurrentShutdown2", NULL, "WIS2", "WIS2"},
+  {"ThermalShutdown", NULL, "WTSD", "WTSD"}};
+
+// request status for convenience and bookkeeping
+enum RequestStatus
+{   REQUEST_PENDING = 0,
+    REQUEST_OK,
+    REQUEST_TIMEOUT, // no answer after every attempt
+    REQUEST_BAD_RESPONSE, // answer was not a number, or a write echoed another value
+    REQUEST_UNSUPPORTED, // register cannot be read (or written)
+    REQUEST_LINK_ERROR, // the transport failed
+    NUM_REQUESTSTATUS
+};
+
+const char * const REQUEST_STATUS_NAMES[NUM_REQUESTSTATUS] = {
+  "pending",
+  "ok",
+  "timeout",
+  "bad response",
+  "unsupported",
+  "link error"};
+
+struct AtverterRequest
+{
+  int reg = REG_V1; // AtverterRegisters
+  bool write = false;
+  int32_t value = 0; // value to write, or the value read back
+  int status = REQUEST_PENDING; // RequestStatus
+  int attempts = 0; // commands sent for this request
+};
+
+// a link to one converter
+class AtverterTransport
+{
+  public:
+    virtual ~AtverterTransport() {}
+    virtual bool sendCommand(const char* command) = 0; // sends "CMD:value", without the newline
+    virtual int readLine(std::string& line, int timeoutMs) = 0; // 1 got a line, 0 timed out, -1 link error
+    virtual int getMaxWindow() = 0; // commands the link can have in flight
+};
+
+// the converter's UART, shared with the telemetry stream
+class SerialTransport : public AtverterTransport
+{
+  public:
+    bool open(const char* path, int baud = SERIAL_DEFAULT_BAUD); // opens the port in raw mode
+    void close(); // closes the port
+    bool sendCommand(const char* command) override;
+    int readLine(std::string& line, int timeoutMs) override;
+    int getMaxWindow() override { return 8; } // the AVR's 64 byte RX buffer holds ~8 commands
+  private:
+    SerialPort _port;
+};
+
+// /dev/i2c-N with the converter as slave, see PicroBoard::receiveEventI2C()
+class I2cTransport : public AtverterTransport
+{
+  public:
+    ~I2cTransport(); // closes the bus
+    bool open(const char* path, int address = I2C_DEFAULT_ADDRESS); // opens the bus and selects the slave
+    void close(); // closes the bus
+    bool sendCommand(const char* command) override; // writes the command, then reads the answer
+    int readLine(std::string& line, int timeoutMs) override; // returns the stored answer
+    int getMaxWindow() override { return 1; }
+  private:
+    int _fd = -1;
+    std::deque<std::string> _answers;
+};
+
+class AtverterClient
+{
+  public:
+    AtverterClient(AtverterTransport& transport); // constructor
+    void setTimeout(int milliseconds); // per attempt
+    void setAttempts(int attempts); // sends per request, 1 disables retries
+    void setWindow(int window); // commands in flight, clamped to the transport's maximum
+    int getWindow(); // current window
+    int getAttempts(); // sends per request
+    bool execute(AtverterRequest* requests, int count); // pipelines a batch, true if all are REQUEST_OK
+    int readRegister(int reg, int32_t& value); // one read, returns a RequestStatus
+    int writeRegister(int reg, int32_t value); // one write, returns a RequestStatus
+    long getRetries(); // commands sent again after a timeout
+    long getIgnoredLines(); // lines that answered no request (telemetry, late answers)
+    // typed register API, each returns true on success
+    bool getV1(int32_t& mV); // terminal 1 voltage
+    bool getV2(int32_t& mV); // terminal 2 voltage
+    bool getI1(int32_t& mA); // terminal 1 current
+    bool getI2(int32_t& mA); // terminal 2 current
+    bool getT1(int32_t& degC); // side 1 FET temperature
+    bool getT2(int32_t& degC); // side 2 FET temperature
+    bool getVCC(int32_t& mV); // VCC bus voltage
+    bool getDutyCycle(int32_t& percent); // duty cycle
+    bool getRDroop(int32_t& mOhm); // droop resistance
+    bool setRDroop(int32_t mOhm); // droop resistance
+    bool setCurrentShutdown1(int32_t mA); // terminal 1 current shutdown limit
+    bool setCurrentShutdown2(int32_t mA); // terminal 2 current shutdown limit
+    bool setThermalShutdown(int32_t degC); // thermal shutdown limit
+  private:
+    struct InFlight
+    {
+      int index; // into the batch
+      double deadline; // steady clock seconds
+    };
+    AtverterTransport& _transport;
+    int _timeoutMs = CLIENT_DEFAULT_TIMEOUT_MS;
+    int _attempts = CLIENT_DEFAULT_ATTEMPTS;
+    int _window = CLIENT_DEFAULT_WINDOW;
+    long _retries = 0;
+    long _ignoredLines = 0;
+    bool sendRequest(AtverterRequest& request); // formats and sends one command
+    bool matchResponse(const std::string& line, AtverterRequest* requests,
+      std::deque<InFlight>& inFlight); // completes the request a line answers, if any
+};
+
+#endif
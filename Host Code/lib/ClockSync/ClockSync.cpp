@@ -0,0 +1,163 @@
+/*
+  ClockSync.cpp - Maps the AtverterH control tick counter to host time
+  Released into the public domain.
+*/
+
+#include "ClockSync.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+ClockSync::ClockSync() {
+}
+
+// sets the nominal tick period, only used to report the drift
+void ClockSync::setTickPeriod(double microseconds) {
+  _tickUs = microseconds;
+  if (!_locked)
+    _slopeUs = microseconds;
+}
+
+// sets the UART speed, so each exchange can take the request and answer off the wire time
+void ClockSync::setBaud(int baud) {
+  _byteUs = baud > 0 ? 10e6/baud : 0.0;
+}
+
+// forgets every exchange, e.g. after the device restarted and its counter began again at 0
+void ClockSync::reset() {
+  _window.clear();
+  _pending = false;
+  _nextUs = 0.0;
+  _newestTicks = -1;
+  _locked = false;
+  _slopeUs = _tickUs;
+  _residualUs = 0.0;
+  _roundTripUs = 0.0;
+}
+
+// true when the next exchange should be started, gives up on an unanswered one
+bool ClockSync::isDue(double hostUs) {
+  if (_pending && hostUs - _sentUs > CLOCK_SYNC_TIMEOUT_US) {
+    _pending = false;
+    _timeouts++;
+  }
+  return !_pending && hostUs >= _nextUs;
+}
+
+// call right after "RTCK:" was written to the port
+void ClockSync::beginExchange(double hostUs) {
+  _pending = true;
+  _sentUs = hostUs;
+  _nextUs = hostUs + (_locked ? CLOCK_SYNC_INTERVAL_US : CLOCK_SYNC_FAST_INTERVAL_US);
+}
+
+// call when "WTCK:<ticks>" arrives, returns false if no exchange was pending
+bool ClockSync::completeExchange(uint32_t ticks, double hostUs) {
+  if (!_pending)
+    return false;
+  _pending = false;
+  int64_t unwrapped = unwrap(ticks);
+  if (!_window.empty() && unwrapped < _window.back().ticks) { // counter went back: the device restarted
+    reset();
+    unwrapped = unwrap(ticks);
+  }
+  // the counter was read after the request's last byte arrived and before the answer's first byte left
+  char digits[12];
+  int answerBytes = snprintf(digits, sizeof(digits), "%lu", (unsigned long)ticks) + 7; // "WTCK:" ... "\r\n"
+  double earliest = _sentUs + 6*_byteUs; // "RTCK:\n"
+  double latest = hostUs - answerBytes*_byteUs;
+  ClockSyncExchange exchange;
+  exchange.ticks = unwrapped;
+  exchange.deviceTicks = unwrapped + 0.5;
+  exchange.hostUs = (earliest + latest)/2.0;
+  exchange.roundTripUs = latest - earliest;
+  if (_window.size() >= (size_t)CLOCK_SYNC_WINDOW)
+    _window.erase(_window.begin());
+  _window.push_back(exchange);
+  _exchanges++;
+  fit();
+  return true;
+}
+
+// extends a 32-bit counter value to 64 bits, relative to the newest value seen
+int64_t ClockSync::unwrap(uint32_t ticks) {
+  if (_newestTicks < 0) {
+    _newestTicks = ticks;
+    return ticks;
+  }
+  int64_t unwrapped = _newestTicks + (int32_t)(ticks - (uint32_t)_newestTicks);
+  if (unwrapped > _newestTicks)
+    _newestTicks = unwrapped;
+  return unwrapped;
+}
+
+// least squares of host time against device ticks over the quickest half of the window
+void ClockSync::fit() {
+  std::vector<const ClockSyncExchange*> quickest;
+  for (const ClockSyncExchange& exchange : _window)
+    quickest.push_back(&exchange);
+  std::sort(quickest.begin(), quickest.end(), [](const ClockSyncExchange* a, const ClockSyncExchange* b) {
+    return a->roundTripUs < b->roundTripUs; });
+  size_t used = std::max(quickest.size()/2, std::min(quickest.size(), (size_t)CLOCK_SYNC_MIN_EXCHANGES));
+  quickest.resize(used);
+  _roundTripUs = quickest[0]->roundTripUs;
+  // center both axes so the sums stay small next to 2^53
+  double meanTicks = 0.0, meanUs = 0.0, firstUs = quickest[0]->hostUs, lastUs = firstUs;
+  for (const ClockSyncExchange* exchange : quickest) {
+    meanTicks += exchange->deviceTicks;
+    meanUs += exchange->hostUs;
+    firstUs = std::min(firstUs, exchange->hostUs);
+    lastUs = std::max(lastUs, exchange->hostUs);
+  }
+  meanTicks /= used;
+  meanUs /= used;
+  double sxx = 0.0, sxy = 0.0;
+  for (const ClockSyncExchange* exchange : quickest) {
+    double dx = exchange->deviceTicks - meanTicks;
+    sxx += dx*dx;
+    sxy += dx*(exchange->hostUs - meanUs);
+  }
+  _locked = used >= (size_t)CLOCK_SYNC_MIN_EXCHANGES && lastUs - firstUs >= CLOCK_SYNC_LOCK_SPAN_US;
+  // until the exchanges span enough time for the drift, keep the nominal period and fit the offset only
+  _slopeUs = (_locked && sxx > 0.0) ? sxy/sxx : _tickUs;
+  _baseTicks = meanTicks;
+  _baseUs = meanUs;
+  double squares = 0.0;
+  for (const ClockSyncExchange* exchange : quickest) {
+    double error = exchange->hostUs - (_baseUs + _slopeUs*(exchange->deviceTicks - _baseTicks));
+    squares += error*error;
+  }
+  _residualUs = sqrt(squares/used);
+}
+
+// true once enough exchanges over a long enough time are fitted
+bool ClockSync::isLocked() {
+  return _locked;
+}
+
+// host time at which the counter reached ticks, e.g. the sampling instant of a record
+double ClockSync::toHostUs(uint32_t ticks) {
+  return _baseUs + _slopeUs*((double)unwrap(ticks) - _baseTicks);
+}
+
+// positive when the device's ticks are longer than nominal
+double ClockSync::getDriftPpm() {
+  return (_slopeUs/_tickUs - 1.0)*1e6;
+}
+
+double ClockSync::getResidualUs() {
+  return _residualUs;
+}
+
+double ClockSync::getRoundTripUs() {
+  return _roundTripUs;
+}
+
+long ClockSync::getExchanges() {
+  return _exchanges;
+}
+
+long ClockSync::getTimeouts() {
+  return _timeouts;
+}
@@ -0,0 +1,89 @@
+/*
+  ClockSync.h - Maps the AtverterH control tick counter to host time
+  Released into the public domain.
+
+  The firmware counts control timer interrupts (AtverterH::getTicks()) and
+  prints the tick of every record ("Tick: N"). Stamping records with the host
+  clock when their line arrives adds the UART transfer, the USB adapter's
+  latency timer and the poll() loop to every timestamp, tens of milliseconds of
+  jitter. Instead the host keeps a fit of host time against ticks:
+
+    host "RTCK:"  --- request on the wire --->  device reads the counter
+    host receives <--- "WTCK:<ticks>" -------  device answers from loop()
+
+  Each exchange brackets the moment the counter was read between the end of
+  the request and the start of the answer, both known from the wire times.
+  Exchanges delayed by a telemetry line, the ISR or the adapter show up as a
+  long round trip and are left out: only the quickest half of the last
+  CLOCK_SYNC_WINDOW exchanges is fitted, by least squares, giving the offset
+  and the drift of the device's clock (ceramic resonators are off by up to a
+  few thousand ppm). The 1 tick quantization of every reading averages out
+  over the fitted exchanges, since requests land at random tick phases.
+
+  The fit works on whatever host clock the caller passes, preferably a
+  monotonic one; a step of the wall clock then moves no device timestamps.
+  The 32-bit tick counter wraps after 49 days at 1 kHz; ticks are unwrapped
+  against the newest tick seen, so readings must arrive less than 2^31 ticks
+  apart.
+*/
+
+#ifndef ClockSync_h
+#define ClockSync_h
+
+#include <stdint.h>
+#include <vector>
+
+const double CLOCK_SYNC_DEFAULT_TICK_US = 1000.0; // INTERRUPT_TIME in AtverterH_MPPT.cpp
+const int CLOCK_SYNC_WINDOW = 64; // exchanges kept for the fit
+const int CLOCK_SYNC_MIN_EXCHANGES = 4; // fitted exchanges before isLocked()
+const double CLOCK_SYNC_LOCK_SPAN_US = 10e6; // and the host time they must span, for the drift
+const double CLOCK_SYNC_TIMEOUT_US = 1e6; // an exchange without an answer is given up after this
+const double CLOCK_SYNC_FAST_INTERVAL_US = 1e6; // between exchanges until locked
+const double CLOCK_SYNC_INTERVAL_US = 5e6; // between exchanges once locked
+
+struct ClockSyncExchange
+{
+  int64_t ticks; // unwrapped counter value of the answer
+  double deviceTicks; // ticks + 0.5, the mean reading instant within the tick
+  double hostUs; // host time the counter was read, midpoint of the bracket
+  double roundTripUs; // request sent to answer received, less the wire times
+};
+
+class ClockSync
+{
+  public:
+    ClockSync(); // constructor
+    void setTickPeriod(double microseconds); // nominal tick period, for getDriftPpm()
+    void setBaud(int baud); // UART speed for the wire times of request and answer, 0 to ignore them
+    void reset(); // forgets every exchange, e.g. after the device restarted
+    bool isDue(double hostUs); // true when the next exchange should be started
+    void beginExchange(double hostUs); // call right after sending "RTCK:"
+    bool completeExchange(uint32_t ticks, double hostUs); // call when "WTCK:" arrives, false if none is pending
+    int64_t unwrap(uint32_t ticks); // extends a counter value to 64 bits
+    bool isLocked(); // true once device times can be mapped
+    double toHostUs(uint32_t ticks); // host time of a tick, only meaningful while isLocked()
+    double getDriftPpm(); // how much longer a device tick is than nominal, in ppm
+    double getResidualUs(); // RMS distance of the fitted exchanges from the fit
+    double getRoundTripUs(); // round trip of the quickest exchange in the window
+    long getExchanges(); // exchanges completed
+    long getTimeouts(); // exchanges given up
+  private:
+    double _tickUs = CLOCK_SYNC_DEFAULT_TICK_US;
+    double _byteUs = 0.0; // time on the wire of one byte, 10 bits at the baud rate
+    std::vector<ClockSyncExchange> _window; // newest CLOCK_SYNC_WINDOW exchanges, oldest first
+    bool _pending = false;
+    double _sentUs = 0.0; // host time of the pending request
+    double _nextUs = 0.0; // host time the next exchange is due
+    int64_t _newestTicks = -1; // largest unwrapped tick seen, -1 before the first
+    bool _locked = false;
+    double _baseTicks = 0.0; // fit: hostUs = _baseUs + _slopeUs*(deviceTicks - _baseTicks)
+    double _baseUs = 0.0;
+    double _slopeUs = CLOCK_SYNC_DEFAULT_TICK_US; // host microseconds per device tick
+    double _residualUs = 0.0;
+    double _roundTripUs = 0.0;
+    long _exchanges = 0;
+    long _timeouts = 0;
+    void fit(); // refits offset and drift to the quickest exchanges
+};
+
+#endif
@@ -0,0 +1,208 @@
+/*
+  HttpServer.cpp - Minimal non-blocking HTTP/1.0 server for atverterd endpoints
+  Released into the public domain.
+*/
+
+#include "HttpServer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char* statusText(int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    default: return "Internal Server Error";
+  }
+}
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// finds key in a "a=1&b=2" query string and percent-decodes its value ('+' is kept as is)
+bool getQueryParameter(const char* query, const char* key, std::string& value) {
+  size_t keyLength = strlen(key);
+  for (const char* p = query; *p; ) {
+    const char* end = strchr(p, '&');
+    if (!end)
+      end = p + strlen(p);
+    if ((size_t)(end - p) >= keyLength && strncmp(p, key, keyLength) == 0
+      && (p[keyLength] == '=' || p + keyLength == end)) {
+      value.clear();
+      for (const char* c = p + keyLength + (p + keyLength < end ? 1 : 0); c < end; c++) {
+        if (*c == '%' && end - c >= 3 && hexDigit(c[1]) >= 0 && hexDigit(c[2]) >= 0) {
+          value += (char)(hexDigit(c[1])*16 + hexDigit(c[2]));
+          c += 2;
+        } else {
+          value += *c;
+        }
+      }
+      return true;
+    }
+    p = *end ? end + 1 : end;
+  }
+  return false;
+}
+
+HttpServer::HttpServer() {
+}
+
+HttpServer::~HttpServer() {
+  close();
+}
+
+// binds and listens on all interfaces
+bool HttpServer::listen(int port) {
+  close();
+  _listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (_listenFd < 0)
+    return false;
+  int reuse = 1;
+  setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons((uint16_t)port);
+  if (bind(_listenFd, (struct sockaddr*)&address, sizeof(address)) != 0
+    || ::listen(_listenFd, 16) != 0) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+// closes every socket
+void HttpServer::close() {
+  for (Client& client : _clients)
+    ::close(client.fd);
+  _clients.clear();
+  if (_listenFd >= 0)
+    ::close(_listenFd);
+  _listenFd = -1;
+}
+
+// adds the listen socket and every client to a poll() set, returns how many were added
+int HttpServer::fillPollFds(struct pollfd* fds, int max) {
+  int count = 0;
+  if (_listenFd >= 0 && count < max && (int)_clients.size() < HTTP_CLIENTS_MAX) {
+    fds[count].fd = _listenFd;
+    fds[count].events = POLLIN;
+    fds[count].revents = 0;
+    count++;
+  }
+  for (size_t n = 0; n < _clients.size() && count < max; n++) {
+    fds[count].fd = _clients[n].fd;
+    fds[count].events = _clients[n].reply.empty() ? POLLIN : POLLOUT;
+    fds[count].revents = 0;
+    count++;
+  }
+  return count;
+}
+
+// accepts, reads and writes on whichever sockets poll() reported ready
+void HttpServer::processPollFds(const struct pollfd* fds, int count) {
+  for (int n = 0; n < count; n++) {
+    if (!fds[n].revents)
+      continue;
+    if (fds[n].fd == _listenFd) {
+      acceptClients();
+      continue;
+    }
+    for (size_t c = 0; c < _clients.size(); c++) {
+      if (_clients[c].fd != fds[n].fd)
+        continue;
+      bool keep = (fds[n].revents & (POLLERR | POLLNVAL)) == 0;
+      if (keep && (fds[n].revents & (POLLIN | POLLHUP)) && _clients[c].reply.empty())
+        keep = readRequest(_clients[c]);
+      if (keep && (fds[n].revents & POLLOUT))
+        keep = writeReply(_clients[c]);
+      if (!keep) {
+        ::close(_clients[c].fd);
+        _clients.erase(_clients.begin() + c);
+      }
+      break;
+    }
+  }
+}
+
+// default handler, override to serve something useful
+void HttpServer::handleRequest(const char* path, const char* query, HttpResponse& response) {
+  (void)path;
+  (void)query;
+  response.status = 404;
+  response.body = "not found\n";
+}
+
+// accepts all pending connections
+void HttpServer::acceptClients() {
+  while ((int)_clients.size() < HTTP_CLIENTS_MAX) {
+    int fd = accept4(_listenFd, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0)
+      return;
+    Client client;
+    client.fd = fd;
+    _clients.push_back(client);
+  }
+}
+
+// reads until the end of the request header, then builds the reply
+bool HttpServer::readRequest(Client& client) {
+  char buffer[1024];
+  ssize_t got = recv(client.fd, buffer, sizeof(buffer), 0);
+  if (got <= 0)
+    return got < 0 && (errno == EAGAIN || errno == EINTR);
+  client.request.append(buffer, got);
+  if (client.request.size() > (size_t)HTTP_REQUEST_MAX)
+    return false;
+  if (client.request.find("\r\n\r\n") == std::string::npos && client.request.find("\n\n") == std::string::npos)
+    return true; // header not complete yet
+  HttpResponse response;
+  char method[8];
+  char target[1024];
+  if (sscanf(client.request.c_str(), "%7s %1023s", method, target) != 2) {
+    response.status = 400;
+  } else if (strcmp(method, "GET") != 0) {
+    response.status = 405;
+  } else {
+    char* query = strchr(target, '?');
+    if (query)
+      *query++ = '\0';
+    handleRequest(target, query ? query : "", response);
+  }
+  char header[256];
+  int length = snprintf(header, sizeof(header),
+    "HTTP/1.0 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+    response.status, statusText(response.status), response.contentType, response.body.size());
+  client.reply.reserve(length + response.body.size());
+  client.reply.assign(header, length);
+  client.reply += response.body;
+  client.sent = 0;
+  return writeReply(client);
+}
+
+// sends as much of the reply as the socket takes, returns false when finished or failed
+bool HttpServer::writeReply(Client& client) {
+  while (client.sent < client.reply.size()) {
+    ssize_t sent = send(client.fd, client.reply.data() + client.sent, client.reply.size() - client.sent,
+      MSG_NOSIGNAL);
+    if (sent < 0)
+      return errno == EAGAIN || errno == EINTR;
+    client.sent += sent;
+  }
+  return false;
+}
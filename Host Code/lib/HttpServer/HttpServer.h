@@ -0,0 +1,55 @@
+/*
+  HttpServer.h - Minimal non-blocking HTTP/1.0 server for atverterd endpoints
+  Released into the public domain.
+
+  Runs inside the daemon's poll() loop: no threads, one request per
+  connection. Subclasses override handleRequest(), the same way AtverterH
+  overrides PicroBoard::interpretRXCommand().
+*/
+
+#ifndef HttpServer_h
+#define HttpServer_h
+
+#include <poll.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+const int HTTP_REQUEST_MAX = 4096; // longer requests are rejected
+const int HTTP_CLIENTS_MAX = 16; // concurrent connections, extra ones wait in the backlog
+
+struct HttpResponse
+{
+  int status = 200;
+  const char* contentType = "text/plain; charset=utf-8";
+  std::string body;
+};
+
+bool getQueryParameter(const char* query, const char* key, std::string& value); // decoded value of key=value
+
+class HttpServer
+{
+  public:
+    HttpServer(); // constructor
+    virtual ~HttpServer(); // closes every socket
+    bool listen(int port); // binds and listens on all interfaces
+    void close(); // closes every socket
+    int fillPollFds(struct pollfd* fds, int max); // adds the listen socket and clients, returns count
+    void processPollFds(const struct pollfd* fds, int count); // accepts, reads and writes as ready
+    virtual void handleRequest(const char* path, const char* query, HttpResponse& response); // override
+  private:
+    struct Client
+    {
+      int fd;
+      std::string request; // bytes received until the blank line
+      std::string reply; // header and body waiting to be sent
+      size_t sent = 0;
+    };
+    int _listenFd = -1;
+    std::vector<Client> _clients;
+    void acceptClients(); // accepts all pending connections
+    bool readRequest(Client& client); // returns false when the client should be dropped
+    bool writeReply(Client& client); // returns false when done or failed
+};
+
+#endif
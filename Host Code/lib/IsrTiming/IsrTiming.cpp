@@ -0,0 +1,122 @@
+/*
+  IsrTiming.cpp - Cycle accounting of the control interrupt, from emulator events
+  Released into the public domain.
+*/
+
+#include "IsrTiming.h"
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+void CycleStats::add(long cycles) {
+  min = count ? std::min(min, cycles) : cycles;
+  max = count ? std::max(max, cycles) : cycles;
+  count++;
+  sum += cycles;
+  values.push_back(cycles);
+}
+
+long CycleStats::percentile(double fraction) {
+  if (values.empty())
+    return 0;
+  size_t at = (size_t)(fraction*(values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + at, values.end());
+  return values[at];
+}
+
+IsrTiming::IsrTiming() {
+  memset(_stageCycles, 0, sizeof(_stageCycles));
+  memset(_stageSeen, 0, sizeof(_stageSeen));
+}
+
+void IsrTiming::setCsv(FILE* csv) {
+  _csv = csv;
+  if (!_csv)
+    return;
+  fprintf(_csv, "isr,entry_cycle,latency,cycles");
+  for (int n = 0; n < ISR_NUM_STAGES; n++)
+    fprintf(_csv, ",%s", ISR_STAGE_NAMES[n]);
+  fprintf(_csv, "\n");
+}
+
+void IsrTiming::pending(uint64_t cycle) {
+  if (_inIsr)
+    overruns++;
+  _pending = true;
+  _pendingCycle = cycle;
+}
+
+void IsrTiming::entry(uint64_t cycle) {
+  _inIsr = true;
+  _entryCycle = cycle;
+  _latency = _pending ? (long)(cycle - _pendingCycle) : 0;
+  _pending = false;
+  _stage = 0;
+  _stageStart = cycle;
+  memset(_stageCycles, 0, sizeof(_stageCycles));
+  memset(_stageSeen, 0, sizeof(_stageSeen));
+}
+
+void IsrTiming::stage(uint64_t cycle, int stage) {
+  if (!_inIsr)
+    return;
+  closeStage(cycle);
+  _stage = stage >= 0 && stage < ISR_NUM_STAGES ? stage : 0;
+}
+
+void IsrTiming::exit(uint64_t cycle) {
+  if (!_inIsr)
+    return;
+  closeStage(cycle);
+  _inIsr = false;
+  long total = (long)(cycle - _entryCycle);
+  isr.add(total);
+  latencies.add(_latency);
+  for (int n = 0; n < ISR_NUM_STAGES; n++) {
+    if (_stageSeen[n])
+      stages[n].add(_stageCycles[n]);
+  }
+  if (_csv) {
+    fprintf(_csv, "%ld,%llu,%ld,%ld", isr.count, (unsigned long long)_entryCycle, _latency, total);
+    for (int n = 0; n < ISR_NUM_STAGES; n++)
+      fprintf(_csv, ",%ld", _stageCycles[n]);
+    fprintf(_csv, "\n");
+  }
+}
+
+bool IsrTiming::inIsr() {
+  return _inIsr;
+}
+
+long IsrTiming::getWorstCase() {
+  return isr.max + latencies.max;
+}
+
+bool IsrTiming::overBudget(long budget) {
+  return isr.max > budget || overruns > 0;
+}
+
+static void printStats(FILE* out, const char* name, CycleStats& stats) {
+  fprintf(out, "%-14s %8ld %8ld %10.1f %8ld %8ld %8.1f\n", name, stats.count, stats.min,
+    stats.count ? stats.sum/stats.count : 0.0, stats.percentile(0.99), stats.max, stats.max*1e6/ISR_CPU_HZ);
+}
+
+void IsrTiming::printReport(FILE* out) {
+  fprintf(out, "%-14s %8s %8s %10s %8s %8s %8s\n", "cycles", "count", "min", "mean", "p99", "max", "max us");
+  printStats(out, "ISR", isr);
+  for (int n = 0; n < ISR_NUM_STAGES; n++)
+    printStats(out, (std::string("  ") + ISR_STAGE_NAMES[n]).c_str(), stages[n]);
+  printStats(out, "latency", latencies);
+  fprintf(out, "overruns: %ld\n", overruns);
+  long worst = getWorstCase();
+  fprintf(out, "worst case: %ld cycles from overflow to return, %.1f %% of the %ld cycle slot\n", worst,
+    100.0*worst/ISR_SLOT_CYCLES, ISR_SLOT_CYCLES);
+}
+
+// adds the cycles since the last mark to the stage that ran them
+void IsrTiming::closeStage(uint64_t cycle) {
+  _stageCycles[_stage] += (long)(cycle - _stageStart);
+  _stageSeen[_stage] = true;
+  _stageStart = cycle;
+}
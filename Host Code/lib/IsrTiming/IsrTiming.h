@@ -0,0 +1,72 @@
+/*
+  IsrTiming.h - Cycle accounting of the control interrupt, from emulator events
+  Released into the public domain.
+
+  atv-isrtime reports to an IsrTiming what simavr sees: the Timer1 overflow
+  becoming pending, the handler starting and returning, and the stage marks
+  the firmware writes to GPIOR0 (halMarkStage()). IsrTiming turns them into
+  cycles per interrupt and per stage of controlUpdate(), the latency from
+  the overflow to the handler, and overruns: an overflow while the handler
+  still runs, a tick lost. It needs no emulator, so it builds and is tested
+  everywhere; only atv-isrtime itself needs simavr.
+*/
+
+#ifndef IsrTiming_h
+#define IsrTiming_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+const uint32_t ISR_CPU_HZ = 16000000; // the Uno's clock
+const long ISR_SLOT_CYCLES = 16000; // INTERRUPT_TIME of 1000 us
+
+// IsrStages of AtverterH_MPPT.cpp
+const int ISR_NUM_STAGES = 7;
+const char * const ISR_STAGE_NAMES[ISR_NUM_STAGES] = {"entry/exit", "sensors", "protection", "status", "slow",
+  "mppt", "compensator"};
+
+struct CycleStats
+{
+  long count = 0;
+  double sum = 0.0;
+  long min = 0;
+  long max = 0;
+  std::vector<long> values; // for percentiles
+
+  void add(long cycles);
+  long percentile(double fraction);
+};
+
+class IsrTiming
+{
+  public:
+    IsrTiming();
+    void setCsv(FILE* csv); // one row per interrupt from now on: latency, cycles, cycles per stage
+    void pending(uint64_t cycle); // the overflow raised the interrupt flag
+    void entry(uint64_t cycle); // the handler's first instruction
+    void stage(uint64_t cycle, int stage); // a stage mark, IsrStages; unknown stages count as entry/exit
+    void exit(uint64_t cycle); // the handler returned
+    bool inIsr(); // between entry() and exit()
+    long getWorstCase(); // cycles from overflow to return, the longest handler after the longest latency
+    bool overBudget(long budget); // the longest handler took more than budget cycles, or a tick was lost
+    void printReport(FILE* out); // the table of cycles, the overruns and the worst case
+    CycleStats isr; // cycles per interrupt, entry to return
+    CycleStats stages[ISR_NUM_STAGES]; // cycles per stage, in the interrupts that reached it
+    CycleStats latencies; // cycles from overflow to entry
+    long overruns = 0;
+  private:
+    bool _inIsr = false;
+    bool _pending = false;
+    uint64_t _pendingCycle = 0;
+    uint64_t _entryCycle = 0;
+    long _latency = 0;
+    int _stage = 0;
+    uint64_t _stageStart = 0;
+    long _stageCycles[ISR_NUM_STAGES];
+    bool _stageSeen[ISR_NUM_STAGES];
+    FILE* _csv = nullptr;
+    void closeStage(uint64_t cycle);
+};
+
+#endif
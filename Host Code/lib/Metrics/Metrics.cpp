@@ -0,0 +1,161 @@
+/*
+  Metrics.cpp - Prometheus text exposition from a preformatted buffer
+  Released into the public domain.
+*/
+
+#include "Metrics.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* const TYPE_NAMES[NUM_METRICTYPES] = {"gauge", "counter", "histogram"};
+
+MetricsRegistry::MetricsRegistry() {
+}
+
+// adds a metric family (one # HELP/# TYPE block), returns its id
+int MetricsRegistry::addFamily(const char* name, const char* help, int type) {
+  Family family;
+  family.name = name;
+  family.help = help;
+  family.type = type;
+  _families.push_back(family);
+  _layoutDirty = true;
+  return (int)_families.size() - 1;
+}
+
+// appends a slot
+int MetricsRegistry::newSlot(const char* labels) {
+  _slots.push_back(Slot());
+  _slotLabels.push_back(labels ? labels : "");
+  return (int)_slots.size() - 1;
+}
+
+// adds a gauge or counter series with labels like: device="pv1",side="low"
+int MetricsRegistry::addSeries(int family, const char* labels) {
+  int slot = newSlot(labels);
+  _families[family].members.push_back(slot);
+  _layoutDirty = true;
+  return slot;
+}
+
+// adds a histogram series with the given ascending bucket upper bounds (+Inf is implied)
+int MetricsRegistry::addHistogram(int family, const char* labels, const double* bounds, int numBounds) {
+  Histogram histogram;
+  histogram.labels = labels ? labels : "";
+  histogram.bounds.assign(bounds, bounds + numBounds);
+  histogram.firstSlot = (int)_slots.size();
+  for (int n = 0; n < numBounds + 3; n++) // buckets, +Inf, sum, count
+    newSlot(NULL);
+  _histograms.push_back(histogram);
+  _families[family].members.push_back((int)_histograms.size() - 1);
+  _layoutDirty = true;
+  return (int)_histograms.size() - 1;
+}
+
+// sets a gauge, or a counter the firmware reports as a running total
+void MetricsRegistry::set(int slot, double value) {
+  _slots[slot].value = value;
+  if (!_layoutDirty)
+    writeValue(slot);
+}
+
+// increments a counter
+void MetricsRegistry::add(int slot, double amount) {
+  set(slot, _slots[slot].value + amount);
+}
+
+// current value of a series
+double MetricsRegistry::get(int slot) {
+  return _slots[slot].value;
+}
+
+// records one observation: every bucket with bound >= value, +Inf, sum and count
+void MetricsRegistry::observe(int histogram, double value) {
+  const Histogram& h = _histograms[histogram];
+  int numBounds = (int)h.bounds.size();
+  int bucket = 0;
+  while (bucket < numBounds && value > h.bounds[bucket])
+    bucket++;
+  for (int n = bucket; n <= numBounds; n++)
+    add(h.firstSlot + n, 1.0);
+  add(h.firstSlot + numBounds + 1, value);
+  add(h.firstSlot + numBounds + 2, 1.0);
+}
+
+// the exposition text, laid out again only if series were added since the last call
+const char* MetricsRegistry::getText() {
+  if (_layoutDirty)
+    layout();
+  return _text.c_str();
+}
+
+// length of getText()
+size_t MetricsRegistry::getTextLength() {
+  if (_layoutDirty)
+    layout();
+  return _text.size();
+}
+
+// one sample line: name{labels} <padded value>
+void MetricsRegistry::appendLine(const std::string& name, const std::string& labels, int slot) {
+  _text += name;
+  if (!labels.empty()) {
+    _text += '{';
+    _text += labels;
+    _text += '}';
+  }
+  _text += ' ';
+  _slots[slot].offset = _text.size();
+  _text.append(METRIC_VALUE_WIDTH, ' ');
+  _text += '\n';
+}
+
+// renders the whole page and records where every value field lives
+void MetricsRegistry::layout() {
+  _text.clear();
+  for (const Family& family : _families) {
+    _text += "# HELP " + family.name + " " + family.help + "\n";
+    _text += "# TYPE " + family.name + " " + TYPE_NAMES[family.type] + "\n";
+    for (int member : family.members) {
+      if (family.type != METRIC_HISTOGRAM) {
+        appendLine(family.name, _slotLabels[member], member);
+        continue;
+      }
+      const Histogram& h = _histograms[member];
+      std::string separator = h.labels.empty() ? "" : ",";
+      char bound[32];
+      for (size_t n = 0; n <= h.bounds.size(); n++) {
+        if (n < h.bounds.size())
+          snprintf(bound, sizeof(bound), "%g", h.bounds[n]);
+        else
+          strcpy(bound, "+Inf");
+        appendLine(family.name + "_bucket", h.labels + separator + "le=\"" + bound + "\"",
+          h.firstSlot + (int)n);
+      }
+      appendLine(family.name + "_sum", h.labels, h.firstSlot + (int)h.bounds.size() + 1);
+      appendLine(family.name + "_count", h.labels, h.firstSlot + (int)h.bounds.size() + 2);
+    }
+  }
+  _layoutDirty = false;
+  for (size_t slot = 0; slot < _slots.size(); slot++)
+    writeValue((int)slot);
+}
+
+// formats one value into its fixed width field, zero padded ("0000000000000012.5")
+// so the line keeps single space separators and stays valid exposition text
+void MetricsRegistry::writeValue(int slot) {
+  char value[48];
+  double v = _slots[slot].value;
+  if (!isfinite(v))
+    v = 0.0;
+  int length;
+  if (v == floor(v) && fabs(v) < 1e15)
+    length = snprintf(value, sizeof(value), "%0*.0f", METRIC_VALUE_WIDTH, v);
+  else
+    length = snprintf(value, sizeof(value), "%0*.10g", METRIC_VALUE_WIDTH, v);
+  if (length > METRIC_VALUE_WIDTH)
+    snprintf(value, sizeof(value), "%0*.*e", METRIC_VALUE_WIDTH, METRIC_VALUE_WIDTH - 8, v);
+  memcpy(&_text[_slots[slot].offset], value, METRIC_VALUE_WIDTH);
+}
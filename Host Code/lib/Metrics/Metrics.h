@@ -0,0 +1,74 @@
+/*
+  Metrics.h - Prometheus text exposition from a preformatted buffer
+  Released into the public domain.
+
+  The whole /metrics page is laid out once, with every sample value in a fixed
+  width, zero padded field. Updating a metric rewrites only its own field, so a
+  scrape is a single copy of the buffer instead of a serialization of the state.
+  Adding a series re-lays the buffer on the next getText() call.
+
+  Not thread safe: update and scrape from the same thread (atverterd's poll loop).
+*/
+
+#ifndef Metrics_h
+#define Metrics_h
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// metric family types, as printed in the # TYPE line
+enum MetricTypes
+{   METRIC_GAUGE = 0,
+    METRIC_COUNTER,
+    METRIC_HISTOGRAM,
+    NUM_METRICTYPES
+};
+
+const int METRIC_VALUE_WIDTH = 20; // characters reserved for every sample value
+
+class MetricsRegistry
+{
+  public:
+    MetricsRegistry(); // constructor
+    int addFamily(const char* name, const char* help, int type); // returns a family id
+    int addSeries(int family, const char* labels); // adds a gauge/counter series, returns its slot id
+    int addHistogram(int family, const char* labels, const double* bounds, int numBounds); // returns a histogram id
+    void set(int slot, double value); // sets a gauge (or a counter reported as a running total)
+    void add(int slot, double amount); // increments a counter
+    double get(int slot); // current value of a series
+    void observe(int histogram, double value); // records one histogram observation
+    const char* getText(); // the exposition text, laid out again if series were added
+    size_t getTextLength(); // length of getText()
+  private:
+    struct Family
+    {
+      std::string name;
+      std::string help;
+      int type;
+      std::vector<int> members; // slot ids (gauge/counter) or histogram ids
+    };
+    struct Slot
+    {
+      double value = 0.0;
+      size_t offset = 0; // position of the value field in _text
+    };
+    struct Histogram
+    {
+      std::string labels;
+      std::vector<double> bounds; // upper bounds, ascending, +Inf implied
+      int firstSlot; // bucket slots (numBounds + 1), then sum, then count
+    };
+    std::vector<Family> _families;
+    std::vector<Slot> _slots;
+    std::vector<std::string> _slotLabels; // labels of each gauge/counter slot
+    std::vector<Histogram> _histograms;
+    std::string _text;
+    bool _layoutDirty = true;
+    int newSlot(const char* labels); // appends a slot
+    void layout(); // renders _text and records every value field offset
+    void appendLine(const std::string& name, const std::string& labels, int slot); // one sample line
+    void writeValue(int slot); // formats one value into its field
+};
+
+#endif
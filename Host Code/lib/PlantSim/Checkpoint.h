@@ -0,0 +1,97 @@
+/*
+  Checkpoint.h - Saves a whole simulation by forking, and goes back to it
+  Released into the public domain.
+
+  The sketch, its board, PicroHAL's fakes and the plant are globals spread
+  over many files, so rather than copying them a checkpoint keeps a process:
+  save() forks, the child carries on with the simulation and the parent
+  waits, frozen as it was. restore() ends the child; the parent then forks
+  again and save() returns a second time in the new child, from the same
+  state, like setjmp(). When the simulation ends without a restore, the
+  parent exits with its status.
+
+  A note passed to restore() comes back from save(), so a run can tell the
+  rerun what it found. Checkpoints nest, restore() goes back to the latest.
+  The process ID changes at every save() and restore().
+*/
+
+#ifndef Checkpoint_h
+#define Checkpoint_h
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+
+const int CHECKPOINT_RESTORE_STATUS = 125; // exit status of a child that restore() ended
+
+class Checkpoint
+{
+  public:
+    // 0 on the way through, how many times restore() came back here since
+    int save(std::string* note = nullptr) {
+      fflush(stdout); // or the children print it again
+      fflush(stderr);
+      std::string received;
+      for (int restores = 0;; restores++) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+          perror("pipe");
+          return -1;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+          perror("fork");
+          close(fds[0]);
+          close(fds[1]);
+          return -1;
+        }
+        if (pid == 0) {
+          close(fds[0]);
+          _fd = fds[1];
+          if (note)
+            *note = received;
+          return restores;
+        }
+        close(fds[1]);
+        received.clear();
+        char buffer[4096];
+        for (;;) {
+          ssize_t length = read(fds[0], buffer, sizeof(buffer));
+          if (length > 0)
+            received.append(buffer, length);
+          else if (length == 0 || errno != EINTR)
+            break;
+        }
+        close(fds[0]);
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == CHECKPOINT_RESTORE_STATUS)
+          continue;
+        _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1); // the simulation is over, so is its checkpoint
+      }
+    }
+
+    // ends this process, save() returns again in a new one with note
+    void restore(const std::string& note = "") {
+      fflush(stdout);
+      fflush(stderr);
+      size_t written = 0;
+      while (_fd >= 0 && written < note.size()) {
+        ssize_t n = write(_fd, note.data() + written, note.size() - written);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          break;
+        written += n;
+      }
+      _exit(CHECKPOINT_RESTORE_STATUS);
+    }
+
+  private:
+    int _fd = -1; // to the parent that keeps the checkpoint
+};
+
+#endif
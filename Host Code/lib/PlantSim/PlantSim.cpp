@@ -0,0 +1,553 @@
+/*
+  PlantSim.cpp - PV panel, AtverterH buck stage and battery, closed around the firmware
+  Released into the public domain.
+*/
+
+#include "PlantSim.h"
+
+#include <math.h>
+
+#include <AtverterH.h>
+
+const double BOLTZMANN_EV = 8.617333e-5; // eV/K
+const double STC_K = 298.15; // 25 °C
+const double AVERAGED_STEP_S = 1e-6;
+const double SWITCHING_STEPS = 40; // per PWM period
+const double CURRENT_SENSOR_V_PER_A = 0.333; // MT9221 at 5 V, ratiometric
+const double DIVIDER_RATIO = 13.0; // (120k + 10k)/10k
+const double THERMISTOR_R25_OHM = 100000.0;
+const double DIVIDER_OHM = 130000.0; // all that loads side 2 with the battery off
+
+static PlantSim* attachedPlant = nullptr; // the one the HAL callbacks belong to
+
+// the gate driver's protection latch: pulling GATESD low latches it, PRORESET releases it
+static void protectionLatch(int pin, int level) {
+  if (pin == GATESD_PIN && level == LOW && halNativeGetPinMode(GATESD_PIN) == OUTPUT)
+    halNativeSetInput(GATESD_PIN, LOW);
+  else if (pin == PRORESET_PIN && level == HIGH)
+    halNativeSetInput(GATESD_PIN, HIGH);
+}
+
+// PvModule ------------------------------------------------------------------
+
+PvModule::PvModule() {
+  configure(PvParams());
+}
+
+// photo current from Isc, saturation current so that I(Voc) = 0, both at STC
+void PvModule::configure(const PvParams& params) {
+  _params = params;
+  double thermalStcV = params.ideality*params.cells*BOLTZMANN_EV*STC_K;
+  _photoStcA = params.iscA*(params.rsOhm + params.rshOhm)/params.rshOhm;
+  _saturationStcA = (_photoStcA - params.vocV/params.rshOhm)/(exp(params.vocV/thermalStcV) - 1.0);
+  setConditions(1000.0, 25.0);
+}
+
+void PvModule::setConditions(double irradiance, double cellC) {
+  double kelvin = cellC + 273.15;
+  _thermalV = _params.ideality*_params.cells*BOLTZMANN_EV*kelvin;
+  _photoA = irradiance/1000.0*_photoStcA*(1.0 + _params.iscTempCoeff*(cellC - 25.0));
+  if (_photoA < 0.0)
+    _photoA = 0.0;
+  _saturationA = _saturationStcA*pow(kelvin/STC_K, 3.0)
+    *exp(_params.bandgapEv/(_params.ideality*BOLTZMANN_EV)*(1.0/STC_K - 1.0/kelvin));
+  _mppW = -1.0;
+  _openV = -1.0;
+}
+
+// current at a junction voltage, explicit in the single-diode model
+double PvModule::diodeCurrent(double diodeV, double& slope) {
+  double e = exp(diodeV/_thermalV);
+  slope = -_saturationA*e/_thermalV - 1.0/_params.rshOhm;
+  return _photoA - _saturationA*(e - 1.0) - diodeV/_params.rshOhm;
+}
+
+double PvModule::current(double volts) {
+  double slope;
+  return current(volts, slope);
+}
+
+// solves diodeV - I(diodeV)*Rs = volts by Newton's method, warm started from the last call
+double PvModule::current(double volts, double& slope) {
+  double diodeV = _diodeV;
+  double current = 0.0;
+  double diodeSlope = 0.0;
+  for (int n = 0; n < 60; n++) {
+    current = diodeCurrent(diodeV, diodeSlope);
+    double error = diodeV - current*_params.rsOhm - volts;
+    double step = error/(1.0 - _params.rsOhm*diodeSlope);
+    if (step > 2.0*_thermalV) // keep exp() in range far from the solution
+      step = 2.0*_thermalV;
+    else if (step < -2.0*_thermalV)
+      step = -2.0*_thermalV;
+    diodeV -= step;
+    if (fabs(step) < 1e-9)
+      break;
+  }
+  _diodeV = diodeV;
+  current = diodeCurrent(diodeV, diodeSlope);
+  slope = diodeSlope/(1.0 - _params.rsOhm*diodeSlope);
+  return current;
+}
+
+// golden section search over the terminal voltage, cached until the conditions change
+double PvModule::maxPower(double* volts) {
+  if (_mppW < 0.0) {
+    double low = 0.0;
+    double high = openCircuitVoltage();
+    const double ratio = 0.6180339887;
+    while (high - low > 1e-4) {
+      double a = high - ratio*(high - low);
+      double b = low + ratio*(high - low);
+      if (a*current(a) > b*current(b))
+        high = b;
+      else
+        low = a;
+    }
+    _mppV = 0.5*(low + high);
+    _mppW = _mppV*current(_mppV);
+    if (_mppW < 0.0)
+      _mppW = 0.0;
+  }
+  if (volts)
+    *volts = _mppV;
+  return _mppW;
+}
+
+// where the panel current is zero, so the junction and terminal voltages are equal; cached
+double PvModule::openCircuitVoltage() {
+  if (_openV < 0.0) {
+    _openV = 0.0;
+    if (_photoA > 0.0) {
+      _openV = _thermalV*log(_photoA/_saturationA + 1.0); // ignoring the shunt
+      for (int n = 0; n < 20; n++) {
+        double slope;
+        double current = diodeCurrent(_openV, slope);
+        _openV -= current/slope;
+      }
+    }
+  }
+  return _openV;
+}
+
+double PvModule::seriesOhm() {
+  return _params.rsOhm;
+}
+
+// PlantSim ------------------------------------------------------------------
+
+PlantSim::PlantSim() : _gaussian(0.0, 1.0) {
+  configure(PlantParams());
+}
+
+void PlantSim::configure(const PlantParams& params) {
+  _params = params;
+  _pv.configure(params.pv);
+  _random.seed(params.seed);
+  _gaussian.reset();
+  _state = PlantState();
+  _state.soc = params.battery.initialSoc;
+  _state.powered = true;
+  _state.ambientC = 25.0;
+  _state.fet1C = _state.fet2C = 25.0;
+  clearFaults();
+  setIrradiance(1000.0);
+}
+
+// a freshly powered board with the converter off: the panel open, the battery at rest
+void PlantSim::attach() {
+  halNativeReset();
+  halNativeOnPinWrite(protectionLatch);
+  halNativeSetInput(GATESD_PIN, HIGH);
+  halNativeSetVCC((int)lround(_params.sensors.vccV*1000.0));
+  attachedPlant = this;
+  _pvEnergyJ = _mppEnergyJ = _batteryEnergyJ = 0.0;
+  _state.timeS = 0.0;
+  _state.ticks = 0;
+  _state.powered = true;
+  _vccV = _params.sensors.vccV;
+  _batteryConnected = true;
+  _shortOhm = 0.0;
+  _activeFaults.clear();
+  _state.panelV = _inputV = _pv.openCircuitVoltage();
+  _state.batteryV = _outputV = batteryOpenCircuitV() - _params.battery.loadA*_params.battery.internalOhm;
+  _state.panelA = _state.inductorA = _inductorA = 0.0;
+  _state.batteryA = -_params.battery.loadA;
+  _pwmPhase = 0.0;
+  _thermistorC[0] = _thermistorC[1] = -273.15;
+  sense();
+}
+
+void PlantSim::detach() {
+  if (attachedPlant == this) {
+    halNativeOnPinWrite(nullptr);
+    attachedPlant = nullptr;
+  }
+}
+
+void PlantSim::setIrradiance(double irradiance) {
+  _state.irradiance = irradiance < 0.0 ? 0.0 : irradiance;
+  _state.cellC = _state.ambientC + _state.irradiance/800.0*(_params.pv.noctC - 20.0);
+  _pv.setConditions(_state.irradiance, _state.cellC);
+}
+
+void PlantSim::setAmbient(double ambientC) {
+  _state.ambientC = ambientC;
+  setIrradiance(_state.irradiance);
+}
+
+void PlantSim::setLoad(double loadA) {
+  _params.battery.loadA = loadA;
+}
+
+// one control period: the plant runs with the duty cycle the firmware left, then the ISR runs
+void PlantSim::step() {
+  applyFaults();
+  long periodus = halNativeGetTimerPeriod();
+  double dt = (periodus > 0 ? periodus : 1000)*1e-6; // 1 ms before setup() starts the timer
+  int pwmDuty = halNativeGetPwmDuty(PWM_PIN);
+  _state.latched = !halDigitalRead(GATESD_PIN);
+  bool buck = halNativeGetPinLevel(VCTRL2_PIN) == HIGH && halNativeGetPinLevel(VCTRL1_PIN) == LOW; // applyHoldHigh2()
+  bool switching = pwmDuty >= 0 && !_state.latched && buck;
+  _state.duty = switching ? pwmDuty/100.0 : 0.0;
+
+  if (_params.buckModel == BUCK_QUASI_STATIC)
+    solveQuasiStatic(_state.duty, switching, dt);
+  else
+    integrate(_state.duty, switching, dt);
+
+  const BatteryParams& battery = _params.battery;
+  _state.soc += _state.batteryA*dt/(battery.capacityAh*3600.0);
+  _state.soc = constrain(_state.soc, 0.0, 1.0);
+  const BuckParams& buckParams = _params.buck;
+  double conductionW = _state.inductorA*_state.inductorA*buckParams.conductionOhm;
+  double switchingW = switching ? _state.panelV*fabs(_state.inductorA)*buckParams.switchingS*buckParams.pwmHz : 0.0;
+  double fet1C = _state.ambientC + buckParams.fetThermalKPerW*(0.5*conductionW + switchingW);
+  double fet2C = _state.ambientC + buckParams.fetThermalKPerW*0.5*conductionW;
+  _state.fet1C += (fet1C - _state.fet1C)*dt/buckParams.fetThermalS;
+  _state.fet2C += (fet2C - _state.fet2C)*dt/buckParams.fetThermalS;
+  _state.mppW = _pv.maxPower();
+  _mppEnergyJ += _state.mppW*dt;
+  _state.timeS += dt;
+
+  sense();
+  halNativeTick(); // nothing while the MCU is in reset, as halNativeRestart() stopped the timer
+  _state.ticks++;
+}
+
+// ticks control periods of the plant alone, as many step() calls with the firmware idle would be: the duty
+// cycle and the latch as the firmware left them, one quasi-static solve for all of them, the state of
+// charge, the energies and the heatsinks moved over the whole block at once; no ADC inputs and no interrupt
+bool PlantSim::advance(long ticks, const PlantState& reference, double toleranceV, double toleranceA) {
+  if (_params.buckModel != BUCK_QUASI_STATIC || ticks <= 0 || !_state.powered)
+    return false;
+  long periodus = halNativeGetTimerPeriod();
+  double dt = (periodus > 0 ? periodus : 1000)*1e-6;
+  int pwmDuty = halNativeGetPwmDuty(PWM_PIN);
+  bool latched = !halDigitalRead(GATESD_PIN);
+  bool buck = halNativeGetPinLevel(VCTRL2_PIN) == HIGH && halNativeGetPinLevel(VCTRL1_PIN) == LOW;
+  bool switching = pwmDuty >= 0 && !latched && buck;
+  double duty = switching ? pwmDuty/100.0 : 0.0;
+  PlantState point = _state;
+  operatingPoint(duty, switching, point);
+  if (fabs(point.panelV - reference.panelV) > toleranceV || fabs(point.batteryV - reference.batteryV) > toleranceV
+    || fabs(point.panelA - reference.panelA) > toleranceA || fabs(point.inductorA - reference.inductorA) > toleranceA)
+    return false;
+
+  double blockS = dt*ticks;
+  _state = point;
+  _state.latched = latched;
+  _state.duty = duty;
+  _inputV = _state.panelV;
+  _outputV = _state.batteryV;
+  _inductorA = _state.inductorA;
+  _pvEnergyJ += _state.panelV*_state.panelA*blockS;
+  _batteryEnergyJ += _state.batteryV*_state.batteryA*blockS;
+  const BatteryParams& battery = _params.battery;
+  _state.soc += _state.batteryA*blockS/(battery.capacityAh*3600.0);
+  _state.soc = constrain(_state.soc, 0.0, 1.0);
+  const BuckParams& buckParams = _params.buck;
+  double conductionW = _state.inductorA*_state.inductorA*buckParams.conductionOhm;
+  double switchingW = switching ? _state.panelV*fabs(_state.inductorA)*buckParams.switchingS*buckParams.pwmHz : 0.0;
+  double fet1C = _state.ambientC + buckParams.fetThermalKPerW*(0.5*conductionW + switchingW);
+  double fet2C = _state.ambientC + buckParams.fetThermalKPerW*0.5*conductionW;
+  double approach = 1.0 - pow(1.0 - dt/buckParams.fetThermalS, (double)ticks); // step()'s Euler steps, compounded
+  _state.fet1C += (fet1C - _state.fet1C)*approach;
+  _state.fet2C += (fet2C - _state.fet2C)*approach;
+  _state.mppW = _pv.maxPower();
+  _mppEnergyJ += _state.mppW*blockS;
+  _state.timeS += blockS;
+  _state.ticks += ticks;
+  return true;
+}
+
+// the first tick from now on at which a fault starts or ends, -1 if none will
+long PlantSim::nextFaultTick() {
+  long next = -1;
+  for (size_t n = 0; n < _faults.size(); n++) {
+    const Fault& fault = _faults[n];
+    long edges[2] = {fault.startTick, fault.ticks >= 0 ? fault.startTick + fault.ticks : -1};
+    for (int edge = 0; edge < 2; edge++) {
+      if (edges[edge] >= _state.ticks && (next < 0 || edges[edge] < next))
+        next = edges[edge];
+    }
+  }
+  return next;
+}
+
+// which faults cover this tick, and what they do to the supply and side 2
+void PlantSim::applyFaults() {
+  _activeFaults.clear();
+  double vccV = _params.sensors.vccV;
+  bool brownOut = false;
+  _batteryConnected = true;
+  _shortOhm = 0.0;
+  for (size_t n = 0; n < _faults.size(); n++) {
+    const Fault& fault = _faults[n];
+    if (_state.ticks < fault.startTick || (fault.ticks >= 0 && _state.ticks >= fault.startTick + fault.ticks))
+      continue;
+    _activeFaults.push_back((int)n);
+    if (fault.kind == FAULT_VCC_SAG)
+      vccV = fault.value;
+    else if (fault.kind == FAULT_BROWN_OUT)
+      brownOut = true;
+    else if (fault.kind == FAULT_BATTERY_DISCONNECT)
+      _batteryConnected = false;
+    else if (fault.kind == FAULT_OUTPUT_SHORT)
+      _shortOhm = _shortOhm > 0.0 ? _shortOhm*fault.value/(_shortOhm + fault.value) : fault.value;
+  }
+  if (vccV != _vccV) {
+    _vccV = vccV;
+    halNativeSetVCC((int)lround(vccV*1000.0));
+  }
+  if (brownOut && _state.powered) {
+    _state.powered = false;
+    halNativeRestart(); // the pins go to inputs: no PWM, the latch keeps its state
+  } else if (!brownOut && !_state.powered) {
+    _state.powered = true;
+    if (_reset)
+      _reset();
+  }
+}
+
+// side 2 as a Thevenin source: the battery less its load's drop, or only the V2 divider, a short in parallel
+void PlantSim::outputSource(double& sourceV, double& sourceOhm) {
+  const BatteryParams& battery = _params.battery;
+  if (_batteryConnected) {
+    sourceV = batteryOpenCircuitV() - battery.internalOhm*battery.loadA;
+    sourceOhm = battery.internalOhm;
+  } else {
+    sourceV = 0.0;
+    sourceOhm = DIVIDER_OHM;
+  }
+  if (_shortOhm > 0.0) {
+    sourceV *= _shortOhm/(_shortOhm + sourceOhm);
+    sourceOhm = sourceOhm*_shortOhm/(sourceOhm + _shortOhm);
+  }
+}
+
+// the averaged model with its capacitors and inductor settled
+void PlantSim::solveQuasiStatic(double duty, bool switching, double dt) {
+  operatingPoint(duty, switching, _state);
+  _inputV = _state.panelV;
+  _outputV = _state.batteryV;
+  _inductorA = _state.inductorA;
+  _pvEnergyJ += _state.panelV*_state.panelA*dt;
+  _batteryEnergyJ += _state.batteryV*_state.batteryA*dt;
+}
+
+// panel, inductor and battery of the settled averaged model into point: one equation in the panel's
+// junction voltage, solved by Newton's method inside a bracket, from point's panel voltage and current
+void PlantSim::operatingPoint(double duty, bool switching, PlantState& point) {
+  const BuckParams& buck = _params.buck;
+  const BatteryParams& battery = _params.battery;
+  double openV = batteryOpenCircuitV();
+  double sourceV, sourceOhm;
+  outputSource(sourceV, sourceOhm);
+  if (!switching) {
+    point.panelV = _pv.openCircuitVoltage();
+    point.panelA = point.inductorA = 0.0;
+    point.batteryV = sourceV;
+  } else {
+    double loopOhm = buck.conductionOhm + sourceOhm;
+    double switchingPerA = buck.switchingS*buck.pwmHz; // switching loss over Vin, per A of inductor current
+    double rs = _pv.seriesOhm();
+    double low = 0.0;
+    double high = _pv.openCircuitVoltage() + 40.0*_params.pv.ideality*_params.pv.cells*BOLTZMANN_EV*(_state.cellC + 273.15);
+    double diodeV = point.panelV + point.panelA*rs; // last solution
+    if (diodeV <= low || diodeV >= high)
+      diodeV = 0.5*(low + high);
+    double panelA = 0.0, panelV = 0.0, inductorA = 0.0;
+    for (int n = 0; n < 100; n++) {
+      double slope;
+      panelA = _pv.diodeCurrent(diodeV, slope);
+      panelV = diodeV - panelA*rs;
+      inductorA = (duty*panelV - sourceV)/loopOhm;
+      double sign = inductorA >= 0.0 ? 1.0 : -1.0;
+      double quiescentA = buck.quiescentW/(panelV > 1.0 ? panelV : 1.0);
+      double residual = panelA - duty*inductorA - switchingPerA*fabs(inductorA) - quiescentA;
+      if (residual > 0.0) // the panel gives more than the converter takes: the voltage rises
+        low = diodeV;
+      else
+        high = diodeV;
+      double dPanelV = 1.0 - rs*slope;
+      double dResidual = slope - (duty + switchingPerA*sign)*duty*dPanelV/loopOhm
+        + (panelV > 1.0 ? buck.quiescentW/(panelV*panelV)*dPanelV : 0.0);
+      double next = diodeV - residual/dResidual;
+      if (!(next > low && next < high))
+        next = 0.5*(low + high);
+      if (fabs(next - diodeV) < 1e-9 || high - low < 1e-9) {
+        diodeV = next;
+        break;
+      }
+      diodeV = next;
+    }
+    point.panelA = panelA;
+    point.panelV = panelV;
+    point.inductorA = inductorA;
+    point.batteryV = sourceV + sourceOhm*inductorA;
+  }
+  point.batteryA = _batteryConnected ? (point.batteryV - openV)/battery.internalOhm : 0.0;
+}
+
+// the capacitors and the inductor step by step: the inductor first (symplectic Euler, no
+// numerical gain on the LC ringing), the battery side implicitly as the battery is stiff
+void PlantSim::integrate(double duty, bool switching, double dt) {
+  const BuckParams& buck = _params.buck;
+  const BatteryParams& battery = _params.battery;
+  double openV = batteryOpenCircuitV();
+  double sourceV, sourceOhm;
+  outputSource(sourceV, sourceOhm);
+  bool pwm = _params.buckModel == BUCK_SWITCHING;
+  double h = pwm ? 1.0/(buck.pwmHz*SWITCHING_STEPS) : AVERAGED_STEP_S;
+  long steps = lround(dt/h);
+  double switchingPerA = buck.switchingS*buck.pwmHz;
+  double panelA = 0.0;
+  double pvJ = 0.0, batteryJ = 0.0;
+  if (!switching)
+    _inductorA = 0.0; // the body diodes carry it to zero within microseconds
+  for (long n = 0; n < steps; n++) {
+    double on = duty; // switch node duty over this step
+    if (pwm) {
+      on = _pwmPhase < duty ? 1.0 : 0.0;
+      _pwmPhase += h*buck.pwmHz;
+      if (_pwmPhase >= 1.0)
+        _pwmPhase -= 1.0;
+    }
+    if (switching)
+      _inductorA += h*(on*_inputV - _inductorA*buck.conductionOhm - _outputV)/buck.inductorH;
+    panelA = _pv.current(_inputV);
+    double takenA = switching ? on*_inductorA + switchingPerA*fabs(_inductorA)
+      + buck.quiescentW/(_inputV > 1.0 ? _inputV : 1.0) : 0.0;
+    _inputV += h*(panelA - takenA)/buck.inputCapF;
+    _outputV = (buck.outputCapF*_outputV + h*(_inductorA + sourceV/sourceOhm))/(buck.outputCapF + h/sourceOhm);
+    pvJ += _inputV*panelA*h;
+    if (_batteryConnected)
+      batteryJ += _outputV*(_outputV - openV)/battery.internalOhm*h;
+  }
+  _state.panelV = _inputV;
+  _state.panelA = panelA;
+  _state.inductorA = _inductorA;
+  _state.batteryV = _outputV;
+  _state.batteryA = _batteryConnected ? (_outputV - openV)/battery.internalOhm : 0.0;
+  _pvEnergyJ += pvJ;
+  _batteryEnergyJ += batteryJ;
+}
+
+// open-circuit voltage over the state of charge, piecewise linear
+double PlantSim::batteryOpenCircuitV() {
+  static const double SOC[] = {0.0, 0.05, 0.1, 0.2, 0.3, 0.5, 0.7, 0.9, 0.95, 1.0};
+  static const double LEAD_ACID_V[] = {11.6, 11.7, 11.8, 11.95, 12.05, 12.2, 12.4, 12.6, 12.65, 12.75};
+  static const double LIFEPO4_V[] = {10.0, 12.0, 12.8, 13.0, 13.1, 13.2, 13.3, 13.35, 13.5, 14.0};
+  const double* volts = _params.battery.chemistry == BATTERY_LIFEPO4 ? LIFEPO4_V : LEAD_ACID_V;
+  double soc = _state.soc;
+  int points = sizeof(SOC)/sizeof(SOC[0]);
+  for (int n = 1; n < points; n++) {
+    if (soc <= SOC[n])
+      return volts[n - 1] + (volts[n] - volts[n - 1])*(soc - SOC[n - 1])/(SOC[n] - SOC[n - 1]);
+  }
+  return volts[points - 1];
+}
+
+// what each ADC pin reads at the end of the period, the instant the ISR samples
+void PlantSim::sense() {
+  const SensorParams& sensors = _params.sensors;
+  double vcc = _vccV;
+  double gain = (1.0 + sensors.dividerGainError)/DIVIDER_RATIO;
+  double lsbV = vcc/1024.0;
+  setAnalog(V1_PIN, adc(_state.panelV*gain + sensors.voltageNoiseLsb*lsbV*_gaussian(_random)));
+  setAnalog(V2_PIN, adc(_state.batteryV*gain + sensors.voltageNoiseLsb*lsbV*_gaussian(_random)));
+  // the firmware reads terminal 1 current as flowing in, terminal 2 as flowing out (lowCurrent = -I2)
+  double terminalA[2] = {_state.panelA, -_state.inductorA};
+  const int currentPins[2] = {I1_PIN, I2_PIN};
+  for (int side = 0; side < 2; side++) {
+    double amps = terminalA[side] + sensors.currentNoisemA*1e-3*_gaussian(_random);
+    double volts = vcc/2.0 + amps*CURRENT_SENSOR_V_PER_A*vcc/5.0 + sensors.currentOffsetmV[side]*1e-3;
+    setAnalog(currentPins[side], adc(volts));
+  }
+  double fetC[2] = {_state.fet1C, _state.fet2C};
+  const int thermistorPins[2] = {T1_PIN, T2_PIN};
+  for (int side = 0; side < 2; side++) {
+    if (fabs(fetC[side] - _thermistorC[side]) >= 0.01) { // the heatsink moves slowly, skip the exp()
+      _thermistorC[side] = fetC[side];
+      double ntcOhm = THERMISTOR_R25_OHM*exp(sensors.thermistorBeta*(1.0/(fetC[side] + 273.15) - 1.0/STC_K));
+      _thermistorRaw[side] = adc(vcc*sensors.thermistorFixedOhm/(sensors.thermistorFixedOhm + ntcOhm));
+    }
+    setAnalog(thermistorPins[side], _thermistorRaw[side]);
+  }
+}
+
+void PlantSim::setAnalog(int pin, int raw) {
+  for (size_t n = 0; n < _activeFaults.size(); n++) {
+    const Fault& fault = _faults[_activeFaults[n]];
+    if (fault.pin != pin)
+      continue;
+    if (fault.kind == FAULT_ADC_SPIKE)
+      raw += (int)fault.value;
+    else if (fault.kind == FAULT_ADC_STUCK)
+      raw = (int)fault.value;
+    else if (fault.kind == FAULT_THERMISTOR_OPEN)
+      raw = 0;
+    else if (fault.kind == FAULT_THERMISTOR_SHORT)
+      raw = 1023;
+  }
+  halNativeSetAnalog(pin, constrain(raw, 0, 1023));
+}
+
+int PlantSim::adc(double volts) {
+  long raw = lround(volts/_vccV*1024.0);
+  return (int)constrain(raw, 0L, 1023L);
+}
+
+const PlantState& PlantSim::getState() {
+  return _state;
+}
+
+double PlantSim::getPvEnergyJ() {
+  return _pvEnergyJ;
+}
+
+double PlantSim::getMppEnergyJ() {
+  return _mppEnergyJ;
+}
+
+double PlantSim::getBatteryEnergyJ() {
+  return _batteryEnergyJ;
+}
+
+PvModule& PlantSim::getPv() {
+  return _pv;
+}
+
+void PlantSim::injectFault(const Fault& fault) {
+  _faults.push_back(fault);
+}
+
+void PlantSim::clearFaults() {
+  _faults.clear();
+  _activeFaults.clear();
+}
+
+void PlantSim::onReset(void (*setup)()) {
+  _reset = setup;
+}
@@ -0,0 +1,262 @@
+/*
+  PlantSim.h - PV panel, AtverterH buck stage and battery, closed around the firmware
+  Released into the public domain.
+
+  A deterministic model of what the MPPT sketch controls, for judging
+  controller changes without a rooftop:
+    PV module   single-diode model (photo current, diode with ideality
+                factor, series and shunt resistance) scaled with irradiance
+                and cell temperature; the default is a 72-cell "24 V" module
+                of about 60 W
+    buck stage  side 1 switching at 100 kHz into side 2, the way the sketch
+                runs the AtverterH (applyHoldHigh2()): synchronous, so the
+                inductor current can reverse; conduction, switching and
+                quiescent losses
+    battery     12 V lead-acid or LiFePO4: open-circuit voltage from the
+                state of charge, internal resistance, an optional load
+    sensors     10-bit ADC against VCC, the 13x voltage dividers with a gain
+                error, MT9221 current sensors (333 mV/A, ratiometric) with
+                offset and noise, NTC thermistors on the FETs heating with
+                the converter losses
+
+  The buck stage can be simulated three ways:
+    quasi-static  the steady state of the averaged model at every control
+                  tick; the LC dynamics settle well within the 1 s MPPT
+                  period, so this is what tuning runs use (>1000x real time)
+    averaged      the averaged model integrated in 1 us steps: the
+                  input/output filter transients, no ripple
+    switching     the switch node itself at 100 kHz in 0.25 us steps: ripple
+                  and what the ADC samples of it
+
+  The model drives the firmware through PicroHAL's native fakes: step()
+  reads the duty cycle the firmware last set and the gate driver latch,
+  advances the plant by one control period, sets the ADC inputs and fires
+  the control interrupt. The protection latch is modelled on the GPIO pins
+  (GATESD pulled low latches it, PRORESET releases it); while latched the
+  converter does not switch. Only one PlantSim can be attached at a time,
+  as there is one board.
+
+  For runs of days, advance() moves the quasi-static plant over many control
+  periods at once while the firmware has nothing to do (TimeWarp.h decides
+  when): one solve for the whole block with the duty cycle held, no ADC
+  inputs and no interrupt. It refuses, and nothing moves, when the block's
+  panel or battery voltage or current would be further than the tolerances
+  from a reference state, the last tick the firmware saw.
+
+  Faults are injected at control ticks, for testing the protection logic:
+  glitches and stuck codes on the ADC inputs, open and shorted thermistors,
+  VCC sagging (the ADC reference, so the dividers read high), brown-outs
+  (the MCU held in reset, then running setup() again from onReset()), the
+  battery coming off side 2 and a short across side 2.
+*/
+
+#ifndef PlantSim_h
+#define PlantSim_h
+
+#include <stdint.h>
+#include <random>
+#include <vector>
+
+// how the buck stage is integrated, for convenience and bookkeeping
+enum BuckModels
+{   BUCK_QUASI_STATIC = 0, // steady state each control tick
+    BUCK_AVERAGED, // averaged model, 1 us steps
+    BUCK_SWITCHING, // switch node at the PWM frequency, 0.25 us steps
+    NUM_BUCKMODELS
+};
+
+const char * const BUCK_MODEL_NAMES[NUM_BUCKMODELS] = {"quasi-static", "averaged", "switching"};
+
+// battery chemistries, for convenience and bookkeeping
+enum BatteryChemistries
+{   BATTERY_LEAD_ACID = 0, // 6 cells, flooded or AGM
+    BATTERY_LIFEPO4, // 4 cells
+    NUM_BATTERYCHEMISTRIES
+};
+
+const char * const BATTERY_CHEMISTRY_NAMES[NUM_BATTERYCHEMISTRIES] = {"lead-acid", "LiFePO4"};
+
+// faults injectFault() can apply, for convenience and bookkeeping
+enum FaultKinds
+{   FAULT_ADC_SPIKE = 0, // an ADC input reads value codes off
+    FAULT_ADC_STUCK, // an ADC input reads value
+    FAULT_THERMISTOR_OPEN, // the thermistor on pin reads 0
+    FAULT_THERMISTOR_SHORT, // the thermistor on pin reads 1023
+    FAULT_VCC_SAG, // VCC at value volts, above the brown-out level
+    FAULT_BROWN_OUT, // VCC below the brown-out level: the MCU is held in reset
+    FAULT_BATTERY_DISCONNECT, // the battery and its load come off side 2
+    FAULT_OUTPUT_SHORT, // value ohms across side 2
+    NUM_FAULTKINDS
+};
+
+const char * const FAULT_KIND_NAMES[NUM_FAULTKINDS] = {"ADC spike", "ADC stuck", "thermistor open",
+  "thermistor short", "VCC sag", "brown-out", "battery disconnect", "output short"};
+
+struct PvParams
+{
+  int cells = 72; // in series
+  double iscA = 1.85; // short-circuit current at 1000 W/m2, 25 °C
+  double vocV = 43.2; // open-circuit voltage at 1000 W/m2, 25 °C
+  double ideality = 1.3; // diode ideality factor
+  double rsOhm = 0.8; // series resistance
+  double rshOhm = 600.0; // shunt resistance
+  double iscTempCoeff = 0.0005; // relative change of Isc per K
+  double bandgapEv = 1.12; // silicon, sets how the diode saturation current moves with temperature
+  double noctC = 45.0; // cell temperature at 800 W/m2 and 20 °C ambient
+};
+
+struct BuckParams
+{
+  double pwmHz = 100000.0; // FastPwmPin frequency set by AtverterH::setDutyCycle()
+  double inductorH = 47e-6;
+  double inputCapF = 22e-6; // side 1
+  double outputCapF = 22e-6; // side 2
+  double conductionOhm = 0.06; // FET on-resistance plus inductor DCR
+  double switchingS = 25e-9; // rise plus fall time, loss Vin*IL*switchingS*pwmHz
+  double quiescentW = 0.2; // gate drivers and board, drawn from side 1
+  double fetThermalKPerW = 8.0; // FET junction over ambient, per W dissipated on its side
+  double fetThermalS = 60.0; // heatsink time constant
+};
+
+struct BatteryParams
+{
+  int chemistry = BATTERY_LEAD_ACID; // BatteryChemistries
+  double capacityAh = 50.0;
+  double internalOhm = 0.025;
+  double initialSoc = 0.5; // 0 to 1
+  double loadA = 0.0; // drawn by whatever else hangs on the battery
+};
+
+struct SensorParams
+{
+  double vccV = 5.0; // ADC reference; the firmware assumes 5000 mV unless it measures more
+  double dividerGainError = 0.0; // relative, e.g. 0.005 for 0.5 % resistors
+  double currentOffsetmV[2] = {0.0, 0.0}; // MT9221 zero-current offset, terminals 1 and 2
+  double currentNoisemA = 20.0; // RMS per sample, both sensors
+  double voltageNoiseLsb = 0.3; // RMS per sample, both dividers
+  double thermistorFixedOhm = 33000.0; // to ground, the NTC to VCC; matches AtverterH's TTABLE
+  double thermistorBeta = 4250.0; // NCP15WF104F03RC, 100 kOhm at 25 °C
+};
+
+struct PlantParams
+{
+  int buckModel = BUCK_QUASI_STATIC; // BuckModels
+  PvParams pv;
+  BuckParams buck;
+  BatteryParams battery;
+  SensorParams sensors;
+  uint32_t seed = 1; // sensor noise
+};
+
+// a fault from a control tick on
+struct Fault
+{
+  int kind = FAULT_ADC_SPIKE; // FaultKinds
+  int pin = -1; // the ADC input of spikes, stuck codes and thermistor faults
+  long startTick = 0; // control ticks since attach()
+  long ticks = 1; // how long, -1 for good
+  double value = 0.0; // codes, volts or ohms, see FaultKinds
+};
+
+// what the plant is doing, in SI units
+struct PlantState
+{
+  double timeS; // since attach()
+  long ticks; // control periods since attach()
+  bool powered; // the MCU runs, false during a brown-out
+  double irradiance; // W/m2
+  double ambientC;
+  double cellC; // PV cell temperature
+  double duty; // 0 to 1, as the converter switches it
+  bool latched; // gate driver shut down
+  double panelV; // side 1
+  double panelA; // out of the panel
+  double inductorA;
+  double batteryV; // side 2 terminal voltage
+  double batteryA; // into the battery, load included
+  double soc; // 0 to 1
+  double mppW; // what the panel could deliver right now
+  double fet1C; // FET temperatures, side 1 and 2
+  double fet2C;
+};
+
+// the photovoltaic module on side 1
+class PvModule
+{
+  public:
+    PvModule(); // constructor
+    void configure(const PvParams& params); // fits the diode model to Isc and Voc
+    void setConditions(double irradiance, double cellC); // W/m2, °C
+    double current(double volts); // panel current at a terminal voltage, negative beyond Voc
+    double current(double volts, double& slope); // also dI/dV
+    double maxPower(double* volts = nullptr); // W at the maximum power point
+    double openCircuitVoltage();
+    double diodeCurrent(double diodeV, double& slope); // panel current at a junction voltage, for solvers
+    double seriesOhm(); // Rs
+  private:
+    PvParams _params;
+    double _photoA = 0.0; // at the current conditions
+    double _saturationA = 0.0;
+    double _thermalV = 1.0; // ideality*cells*kT/q
+    double _photoStcA = 0.0;
+    double _saturationStcA = 0.0;
+    double _diodeV = 0.0; // junction voltage of the last current() call, warm start
+    double _mppW = -1.0; // cached until the conditions change
+    double _mppV = 0.0;
+    double _openV = -1.0; // cached like _mppW
+};
+
+class PlantSim
+{
+  public:
+    PlantSim(); // constructor
+    void configure(const PlantParams& params); // before attach(), drops the faults
+    void attach(); // resets PicroHAL, installs the board model and sets the sensor inputs for setup()
+    void detach(); // releases the board
+    void setIrradiance(double irradiance); // W/m2 in the module plane
+    void setAmbient(double ambientC); // air temperature
+    void setLoad(double loadA); // what else draws on the battery from now on, as BatteryParams::loadA
+    void step(); // advances one control period and fires the control interrupt
+    bool advance(long ticks, const PlantState& reference, double toleranceV, double toleranceA); // see above
+    const PlantState& getState(); // after the last step
+    double getPvEnergyJ(); // delivered by the panel since attach()
+    double getMppEnergyJ(); // what the panel could have delivered
+    double getBatteryEnergyJ(); // into the battery terminals, load included
+    PvModule& getPv(); // for the maximum power point of other conditions
+    void injectFault(const Fault& fault); // applied from its start tick on, any number at once
+    void clearFaults();
+    long nextFaultTick(); // where a fault starts or ends from the current tick on, -1 if nowhere
+    void onReset(void (*setup)()); // run when the MCU comes out of a brown-out, e.g. the sketch's setup()
+  private:
+    PlantParams _params;
+    PlantState _state;
+    PvModule _pv;
+    std::mt19937 _random;
+    std::normal_distribution<double> _gaussian;
+    double _inputV = 0.0; // capacitor voltages and inductor current of the dynamic models
+    double _outputV = 0.0;
+    double _inductorA = 0.0;
+    double _pwmPhase = 0.0; // 0 to 1 within a switching period
+    double _thermistorC[2] = {-273.15, -273.15}; // FET temperatures the thermistor readings were last worked out for
+    int _thermistorRaw[2] = {0, 0};
+    std::vector<Fault> _faults;
+    std::vector<int> _activeFaults; // those covering the current tick, indexes into _faults
+    void (*_reset)() = nullptr;
+    double _vccV = 5.0; // the supply now, sags with FAULT_VCC_SAG
+    bool _batteryConnected = true;
+    double _shortOhm = 0.0; // across side 2, 0 for none
+    double _pvEnergyJ = 0.0;
+    double _mppEnergyJ = 0.0;
+    double _batteryEnergyJ = 0.0;
+    double batteryOpenCircuitV(); // from the state of charge
+    void solveQuasiStatic(double duty, bool switching, double dt); // steady state of the averaged model
+    void operatingPoint(double duty, bool switching, PlantState& point); // the steady state alone, into point
+    void integrate(double duty, bool switching, double dt); // averaged or switching model
+    void applyFaults(); // the faults covering the current tick
+    void outputSource(double& sourceV, double& sourceOhm); // side 2 as seen by the inductor: battery, load, short
+    void sense(); // plant state to ADC readings
+    void setAnalog(int pin, int raw); // an ADC reading, through the sensor faults
+    int adc(double volts); // ADC reading of a pin voltage, quantized
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*
+  ProcessPool.h - Runs independent jobs in forked child processes, a few at a time
+  Released into the public domain.
+
+  For jobs that cannot share a process, like the firmware with its globals.
+  Each job runs in its own child and returns a string (a JSON object, a CSV
+  row), which reaches the parent through a pipe; the results come back in
+  job order whatever order the children finish in. A new child starts as
+  soon as one finishes, so jobs of uneven length keep every worker busy. A
+  child that dies returns an empty string.
+*/
+
+#ifndef ProcessPool_h
+#define ProcessPool_h
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// job(0) to job(count - 1), at most workers of them at a time
+inline std::vector<std::string> runInProcesses(int count, int workers, const std::function<std::string(int)>& job) {
+  struct Child
+  {
+    pid_t pid;
+    int fd;
+    int job;
+  };
+  std::vector<std::string> results(count);
+  std::vector<Child> running;
+  int next = 0;
+  fflush(stdout); // or the children print it again
+  fflush(stderr);
+  while (next < count || !running.empty()) {
+    while (next < count && (int)running.size() < (workers > 0 ? workers : 1)) {
+      int fds[2];
+      if (pipe(fds) != 0) {
+        perror("pipe");
+        return results;
+      }
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return results;
+      }
+      if (pid == 0) {
+        close(fds[0]);
+        std::string result = job(next);
+        size_t written = 0;
+        while (written < result.size()) {
+          ssize_t n = write(fds[1], result.data() + written, result.size() - written);
+          if (n < 0 && errno == EINTR)
+            continue;
+          if (n <= 0)
+            break;
+          written += n;
+        }
+        _exit(0); // no atexit handlers or stdio flushes of the parent's state
+      }
+      close(fds[1]);
+      running.push_back({pid, fds[0], next++});
+    }
+
+    std::vector<pollfd> fds(running.size());
+    for (size_t n = 0; n < running.size(); n++)
+      fds[n] = {running[n].fd, POLLIN, 0};
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      break;
+    }
+    for (size_t n = running.size(); n-- > 0;) {
+      if (!(fds[n].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      char buffer[4096];
+      ssize_t length = read(running[n].fd, buffer, sizeof(buffer));
+      if (length > 0) {
+        results[running[n].job].append(buffer, length);
+      } else if (length == 0 || errno != EINTR) {
+        close(running[n].fd);
+        int status = 0;
+        waitpid(running[n].pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+          results[running[n].job].clear();
+        running.erase(running.begin() + n);
+      }
+    }
+  }
+  return results;
+}
+
+#endif
@@ -0,0 +1,70 @@
+/*
+  SketchRunner.h - Runs AtverterH_MPPT.cpp on a PlantSim, a simulated second at a time
+  Released into the public domain.
+
+  The sketch, its board and PicroHAL's fakes are globals, like on the
+  ATmega, so there is one sketch per process: benchmarks that run several
+  in parallel fork (ProcessPool.h) rather than start threads.
+*/
+
+#ifndef SketchRunner_h
+#define SketchRunner_h
+
+#include <functional>
+#include <string>
+
+#include <AtverterH.h>
+#include "PlantSim.h"
+
+// the sketch's entry points and board, from AtverterH_MPPT.cpp
+void setup();
+void loop();
+extern AtverterH atverterH;
+extern long slowInterruptCounter; // ticks since the slow loop last ran
+extern long slowInterruptCount; // the slow loop runs when the counter passes it
+
+const int SKETCH_TICKS_PER_SECOND = 1000; // INTERRUPT_TIME of 1000 us
+const int SKETCH_IRRADIANCE_TICKS = 100; // how often an irradiance profile moves the plant
+
+// what happened over one simulated second
+struct SketchSecond
+{
+  double pvJ; // panel energy
+  double mppJ; // at the maximum power point
+  double batteryJ;
+  int duty; // the sketch's duty cycle at the end, %
+};
+
+// powers the board up on the plant and runs setup(), again after every brown-out
+inline void startSketch(PlantSim& plant) {
+  plant.attach();
+  plant.onReset(setup);
+  setup();
+}
+
+// the control interrupt and loop() in turn for one second; the UART output is appended to uart if given,
+// irradiance (W/m2 at the plant's time) is followed every SKETCH_IRRADIANCE_TICKS if given
+inline SketchSecond runSketchSecond(PlantSim& plant, std::string* uart = nullptr,
+    const std::function<double(double)>& irradiance = nullptr) {
+  double pvJ = plant.getPvEnergyJ();
+  double mppJ = plant.getMppEnergyJ();
+  double batteryJ = plant.getBatteryEnergyJ();
+  for (int n = 0; n < SKETCH_TICKS_PER_SECOND; n++) {
+    if (irradiance && n % SKETCH_IRRADIANCE_TICKS == 0)
+      plant.setIrradiance(irradiance(plant.getState().timeS));
+    plant.step();
+    if (plant.getState().powered)
+      loop();
+  }
+  std::string output = halNativeUARTTake();
+  if (uart)
+    uart->append(output);
+  SketchSecond second;
+  second.pvJ = plant.getPvEnergyJ() - pvJ;
+  second.mppJ = plant.getMppEnergyJ() - mppJ;
+  second.batteryJ = plant.getBatteryEnergyJ() - batteryJ;
+  second.duty = atverterH.getDutyCycle();
+  return second;
+}
+
+#endif
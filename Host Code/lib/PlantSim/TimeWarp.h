@@ -0,0 +1,140 @@
+/*
+  TimeWarp.h - Runs AtverterH_MPPT.cpp on a PlantSim for days, passing over the control ticks that change nothing
+  Released into the public domain.
+
+  Between two runs of its slow loop (the IC step and the record, once a
+  second) the sketch's control interrupt only averages the sensors and
+  checks them against its limits, so while the plant holds still each of
+  those ticks does what the one before did. TimeWarp runs the ticks around
+  every slow loop one by one, enough of them (AVERAGE_WINDOW_MAX of the
+  voltage and current sensors) that the averages the IC step reads hold
+  fresh samples only, and so do the ones after the duty cycle moved. The
+  ticks in between go to PlantSim::advance() in blocks of up to
+  SKETCH_IRRADIANCE_TICKS, one plant solve each, and are counted on the
+  board's tick counter, the bootstrap counter and the sketch's slow loop
+  counter as if the interrupt had run.
+
+  These run tick by tick instead, as events:
+    - a block whose operating point would move beyond the tolerances from
+      the last tick that ran (by default about the deadband telemetry's 2
+      ADC steps of voltage and 3 of current), so a limit is never crossed
+      unseen
+    - a block with a fault starting or ending in it
+    - the gates shut down (the sketch prints every tick), a brown-out, host
+      commands waiting on the UART
+    - the averaged and switching buck models, which do not batch
+
+  At the 1 s MPPT interval about 20 of the 1001 ticks run, and a day takes a
+  few seconds on one core. A warped run is as deterministic for its seed as
+  a full one, but not the same run: the skipped ticks draw no sensor noise.
+*/
+
+#ifndef TimeWarp_h
+#define TimeWarp_h
+
+#include <functional>
+#include <string>
+
+#include "SketchRunner.h"
+
+struct WarpParams
+{
+  bool enabled = true; // false runs every tick, like runSketchSecond()
+  double toleranceV = 0.13; // panel and battery voltage a skipped block may move from the last tick run
+  double toleranceA = 0.045; // panel and inductor current
+};
+
+struct WarpStats
+{
+  long long ticksRun = 0; // control interrupts that ran
+  long long ticksSkipped = 0; // passed over in blocks
+  long long blocks = 0; // plant solves for the skipped ticks
+  long long events = 0; // blocks that ran tick by tick as the plant would have moved too far
+};
+
+class TimeWarp
+{
+  public:
+    TimeWarp(PlantSim& plant, const WarpParams& params = WarpParams()) : _plant(plant), _params(params) {
+      for (int n = V1_INDEX; n <= I2_INDEX; n++)
+        if (AVERAGE_WINDOW_MAX[n] > _settleTicks)
+          _settleTicks = AVERAGE_WINDOW_MAX[n];
+      _reference = plant.getState();
+    }
+
+    // runSketchSecond() with the idle ticks passed over
+    SketchSecond runSecond(std::string* uart = nullptr, const std::function<double(double)>& irradiance = nullptr) {
+      double pvJ = _plant.getPvEnergyJ();
+      double mppJ = _plant.getMppEnergyJ();
+      double batteryJ = _plant.getBatteryEnergyJ();
+      for (int n = 0; n < SKETCH_TICKS_PER_SECOND;) {
+        if (irradiance && n % SKETCH_IRRADIANCE_TICKS == 0)
+          _plant.setIrradiance(irradiance(_plant.getState().timeS));
+        long skip = skippable(n);
+        if (skip > 0) {
+          _stats.blocks++;
+          if (_plant.advance(skip, _reference, _params.toleranceV, _params.toleranceA)) {
+            halNativeSkipTicks(skip);
+            atverterH.skipTicks(skip);
+            slowInterruptCounter += skip;
+            _stats.ticksSkipped += skip;
+            n += skip;
+            continue;
+          }
+          _stats.events++;
+          _eventTicks = SKETCH_IRRADIANCE_TICKS - n%SKETCH_IRRADIANCE_TICKS; // the rest of the block tick by tick
+        }
+        int duty = halNativeGetPwmDuty(PWM_PIN);
+        _plant.step();
+        if (_plant.getState().powered)
+          loop();
+        _reference = _plant.getState();
+        _stats.ticksRun++;
+        _settled = halNativeGetPwmDuty(PWM_PIN) == duty ? _settled + 1 : 0;
+        if (_eventTicks > 0)
+          _eventTicks--;
+        n++;
+      }
+      std::string output = halNativeUARTTake();
+      if (uart)
+        uart->append(output);
+      SketchSecond second;
+      second.pvJ = _plant.getPvEnergyJ() - pvJ;
+      second.mppJ = _plant.getMppEnergyJ() - mppJ;
+      second.batteryJ = _plant.getBatteryEnergyJ() - batteryJ;
+      second.duty = atverterH.getDutyCycle();
+      return second;
+    }
+
+    const WarpStats& getStats() {
+      return _stats;
+    }
+
+  private:
+    PlantSim& _plant;
+    WarpParams _params;
+    WarpStats _stats;
+    PlantState _reference; // the plant at the last tick that ran
+    int _settleTicks = 1; // ticks that fill the voltage and current averages with fresh samples
+    long _settled = 0; // ticks run in a row since the duty cycle last moved
+    long _eventTicks = 0; // left of an event block, run tick by tick
+
+    // how many ticks from tick n of the second can be passed over, 0 to run the next one
+    long skippable(int n) {
+      if (!_params.enabled || _eventTicks > 0 || _settled < _settleTicks)
+        return 0;
+      const PlantState& state = _plant.getState();
+      if (!state.powered || state.latched || atverterH.isGateShutdown() || Serial.available() > 0)
+        return 0;
+      long skip = slowInterruptCount - slowInterruptCounter - _settleTicks; // the slow loop's own ticks run
+      long block = SKETCH_IRRADIANCE_TICKS - n%SKETCH_IRRADIANCE_TICKS;
+      if (block < skip)
+        skip = block;
+      long fault = _plant.nextFaultTick();
+      if (fault >= 0 && fault - state.ticks < skip)
+        skip = fault - state.ticks;
+      return skip > 0 ? skip : 0;
+    }
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
+  SerialPort.cpp - Non-blocking line reader for the AtverterH UART
+  Released into the public domain.
+*/
+
+#include "SerialPort.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#endif
+
+// maps a numeric baud rate to its termios constant
+static speed_t baudConstant(int baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    default: return B38400;
+  }
+}
+
+SerialPort::SerialPort() {
+}
+
+SerialPort::~SerialPort() {
+  close();
+}
+
+// opens and configures the port, non-blocking; non-tty paths are opened unchanged
+bool SerialPort::open(const char* path, int baud) {
+  close();
+  _fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (_fd < 0)
+    _fd = ::open(path, O_RDONLY | O_NONBLOCK); // capture files and FIFOs
+  if (_fd < 0)
+    return false;
+  if (isatty(_fd)) {
+    struct termios options;
+    if (tcgetattr(_fd, &options) != 0) {
+      close();
+      return false;
+    }
+    cfmakeraw(&options);
+    cfsetispeed(&options, baudConstant(baud));
+    cfsetospeed(&options, baudConstant(baud));
+    options.c_cflag |= CLOCAL | CREAD;
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    tcsetattr(_fd, TCSANOW, &options);
+    tcflush(_fd, TCIFLUSH); // drop whatever was buffered before we started listening
+#ifdef __linux__
+    // FTDI adapters hold short reads for their 16 ms latency timer unless asked not to,
+    // which would swamp the clock sync exchanges; other drivers ignore the flag
+    struct serial_struct serial;
+    if (ioctl(_fd, TIOCGSERIAL, &serial) == 0) {
+      serial.flags |= ASYNC_LOW_LATENCY;
+      ioctl(_fd, TIOCSSERIAL, &serial);
+    }
+#endif
+  }
+  _pending.clear();
+  _scanned = 0;
+  return true;
+}
+
+// closes the port
+void SerialPort::close() {
+  if (_fd >= 0)
+    ::close(_fd);
+  _fd = -1;
+}
+
+// file descriptor for poll(), -1 if closed
+int SerialPort::getFd() {
+  return _fd;
+}
+
+// returns true if the port is open
+bool SerialPort::isOpen() {
+  return _fd >= 0;
+}
+
+// reads what the kernel has buffered, returns bytes read, 0 if nothing yet, -1 on error/EOF
+int SerialPort::readAvailable() {
+  if (_fd < 0)
+    return -1;
+  char buffer[4096];
+  int total = 0;
+  while (true) {
+    ssize_t got = ::read(_fd, buffer, sizeof(buffer));
+    if (got > 0) {
+      _pending.append(buffer, got);
+      total += (int)got;
+      continue;
+    }
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      return total;
+    return total > 0 ? total : -1; // EOF (end of a capture file, unplugged adapter) or error
+  }
+}
+
+// pops the next complete line, without its \r\n; overlong lines are cut and counted
+bool SerialPort::nextLine(std::string& line) {
+  size_t newline = _pending.find('\n', _scanned);
+  if (newline == std::string::npos) {
+    if (_pending.size() < (size_t)SERIAL_LINE_MAX) {
+      _scanned = _pending.size();
+      return false;
+    }
+    newline = SERIAL_LINE_MAX; // no terminator in sight, cut it here
+    _overflows++;
+    line.assign(_pending, 0, newline);
+    _pending.erase(0, newline);
+  } else {
+    line.assign(_pending, 0, newline);
+    _pending.erase(0, newline + 1);
+  }
+  _scanned = 0;
+  if (!line.empty() && line[line.size() - 1] == '\r')
+    line.erase(line.size() - 1);
+  return true;
+}
+
+// lines cut because they exceeded SERIAL_LINE_MAX
+long SerialPort::getOverflows() {
+  return _overflows;
+}
+
+// writes a command to the device, e.g. "RV1:\n"
+bool SerialPort::write(const char* text, size_t length) {
+  while (length > 0 && _fd >= 0) {
+    ssize_t sent = ::write(_fd, text, length);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EINTR)
+        continue;
+      return false;
+    }
+    text += sent;
+    length -= sent;
+  }
+  return length == 0;
+}
@@ -0,0 +1,40 @@
+/*
+  SerialPort.h - Non-blocking line reader for the AtverterH UART
+  Released into the public domain.
+
+  Opens a tty in raw mode at the firmware baud rate (38400, see
+  PicroBoard::startUART()), in the driver's low latency mode where it has
+  one. Anything that is not a tty (a FIFO, a capture file, a pseudo-terminal
+  simulator) is read as-is, which makes replays easy.
+*/
+
+#ifndef SerialPort_h
+#define SerialPort_h
+
+#include <stddef.h>
+#include <string>
+
+const int SERIAL_DEFAULT_BAUD = 38400; // PicroBoard::startUART() default
+const int SERIAL_LINE_MAX = 512; // longer lines are cut and reported as overflow
+
+class SerialPort
+{
+  public:
+    SerialPort(); // constructor
+    ~SerialPort(); // closes the port
+    bool open(const char* path, int baud); // opens and configures the port, non-blocking
+    void close(); // closes the port
+    int getFd(); // file descriptor for poll(), -1 if closed
+    bool isOpen(); // returns true if the port is open
+    int readAvailable(); // reads what the kernel has buffered, returns bytes read, -1 on error/EOF
+    bool nextLine(std::string& line); // pops the next complete line (without \r\n)
+    long getOverflows(); // lines cut because they exceeded SERIAL_LINE_MAX
+    bool write(const char* text, size_t length); // writes a command, e.g. "RV1:\n"
+  private:
+    int _fd = -1;
+    std::string _pending; // bytes received but not yet returned as lines
+    size_t _scanned = 0; // prefix of _pending known not to hold a newline
+    long _overflows = 0;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+  SharedTelemetry.cpp - Latest record of every device in POSIX shared memory
+  Released into the public domain.
+*/
+
+#include "SharedTelemetry.h"
+
+#include <stdio.h>
+#include <chrono>
+#include <new>
+
+SharedTelemetryWriter::SharedTelemetryWriter() {
+}
+
+SharedTelemetryWriter::~SharedTelemetryWriter() {
+  close();
+}
+
+// creates (or replaces a stale) segment with numSlots empty slots; the magic is written last
+// so a reader that maps the segment early sees either nothing or a complete header
+bool SharedTelemetryWriter::open(const char* name, int numSlots) {
+  close();
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return false;
+  size_t size = SHARED_SLOTS_OFFSET + numSlots*sizeof(SharedTelemetrySlot);
+  void* map = MAP_FAILED;
+  if (ftruncate(fd, size) == 0)
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    shm_unlink(name);
+    return false;
+  }
+  _name = name;
+  _map = map;
+  _size = size;
+  _numSlots = numSlots;
+  _slots = (SharedTelemetrySlot*)((char*)map + SHARED_SLOTS_OFFSET);
+  for (int slot = 0; slot < numSlots; slot++) { // the mapping starts zeroed, only set what is not 0
+    new (&_slots[slot].sequence) std::atomic<uint32_t>(0);
+    _slots[slot].record.shutdownCode = -1;
+  }
+  SharedTelemetryHeader* header = (SharedTelemetryHeader*)map;
+  header->version = SHARED_TELEMETRY_VERSION;
+  header->numChannels = NUM_CHANNELS;
+  header->numSlots = numSlots;
+  header->slotSize = sizeof(SharedTelemetrySlot);
+  header->writerPid = getpid();
+  header->startedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, "ATVS", 4);
+  return true;
+}
+
+// unmaps and removes the segment; readers that mapped it keep their last snapshot and can
+// tell it is stale from publishedUs
+void SharedTelemetryWriter::close() {
+  if (_map) {
+    munmap(_map, _size);
+    shm_unlink(_name.c_str());
+  }
+  _map = NULL;
+  _slots = NULL;
+  _numSlots = 0;
+}
+
+// returns true if the segment exists
+bool SharedTelemetryWriter::isOpen() {
+  return _map != NULL;
+}
+
+// names a slot; call before the first publish, readers look devices up by name
+void SharedTelemetryWriter::setDeviceName(int slot, const char* name) {
+  if (slot < 0 || slot >= _numSlots)
+    return;
+  snprintf(_slots[slot].name, SHARED_TELEMETRY_NAME_MAX, "%s", name);
+}
+
+// makes the slot's sequence odd; readers that overlap with the write will retry
+SharedTelemetryRecord* SharedTelemetryWriter::beginWrite(int slot) {
+  std::atomic<uint32_t>& sequence = _slots[slot].sequence;
+  sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return &_slots[slot].record;
+}
+
+// makes the sequence even again, publishing the record
+void SharedTelemetryWriter::endWrite(int slot) {
+  std::atomic<uint32_t>& sequence = _slots[slot].sequence;
+  sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// publishes a new record, which also means the converter is running
+void SharedTelemetryWriter::publish(int slot, const TelemetrySample& sample, uint32_t presentMask) {
+  if (slot < 0 || slot >= _numSlots)
+    return;
+  SharedTelemetryRecord* record = beginWrite(slot);
+  record->recordCount++;
+  record->publishedUs = sample.timestampUs;
+  record->shutdownCode = -1;
+  record->presentMask = presentMask;
+  record->sample = sample;
+  endWrite(slot);
+}
+
+// publishes a latched shutdown code, keeping the last record
+void SharedTelemetryWriter::publishShutdown(int slot, int code) {
+  if (slot < 0 || slot >= _numSlots)
+    return;
+  SharedTelemetryRecord* record = beginWrite(slot);
+  record->shutdownCode = code;
+  endWrite(slot);
+}
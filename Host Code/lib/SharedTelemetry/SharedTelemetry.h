@@ -0,0 +1,183 @@
+/*
+  SharedTelemetry.h - Latest record of every device in POSIX shared memory
+  Released into the public domain.
+
+  atverterd publishes each decoded record into /dev/shm/atverter so local
+  programs (battery manager, logger, ...) can read the converter state without
+  parsing data.json or talking to the daemon. Each device has one slot guarded
+  by a seqlock: the writer makes the slot's sequence odd, copies the record and
+  makes it even again; a reader copies the record between two loads of the
+  sequence and keeps it only if both are the same even value. Readers never
+  write to the segment, never block the daemon and make no syscalls after
+  open().
+
+  Segment layout (native byte order, the Pi is the only intended host):
+    SharedTelemetryHeader
+    SharedTelemetrySlot[numSlots], each on its own 64 byte cache lines
+  Bump SHARED_TELEMETRY_VERSION whenever either struct changes; readers refuse
+  other versions.
+
+  This header is all a consumer needs; SharedTelemetryReader is header only.
+  Link with -lrt on glibc older than 2.34.
+*/
+
+#ifndef SharedTelemetry_h
+#define SharedTelemetry_h
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+
+#include "Telemetry.h"
+
+const char * const SHARED_TELEMETRY_NAME = "/atverter"; // shm_open() name, i.e. /dev/shm/atverter
+const uint16_t SHARED_TELEMETRY_VERSION = 1; // bump when the layout below changes
+const int SHARED_TELEMETRY_NAME_MAX = 48; // device name bytes, including the terminator
+const int SHARED_READ_RETRIES = 1000; // attempts read() makes before giving up on a busy slot
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "seqlock needs a lock-free 32 bit atomic");
+
+struct SharedTelemetryHeader
+{
+  char magic[4]; // "ATVS", written last when the segment is created
+  uint16_t version; // SHARED_TELEMETRY_VERSION
+  uint16_t numChannels; // NUM_CHANNELS of the writer
+  uint32_t numSlots; // devices in the segment
+  uint32_t slotSize; // sizeof(SharedTelemetrySlot) of the writer
+  int32_t writerPid; // atverterd's pid
+  uint32_t reserved;
+  int64_t startedUs; // wall clock when the daemon created the segment
+};
+
+const size_t SHARED_SLOTS_OFFSET = (sizeof(SharedTelemetryHeader) + 63)/64*64; // slots start on a cache line
+
+// one consistent snapshot of a device
+struct SharedTelemetryRecord
+{
+  uint64_t recordCount; // records published to this slot so far, 0 before the first one
+  int64_t publishedUs; // host wall clock when the record was published
+  int32_t shutdownCode; // latched gate shutdown code, -1 while the converter runs
+  uint32_t presentMask; // 1 << TelemetryChannel for every field the record carried
+  TelemetrySample sample; // timestamp and every channel
+};
+
+struct alignas(64) SharedTelemetrySlot
+{
+  std::atomic<uint32_t> sequence; // odd while the writer is inside the slot
+  uint32_t reserved;
+  char name[SHARED_TELEMETRY_NAME_MAX]; // device name, fixed once the segment exists
+  SharedTelemetryRecord record;
+};
+
+// maps the segment read-only and takes seqlock snapshots of its slots
+class SharedTelemetryReader
+{
+  public:
+    ~SharedTelemetryReader() { close(); }
+
+    // maps the segment and checks its version, false if the daemon is not running or differs
+    bool open(const char* name = SHARED_TELEMETRY_NAME) {
+      close();
+      int fd = shm_open(name, O_RDONLY, 0);
+      if (fd < 0)
+        return false;
+      struct stat info;
+      if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(SharedTelemetryHeader)) {
+        ::close(fd);
+        return false;
+      }
+      void* map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (map == MAP_FAILED)
+        return false;
+      _map = map;
+      _size = info.st_size;
+      _header = (const SharedTelemetryHeader*)map;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (memcmp(_header->magic, "ATVS", 4) != 0 || _header->version != SHARED_TELEMETRY_VERSION
+        || _header->numChannels != NUM_CHANNELS || _header->slotSize != sizeof(SharedTelemetrySlot)
+        || _size < SHARED_SLOTS_OFFSET + (size_t)_header->numSlots*sizeof(SharedTelemetrySlot)) {
+        close();
+        return false;
+      }
+      _slots = (const SharedTelemetrySlot*)((const char*)map + SHARED_SLOTS_OFFSET);
+      return true;
+    }
+
+    void close() {
+      if (_map)
+        munmap(_map, _size);
+      _map = NULL;
+      _header = NULL;
+      _slots = NULL;
+    }
+
+    bool isOpen() { return _map != NULL; }
+    int getNumDevices() { return _header ? (int)_header->numSlots : 0; }
+    const SharedTelemetryHeader* getHeader() { return _header; }
+    const char* getDeviceName(int slot) { return _slots[slot].name; }
+
+    // slot of a device by name, -1 if the daemon does not serve it
+    int findDevice(const char* name) {
+      for (int slot = 0; slot < getNumDevices(); slot++) {
+        if (strncmp(_slots[slot].name, name, SHARED_TELEMETRY_NAME_MAX) == 0)
+          return slot;
+      }
+      return -1;
+    }
+
+    // one attempt, wait-free: false if the writer was inside the slot
+    bool tryRead(int slot, SharedTelemetryRecord& record) {
+      const SharedTelemetrySlot& s = _slots[slot];
+      uint32_t before = s.sequence.load(std::memory_order_acquire);
+      if (before & 1)
+        return false;
+      memcpy(&record, (const void*)&s.record, sizeof(record));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return s.sequence.load(std::memory_order_relaxed) == before;
+    }
+
+    // retries tryRead(); the writer holds a slot for a few hundred nanoseconds at 1 Hz
+    bool read(int slot, SharedTelemetryRecord& record) {
+      for (int attempt = 0; attempt < SHARED_READ_RETRIES; attempt++) {
+        if (tryRead(slot, record))
+          return true;
+      }
+      return false;
+    }
+
+  private:
+    void* _map = NULL;
+    size_t _size = 0;
+    const SharedTelemetryHeader* _header = NULL;
+    const SharedTelemetrySlot* _slots = NULL;
+};
+
+// creates the segment and publishes records into it; used by atverterd
+class SharedTelemetryWriter
+{
+  public:
+    SharedTelemetryWriter(); // constructor
+    ~SharedTelemetryWriter(); // unmaps and removes the segment
+    bool open(const char* name, int numSlots); // creates (or replaces) the segment
+    void close(); // unmaps and removes the segment, readers keep their last snapshot
+    bool isOpen(); // returns true if the segment exists
+    void setDeviceName(int slot, const char* name); // names a slot, call before publishing
+    void publish(int slot, const TelemetrySample& sample, uint32_t presentMask); // a new record
+    void publishShutdown(int slot, int code); // latched shutdown code, the next publish() clears it
+  private:
+    std::string _name;
+    void* _map = NULL;
+    size_t _size = 0;
+    SharedTelemetrySlot* _slots = NULL;
+    int _numSlots = 0;
+    SharedTelemetryRecord* beginWrite(int slot); // makes the sequence odd
+    void endWrite(int slot); // makes the sequence even again
+};
+
+#endif
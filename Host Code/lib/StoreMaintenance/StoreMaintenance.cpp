@@ -0,0 +1,358 @@
+/*
+  StoreMaintenance.cpp - Retention and compaction of TelemetryStore directories
+  Released into the public domain.
+*/
+
+#include "StoreMaintenance.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+#include "TelemetryArchive.h"
+#include "TelemetryQuery.h"
+#include "TelemetryStore.h"
+
+// not wrapped by glibc, see ioprio_set(2)
+const int IOPRIO_WHO_PROCESS = 1;
+const int IOPRIO_CLASS_IDLE = 3;
+const int IOPRIO_CLASS_SHIFT = 13;
+
+static double steadySeconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// size of a file, -1 if it does not exist
+static long long fileBytes(const std::string& path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? (long long)info.st_size : -1;
+}
+
+// total size of the files in a directory; also removes the .tmp files of an interrupted compaction
+static long long sweepDirectory(const std::string& directory) {
+  long long bytes = 0;
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+    return 0;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string path = directory + "/" + entry->d_name;
+    size_t length = strlen(entry->d_name);
+    if (length > 8 && strcmp(entry->d_name + length - 8, ".atv.tmp") == 0) {
+      unlink(path.c_str());
+      continue;
+    }
+    struct stat info;
+    if (entry->d_name[0] != '.' && stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+      bytes += info.st_size;
+  }
+  closedir(dir);
+  return bytes;
+}
+
+// makes a finished temporary file durable and moves it over the original
+static bool replaceFile(const std::string& temporary, const std::string& path) {
+  int fd = open(temporary.c_str(), O_RDONLY);
+  bool ok = fd >= 0 && fsync(fd) == 0;
+  if (fd >= 0)
+    close(fd);
+  ok = ok && rename(temporary.c_str(), path.c_str()) == 0;
+  if (!ok)
+    unlink(temporary.c_str());
+  return ok;
+}
+
+// "raw=7d,1s=2d,1m=1y,15m=5y,1h=forever,1d=forever"; keys that are not listed keep their value
+bool parseRetention(const char* text, RetentionPolicy& policy) {
+  std::string list = text;
+  size_t start = 0;
+  while (start < list.size()) {
+    size_t comma = list.find(',', start);
+    std::string item = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+    start = comma == std::string::npos ? list.size() : comma + 1;
+    size_t equals = item.find('=');
+    if (equals == std::string::npos)
+      return false;
+    std::string key = item.substr(0, equals);
+    std::string value = item.substr(equals + 1);
+    int64_t durationUs = 0;
+    if (value != "forever" && (!parseQueryDuration(value.c_str(), durationUs) || durationUs <= 0))
+      return false;
+    if (key == "raw") {
+      policy.rawUs = durationUs;
+      continue;
+    }
+    int tier = 0;
+    while (tier < NUM_TIERS && key != TIER_NAMES[tier])
+      tier++;
+    if (tier == NUM_TIERS)
+      return false;
+    policy.tierUs[tier] = durationUs;
+  }
+  return true;
+}
+
+StoreMaintenance::StoreMaintenance() {
+}
+
+StoreMaintenance::~StoreMaintenance() {
+  stop();
+}
+
+// retention of every directory
+void StoreMaintenance::setPolicy(const RetentionPolicy& policy) {
+  _policy = policy;
+}
+
+// IO budget of the thread in bytes per second, 0 for unthrottled
+void StoreMaintenance::setBytesPerSecond(long bytesPerSecond) {
+  _bytesPerSecond = bytesPerSecond;
+}
+
+// seconds between passes of the thread
+void StoreMaintenance::setInterval(int seconds) {
+  _intervalSeconds = seconds > 0 ? seconds : 1;
+}
+
+// a TelemetryStore directory (<root>/<device>); call before start()
+void StoreMaintenance::addDirectory(const std::string& directory) {
+  _directories.push_back(directory);
+  _stats.directoryBytes.push_back(0);
+}
+
+// runs a pass now and then every interval, in a low priority thread
+bool StoreMaintenance::start() {
+  if (_thread.joinable())
+    return false;
+  _stopping = false;
+  _thread = std::thread([this]() { run(); });
+  return true;
+}
+
+// interrupts a running pass (at the next throttle point) and joins the thread
+void StoreMaintenance::stop() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _wake.notify_all();
+  if (_thread.joinable())
+    _thread.join();
+}
+
+// one pass over every directory in the calling thread: retention first, then compaction
+bool StoreMaintenance::runOnce(int64_t nowUs) {
+  for (size_t d = 0; d < _directories.size() && !isStopping(); d++) {
+    const std::string& directory = _directories[d];
+    sweepDirectory(directory);
+    applyRetention(directory, nowUs);
+    std::vector<std::string> paths;
+    listSegments(directory, "raw", paths);
+    for (const std::string& path : paths) {
+      int64_t startUs;
+      if (segmentStartTime(path, startUs) && startUs + STORE_SEGMENT_US + COMPACTION_GRACE_US <= nowUs)
+        compactSegment(path);
+    }
+    for (int t = 0; t < NUM_TIERS; t++) {
+      listSegments(directory, rollupPrefix(t).c_str(), paths);
+      for (const std::string& path : paths) {
+        int64_t startUs;
+        if (segmentStartTime(path, startUs)
+          && startUs + TIER_FILE_DAYS[t]*STORE_SEGMENT_US + COMPACTION_GRACE_US <= nowUs)
+          compactRollup(path);
+      }
+    }
+    long long bytes = sweepDirectory(directory);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats.directoryBytes[d] = bytes;
+  }
+  std::lock_guard<std::mutex> lock(_mutex);
+  _stats.passes++;
+  return !_stopping;
+}
+
+// thread safe copy of the totals
+MaintenanceStats StoreMaintenance::getStats() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+// the thread: lowest CPU and idle IO priority, so only otherwise idle time is used
+void StoreMaintenance::run() {
+  pid_t tid = (pid_t)syscall(SYS_gettid);
+  setpriority(PRIO_PROCESS, tid, 19);
+#ifdef SYS_ioprio_set
+  syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+  while (true) {
+    int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+    runOnce(nowUs);
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_wake.wait_for(lock, std::chrono::seconds(_intervalSeconds), [this]() { return _stopping; }))
+      break;
+  }
+}
+
+// waits until the IO before this one fits the byte rate, then books bytes; false once stopping
+bool StoreMaintenance::throttle(long long bytes) {
+  if (_bytesPerSecond <= 0)
+    return !isStopping();
+  double now = steadySeconds();
+  _ioFree = std::max(_ioFree, now);
+  double waitUntil = _ioFree;
+  _ioFree += (double)bytes/_bytesPerSecond;
+  auto deadline = std::chrono::steady_clock::time_point(std::chrono::duration_cast<
+    std::chrono::steady_clock::duration>(std::chrono::duration<double>(waitUntil)));
+  std::unique_lock<std::mutex> lock(_mutex);
+  return !_wake.wait_until(lock, deadline, [this]() { return _stopping; });
+}
+
+// true once stop() was called
+bool StoreMaintenance::isStopping() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stopping;
+}
+
+// deletes raw segments and rollup files whose whole period is older than the policy allows;
+// a raw day survives until some rollup tier has rows past its end
+void StoreMaintenance::applyRetention(const std::string& directory, int64_t nowUs) {
+  int64_t coveredUs = INT64_MIN;
+  bool haveRollups = false;
+  for (int t = 0; t < NUM_TIERS; t++) {
+    int64_t startUs, endUs;
+    if (rollupRange(directory, t, startUs, endUs)) {
+      coveredUs = std::max(coveredUs, endUs);
+      haveRollups = true;
+    }
+  }
+  std::vector<std::string> paths;
+  long deleted = 0;
+  long long freed = 0;
+  if (_policy.rawUs > 0 && listSegments(directory, "raw", paths)) {
+    for (const std::string& path : paths) {
+      int64_t startUs;
+      if (!segmentStartTime(path, startUs) || startUs + STORE_SEGMENT_US > nowUs - _policy.rawUs
+        || (haveRollups && startUs + STORE_SEGMENT_US > coveredUs))
+        continue;
+      long long bytes = fileBytes(path);
+      if (unlink(path.c_str()) == 0) {
+        deleted++;
+        freed += bytes;
+      }
+    }
+  }
+  for (int t = 0; t < NUM_TIERS; t++) {
+    if (_policy.tierUs[t] <= 0 || !listSegments(directory, rollupPrefix(t).c_str(), paths))
+      continue;
+    for (const std::string& path : paths) {
+      int64_t startUs;
+      if (!segmentStartTime(path, startUs)
+        || startUs + TIER_FILE_DAYS[t]*STORE_SEGMENT_US > nowUs - _policy.tierUs[t])
+        continue;
+      long long bytes = fileBytes(path);
+      if (unlink(path.c_str()) == 0) {
+        deleted++;
+        freed += bytes;
+      }
+    }
+  }
+  count(deleted, 0, freed, 0, 0);
+}
+
+// re-encodes a raw segment in full blocks if flushes left it with short ones
+void StoreMaintenance::compactSegment(const std::string& path) {
+  ArchiveReader reader;
+  if (!reader.open(path.c_str()))
+    return;
+  long samples = reader.getNumSamples();
+  int blocks = reader.getNumBlocks();
+  if (blocks <= (samples + ARCHIVE_BLOCK_SAMPLES - 1)/ARCHIVE_BLOCK_SAMPLES)
+    return; // already compact
+  long long before = fileBytes(path);
+  if (!throttle(before))
+    return;
+  std::string temporary = path + ".tmp";
+  unlink(temporary.c_str());
+  ArchiveWriter writer;
+  if (!writer.open(temporary.c_str()))
+    return;
+  std::vector<int64_t> timestamps;
+  std::vector<int32_t> columns[NUM_CHANNELS];
+  int32_t* pointers[NUM_CHANNELS];
+  TelemetrySample sample;
+  bool ok = true;
+  for (int b = 0; b < blocks && ok; b++) {
+    const ArchiveBlockInfo& info = reader.getBlockInfo(b);
+    timestamps.resize(info.numSamples);
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+      columns[c].resize(info.numSamples);
+      pointers[c] = columns[c].data();
+    }
+    ok = reader.readBlock(b, timestamps.data(), pointers);
+    for (uint32_t n = 0; n < info.numSamples && ok; n++) {
+      sample.timestampUs = timestamps[n];
+      for (int c = 0; c < NUM_CHANNELS; c++)
+        sample.values[c] = columns[c][n];
+      ok = writer.append(sample);
+    }
+  }
+  writer.close();
+  reader.close();
+  ArchiveReader check;
+  ok = ok && check.open(temporary.c_str()) && check.getNumSamples() == samples;
+  check.close();
+  long long after = fileBytes(temporary);
+  // the store appended meanwhile (a late sample): keep the original, try again next pass
+  ok = ok && throttle(after) && fileBytes(path) == before;
+  if (!ok || !replaceFile(temporary, path)) {
+    unlink(temporary.c_str());
+    return;
+  }
+  count(0, 1, before - after, before, after);
+}
+
+// merges the per-flush blocks of a rollup file into a single block
+void StoreMaintenance::compactRollup(const std::string& path) {
+  RollupReader reader;
+  if (!reader.open(path.c_str()) || reader.getNumBlocks() <= 1)
+    return;
+  long long before = fileBytes(path);
+  if (!throttle(before))
+    return;
+  RollupRows rows;
+  RollupRows block;
+  bool ok = true;
+  for (int b = 0; b < reader.getNumBlocks() && ok; b++) {
+    ok = reader.readBlock(b, (1u << NUM_CHANNELS) - 1, block);
+    rows.append(block);
+  }
+  int64_t tierUs = reader.getTierUs();
+  reader.close();
+  std::string temporary = path + ".tmp";
+  ok = ok && writeRollupFile(temporary, tierUs, rows);
+  long long after = fileBytes(temporary);
+  ok = ok && throttle(after) && fileBytes(path) == before;
+  if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+    unlink(temporary.c_str());
+    return;
+  }
+  count(0, 1, before - after, before, after);
+}
+
+// adds to the totals
+void StoreMaintenance::count(long deleted, long compacted, long long freed, long long read,
+    long long written) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _stats.filesDeleted += deleted;
+  _stats.filesCompacted += compacted;
+  _stats.bytesFreed += freed;
+  _stats.bytesRead += read;
+  _stats.bytesWritten += written;
+}
@@ -0,0 +1,103 @@
+/*
+  StoreMaintenance.h - Retention and compaction of TelemetryStore directories
+  Released into the public domain.
+
+  Keeps a multi-year deployment's disk usage bounded. Each pass over a device
+  directory does two things.
+
+  Retention deletes whole files once their period is older than the policy
+  allows: raw-*.atv segments after RetentionPolicy::rawUs, rollup-<tier>-*
+  files after tierUs[tier]. A value of 0 keeps the files forever. A raw day is
+  only deleted once the rollups have seen all of it, so the summaries outlive
+  the samples.
+
+  Compaction rewrites files that will not be written again (their period
+  ended more than a day ago):
+    - raw segments, whose short blocks from --flush-seconds flushes are
+      re-encoded into full ARCHIVE_BLOCK_SAMPLES blocks (better packing, fewer
+      headers to index)
+    - rollup files, whose per-flush blocks are merged into a single block
+  The new file is written next to the old one and renamed over it, so readers
+  keep a consistent view. A file that grows while it is being rewritten is
+  left alone until the next pass.
+
+  The background thread runs at the lowest CPU and idle IO priority and
+  throttles its own reads and writes to a byte rate, so ingest and queries
+  keep the disk.
+*/
+
+#ifndef StoreMaintenance_h
+#define StoreMaintenance_h
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TelemetryRollup.h"
+
+const long MAINTENANCE_DEFAULT_BYTES_PER_SECOND = 1024*1024; // ~5% of an SD card's write speed
+const int MAINTENANCE_DEFAULT_INTERVAL_SECONDS = 3600; // between passes
+const int64_t COMPACTION_GRACE_US = 86400LL*1000000; // files are only rewritten a day after their period
+
+struct RetentionPolicy
+{
+  int64_t rawUs = 7*86400LL*1000000; // raw segments, 0 keeps them forever
+  int64_t tierUs[NUM_TIERS] = { // rollup tiers, 0 keeps them forever
+    2*86400LL*1000000, // 1 s
+    365*86400LL*1000000, // 1 min
+    5*365*86400LL*1000000, // 15 min
+    0, // 1 h
+    0}; // 1 d
+};
+
+// what maintenance did, totals since the thread started
+struct MaintenanceStats
+{
+  long passes = 0;
+  long filesDeleted = 0;
+  long filesCompacted = 0;
+  long long bytesFreed = 0; // by deletion and compaction
+  long long bytesRead = 0;
+  long long bytesWritten = 0;
+  std::vector<long long> directoryBytes; // size of every directory after the last pass
+};
+
+bool parseRetention(const char* text, RetentionPolicy& policy); // e.g. raw=7d,1m=1y,1h=forever
+
+class StoreMaintenance
+{
+  public:
+    StoreMaintenance(); // constructor
+    ~StoreMaintenance(); // stops the thread
+    void setPolicy(const RetentionPolicy& policy); // retention of every directory
+    void setBytesPerSecond(long bytesPerSecond); // IO budget, 0 for unthrottled
+    void setInterval(int seconds); // seconds between passes of the thread
+    void addDirectory(const std::string& directory); // a TelemetryStore directory, call before start()
+    bool start(); // runs a pass now and then every interval, in a low priority thread
+    void stop(); // interrupts a running pass and joins the thread
+    bool runOnce(int64_t nowUs); // one pass over every directory in the calling thread
+    MaintenanceStats getStats(); // thread safe copy
+  private:
+    RetentionPolicy _policy;
+    long _bytesPerSecond = MAINTENANCE_DEFAULT_BYTES_PER_SECOND;
+    int _intervalSeconds = MAINTENANCE_DEFAULT_INTERVAL_SECONDS;
+    std::vector<std::string> _directories;
+    std::thread _thread;
+    std::mutex _mutex; // guards _stats and _stopping
+    std::condition_variable _wake;
+    bool _stopping = false;
+    MaintenanceStats _stats;
+    double _ioFree = 0.0; // steady clock seconds when the IO budget is available again
+    void run(); // the thread
+    bool throttle(long long bytes); // spends IO budget, false if stop() was called meanwhile
+    bool isStopping(); // true once stop() was called
+    void applyRetention(const std::string& directory, int64_t nowUs); // deletes expired files
+    void compactSegment(const std::string& path); // re-encodes a raw segment in full blocks
+    void compactRollup(const std::string& path); // merges a rollup file into one block
+    void count(long deleted, long compacted, long long freed, long long read, long long written);
+};
+
+#endif
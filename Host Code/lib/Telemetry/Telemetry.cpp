@@ -0,0 +1,169 @@
+/*
+  Telemetry.cpp - Host-side record layout for AtverterH MPPT telemetry
+  Released into the public domain.
+*/
+
+#include "Telemetry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// returns the TelemetryChannel for a field name, or -1
+int channelIndex(const char* name) {
+  return channelIndex(name, strlen(name));
+}
+
+// returns the TelemetryChannel for a field name, or -1
+int channelIndex(const char* name, size_t length) {
+  for (int n = 0; n < NUM_CHANNELS; n++) {
+    if (strncmp(CHANNEL_NAMES[n], name, length) == 0 && CHANNEL_NAMES[n][length] == '\0')
+      return n;
+  }
+  if (length == 10 && strncmp(name, "Duty Cycle", length) == 0) // alternate format handled by UART.py
+    return DUTY_CYCLE;
+  return -1;
+}
+
+// computes the power channels the same way transmitData() does: mV*mA/1000 = mW
+// UART.py never stored the power fields, so records imported from data.json need this
+void fillDerivedPower(TelemetrySample& sample) {
+  sample.values[LOW_SIDE_POWER] = (int32_t)((int64_t)sample.values[LOW_SIDE_VOLTAGE]
+    *sample.values[LOW_SIDE_CURRENT]/1000);
+  sample.values[HIGH_SIDE_POWER] = (int32_t)((int64_t)sample.values[HIGH_SIDE_VOLTAGE]
+    *sample.values[HIGH_SIDE_CURRENT]/1000);
+}
+
+// trims leading and trailing whitespace in place
+static char* trim(char* text) {
+  while (*text == ' ' || *text == '\r' || *text == '\n')
+    text++;
+  char* end = text + strlen(text);
+  while (end > text && (end[-1] == ' ' || end[-1] == '\r' || end[-1] == '\n'))
+    *--end = '\0';
+  return text;
+}
+
+// parses one UART line in place, following the rules UART.py used for data.json:
+//  tab separated "Key: value" (or "Key=value") fields, "Duty Cycle" accepted for DutyCycle,
+//  and a record only counts when all REQUIRED_CHANNELS are present
+int parseTelemetryLine(char* line, TelemetryLine& parsed) {
+  memset(&parsed, 0, sizeof(parsed));
+  parsed.isrOverruns = -1;
+  parsed.ticks = -1;
+  parsed.sequence = -1;
+  parsed.periodTicks = -1;
+  bool isDelta = false;
+  line = trim(line);
+  if (*line == '\0')
+    return parsed.type = LINE_EMPTY;
+  if (strcmp(line, "Safety Shutoff Triggered") == 0)
+    return parsed.type = LINE_SAFETY_SHUTOFF;
+  if (strcmp(line, "Low Side Overvoltage") == 0)
+    return parsed.type = LINE_OVERVOLTAGE;
+  int fields = 0;
+  for (char* part = strtok(line, "\t"); part; part = strtok(NULL, "\t")) {
+    char* separator = strpbrk(part, ":=");
+    if (!separator)
+      continue;
+    *separator = '\0';
+    char* key = trim(part);
+    char* value = trim(separator + 1);
+    char* end;
+    long number = strtol(value, &end, 10);
+    bool isNumber = (*value != '\0' && *end == '\0');
+    if (strcmp(key, "Shutdown Code") == 0 && isNumber) {
+      parsed.shutdownCode = (int)number;
+      return parsed.type = LINE_SHUTDOWN_CODE;
+    }
+    if (strcmp(key, "Tick") == 0 || strcmp(key, "WTCK") == 0) { // 32-bit unsigned, too big for long on ARM
+      long long ticks = strtoll(value, &end, 10);
+      if (*value != '\0' && *end == '\0' && ticks >= 0 && ticks <= 0xFFFFFFFFLL)
+        parsed.ticks = ticks;
+      else
+        parsed.badValues++;
+      if (key[0] == 'W')
+        return parsed.type = (parsed.ticks >= 0 ? LINE_TICK_ANSWER : LINE_UNKNOWN);
+      continue;
+    }
+    if (strcmp(key, "Seq") == 0 || strcmp(key, "Delta") == 0 || strcmp(key, "Period") == 0) {
+      if (!isNumber || number < 0) {
+        parsed.badValues++;
+      } else if (key[0] == 'P') {
+        parsed.periodTicks = number;
+      } else {
+        parsed.sequence = (int)number;
+        isDelta = (key[0] == 'D');
+      }
+      continue;
+    }
+    if (strcmp(key, "IsrOverruns") == 0) {
+      if (isNumber)
+        parsed.isrOverruns = number;
+      else
+        parsed.badValues++;
+      continue;
+    }
+    int channel = channelIndex(key);
+    if (channel < 0)
+      continue;
+    fields++;
+    if (!isNumber) {
+      parsed.badValues++;
+      continue;
+    }
+    parsed.sample.values[channel] = (int32_t)number;
+    parsed.presentMask |= 1u << channel;
+  }
+  if (isDelta) // values are differences, any subset of channels
+    return parsed.type = LINE_DELTA_RECORD;
+  if ((parsed.presentMask & REQUIRED_CHANNELS) == REQUIRED_CHANNELS) {
+    if (!(parsed.presentMask & ((1u << LOW_SIDE_POWER) | (1u << HIGH_SIDE_POWER))))
+      fillDerivedPower(parsed.sample);
+    return parsed.type = LINE_RECORD;
+  }
+  return parsed.type = (fields > 0 ? LINE_PARTIAL_RECORD : LINE_UNKNOWN);
+}
+
+// parses a Python datetime.isoformat() string in local time, e.g. "2025-04-23T17:12:25.692115"
+bool parseIsoTimestamp(const char* text, int64_t& timestampUs) {
+  struct tm fields;
+  memset(&fields, 0, sizeof(fields));
+  int consumed = 0;
+  if (sscanf(text, "%4d-%2d-%2dT%2d:%2d:%2d%n", &fields.tm_year, &fields.tm_mon, &fields.tm_mday,
+      &fields.tm_hour, &fields.tm_min, &fields.tm_sec, &consumed) != 6)
+    return false;
+  fields.tm_year -= 1900;
+  fields.tm_mon -= 1;
+  fields.tm_isdst = -1;
+  time_t seconds = mktime(&fields);
+  if (seconds == (time_t)-1)
+    return false;
+  // fractional seconds are optional and may have fewer than 6 digits
+  long micros = 0;
+  const char* fraction = text + consumed;
+  if (*fraction == '.') {
+    long scale = 100000;
+    for (fraction++; *fraction >= '0' && *fraction <= '9'; fraction++) {
+      micros += (*fraction - '0')*scale;
+      scale /= 10;
+    }
+  }
+  timestampUs = (int64_t)seconds*1000000 + micros;
+  return true;
+}
+
+// formats a timestamp the way Python datetime.isoformat() does, returns the length written
+int formatIsoTimestamp(int64_t timestampUs, char* buffer, size_t size) {
+  time_t seconds = (time_t)(timestampUs/1000000);
+  long micros = (long)(timestampUs%1000000);
+  if (micros < 0) {
+    seconds--;
+    micros += 1000000;
+  }
+  struct tm fields;
+  localtime_r(&seconds, &fields);
+  return snprintf(buffer, size, "%04d-%02d-%02dT%02d:%02d:%02d.%06ld", fields.tm_year + 1900,
+    fields.tm_mon + 1, fields.tm_mday, fields.tm_hour, fields.tm_min, fields.tm_sec, micros);
+}
@@ -0,0 +1,91 @@
+/*
+  Telemetry.h - Host-side record layout for AtverterH MPPT telemetry
+  Released into the public domain.
+
+  One TelemetrySample holds everything transmitData() prints in a single line,
+  plus the host timestamp that UART.py used to add to data.json. Newer
+  firmware also prints the control tick the record was sampled in, which
+  ClockSync.h turns into a more precise timestamp, and in its deadband mode
+  sends only the fields that moved (TelemetryDelta.h rebuilds the records).
+*/
+
+#ifndef Telemetry_h
+#define Telemetry_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// channel index enumerator, in the order transmitData() prints them
+enum TelemetryChannel
+{   LOW_SIDE_VOLTAGE = 0, // mV, battery side
+    LOW_SIDE_CURRENT, // mA, battery side
+    LOW_SIDE_POWER, // mW, battery side
+    HIGH_SIDE_VOLTAGE, // mV, panel side
+    HIGH_SIDE_CURRENT, // mA, panel side
+    HIGH_SIDE_POWER, // mW, panel side
+    DUTY_CYCLE, // percent (0 to 100)
+    TEMPERATURE_1, // °C, thermistor 1 (absent from older firmware)
+    TEMPERATURE_2, // °C, thermistor 2 (absent from older firmware)
+    NUM_CHANNELS
+};
+
+// field names exactly as printed by the firmware and stored in data.json
+const char * const CHANNEL_NAMES[NUM_CHANNELS] = {
+  "LowSideVoltage",
+  "LowSideCurrent",
+  "LowSidePower",
+  "HighSideVoltage",
+  "HighSideCurrent",
+  "HighSidePower",
+  "DutyCycle",
+  "Temperature1",
+  "Temperature2"};
+
+// fields UART.py required before it stored a record
+const uint32_t REQUIRED_CHANNELS = (1u << LOW_SIDE_VOLTAGE) | (1u << LOW_SIDE_CURRENT)
+  | (1u << HIGH_SIDE_VOLTAGE) | (1u << HIGH_SIDE_CURRENT) | (1u << DUTY_CYCLE);
+
+// kinds of line the firmware prints on its UART, see controlUpdate() and transmitData()
+enum TelemetryLineType
+{   LINE_EMPTY = 0, // blank line
+    LINE_RECORD, // complete transmitData() record
+    LINE_PARTIAL_RECORD, // record missing required fields, e.g. a frame cut by a reset or overrun
+    LINE_SAFETY_SHUTOFF, // "Safety Shutoff Triggered"
+    LINE_SHUTDOWN_CODE, // "Shutdown Code: N"
+    LINE_OVERVOLTAGE, // "Low Side Overvoltage"
+    LINE_UNKNOWN, // anything else (command responses, debug output, noise)
+    LINE_TICK_ANSWER, // "WTCK:N", the answer to a clock sync request
+    LINE_DELTA_RECORD, // deadband mode record holding only the fields that moved, as differences
+    NUM_LINETYPES
+};
+
+struct TelemetrySample
+{
+  int64_t timestampUs; // host wall clock, microseconds since the Unix epoch
+  int32_t values[NUM_CHANNELS]; // channel values indexed by TelemetryChannel
+};
+
+// result of parsing one UART line
+struct TelemetryLine
+{
+  int type; // TelemetryLineType
+  TelemetrySample sample; // channel values, valid for LINE_RECORD (timestamp left to the caller)
+  uint32_t presentMask; // bit n set if channel n was present in the line
+  int badValues; // fields whose value was not an integer
+  int shutdownCode; // code from a LINE_SHUTDOWN_CODE line
+  long isrOverruns; // cumulative overrun count if the firmware reports one, else -1
+  int64_t ticks; // control tick of a record ("Tick: N") or of a LINE_TICK_ANSWER, else -1
+  int sequence; // deadband mode sequence number, "Seq: N" of a keyframe or "Delta: N", else -1
+  long periodTicks; // ticks between records ("Period: N" of a keyframe), else -1
+};
+
+int channelIndex(const char* name); // returns the TelemetryChannel for a field name, or -1
+int channelIndex(const char* name, size_t length); // same as above for a non-terminated name
+void fillDerivedPower(TelemetrySample& sample); // computes LowSidePower/HighSidePower like transmitData()
+
+int parseTelemetryLine(char* line, TelemetryLine& parsed); // parses one UART line in place, returns its type
+
+bool parseIsoTimestamp(const char* text, int64_t& timestampUs); // parses "2025-04-23T17:12:25.692115"
+int formatIsoTimestamp(int64_t timestampUs, char* buffer, size_t size); // inverse of parseIsoTimestamp
+
+#endif
@@ -0,0 +1,585 @@
+/*
+  TelemetryArchive.cpp - Compressed block archive for long-term AtverterH telemetry
+  Released into the public domain.
+*/
+
+#include "TelemetryArchive.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <array>
+#include <utility>
+
+// Codec Utility Functions ---------------------------------------------------
+
+static inline uint32_t zigzag32(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag32(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static inline uint64_t zigzag64(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag64(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// number of bits needed to hold value (0 for 0)
+static inline int bitWidth(uint64_t value) {
+  return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+static uint8_t* writeVarint(uint8_t* out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+static const uint8_t* readVarint(const uint8_t* in, const uint8_t* end, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && in < end; shift += 7) {
+    uint8_t byte = *in++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return in;
+  }
+  return NULL;
+}
+
+// packs count values of width bits each (at most 56) into a little endian bit stream
+static uint8_t* packBits(uint8_t* out, const uint64_t* values, int count, int width) {
+  uint64_t acc = 0; // pending bits, lowest first; never more than 7 + 56 bits
+  int accBits = 0;
+  for (int n = 0; n < count; n++) {
+    acc |= values[n] << accBits;
+    accBits += width;
+    while (accBits >= 8) {
+      *out++ = (uint8_t)acc;
+      acc >>= 8;
+      accBits -= 8;
+    }
+  }
+  if (accBits > 0)
+    *out++ = (uint8_t)acc;
+  return out;
+}
+
+static inline size_t packedBytes(int count, int width) {
+  return ((size_t)count*width + 7)/8;
+}
+
+// writes one group: a width byte followed by the packed values (raw 64-bit words above 56 bits)
+static uint8_t* writeGroup(uint8_t* out, const uint64_t* values, int count) {
+  uint64_t all = 0;
+  for (int n = 0; n < count; n++)
+    all |= values[n];
+  int width = bitWidth(all);
+  if (width > 56) { // the decoder reads one 64-bit word per value, which holds at most 57 bits
+    *out++ = 64;
+    memcpy(out, values, (size_t)count*8);
+    return out + (size_t)count*8;
+  }
+  *out++ = (uint8_t)width;
+  return packBits(out, values, count, width);
+}
+
+// unpacks and accumulates one group of zigzag deltas with a compile-time bit width,
+// which lets the compiler turn every shift and mask into constants
+template <int WIDTH>
+static uint32_t unpackGroup32(const uint8_t* in, int count, uint32_t previous, int32_t* out) {
+  const uint64_t mask = (1ULL << WIDTH) - 1;
+  for (int n = 0; n < count; n++) {
+    const size_t bit = (size_t)n*WIDTH;
+    uint64_t word;
+    memcpy(&word, in + (bit >> 3), 8); // needs ARCHIVE_DECODE_PADDING after the payload
+    previous += (uint32_t)unzigzag32((uint32_t)((word >> (bit & 7)) & mask));
+    out[n] = (int32_t)previous;
+  }
+  return previous;
+}
+
+typedef uint32_t (*UnpackGroup32)(const uint8_t*, int, uint32_t, int32_t*);
+
+template <size_t... INDICES>
+static constexpr std::array<UnpackGroup32, sizeof...(INDICES)> makeUnpackers(std::index_sequence<INDICES...>) {
+  return {{&unpackGroup32<INDICES + 1>...}};
+}
+
+// unpackers for widths 1 to 32, indexed by width - 1
+static const std::array<UnpackGroup32, 32> UNPACKERS = makeUnpackers(std::make_index_sequence<32>());
+
+// decodes count zigzag deltas of a 32-bit column and applies them to previous
+static const uint8_t* readDeltas32(const uint8_t* in, const uint8_t* end, int count,
+    uint32_t previous, int32_t* out) {
+  for (int start = 0; start < count; start += ARCHIVE_GROUP_SIZE) {
+    int groupCount = count - start < ARCHIVE_GROUP_SIZE ? count - start : ARCHIVE_GROUP_SIZE;
+    if (in >= end)
+      return NULL;
+    int width = *in++;
+    if (width > 32 || in + packedBytes(groupCount, width) > end)
+      return NULL;
+    int32_t* group = out + start;
+    if (width == 0) { // flat signal, e.g. a stuck duty cycle or a dark panel
+      for (int n = 0; n < groupCount; n++)
+        group[n] = (int32_t)previous;
+    } else {
+      previous = UNPACKERS[width - 1](in, groupCount, previous, group);
+    }
+    in += packedBytes(groupCount, width);
+  }
+  return in;
+}
+
+// decodes count zigzag delta-of-deltas of the timestamp column
+static const uint8_t* readDeltaOfDeltas(const uint8_t* in, const uint8_t* end, int count,
+    int64_t previous, int64_t delta, int64_t* out) {
+  for (int start = 0; start < count; start += ARCHIVE_GROUP_SIZE) {
+    int groupCount = count - start < ARCHIVE_GROUP_SIZE ? count - start : ARCHIVE_GROUP_SIZE;
+    if (in >= end)
+      return NULL;
+    int width = *in++;
+    size_t bytes = (width == 64) ? (size_t)groupCount*8 : packedBytes(groupCount, width);
+    if ((width > 56 && width != 64) || in + bytes > end)
+      return NULL;
+    const uint64_t mask = (width == 64) ? ~0ULL : ((1ULL << width) - 1);
+    size_t bit = 0;
+    for (int n = 0; n < groupCount; n++) {
+      uint64_t word;
+      if (width == 64) {
+        memcpy(&word, in + (size_t)n*8, 8);
+      } else {
+        memcpy(&word, in + (bit >> 3), 8);
+        word = (word >> (bit & 7)) & mask;
+      }
+      delta += unzigzag64(word);
+      previous += delta;
+      out[start + n] = previous;
+      bit += width;
+    }
+    in += bytes;
+  }
+  return in;
+}
+
+// Block Codec ---------------------------------------------------------------
+
+// upper bound for encodeBlock() output
+size_t maxEncodedBlockSize(int numSamples) {
+  size_t groups = (size_t)numSamples/ARCHIVE_GROUP_SIZE + 1;
+  // column offset table + timestamps (raw worst case) + every channel at full 32-bit width
+  return 4*NUM_CHANNELS + 20 + groups + (size_t)numSamples*8
+    + NUM_CHANNELS*(5 + groups + (size_t)numSamples*5);
+}
+
+// encodes a block of samples into out, returns the number of bytes written
+//  payload: uint32 columnOffset[numColumns], timestamp section, column sections
+size_t encodeBlock(const int64_t* timestamps, const int32_t* const columns[], int numColumns,
+    int numSamples, uint8_t* out) {
+  uint8_t* p = out + 4*numColumns;
+  uint64_t group[ARCHIVE_GROUP_SIZE];
+  // timestamps: first value, first delta, then delta-of-deltas
+  if (numSamples > 0)
+    p = writeVarint(p, zigzag64(timestamps[0]));
+  if (numSamples > 1)
+    p = writeVarint(p, zigzag64(timestamps[1] - timestamps[0]));
+  for (int start = 2; start < numSamples; start += ARCHIVE_GROUP_SIZE) {
+    int count = 0;
+    for (int n = start; n < numSamples && count < ARCHIVE_GROUP_SIZE; n++, count++) {
+      int64_t dod = (timestamps[n] - timestamps[n - 1]) - (timestamps[n - 1] - timestamps[n - 2]);
+      group[count] = zigzag64(dod);
+    }
+    p = writeGroup(p, group, count);
+  }
+  // channels: first value, then deltas (wrapping arithmetic, so any int32 round-trips)
+  for (int c = 0; c < numColumns; c++) {
+    uint32_t offset = (uint32_t)(p - out);
+    memcpy(out + 4*c, &offset, 4);
+    const int32_t* values = columns[c];
+    if (numSamples > 0)
+      p = writeVarint(p, zigzag32(values[0]));
+    for (int start = 1; start < numSamples; start += ARCHIVE_GROUP_SIZE) {
+      int count = 0;
+      for (int n = start; n < numSamples && count < ARCHIVE_GROUP_SIZE; n++, count++)
+        group[count] = zigzag32((int32_t)((uint32_t)values[n] - (uint32_t)values[n - 1]));
+      p = writeGroup(p, group, count);
+    }
+  }
+  return (size_t)(p - out);
+}
+
+// decodes only the timestamp column of a block payload
+bool decodeTimestamps(const uint8_t* payload, size_t size, int numColumns, int numSamples,
+    int64_t* timestamps) {
+  const uint8_t* end = payload + size;
+  const uint8_t* p = payload + 4*numColumns;
+  if (numSamples <= 0)
+    return true;
+  if (p > end)
+    return false;
+  uint64_t raw;
+  if (!(p = readVarint(p, end, raw)))
+    return false;
+  timestamps[0] = unzigzag64(raw);
+  if (numSamples == 1)
+    return true;
+  if (!(p = readVarint(p, end, raw)))
+    return false;
+  int64_t delta = unzigzag64(raw);
+  timestamps[1] = timestamps[0] + delta;
+  return readDeltaOfDeltas(p, end, numSamples - 2, timestamps[1], delta, timestamps + 2) != NULL;
+}
+
+// decodes only one channel column of a block payload
+bool decodeColumn(const uint8_t* payload, size_t size, int numColumns, int numSamples,
+    int column, int32_t* values) {
+  if (column < 0 || column >= numColumns || (size_t)4*numColumns > size)
+    return false;
+  if (numSamples <= 0)
+    return true;
+  uint32_t offset;
+  memcpy(&offset, payload + 4*column, 4);
+  if (offset >= size)
+    return false;
+  const uint8_t* end = payload + size;
+  uint64_t raw;
+  const uint8_t* p = readVarint(payload + offset, end, raw);
+  if (!p)
+    return false;
+  values[0] = unzigzag32((uint32_t)raw);
+  return readDeltas32(p, end, numSamples - 1, (uint32_t)values[0], values + 1) != NULL;
+}
+
+// Archive Writer ------------------------------------------------------------
+
+ArchiveWriter::ArchiveWriter() {
+}
+
+ArchiveWriter::~ArchiveWriter() {
+  close();
+}
+
+// opens (or appends to) an archive file with the default block length
+bool ArchiveWriter::open(const char* path) {
+  return open(path, ARCHIVE_BLOCK_SAMPLES);
+}
+
+// the end of the last complete block of an open archive, from the first block on; a block cut off by a crash
+// and anything after it is not counted
+static long completeBlocksEnd(FILE* file, long fileSize, int numChannels) {
+  long offset = sizeof(ArchiveFileHeader);
+  long minMaxBytes = 2*sizeof(int32_t)*numChannels;
+  while (offset + (long)sizeof(ArchiveBlockHeader) + minMaxBytes <= fileSize) {
+    ArchiveBlockHeader header;
+    fseek(file, offset, SEEK_SET);
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "BLK1", 4) != 0)
+      break;
+    long end = offset + sizeof(header) + minMaxBytes + (long)header.payloadBytes;
+    if (end > fileSize)
+      break;
+    offset = end;
+  }
+  return offset;
+}
+
+// opens (or appends to) an archive file, writing the file header if the file is new
+// an existing file must have this writer's version and channels; a block a crash cut off is truncated away
+// first, or the blocks appended after it would be read from the wrong offsets
+bool ArchiveWriter::open(const char* path, int blockSamples) {
+  close();
+  _file = fopen(path, "r+b");
+  if (!_file)
+    _file = fopen(path, "w+b");
+  if (!_file)
+    return false;
+  _blockSamples = blockSamples > 1 ? blockSamples : 2;
+  _count = 0;
+  _bytesWritten = 0;
+  _timestamps.assign(_blockSamples, 0);
+  for (int c = 0; c < NUM_CHANNELS; c++)
+    _columns[c].assign(_blockSamples, 0);
+  _encoded.resize(maxEncodedBlockSize(_blockSamples));
+  fseek(_file, 0, SEEK_END);
+  long fileSize = ftell(_file);
+  long end = 0; // of the complete data, 0 if the file header is missing or cut off
+  if (fileSize >= (long)sizeof(ArchiveFileHeader)) {
+    ArchiveFileHeader existing;
+    fseek(_file, 0, SEEK_SET);
+    if (fread(&existing, sizeof(existing), 1, _file) != 1
+      || memcmp(existing.magic, "ATVA", 4) != 0
+      || existing.version != ARCHIVE_VERSION
+      || existing.numChannels != NUM_CHANNELS) { // not an archive this writer can append to
+      fclose(_file);
+      _file = NULL;
+      return false;
+    }
+    end = completeBlocksEnd(_file, fileSize, NUM_CHANNELS);
+  }
+  if (end < fileSize && ftruncate(fileno(_file), end) != 0) {
+    fclose(_file);
+    _file = NULL;
+    return false;
+  }
+  fseek(_file, end, SEEK_SET);
+  if (end == 0) {
+    ArchiveFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "ATVA", 4);
+    header.version = ARCHIVE_VERSION;
+    header.numChannels = NUM_CHANNELS;
+    header.blockSamples = (uint32_t)_blockSamples;
+    if (fwrite(&header, sizeof(header), 1, _file) != 1) {
+      close();
+      return false;
+    }
+    _bytesWritten += sizeof(header);
+  }
+  return true;
+}
+
+// buffers one sample, writes a block when the buffer is full
+bool ArchiveWriter::append(const TelemetrySample& sample) {
+  if (!_file)
+    return false;
+  _timestamps[_count] = sample.timestampUs;
+  for (int c = 0; c < NUM_CHANNELS; c++)
+    _columns[c][_count] = sample.values[c];
+  _count++;
+  if (_count >= _blockSamples)
+    return flush();
+  return true;
+}
+
+// writes any buffered samples as a block, then flushes the stdio buffer
+bool ArchiveWriter::flush() {
+  if (!_file)
+    return false;
+  if (_count == 0)
+    return fflush(_file) == 0;
+  const int32_t* columns[NUM_CHANNELS];
+  ArchiveBlockHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "BLK1", 4);
+  header.numSamples = (uint32_t)_count;
+  header.timestampMin = _timestamps[0];
+  header.timestampMax = _timestamps[0];
+  for (int n = 1; n < _count; n++) { // timestamps are not guaranteed monotonic (clock steps)
+    if (_timestamps[n] < header.timestampMin)
+      header.timestampMin = _timestamps[n];
+    if (_timestamps[n] > header.timestampMax)
+      header.timestampMax = _timestamps[n];
+  }
+  int32_t valueMin[NUM_CHANNELS];
+  int32_t valueMax[NUM_CHANNELS];
+  for (int c = 0; c < NUM_CHANNELS; c++) {
+    columns[c] = _columns[c].data();
+    valueMin[c] = valueMax[c] = _columns[c][0];
+    for (int n = 1; n < _count; n++) {
+      if (_columns[c][n] < valueMin[c])
+        valueMin[c] = _columns[c][n];
+      if (_columns[c][n] > valueMax[c])
+        valueMax[c] = _columns[c][n];
+    }
+  }
+  size_t size = encodeBlock(_timestamps.data(), columns, NUM_CHANNELS, _count, _encoded.data());
+  header.payloadBytes = (uint32_t)size;
+  _count = 0;
+  if (fwrite(&header, sizeof(header), 1, _file) != 1
+    || fwrite(valueMin, sizeof(valueMin), 1, _file) != 1
+    || fwrite(valueMax, sizeof(valueMax), 1, _file) != 1
+    || fwrite(_encoded.data(), 1, size, _file) != size)
+    return false;
+  _bytesWritten += sizeof(header) + sizeof(valueMin) + sizeof(valueMax) + size;
+  return fflush(_file) == 0;
+}
+
+// flushes and closes the file
+void ArchiveWriter::close() {
+  if (!_file)
+    return;
+  flush();
+  fclose(_file);
+  _file = NULL;
+}
+
+// returns true if a file is open
+bool ArchiveWriter::isOpen() {
+  return _file != NULL;
+}
+
+// samples waiting for the next block
+int ArchiveWriter::getBufferedSamples() {
+  return _count;
+}
+
+// total bytes appended since open()
+long ArchiveWriter::getBytesWritten() {
+  return _bytesWritten;
+}
+
+// Archive Reader ------------------------------------------------------------
+
+ArchiveReader::ArchiveReader() {
+}
+
+ArchiveReader::~ArchiveReader() {
+  close();
+}
+
+// opens an archive and indexes its block headers, skipping over the payloads
+bool ArchiveReader::open(const char* path) {
+  close();
+  _file = fopen(path, "rb");
+  if (!_file)
+    return false;
+  ArchiveFileHeader fileHeader;
+  if (fread(&fileHeader, sizeof(fileHeader), 1, _file) != 1
+    || memcmp(fileHeader.magic, "ATVA", 4) != 0
+    || fileHeader.version != ARCHIVE_VERSION
+    || fileHeader.numChannels == 0) {
+    close();
+    return false;
+  }
+  _numChannels = fileHeader.numChannels;
+  fseek(_file, 0, SEEK_END);
+  long fileSize = ftell(_file);
+  long offset = sizeof(fileHeader);
+  std::vector<int32_t> minMax(2*_numChannels);
+  while (offset + (long)sizeof(ArchiveBlockHeader) <= fileSize) {
+    ArchiveBlockHeader header;
+    fseek(_file, offset, SEEK_SET);
+    if (fread(&header, sizeof(header), 1, _file) != 1
+      || memcmp(header.magic, "BLK1", 4) != 0
+      || fread(minMax.data(), sizeof(int32_t), minMax.size(), _file) != minMax.size())
+      break;
+    ArchiveBlockInfo info;
+    info.payloadOffset = offset + sizeof(header) + sizeof(int32_t)*minMax.size();
+    info.numSamples = header.numSamples;
+    info.payloadBytes = header.payloadBytes;
+    if (info.payloadOffset + (long)info.payloadBytes > fileSize)
+      break; // truncated last block, e.g. power lost mid-write
+    info.timestampMin = header.timestampMin;
+    info.timestampMax = header.timestampMax;
+    for (int c = 0; c < NUM_CHANNELS; c++) { // channels missing from older files read as 0
+      info.valueMin[c] = c < _numChannels ? minMax[c] : 0;
+      info.valueMax[c] = c < _numChannels ? minMax[_numChannels + c] : 0;
+    }
+    _blocks.push_back(info);
+    _numSamples += info.numSamples;
+    offset = info.payloadOffset + info.payloadBytes;
+  }
+  return true;
+}
+
+// closes the file
+void ArchiveReader::close() {
+  if (_file)
+    fclose(_file);
+  _file = NULL;
+  _blocks.clear();
+  _numSamples = 0;
+  _payloadBlock = -1;
+}
+
+// number of complete blocks
+int ArchiveReader::getNumBlocks() {
+  return (int)_blocks.size();
+}
+
+// total samples in all complete blocks
+long ArchiveReader::getNumSamples() {
+  return _numSamples;
+}
+
+// channels stored in the file
+int ArchiveReader::getNumChannels() {
+  return _numChannels;
+}
+
+// time range and min/max for one block
+const ArchiveBlockInfo& ArchiveReader::getBlockInfo(int block) {
+  return _blocks[block];
+}
+
+// reads the column offsets and one section of a block payload into _payload, where it sits at
+// its usual offset so the codec can decode it; sections already loaded for the block are kept,
+// so a query touching two channels reads neither the other channels nor anything twice
+bool ArchiveReader::loadSection(int block, int section) {
+  if (!_file || block < 0 || block >= (int)_blocks.size())
+    return false;
+  const ArchiveBlockInfo& info = _blocks[block];
+  size_t tableBytes = sizeof(uint32_t)*_numChannels;
+  if (block != _payloadBlock) {
+    _payloadBlock = -1;
+    _loadedSections = 0;
+    _payload.resize(info.payloadBytes + ARCHIVE_DECODE_PADDING);
+    memset(_payload.data() + info.payloadBytes, 0, ARCHIVE_DECODE_PADDING);
+    if (tableBytes > info.payloadBytes || fseek(_file, info.payloadOffset, SEEK_SET) != 0
+      || fread(_payload.data(), 1, tableBytes, _file) != tableBytes)
+      return false;
+    _payloadBlock = block;
+  }
+  uint32_t bit = 1u << (section + 1);
+  if (_loadedSections & bit)
+    return true;
+  // a section runs from its offset to the next one (timestamps come first, right after the table)
+  uint32_t offset;
+  size_t begin = tableBytes;
+  size_t end = info.payloadBytes;
+  if (section >= 0) {
+    memcpy(&offset, _payload.data() + 4*section, 4);
+    begin = offset;
+  }
+  if (section + 1 < _numChannels) {
+    memcpy(&offset, _payload.data() + 4*(section + 1), 4);
+    end = offset;
+  }
+  if (begin > end || end > info.payloadBytes)
+    return false;
+  if (fseek(_file, info.payloadOffset + begin, SEEK_SET) != 0
+    || fread(_payload.data() + begin, 1, end - begin, _file) != end - begin)
+    return false;
+  _loadedSections |= bit;
+  return true;
+}
+
+// decodes the timestamps and every channel of a block
+bool ArchiveReader::readBlock(int block, int64_t* timestamps, int32_t* const columns[NUM_CHANNELS]) {
+  if (!readTimestamps(block, timestamps))
+    return false;
+  for (int c = 0; c < NUM_CHANNELS; c++) {
+    if (!readColumn(block, c, columns[c]))
+      return false;
+  }
+  return true;
+}
+
+// decodes only the timestamps of a block
+bool ArchiveReader::readTimestamps(int block, int64_t* timestamps) {
+  if (!loadSection(block, -1))
+    return false;
+  const ArchiveBlockInfo& info = _blocks[block];
+  return decodeTimestamps(_payload.data(), info.payloadBytes, _numChannels, info.numSamples,
+    timestamps);
+}
+
+// decodes only one channel of a block, channels missing from older files read as 0
+bool ArchiveReader::readColumn(int block, int channel, int32_t* values) {
+  if (block < 0 || block >= (int)_blocks.size() || channel < 0 || channel >= NUM_CHANNELS)
+    return false;
+  const ArchiveBlockInfo& info = _blocks[block];
+  if (channel >= _numChannels) {
+    memset(values, 0, sizeof(int32_t)*info.numSamples);
+    return true;
+  }
+  if (!loadSection(block, channel))
+    return false;
+  return decodeColumn(_payload.data(), info.payloadBytes, _numChannels, info.numSamples,
+    channel, values);
+}
@@ -0,0 +1,125 @@
+/*
+  TelemetryArchive.h - Compressed block archive for long-term AtverterH telemetry
+  Released into the public domain.
+
+  A data.json entry costs ~150 bytes for a timestamp and a handful of small
+  integers. The archive stores the same samples column by column in blocks of a
+  few thousand samples:
+    - timestamps as delta-of-delta, zigzag encoded
+    - every channel as zigzag deltas from the previous sample
+  Deltas are bit-packed in groups of ARCHIVE_GROUP_SIZE values that share one
+  bit width, which decodes with a single unaligned load per value (no varint
+  branches). Every block header carries the time range and per-channel min/max
+  so queries can skip blocks without decoding them.
+
+  File layout (little endian):
+    ArchiveFileHeader
+    { ArchiveBlockHeader, min[numChannels], max[numChannels], payload } ...
+  Blocks are only ever appended, so a crash can at worst leave a truncated last
+  block, which the reader ignores and the writer cuts off before it appends.
+*/
+
+#ifndef TelemetryArchive_h
+#define TelemetryArchive_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+
+#include "Telemetry.h"
+
+const int ARCHIVE_VERSION = 1; // bump when the block payload layout changes
+const int ARCHIVE_BLOCK_SAMPLES = 4096; // default samples per block (~68 min at 1 Hz)
+const int ARCHIVE_GROUP_SIZE = 128; // values sharing one bit width inside a column
+const int ARCHIVE_DECODE_PADDING = 8; // slack bytes required after a payload for unaligned loads
+
+struct ArchiveFileHeader
+{
+  char magic[4]; // "ATVA"
+  uint16_t version; // ARCHIVE_VERSION
+  uint16_t numChannels; // channels stored per sample, NUM_CHANNELS when written
+  uint32_t blockSamples; // nominal samples per block
+  uint32_t reserved;
+};
+
+struct ArchiveBlockHeader
+{
+  char magic[4]; // "BLK1"
+  uint32_t numSamples; // samples in this block
+  uint32_t payloadBytes; // encoded bytes following the min/max arrays
+  uint32_t reserved;
+  int64_t timestampMin; // first timestamp in the block
+  int64_t timestampMax; // last timestamp in the block
+};
+
+// in-memory index entry for one block, built by ArchiveReader::open()
+struct ArchiveBlockInfo
+{
+  long payloadOffset; // file offset of the encoded payload
+  uint32_t numSamples;
+  uint32_t payloadBytes;
+  int64_t timestampMin;
+  int64_t timestampMax;
+  int32_t valueMin[NUM_CHANNELS];
+  int32_t valueMax[NUM_CHANNELS];
+};
+
+// block codec, usable without any file (the archive, the benchmarks and compaction share it)
+size_t maxEncodedBlockSize(int numSamples); // upper bound for encodeBlock() output
+size_t encodeBlock(const int64_t* timestamps, const int32_t* const columns[], int numColumns,
+  int numSamples, uint8_t* out); // returns bytes written
+bool decodeTimestamps(const uint8_t* payload, size_t size, int numColumns, int numSamples,
+  int64_t* timestamps); // decodes only the timestamp column
+bool decodeColumn(const uint8_t* payload, size_t size, int numColumns, int numSamples,
+  int column, int32_t* values); // decodes only one channel column
+
+class ArchiveWriter
+{
+  public:
+    ArchiveWriter(); // constructor
+    ~ArchiveWriter(); // flushes and closes
+    bool open(const char* path); // opens (or appends to) an archive file, false if it has other channels
+    bool open(const char* path, int blockSamples); // as above with a custom block length
+    bool append(const TelemetrySample& sample); // buffers one sample, writes a block when full
+    bool flush(); // writes any buffered samples as a (short) block
+    void close(); // flushes and closes the file
+    bool isOpen(); // returns true if a file is open
+    int getBufferedSamples(); // samples waiting for the next block
+    long getBytesWritten(); // total bytes appended since open()
+  private:
+    FILE* _file = NULL;
+    int _blockSamples = ARCHIVE_BLOCK_SAMPLES;
+    int _count = 0; // buffered samples
+    long _bytesWritten = 0;
+    std::vector<int64_t> _timestamps; // column buffers, struct-of-arrays
+    std::vector<int32_t> _columns[NUM_CHANNELS];
+    std::vector<uint8_t> _encoded; // scratch buffer for the encoded block
+};
+
+class ArchiveReader
+{
+  public:
+    ArchiveReader(); // constructor
+    ~ArchiveReader(); // closes the file
+    bool open(const char* path); // opens an archive and indexes its block headers
+    void close(); // closes the file
+    int getNumBlocks(); // number of complete blocks
+    long getNumSamples(); // total samples in all complete blocks
+    int getNumChannels(); // channels stored in the file
+    const ArchiveBlockInfo& getBlockInfo(int block); // time range and min/max for one block
+    bool readBlock(int block, int64_t* timestamps, int32_t* const columns[NUM_CHANNELS]); // decode all columns
+    bool readTimestamps(int block, int64_t* timestamps); // decode only the timestamps
+    bool readColumn(int block, int channel, int32_t* values); // decode only one channel
+  private:
+    FILE* _file = NULL;
+    int _numChannels = 0;
+    long _numSamples = 0;
+    std::vector<ArchiveBlockInfo> _blocks;
+    std::vector<uint8_t> _payload; // sections of the last used payload (with decode padding)
+    int _payloadBlock = -1; // block currently held in _payload
+    uint32_t _loadedSections = 0; // bit 0 timestamps, bit c + 1 channel c
+    bool loadSection(int block, int section); // reads one section (-1 timestamps, else a channel)
+};
+
+#endif
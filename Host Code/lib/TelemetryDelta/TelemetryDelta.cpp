@@ -0,0 +1,124 @@
+/*
+  TelemetryDelta.cpp - Rebuilds the full record series from deadband mode telemetry
+  Released into the public domain.
+*/
+
+#include "TelemetryDelta.h"
+
+#include <math.h>
+#include <string.h>
+
+TelemetryDeltaDecoder::TelemetryDeltaDecoder() {
+  reset();
+}
+
+// appends the records a line completes to records, oldest first: the skipped records before
+// it, then the line itself with every channel; returns false if a delta record had to be dropped
+bool TelemetryDeltaDecoder::decode(const TelemetryLine& line, std::vector<TelemetryLine>& records) {
+  if (line.type == LINE_RECORD && line.sequence < 0) { // deadband mode off or older firmware
+    _synced = false;
+    _continuous = false;
+    _lastTicks = line.ticks;
+    records.push_back(line);
+    return true;
+  }
+  bool inOrder = _synced && line.sequence == (_sequence + 1)%256;
+  if (line.type == LINE_RECORD) { // keyframe
+    if (_synced && !inOrder)
+      _gaps++;
+    if (inOrder && _continuous)
+      fill(line.ticks, records);
+    _state = line;
+    _synced = true;
+  } else if (line.type == LINE_DELTA_RECORD) {
+    if (!inOrder) {
+      if (_synced)
+        _gaps++;
+      _synced = false;
+      _continuous = false;
+      _sequence = line.sequence;
+      return false;
+    }
+    if (_continuous)
+      fill(line.ticks, records);
+    for (int n = 0; n < NUM_CHANNELS; n++) {
+      if (line.presentMask & (1u << n))
+        _state.sample.values[n] += line.sample.values[n];
+    }
+    // power moves with voltage and current, the firmware only sends it when subscribed
+    TelemetrySample derived = _state.sample;
+    fillDerivedPower(derived);
+    const int powerChannel[2] = {LOW_SIDE_POWER, HIGH_SIDE_POWER};
+    for (int side = 0; side < 2; side++) {
+      if (!(line.presentMask & (1u << powerChannel[side])))
+        _state.sample.values[powerChannel[side]] = derived.values[powerChannel[side]];
+    }
+    _state.ticks = line.ticks;
+  } else {
+    return true;
+  }
+  _sequence = line.sequence;
+  if (line.periodTicks > 0)
+    _periodTicks = line.periodTicks;
+  _state.type = LINE_RECORD;
+  _state.sequence = line.sequence;
+  _state.badValues = line.badValues;
+  _continuous = line.ticks >= 0;
+  _lastTicks = line.ticks;
+  records.push_back(_state);
+  return true;
+}
+
+// adds the records the firmware skipped between the last record and ticks, holding every value
+void TelemetryDeltaDecoder::fill(int64_t ticks, std::vector<TelemetryLine>& records) {
+  if (_lastTicks < 0 || ticks < 0 || _periodTicks <= 0)
+    return;
+  uint32_t gap = (uint32_t)(ticks - _lastTicks); // the counter may have wrapped
+  long steps = lround((double)gap/_periodTicks);
+  long skipped = steps - 1;
+  if (skipped <= 0 || skipped > DELTA_FILL_MAX_RECORDS)
+    return;
+  if (fabs((double)gap - (double)steps*_periodTicks) > _periodTicks/4.0) // not on the record grid
+    return;
+  TelemetryLine held = _state;
+  held.type = LINE_RECORD;
+  held.badValues = 0;
+  for (long n = 1; n <= skipped; n++) {
+    held.ticks = (int64_t)(uint32_t)(_lastTicks + (int64_t)gap*n/steps);
+    records.push_back(held);
+  }
+  _filled += skipped;
+}
+
+// the next record does not continue the last one, so nothing is filled before it
+void TelemetryDeltaDecoder::breakSeries() {
+  _continuous = false;
+}
+
+// forgets every value and the sequence
+void TelemetryDeltaDecoder::reset() {
+  memset(&_state, 0, sizeof(_state));
+  _state.ticks = -1;
+  _state.sequence = -1;
+  _state.periodTicks = -1;
+  _state.isrOverruns = -1;
+  _synced = false;
+  _continuous = false;
+  _sequence = -1;
+  _lastTicks = -1;
+}
+
+// true while delta records can be applied
+bool TelemetryDeltaDecoder::isSynced() {
+  return _synced;
+}
+
+// lines found missing by their sequence number
+long TelemetryDeltaDecoder::getGaps() {
+  return _gaps;
+}
+
+// records filled in between sent records
+long TelemetryDeltaDecoder::getFilled() {
+  return _filled;
+}
@@ -0,0 +1,54 @@
+/*
+  TelemetryDelta.h - Rebuilds the full record series from deadband mode telemetry
+  Released into the public domain.
+
+  In its deadband mode (WTXM:1, see DeadbandTelemetry.h in the firmware) the
+  converter sends a keyframe every heartbeat and in between only records with
+  the fields that moved beyond their deadbands, as differences:
+    Tick: 1201200  Seq: 17    Period: 1001  LowSideVoltage: 12710  ...  (keyframe)
+    Tick: 1225224  Delta: 18  HighSideCurrent: -120                     (delta record)
+  The decoder keeps the value of every channel, applies each delta, recomputes
+  the power channels the delta left out, and fills the records the firmware
+  skipped with the values held at the time, one every Period ticks, so the
+  archive sees the same 1 Hz step series as without the deadband mode.
+
+  A sequence gap means a line was lost; the decoder then drops delta records
+  until the next keyframe, and the caller should ask for one (WKEY:1). Records
+  without a sequence number (deadband mode off, older firmware) pass through.
+  Gaps are never filled across a break (a shutdown, a reopened port) or when
+  the ticks do not line up with the record period.
+*/
+
+#ifndef TelemetryDelta_h
+#define TelemetryDelta_h
+
+#include <stdint.h>
+#include <vector>
+
+#include "Telemetry.h"
+
+const long DELTA_FILL_MAX_RECORDS = 3600; // skipped records filled at most, an hour at 1 Hz
+
+class TelemetryDeltaDecoder
+{
+  public:
+    TelemetryDeltaDecoder(); // constructor
+    bool decode(const TelemetryLine& line, std::vector<TelemetryLine>& records); // false if out of sync
+    void breakSeries(); // the next record does not continue the last one, e.g. after a shutdown
+    void reset(); // forgets everything, e.g. after the port was reopened
+    bool isSynced(); // true while delta records can be applied
+    long getGaps(); // lines found missing
+    long getFilled(); // records filled in
+  private:
+    bool _synced = false; // _state holds what the firmware last sent
+    bool _continuous = false; // nothing but skipped records since _lastTicks
+    int _sequence = -1; // of the last line
+    long _periodTicks = -1; // from the last keyframe
+    TelemetryLine _state; // every channel's current value
+    int64_t _lastTicks = -1; // tick of the last record handed out
+    long _gaps = 0;
+    long _filled = 0;
+    void fill(int64_t ticks, std::vector<TelemetryLine>& records); // adds the skipped records before ticks
+};
+
+#endif
@@ -0,0 +1,656 @@
+/*
+  TelemetryQuery.cpp - Time-range aggregate queries over a device's TelemetryStore
+  Released into the public domain.
+*/
+
+#include "TelemetryQuery.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "HttpServer.h"
+#include "TelemetryArchive.h"
+#include "TelemetryRollup.h"
+#include "TelemetryStore.h"
+
+// floor division, timestamps before 1970 are negative
+static int64_t floorDiv(int64_t a, int64_t b) {
+  return a/b - (a%b != 0 && (a < 0) != (b < 0));
+}
+
+// Buckets -------------------------------------------------------------------
+
+// empties every bucket and allocates columns for the channels in the mask
+void AggregateBuckets::reset(int64_t start, int64_t width, int buckets, uint32_t channels) {
+  startUs = start;
+  bucketUs = width;
+  numBuckets = buckets;
+  channelMask = channels;
+  count.assign(buckets, 0);
+  for (int c = 0; c < NUM_CHANNELS; c++) {
+    bool used = channels & (1u << c);
+    sum[c].assign(used ? buckets : 0, 0);
+    sumSquares[c].assign(used ? buckets : 0, 0.0);
+    min[c].assign(used ? buckets : 0, INT32_MAX);
+    max[c].assign(used ? buckets : 0, INT32_MIN);
+  }
+}
+
+// adds buckets of the same width; other's buckets must line up with these
+void AggregateBuckets::merge(const AggregateBuckets& other) {
+  int offset = (int)((other.startUs - startUs)/bucketUs);
+  int first = std::max(0, -offset);
+  int last = std::min(other.numBuckets, numBuckets - offset);
+  uint32_t channels = channelMask & other.channelMask;
+  for (int b = first; b < last; b++) {
+    if (other.count[b] == 0)
+      continue;
+    int target = b + offset;
+    count[target] += other.count[b];
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+      if (!(channels & (1u << c)))
+        continue;
+      sum[c][target] += other.sum[c][b];
+      sumSquares[c][target] += other.sumSquares[c][b];
+      min[c][target] = std::min(min[c][target], other.min[c][b]);
+      max[c][target] = std::max(max[c][target], other.max[c][b]);
+    }
+  }
+}
+
+// one aggregate of one bucket, NAN for an empty bucket
+double AggregateBuckets::getValue(int aggregate, int channel, int bucket) const {
+  double n = (double)count[bucket];
+  if (aggregate == AGG_COUNT)
+    return n;
+  if (n == 0)
+    return NAN;
+  switch (aggregate) {
+    case AGG_SUM: return (double)sum[channel][bucket];
+    case AGG_MEAN: return sum[channel][bucket]/n;
+    case AGG_MIN: return min[channel][bucket];
+    case AGG_MAX: return max[channel][bucket];
+    case AGG_STDDEV: {
+      double mean = sum[channel][bucket]/n;
+      double variance = sumSquares[channel][bucket]/n - mean*mean;
+      return variance > 0.0 ? sqrt(variance) : 0.0;
+    }
+    default: return NAN;
+  }
+}
+
+// Parsing -------------------------------------------------------------------
+
+// 90, 90s, 15m, 1h, 1d, 1w or 1y (365 days); fractions allowed
+bool parseQueryDuration(const char* text, int64_t& durationUs) {
+  char* end;
+  double value = strtod(text, &end);
+  if (end == text || value < 0.0)
+    return false;
+  double unit = 1.0;
+  switch (*end) {
+    case '\0': break;
+    case 's': unit = 1.0; break;
+    case 'm': unit = 60.0; break;
+    case 'h': unit = 3600.0; break;
+    case 'd': unit = 86400.0; break;
+    case 'w': unit = 604800.0; break;
+    case 'y': unit = 31536000.0; break;
+    default: return false;
+  }
+  if (*end && end[1] != '\0')
+    return false;
+  durationUs = (int64_t)(value*unit*1e6);
+  return true;
+}
+
+// "now", "now-7d", "now+1h", epoch seconds, or an ISO date or timestamp in local time like data.json
+bool parseQueryTime(const char* text, int64_t nowUs, int64_t& timestampUs) {
+  if (strncmp(text, "now", 3) == 0) {
+    int64_t offsetUs = 0;
+    if (text[3] != '\0' && ((text[3] != '-' && text[3] != '+') || !parseQueryDuration(text + 4, offsetUs)))
+      return false;
+    timestampUs = text[3] == '-' ? nowUs - offsetUs : nowUs + offsetUs;
+    return true;
+  }
+  char* end;
+  double seconds = strtod(text, &end);
+  if (end != text && *end == '\0') {
+    timestampUs = (int64_t)(seconds*1e6);
+    return true;
+  }
+  if (strlen(text) == 10) { // a date alone means its midnight
+    std::string midnight = std::string(text) + "T00:00:00";
+    return parseIsoTimestamp(midnight.c_str(), timestampUs);
+  }
+  return parseIsoTimestamp(text, timestampUs);
+}
+
+// comma separated names; "all" selects every name
+static bool parseNameList(const std::string& list, const char* const names[], int count,
+    int (*lookup)(const char*), uint32_t& mask) {
+  mask = 0;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t comma = list.find(',', start);
+    if (comma == std::string::npos)
+      comma = list.size();
+    std::string name = list.substr(start, comma - start);
+    if (name == "all") {
+      mask |= (count >= 32 ? 0xFFFFFFFFu : (1u << count) - 1);
+    } else if (!name.empty()) {
+      int index = lookup ? lookup(name.c_str()) : -1;
+      for (int n = 0; !lookup && n < count; n++) {
+        if (name == names[n])
+          index = n;
+      }
+      if (index < 0)
+        return false;
+      mask |= 1u << index;
+    }
+    start = comma + 1;
+  }
+  return mask != 0;
+}
+
+static int lookupChannel(const char* name) {
+  return channelIndex(name);
+}
+
+// CHANNEL:MIN:MAX, either bound may be empty
+static bool parseFilter(const std::string& text, TelemetryQuery& query) {
+  size_t first = text.find(':');
+  size_t second = first == std::string::npos ? first : text.find(':', first + 1);
+  if (second == std::string::npos)
+    return false;
+  query.filterChannel = channelIndex(text.substr(0, first).c_str());
+  std::string low = text.substr(first + 1, second - first - 1);
+  std::string high = text.substr(second + 1);
+  char* end;
+  if (!low.empty()) {
+    query.filterMin = (int32_t)strtol(low.c_str(), &end, 10);
+    if (*end)
+      return false;
+  }
+  if (!high.empty()) {
+    query.filterMax = (int32_t)strtol(high.c_str(), &end, 10);
+    if (*end)
+      return false;
+  }
+  return query.filterChannel >= 0;
+}
+
+// reads start, end, bucket, channels, agg, filter and rollups from a URL query string; other keys are
+// left to the caller. Defaults: the last day, one bucket, every channel, mean.
+bool parseQuery(const char* queryString, int64_t nowUs, TelemetryQuery& query, std::string& error) {
+  query = TelemetryQuery();
+  query.endUs = nowUs;
+  query.startUs = nowUs - 86400LL*1000000;
+  query.channelMask = (1u << NUM_CHANNELS) - 1;
+  std::string value;
+  if (getQueryParameter(queryString, "start", value) && !parseQueryTime(value.c_str(), nowUs, query.startUs)) {
+    error = "bad start time: " + value;
+    return false;
+  }
+  if (getQueryParameter(queryString, "end", value) && !parseQueryTime(value.c_str(), nowUs, query.endUs)) {
+    error = "bad end time: " + value;
+    return false;
+  }
+  if (getQueryParameter(queryString, "bucket", value) && !parseQueryDuration(value.c_str(), query.bucketUs)) {
+    error = "bad bucket width: " + value;
+    return false;
+  }
+  if (getQueryParameter(queryString, "channels", value)
+    && !parseNameList(value, CHANNEL_NAMES, NUM_CHANNELS, lookupChannel, query.channelMask)) {
+    error = "bad channel list: " + value;
+    return false;
+  }
+  if (getQueryParameter(queryString, "agg", value)
+    && !parseNameList(value, AGGREGATE_NAMES, NUM_AGGREGATES, NULL, query.aggregateMask)) {
+    error = "bad aggregate list: " + value;
+    return false;
+  }
+  if (getQueryParameter(queryString, "filter", value) && !parseFilter(value, query)) {
+    error = "bad filter, expected CHANNEL:MIN:MAX: " + value;
+    return false;
+  }
+  if (getQueryParameter(queryString, "rollups", value)) {
+    if (value != "0" && value != "1") {
+      error = "bad rollups, expected 0 or 1: " + value;
+      return false;
+    }
+    query.useRollups = value == "1";
+  }
+  if (query.endUs <= query.startUs) {
+    error = "end must be after start";
+    return false;
+  }
+  return true;
+}
+
+// Output --------------------------------------------------------------------
+
+// appends the non-empty buckets as JSON, in the spirit of data.json
+void formatQueryJson(const TelemetryQuery& query, const AggregateBuckets& result,
+    const QueryStats& stats, std::string& out) {
+  char text[160];
+  char time[40];
+  formatIsoTimestamp(query.startUs, time, sizeof(time));
+  out += "{\n  \"start\": \"";
+  out += time;
+  formatIsoTimestamp(query.endUs, time, sizeof(time));
+  out += "\",\n  \"end\": \"";
+  out += time;
+  snprintf(text, sizeof(text), "\",\n  \"bucket_seconds\": %.6g,\n", result.bucketUs/1e6);
+  out += text;
+  snprintf(text, sizeof(text), "  \"source\": \"%s\",\n  \"segments\": %d,\n  \"blocks\": %ld,\n"
+    "  \"blocks_pruned\": %ld,\n  \"blocks_from_header\": %ld,\n  \"blocks_decoded\": %ld,\n",
+    stats.fromRollup ? "rollup" : "raw", stats.segments, stats.blocks, stats.blocksPruned,
+    stats.blocksFromHeader, stats.blocksDecoded);
+  out += text;
+  snprintf(text, sizeof(text), "  \"samples_scanned\": %ld,\n  \"rollup_rows\": %ld,\n  \"elapsed_ms\": %.3f,\n"
+    "  \"buckets\": [", stats.samplesScanned, stats.rollupRows, stats.elapsedSeconds*1000.0);
+  out += text;
+  bool first = true;
+  for (int b = 0; b < result.numBuckets; b++) {
+    if (result.count[b] == 0)
+      continue;
+    formatIsoTimestamp(result.startUs + b*result.bucketUs, time, sizeof(time));
+    snprintf(text, sizeof(text), "%s\n    {\"timestamp\": \"%s\", \"count\": %lld", first ? "" : ",", time,
+      (long long)result.count[b]);
+    out += text;
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+      if (!(query.channelMask & (1u << c)))
+        continue;
+      out += ", \"";
+      out += CHANNEL_NAMES[c];
+      out += "\": {";
+      bool firstAggregate = true;
+      for (int a = 0; a < NUM_AGGREGATES; a++) {
+        if (!(query.aggregateMask & (1u << a)))
+          continue;
+        snprintf(text, sizeof(text), "%s\"%s\": %.10g", firstAggregate ? "" : ", ", AGGREGATE_NAMES[a],
+          result.getValue(a, c, b));
+        out += text;
+        firstAggregate = false;
+      }
+      out += "}";
+    }
+    out += "}";
+    first = false;
+  }
+  out += "\n  ]\n}\n";
+}
+
+// appends QueryBinaryHeader and one row per non-empty bucket
+void formatQueryBinary(const TelemetryQuery& query, const AggregateBuckets& result, std::string& out) {
+  QueryBinaryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "ATVQ", 4);
+  header.version = QUERY_BINARY_VERSION;
+  header.channelMask = query.channelMask;
+  header.aggregateMask = query.aggregateMask;
+  header.bucketUs = result.bucketUs;
+  for (int b = 0; b < result.numBuckets; b++)
+    header.numRows += result.count[b] != 0;
+  out.append((const char*)&header, sizeof(header));
+  for (int b = 0; b < result.numBuckets; b++) {
+    if (result.count[b] == 0)
+      continue;
+    int64_t timestampUs = result.startUs + b*result.bucketUs;
+    out.append((const char*)&timestampUs, sizeof(timestampUs));
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+      if (!(query.channelMask & (1u << c)))
+        continue;
+      for (int a = 0; a < NUM_AGGREGATES; a++) {
+        if (!(query.aggregateMask & (1u << a)))
+          continue;
+        double value = result.getValue(a, c, b);
+        out.append((const char*)&value, sizeof(value));
+      }
+    }
+  }
+}
+
+// Raw segments --------------------------------------------------------------
+
+// per-thread scratch space and partial results
+struct QueryWorker
+{
+  ArchiveReader reader;
+  AggregateBuckets partial; // buckets touched by the current segment
+  QueryStats stats;
+  bool needSum = true; // statistics the query's aggregates depend on
+  bool needSquares = true;
+  bool needExtremes = true;
+  std::vector<int64_t> timestamps;
+  std::vector<int32_t> columns[NUM_CHANNELS];
+};
+
+// adds samples [first, last) of the decoded block, all in one bucket; one simple loop per
+// statistic so the compiler can vectorize each of them
+static void accumulateRun(QueryWorker& w, int bucket, int first, int last) {
+  AggregateBuckets& p = w.partial;
+  p.count[bucket] += last - first;
+  for (int c = 0; c < NUM_CHANNELS; c++) {
+    if (!(p.channelMask & (1u << c)))
+      continue;
+    const int32_t* values = w.columns[c].data();
+    if (w.needSum) {
+      int64_t sum = 0;
+      for (int n = first; n < last; n++)
+        sum += values[n];
+      p.sum[c][bucket] += sum;
+    }
+    if (w.needSquares) {
+      double sumSquares = 0.0;
+      for (int n = first; n < last; n++)
+        sumSquares += (double)values[n]*values[n];
+      p.sumSquares[c][bucket] += sumSquares;
+    }
+    if (w.needExtremes) {
+      int32_t low = INT32_MAX;
+      int32_t high = INT32_MIN;
+      for (int n = first; n < last; n++) {
+        low = values[n] < low ? values[n] : low;
+        high = values[n] > high ? values[n] : high;
+      }
+      p.min[c][bucket] = std::min(p.min[c][bucket], low);
+      p.max[c][bucket] = std::max(p.max[c][bucket], high);
+    }
+  }
+}
+
+// decodes one block and adds every sample inside the range (and the filter) to the partial buckets
+static bool scanBlock(QueryWorker& w, const TelemetryQuery& query, int block, bool filterAll) {
+  const ArchiveBlockInfo& info = w.reader.getBlockInfo(block);
+  int count = info.numSamples;
+  w.timestamps.resize(count);
+  if (!w.reader.readTimestamps(block, w.timestamps.data()))
+    return false;
+  uint32_t needed = w.partial.channelMask | (filterAll ? 0 : 1u << query.filterChannel);
+  for (int c = 0; c < NUM_CHANNELS; c++) {
+    if (!(needed & (1u << c)))
+      continue;
+    w.columns[c].resize(count);
+    if (!w.reader.readColumn(block, c, w.columns[c].data()))
+      return false;
+  }
+  w.stats.blocksDecoded++;
+  w.stats.samplesScanned += count;
+  const int64_t* timestamps = w.timestamps.data();
+  int64_t bucketUs = w.partial.bucketUs;
+  for (int n = 0; n < count; ) {
+    int64_t t = timestamps[n];
+    if (t < query.startUs || t >= query.endUs) {
+      n++;
+      continue;
+    }
+    int64_t bucket = (t - w.partial.startUs)/bucketUs;
+    if (t < w.partial.startUs || bucket >= w.partial.numBuckets) { // before the block's first timestamp
+      n++;
+      continue;
+    }
+    if (!filterAll) { // sample by sample
+      int32_t value = w.columns[query.filterChannel][n];
+      if (value >= query.filterMin && value <= query.filterMax)
+        accumulateRun(w, (int)bucket, n, n + 1);
+      n++;
+      continue;
+    }
+    // the run of samples falling in this bucket (timestamps may step backwards after a clock change)
+    int64_t low = std::max(w.partial.startUs + bucket*bucketUs, query.startUs);
+    int64_t high = std::min(w.partial.startUs + (bucket + 1)*bucketUs, query.endUs);
+    int last = n + 1;
+    while (last < count && timestamps[last] >= low && timestamps[last] < high)
+      last++;
+    accumulateRun(w, (int)bucket, n, last);
+    n = last;
+  }
+  return true;
+}
+
+// answers a whole segment into w.partial, pruning and using block headers where possible
+static bool scanSegment(QueryWorker& w, const TelemetryQuery& query, const AggregateBuckets& result) {
+  int numBlocks = w.reader.getNumBlocks();
+  w.stats.segments++;
+  w.stats.blocks += numBlocks;
+  // time span of the blocks that survive pruning, to size the partial buckets
+  int64_t spanStart = INT64_MAX;
+  int64_t spanEnd = INT64_MIN;
+  std::vector<uint8_t> keep(numBlocks, 0);
+  for (int b = 0; b < numBlocks; b++) {
+    const ArchiveBlockInfo& info = w.reader.getBlockInfo(b);
+    if (info.timestampMax < query.startUs || info.timestampMin >= query.endUs)
+      continue;
+    if (query.filterChannel >= 0 && (info.valueMax[query.filterChannel] < query.filterMin
+      || info.valueMin[query.filterChannel] > query.filterMax))
+      continue;
+    keep[b] = 1;
+    spanStart = std::min(spanStart, std::max(info.timestampMin, query.startUs));
+    spanEnd = std::max(spanEnd, std::min(info.timestampMax, query.endUs - 1));
+  }
+  int numKept = (int)std::count(keep.begin(), keep.end(), 1);
+  w.stats.blocksPruned += numBlocks - numKept;
+  if (numKept == 0) {
+    w.partial.numBuckets = 0;
+    return true;
+  }
+  int64_t firstBucket = (spanStart - result.startUs)/result.bucketUs;
+  int64_t lastBucket = (spanEnd - result.startUs)/result.bucketUs;
+  w.partial.reset(result.startUs + firstBucket*result.bucketUs, result.bucketUs,
+    (int)(lastBucket - firstBucket + 1), result.channelMask);
+  bool headerOnly = (query.aggregateMask & ~HEADER_AGGREGATES) == 0;
+  for (int b = 0; b < numBlocks; b++) {
+    if (!keep[b])
+      continue;
+    const ArchiveBlockInfo& info = w.reader.getBlockInfo(b);
+    bool filterAll = query.filterChannel < 0 || (info.valueMin[query.filterChannel] >= query.filterMin
+      && info.valueMax[query.filterChannel] <= query.filterMax);
+    int bucket = (int)((info.timestampMin - w.partial.startUs)/result.bucketUs);
+    if (headerOnly && filterAll && info.timestampMin >= query.startUs && info.timestampMax < query.endUs
+      && info.timestampMin >= w.partial.startUs + bucket*result.bucketUs
+      && info.timestampMax < w.partial.startUs + (bucket + 1)*result.bucketUs) {
+      AggregateBuckets& p = w.partial;
+      p.count[bucket] += info.numSamples;
+      for (int c = 0; c < NUM_CHANNELS; c++) {
+        if (!(p.channelMask & (1u << c)))
+          continue;
+        p.min[c][bucket] = std::min(p.min[c][bucket], info.valueMin[c]);
+        p.max[c][bucket] = std::max(p.max[c][bucket], info.valueMax[c]);
+      }
+      w.stats.blocksFromHeader++;
+    } else if (!scanBlock(w, query, b, filterAll)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Rollups -------------------------------------------------------------------
+
+// adds the rows of one tier whose buckets start in [fromUs, toUs) to the result
+static bool addRollupRows(const std::string& directory, int tier, int64_t fromUs, int64_t toUs,
+    AggregateBuckets& result, QueryStats& stats) {
+  std::vector<std::string> files;
+  if (!listSegments(directory, rollupPrefix(tier).c_str(), files))
+    return false;
+  int64_t periodUs = TIER_FILE_DAYS[tier]*STORE_SEGMENT_US;
+  RollupReader reader;
+  RollupRows rows;
+  for (const std::string& path : files) {
+    int64_t fileStartUs;
+    if (segmentStartTime(path, fileStartUs) && (fileStartUs >= toUs || fileStartUs + periodUs <= fromUs))
+      continue;
+    if (!reader.open(path.c_str()))
+      return false;
+    for (int b = 0; b < reader.getNumBlocks(); b++) {
+      const RollupBlockHeader& header = reader.getBlockHeader(b);
+      if (header.lastStartUs < fromUs || header.firstStartUs >= toUs)
+        continue;
+      if (!reader.readBlock(b, result.channelMask, rows))
+        return false;
+      for (int r = 0; r < rows.size(); r++) {
+        int64_t start = rows.startUs[r];
+        if (start < fromUs || start >= toUs)
+          continue;
+        int bucket = (int)((start - result.startUs)/result.bucketUs);
+        result.count[bucket] += rows.count[r];
+        for (int c = 0; c < NUM_CHANNELS; c++) {
+          if (!(result.channelMask & (1u << c)))
+            continue;
+          result.sum[c][bucket] += rows.sum[c][r];
+          result.sumSquares[c][bucket] += rows.sumSquares[c][r];
+          result.min[c][bucket] = std::min(result.min[c][bucket], rows.min[c][r]);
+          result.max[c][bucket] = std::max(result.max[c][bucket], rows.max[c][r]);
+        }
+        stats.rollupRows++;
+      }
+    }
+  }
+  return true;
+}
+
+// answers whole buckets of the coarsest tier at or below tier that fit in [fromUs, toUs), then
+// the edges from finer tiers; whatever no tier covers is left in rawRanges
+static bool answerFromRollups(const std::string& directory, const TelemetryQuery& query,
+    const int64_t* tierStart, const int64_t* tierEnd, int tier, int64_t fromUs, int64_t toUs,
+    AggregateBuckets& result, QueryStats& stats, std::vector<std::pair<int64_t, int64_t>>& rawRanges) {
+  if (fromUs >= toUs)
+    return true;
+  int64_t low = 0;
+  int64_t high = 0;
+  for (; tier >= 0; tier--) {
+    int64_t width = TIER_US[tier];
+    if (tierEnd[tier] == INT64_MIN || (query.bucketUs > 0 && query.bucketUs%width != 0))
+      continue;
+    low = -floorDiv(-std::max(fromUs, tierStart[tier]), width)*width;
+    high = floorDiv(std::min(toUs, tierEnd[tier]), width)*width;
+    if (low < high)
+      break;
+  }
+  if (tier < 0) {
+    rawRanges.push_back(std::make_pair(fromUs, toUs));
+    return true;
+  }
+  stats.fromRollup = true;
+  return addRollupRows(directory, tier, low, high, result, stats)
+    && answerFromRollups(directory, query, tierStart, tierEnd, tier - 1, fromUs, low, result, stats, rawRanges)
+    && answerFromRollups(directory, query, tierStart, tierEnd, tier - 1, high, toUs, result, stats, rawRanges);
+}
+
+// Engine --------------------------------------------------------------------
+
+TelemetryQueryEngine::TelemetryQueryEngine(int threads) {
+  _threads = threads > 0 ? threads : (int)std::thread::hardware_concurrency();
+  if (_threads < 1)
+    _threads = 1;
+}
+
+// answers a query from the rollup tiers and raw segments of one device directory
+bool TelemetryQueryEngine::run(const std::string& directory, const TelemetryQuery& query,
+    AggregateBuckets& result, QueryStats& stats, std::string& error) {
+  auto started = std::chrono::steady_clock::now();
+  stats = QueryStats();
+  if (query.endUs <= query.startUs || query.channelMask == 0) {
+    error = "empty query";
+    return false;
+  }
+  int64_t bucketUs = query.bucketUs > 0 ? query.bucketUs : query.endUs - query.startUs;
+  int64_t firstStart = query.bucketUs > 0 ? floorDiv(query.startUs, bucketUs)*bucketUs : query.startUs;
+  int64_t numBuckets = (query.endUs - firstStart + bucketUs - 1)/bucketUs;
+  if (numBuckets > QUERY_BUCKETS_MAX) {
+    error = "too many buckets, use a wider bucket";
+    return false;
+  }
+  result.reset(firstStart, bucketUs, (int)numBuckets, query.channelMask & ((1u << NUM_CHANNELS) - 1));
+
+  // a sample filter needs every sample, so filtered queries never use rollups
+  std::vector<std::pair<int64_t, int64_t>> rawRanges;
+  if (query.useRollups && query.filterChannel < 0) {
+    int64_t tierStart[NUM_TIERS];
+    int64_t tierEnd[NUM_TIERS];
+    for (int t = 0; t < NUM_TIERS; t++) {
+      if (!rollupRange(directory, t, tierStart[t], tierEnd[t]))
+        tierStart[t] = tierEnd[t] = INT64_MIN;
+    }
+    if (!answerFromRollups(directory, query, tierStart, tierEnd, NUM_TIERS - 1, query.startUs, query.endUs,
+      result, stats, rawRanges)) {
+      error = "cannot read the rollups";
+      return false;
+    }
+  } else {
+    rawRanges.push_back(std::make_pair(query.startUs, query.endUs));
+  }
+  for (auto& range : rawRanges) {
+    TelemetryQuery part = query;
+    part.startUs = range.first;
+    part.endUs = range.second;
+    if (!scanRaw(directory, part, result, stats, error))
+      return false;
+  }
+  stats.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  return true;
+}
+
+// adds every raw sample in the query's range to result, one worker thread per segment
+bool TelemetryQueryEngine::scanRaw(const std::string& directory, const TelemetryQuery& query,
+    AggregateBuckets& result, QueryStats& stats, std::string& error) {
+  std::vector<std::string> all;
+  if (!listSegments(directory, "raw", all)) {
+    error = "no telemetry for this device";
+    return false;
+  }
+  std::vector<std::string> segments; // the ones whose day overlaps the range
+  for (const std::string& path : all) {
+    int64_t dayStartUs;
+    if (segmentStartTime(path, dayStartUs)
+      && (dayStartUs >= query.endUs || dayStartUs + STORE_SEGMENT_US <= query.startUs))
+      continue;
+    segments.push_back(path);
+  }
+
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  std::mutex merging;
+  auto work = [&]() {
+    QueryWorker w;
+    w.needSum = query.aggregateMask & ((1u << AGG_SUM) | (1u << AGG_MEAN) | (1u << AGG_STDDEV));
+    w.needSquares = query.aggregateMask & (1u << AGG_STDDEV);
+    w.needExtremes = query.aggregateMask & ((1u << AGG_MIN) | (1u << AGG_MAX));
+    for (size_t s = next++; s < segments.size() && !failed; s = next++) {
+      if (!w.reader.open(segments[s].c_str()) || !scanSegment(w, query, result)) {
+        std::lock_guard<std::mutex> lock(merging);
+        error = "cannot read " + segments[s];
+        failed = true;
+        break;
+      }
+      if (w.partial.numBuckets > 0) {
+        std::lock_guard<std::mutex> lock(merging);
+        result.merge(w.partial);
+      }
+    }
+    std::lock_guard<std::mutex> lock(merging);
+    stats.segments += w.stats.segments;
+    stats.blocks += w.stats.blocks;
+    stats.blocksPruned += w.stats.blocksPruned;
+    stats.blocksFromHeader += w.stats.blocksFromHeader;
+    stats.blocksDecoded += w.stats.blocksDecoded;
+    stats.samplesScanned += w.stats.samplesScanned;
+  };
+  int threads = std::min(_threads, (int)segments.size());
+  std::vector<std::thread> pool;
+  for (int t = 1; t < threads; t++)
+    pool.emplace_back(work);
+  work(); // this thread works too
+  for (std::thread& thread : pool)
+    thread.join();
+  return !failed;
+}
@@ -0,0 +1,141 @@
+/*
+  TelemetryQuery.h - Time-range aggregate queries over a device's TelemetryStore
+  Released into the public domain.
+
+  A query names a time range, a set of channels, a set of aggregates and a
+  bucket width, e.g. "mean and max of HighSidePower per hour over the last
+  week". Every bucket keeps count/sum/min/max/sum of squares per channel, from
+  which all aggregates are derived, so partial results from different blocks
+  and threads simply add up.
+
+  Work is cut down in four steps:
+    - whole buckets of a rollup tier are read as one pre-computed row each,
+      from the coarsest tier whose width divides the bucket width; only the
+      edges and the newest, still open buckets fall through to finer tiers
+      and, at last, the raw segments (not for filtered queries)
+    - segments outside the range are never opened (the file name holds the day)
+    - blocks outside the range, or whose min/max cannot pass the filter, are
+      skipped without reading their payload
+    - blocks inside a single bucket that only need count/min/max are answered
+      from the block header
+  The remaining blocks are decoded column by column (only the channels asked
+  for) by one worker thread per core, one segment at a time.
+
+  Buckets are aligned to multiples of the bucket width since the epoch (UTC),
+  so hourly and daily buckets line up with the wall clock and the rollups.
+*/
+
+#ifndef TelemetryQuery_h
+#define TelemetryQuery_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Telemetry.h"
+
+const int QUERY_BUCKETS_MAX = 1000000; // larger results are refused
+const int QUERY_BINARY_VERSION = 1; // bump when the binary result layout changes
+
+// aggregate functions for convenience and bookkeeping
+enum QueryAggregates
+{   AGG_COUNT = 0,
+    AGG_SUM,
+    AGG_MEAN,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_STDDEV, // population standard deviation
+    NUM_AGGREGATES
+};
+
+const char * const AGGREGATE_NAMES[NUM_AGGREGATES] = {
+  "count",
+  "sum",
+  "mean",
+  "min",
+  "max",
+  "stddev"};
+
+// aggregates that can be answered from block headers without decoding
+const uint32_t HEADER_AGGREGATES = (1u << AGG_COUNT) | (1u << AGG_MIN) | (1u << AGG_MAX);
+
+struct TelemetryQuery
+{
+  int64_t startUs = 0; // first timestamp included
+  int64_t endUs = 0; // first timestamp excluded
+  int64_t bucketUs = 0; // bucket width, 0 for a single bucket over the whole range
+  uint32_t channelMask = 0; // 1 << TelemetryChannel for every channel returned
+  uint32_t aggregateMask = 1u << AGG_MEAN; // 1 << QueryAggregates for every aggregate returned
+  int filterChannel = -1; // only samples with filterMin <= value <= filterMax count, -1 for all
+  int32_t filterMin = INT32_MIN;
+  int32_t filterMax = INT32_MAX;
+  bool useRollups = true; // false always scans the raw segments
+};
+
+// how much of the store a query had to touch
+struct QueryStats
+{
+  int segments = 0; // segment files opened
+  long blocks = 0; // blocks in the opened segments
+  long blocksPruned = 0; // skipped by time range or filter
+  long blocksFromHeader = 0; // answered from block min/max
+  long blocksDecoded = 0;
+  long samplesScanned = 0;
+  bool fromRollup = false; // answered (at least partly) from a rollup tier instead of raw blocks
+  long rollupRows = 0; // pre-computed rows read
+  double elapsedSeconds = 0.0;
+};
+
+// count/sum/min/max/sum of squares per bucket and channel, stored column by column
+struct AggregateBuckets
+{
+  int64_t startUs = 0; // start of bucket 0
+  int64_t bucketUs = 0;
+  int numBuckets = 0;
+  uint32_t channelMask = 0; // channels with allocated columns
+  std::vector<int64_t> count; // samples per bucket
+  std::vector<int64_t> sum[NUM_CHANNELS];
+  std::vector<double> sumSquares[NUM_CHANNELS];
+  std::vector<int32_t> min[NUM_CHANNELS];
+  std::vector<int32_t> max[NUM_CHANNELS];
+  void reset(int64_t start, int64_t width, int buckets, uint32_t channels); // empties every bucket
+  void merge(const AggregateBuckets& other); // adds buckets of the same width (any start)
+  double getValue(int aggregate, int channel, int bucket) const; // one aggregate of one bucket
+};
+
+bool parseQueryTime(const char* text, int64_t nowUs, int64_t& timestampUs); // now, now-7d, ISO or epoch s
+bool parseQueryDuration(const char* text, int64_t& durationUs); // 90, 15m, 1h, 1d, 1w, 1y
+bool parseQuery(const char* queryString, int64_t nowUs, TelemetryQuery& query,
+  std::string& error); // URL query string, e.g. start=now-7d&bucket=1h&channels=HighSidePower&agg=mean&rollups=0
+void formatQueryJson(const TelemetryQuery& query, const AggregateBuckets& result,
+  const QueryStats& stats, std::string& out); // appends the non-empty buckets as JSON
+void formatQueryBinary(const TelemetryQuery& query, const AggregateBuckets& result,
+  std::string& out); // appends QueryBinaryHeader and one row per non-empty bucket
+
+// binary result layout (little endian): this header, then numRows rows of
+//   int64 bucketStartUs, double value[channel][aggregate] for every bit set in the masks
+struct QueryBinaryHeader
+{
+  char magic[4]; // "ATVQ"
+  uint16_t version; // QUERY_BINARY_VERSION
+  uint16_t reserved;
+  uint32_t channelMask;
+  uint32_t aggregateMask;
+  int64_t bucketUs;
+  uint32_t numRows;
+  uint32_t reserved2;
+};
+
+class TelemetryQueryEngine
+{
+  public:
+    TelemetryQueryEngine(int threads = 0); // 0 uses one thread per core
+    bool run(const std::string& directory, const TelemetryQuery& query, AggregateBuckets& result,
+      QueryStats& stats, std::string& error); // answers a query from <root>/<device>
+  private:
+    int _threads;
+    bool scanRaw(const std::string& directory, const TelemetryQuery& query, AggregateBuckets& result,
+      QueryStats& stats, std::string& error); // adds raw samples in the query's range to result
+};
+
+#endif
@@ -0,0 +1,443 @@
+/*
+  TelemetryRollup.cpp - Pre-computed aggregates of a device's telemetry at several resolutions
+  Released into the public domain.
+*/
+
+#include "TelemetryRollup.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "TelemetryArchive.h"
+#include "TelemetryStore.h"
+
+// floor division, timestamps before 1970 are negative
+static int64_t floorDiv(int64_t a, int64_t b) {
+  return a/b - (a%b != 0 && (a < 0) != (b < 0));
+}
+
+// bytes of one block's columns after its header
+static long blockBytes(uint32_t rows) {
+  return (long)rows*(2*sizeof(int64_t) + NUM_CHANNELS*(sizeof(int64_t) + sizeof(double) + 2*sizeof(int32_t)));
+}
+
+// Rows ----------------------------------------------------------------------
+
+// drops every row
+void RollupRows::clear() {
+  resize(0, (1u << NUM_CHANNELS) - 1);
+}
+
+// rows for readBlock(); columns of channels outside the mask are left empty
+void RollupRows::resize(int rows, uint32_t channelMask) {
+  startUs.resize(rows);
+  count.resize(rows);
+  for (int c = 0; c < NUM_CHANNELS; c++) {
+    int size = (channelMask & (1u << c)) ? rows : 0;
+    sum[c].resize(size);
+    sumSquares[c].resize(size);
+    min[c].resize(size);
+    max[c].resize(size);
+  }
+}
+
+// adds other's rows after these; both must hold every channel
+void RollupRows::append(const RollupRows& other) {
+  startUs.insert(startUs.end(), other.startUs.begin(), other.startUs.end());
+  count.insert(count.end(), other.count.begin(), other.count.end());
+  for (int c = 0; c < NUM_CHANNELS; c++) {
+    sum[c].insert(sum[c].end(), other.sum[c].begin(), other.sum[c].end());
+    sumSquares[c].insert(sumSquares[c].end(), other.sumSquares[c].begin(), other.sumSquares[c].end());
+    min[c].insert(min[c].end(), other.min[c].begin(), other.min[c].end());
+    max[c].insert(max[c].end(), other.max[c].begin(), other.max[c].end());
+  }
+}
+
+// empties the bucket starting at start
+void RollupAccumulator::reset(int64_t start) {
+  startUs = start;
+  count = 0;
+  for (int c = 0; c < NUM_CHANNELS; c++) {
+    sum[c] = 0;
+    sumSquares[c] = 0.0;
+    min[c] = INT32_MAX;
+    max[c] = INT32_MIN;
+  }
+}
+
+// Files ---------------------------------------------------------------------
+
+// writes the file header if the file is empty
+static bool writeFileHeader(FILE* file, int64_t tierUs) {
+  if (ftell(file) != 0)
+    return true;
+  RollupFileHeader fileHeader;
+  memset(&fileHeader, 0, sizeof(fileHeader));
+  memcpy(fileHeader.magic, "ATVR", 4);
+  fileHeader.version = ROLLUP_VERSION;
+  fileHeader.numChannels = NUM_CHANNELS;
+  fileHeader.tierUs = tierUs;
+  return fwrite(&fileHeader, sizeof(fileHeader), 1, file) == 1;
+}
+
+// writes rows [first, last) as one block
+static bool writeBlock(FILE* file, const RollupRows& rows, int first, int last) {
+  size_t n = last - first;
+  RollupBlockHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "ROW1", 4);
+  header.numRows = (uint32_t)n;
+  header.firstStartUs = *std::min_element(rows.startUs.begin() + first, rows.startUs.begin() + last);
+  header.lastStartUs = *std::max_element(rows.startUs.begin() + first, rows.startUs.begin() + last);
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+    && fwrite(&rows.startUs[first], sizeof(int64_t), n, file) == n
+    && fwrite(&rows.count[first], sizeof(int64_t), n, file) == n;
+  for (int c = 0; c < NUM_CHANNELS && ok; c++) {
+    ok = fwrite(&rows.sum[c][first], sizeof(int64_t), n, file) == n
+      && fwrite(&rows.sumSquares[c][first], sizeof(double), n, file) == n
+      && fwrite(&rows.min[c][first], sizeof(int32_t), n, file) == n
+      && fwrite(&rows.max[c][first], sizeof(int32_t), n, file) == n;
+  }
+  return ok;
+}
+
+// creates (or replaces) a file holding rows as a single block, used by compaction
+bool writeRollupFile(const std::string& path, int64_t tierUs, const RollupRows& rows) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file)
+    return false;
+  bool ok = writeFileHeader(file, tierUs) && (rows.size() == 0 || writeBlock(file, rows, 0, rows.size()));
+  ok = fflush(file) == 0 && fsync(fileno(file)) == 0 && ok;
+  return fclose(file) == 0 && ok;
+}
+
+// file name prefix of a tier, e.g. rollup-1h
+std::string rollupPrefix(int tier) {
+  return std::string("rollup-") + TIER_NAMES[tier];
+}
+
+// comma separated tier names like "1m,1h"; an empty list selects no tier
+bool parseTierList(const char* list, uint32_t& tierMask) {
+  tierMask = 0;
+  std::string text = list;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t comma = text.find(',', start);
+    std::string name = text.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+    int tier = 0;
+    while (tier < NUM_TIERS && name != TIER_NAMES[tier])
+      tier++;
+    if (tier == NUM_TIERS)
+      return false;
+    tierMask |= 1u << tier;
+    start = comma == std::string::npos ? text.size() : comma + 1;
+  }
+  return true;
+}
+
+// start of the TIER_FILE_DAYS period holding timestampUs
+int64_t rollupFileStart(int tier, int64_t timestampUs) {
+  int64_t periodUs = TIER_FILE_DAYS[tier]*STORE_SEGMENT_US;
+  return floorDiv(timestampUs, periodUs)*periodUs;
+}
+
+// first bucket start and end of the last bucket of a tier's rows on disk, false if it has none
+bool rollupRange(const std::string& directory, int tier, int64_t& startUs, int64_t& endUs) {
+  std::vector<std::string> files;
+  if (!listSegments(directory, rollupPrefix(tier).c_str(), files))
+    return false;
+  RollupReader reader;
+  bool found = false;
+  for (size_t f = 0; f < files.size() && !found; f++) { // oldest file with rows
+    if (!reader.open(files[f].c_str()))
+      continue;
+    for (int b = 0; b < reader.getNumBlocks(); b++) {
+      startUs = found ? std::min(startUs, reader.getBlockHeader(b).firstStartUs)
+        : reader.getBlockHeader(b).firstStartUs;
+      found = true;
+    }
+  }
+  if (!found)
+    return false;
+  found = false;
+  for (size_t f = files.size(); f-- > 0 && !found; ) { // newest file with rows
+    if (!reader.open(files[f].c_str()))
+      continue;
+    for (int b = 0; b < reader.getNumBlocks(); b++) {
+      int64_t end = reader.getBlockHeader(b).lastStartUs + reader.getTierUs();
+      endUs = found ? std::max(endUs, end) : end;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Rollup Reader -------------------------------------------------------------
+
+RollupReader::RollupReader() {
+}
+
+RollupReader::~RollupReader() {
+  close();
+}
+
+// opens a rollup file and indexes its block headers; a truncated last block is ignored
+bool RollupReader::open(const char* path) {
+  close();
+  _file = fopen(path, "rb");
+  if (!_file)
+    return false;
+  RollupFileHeader fileHeader;
+  if (fread(&fileHeader, sizeof(fileHeader), 1, _file) != 1
+    || memcmp(fileHeader.magic, "ATVR", 4) != 0
+    || fileHeader.version != ROLLUP_VERSION
+    || fileHeader.numChannels != NUM_CHANNELS
+    || fileHeader.tierUs <= 0) {
+    close();
+    return false;
+  }
+  _tierUs = fileHeader.tierUs;
+  fseek(_file, 0, SEEK_END);
+  long fileSize = ftell(_file);
+  long offset = sizeof(fileHeader);
+  while (offset + (long)sizeof(RollupBlockHeader) <= fileSize) {
+    RollupBlockHeader header;
+    fseek(_file, offset, SEEK_SET);
+    if (fread(&header, sizeof(header), 1, _file) != 1 || memcmp(header.magic, "ROW1", 4) != 0)
+      break;
+    long next = offset + sizeof(header) + blockBytes(header.numRows);
+    if (next > fileSize)
+      break;
+    _blocks.push_back(header);
+    _offsets.push_back(offset + sizeof(header));
+    offset = next;
+  }
+  return true;
+}
+
+// closes the file
+void RollupReader::close() {
+  if (_file)
+    fclose(_file);
+  _file = NULL;
+  _tierUs = 0;
+  _blocks.clear();
+  _offsets.clear();
+}
+
+// bucket width of every row
+int64_t RollupReader::getTierUs() {
+  return _tierUs;
+}
+
+// number of complete blocks
+int RollupReader::getNumBlocks() {
+  return (int)_blocks.size();
+}
+
+// row count and bucket range of one block
+const RollupBlockHeader& RollupReader::getBlockHeader(int block) {
+  return _blocks[block];
+}
+
+// reads the bucket starts, counts and the columns of the channels in the mask
+bool RollupReader::readBlock(int block, uint32_t channelMask, RollupRows& rows) {
+  if (!_file || block < 0 || block >= (int)_blocks.size())
+    return false;
+  size_t n = _blocks[block].numRows;
+  rows.resize((int)n, channelMask);
+  long offset = _offsets[block];
+  fseek(_file, offset, SEEK_SET);
+  if (fread(rows.startUs.data(), sizeof(int64_t), n, _file) != n
+    || fread(rows.count.data(), sizeof(int64_t), n, _file) != n)
+    return false;
+  offset += 2*sizeof(int64_t)*n;
+  long channelBytes = (sizeof(int64_t) + sizeof(double) + 2*sizeof(int32_t))*n;
+  for (int c = 0; c < NUM_CHANNELS; c++) {
+    if (!(channelMask & (1u << c)))
+      continue;
+    fseek(_file, offset + c*channelBytes, SEEK_SET);
+    if (fread(rows.sum[c].data(), sizeof(int64_t), n, _file) != n
+      || fread(rows.sumSquares[c].data(), sizeof(double), n, _file) != n
+      || fread(rows.min[c].data(), sizeof(int32_t), n, _file) != n
+      || fread(rows.max[c].data(), sizeof(int32_t), n, _file) != n)
+      return false;
+  }
+  return true;
+}
+
+// Rollup Writer -------------------------------------------------------------
+
+RollupWriter::RollupWriter() {
+}
+
+RollupWriter::~RollupWriter() {
+  close();
+}
+
+// finds where every tier in the mask stopped, then replays the raw samples after that so
+// the open buckets (and rows lost in a crash) are rebuilt; with no rollups on disk yet this
+// builds every tier from the whole raw history
+bool RollupWriter::open(const std::string& directory, uint32_t tierMask) {
+  close();
+  _directory = directory;
+  _tierMask = tierMask & ALL_TIERS;
+  _rowsWritten = 0;
+  int64_t fromUs = INT64_MAX;
+  for (int t = 0; t < NUM_TIERS; t++) {
+    _open[t] = RollupAccumulator();
+    _closed[t].clear();
+    _resumeUs[t] = INT64_MIN;
+    if (!(_tierMask & (1u << t)))
+      continue;
+    int64_t startUs;
+    rollupRange(directory, t, startUs, _resumeUs[t]);
+    fromUs = std::min(fromUs, _resumeUs[t]);
+  }
+  if (_tierMask == 0)
+    return true;
+  return replay(fromUs);
+}
+
+// adds one sample to the open 1 s bucket; coarser tiers only see closed buckets
+void RollupWriter::add(const TelemetrySample& sample) {
+  if (_tierMask == 0)
+    return;
+  RollupAccumulator& a = _open[TIER_1S];
+  int64_t start = floorDiv(sample.timestampUs, TIER_US[TIER_1S])*TIER_US[TIER_1S];
+  if (start != a.startUs) {
+    closeBucket(TIER_1S);
+    a.reset(start);
+  }
+  a.count++;
+  for (int c = 0; c < NUM_CHANNELS; c++) {
+    int32_t value = sample.values[c];
+    a.sum[c] += value;
+    a.sumSquares[c] += (double)value*value;
+    a.min[c] = value < a.min[c] ? value : a.min[c];
+    a.max[c] = value > a.max[c] ? value : a.max[c];
+  }
+}
+
+// appends every closed row to the file of its period, one block per file
+bool RollupWriter::flush() {
+  bool ok = true;
+  for (int t = 0; t < NUM_TIERS; t++) {
+    RollupRows& rows = _closed[t];
+    int first = 0;
+    while (first < rows.size()) {
+      int64_t fileStartUs = rollupFileStart(t, rows.startUs[first]);
+      int last = first + 1;
+      while (last < rows.size() && rollupFileStart(t, rows.startUs[last]) == fileStartUs)
+        last++;
+      ok = writeRows(t, first, last, fileStartUs) && ok;
+      first = last;
+    }
+    rows.clear();
+  }
+  return ok;
+}
+
+// appends closed rows; the open buckets are rebuilt from the raw segments by the next open()
+void RollupWriter::close() {
+  if (_tierMask != 0)
+    flush();
+  _tierMask = 0;
+}
+
+// rows appended since open()
+long RollupWriter::getRowsWritten() {
+  return _rowsWritten;
+}
+
+// emits the open bucket of a tier (unless that row is already on disk) and folds it into
+// the open bucket of the next tier
+void RollupWriter::closeBucket(int tier) {
+  RollupAccumulator& a = _open[tier];
+  if (a.count == 0)
+    return;
+  if ((_tierMask & (1u << tier)) && a.startUs >= _resumeUs[tier]) {
+    RollupRows& rows = _closed[tier];
+    rows.startUs.push_back(a.startUs);
+    rows.count.push_back(a.count);
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+      rows.sum[c].push_back(a.sum[c]);
+      rows.sumSquares[c].push_back(a.sumSquares[c]);
+      rows.min[c].push_back(a.min[c]);
+      rows.max[c].push_back(a.max[c]);
+    }
+  }
+  int next = tier + 1;
+  if (next < NUM_TIERS && (_tierMask >> next) != 0) { // a coarser tier is still kept
+    RollupAccumulator& up = _open[next];
+    int64_t start = floorDiv(a.startUs, TIER_US[next])*TIER_US[next];
+    if (start != up.startUs) {
+      closeBucket(next);
+      up.reset(start);
+    }
+    up.count += a.count;
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+      up.sum[c] += a.sum[c];
+      up.sumSquares[c] += a.sumSquares[c];
+      up.min[c] = std::min(up.min[c], a.min[c]);
+      up.max[c] = std::max(up.max[c], a.max[c]);
+    }
+  }
+  a.count = 0;
+}
+
+// adds every raw sample at or after fromUs, oldest segment first, writing rows as it goes
+bool RollupWriter::replay(int64_t fromUs) {
+  std::vector<std::string> segments;
+  if (!listSegments(_directory, "raw", segments))
+    return false;
+  ArchiveReader reader;
+  std::vector<int64_t> timestamps;
+  std::vector<int32_t> columns[NUM_CHANNELS];
+  int32_t* pointers[NUM_CHANNELS];
+  TelemetrySample sample;
+  for (const std::string& path : segments) {
+    int64_t dayStartUs;
+    if (segmentStartTime(path, dayStartUs) && dayStartUs + STORE_SEGMENT_US <= fromUs)
+      continue;
+    if (!reader.open(path.c_str()))
+      continue; // an unreadable segment only leaves a hole in the rollups
+    for (int b = 0; b < reader.getNumBlocks(); b++) {
+      const ArchiveBlockInfo& info = reader.getBlockInfo(b);
+      if (info.timestampMax < fromUs)
+        continue;
+      timestamps.resize(info.numSamples);
+      for (int c = 0; c < NUM_CHANNELS; c++) {
+        columns[c].resize(info.numSamples);
+        pointers[c] = columns[c].data();
+      }
+      if (!reader.readBlock(b, timestamps.data(), pointers))
+        continue;
+      for (uint32_t n = 0; n < info.numSamples; n++) {
+        if (timestamps[n] < fromUs)
+          continue;
+        sample.timestampUs = timestamps[n];
+        for (int c = 0; c < NUM_CHANNELS; c++)
+          sample.values[c] = columns[c][n];
+        add(sample);
+      }
+    }
+    if (!flush()) // keeps a long backfill from holding every row in memory
+      return false;
+  }
+  return true;
+}
+
+// appends rows [first, last) of a tier as one block of the file starting at fileStartUs
+bool RollupWriter::writeRows(int tier, int first, int last, int64_t fileStartUs) {
+  std::string path = _directory + "/" + segmentFileName(rollupPrefix(tier).c_str(), fileStartUs);
+  FILE* file = fopen(path.c_str(), "ab");
+  if (!file)
+    return false;
+  bool ok = writeFileHeader(file, TIER_US[tier]) && writeBlock(file, _closed[tier], first, last);
+  ok = fclose(file) == 0 && ok;
+  if (ok)
+    _rowsWritten += last - first;
+  return ok;
+}
@@ -0,0 +1,154 @@
+/*
+  TelemetryRollup.h - Pre-computed aggregates of a device's telemetry at several resolutions
+  Released into the public domain.
+
+  Every sample appended to a TelemetryStore also lands in the open 1 s bucket
+  of a RollupWriter. When a bucket closes it is written out as a row
+  (count/sum/min/max/sum of squares of every channel) and folded into the open
+  bucket of the next tier, so a sample costs one tier's worth of work no matter
+  how many tiers are kept:
+    1 s -> 1 min -> 15 min -> 1 h -> 1 d
+  Buckets are aligned to multiples of their width since the epoch (UTC), like
+  query buckets, so a query whose bucket width is a multiple of a tier's width
+  can be answered from that tier's rows. A year of hourly buckets is 8760 rows
+  instead of 31 million samples.
+
+  Rows are stored per tier in <root>/<device>/rollup-<tier>-YYYYMMDD.atv, one
+  file per TIER_FILE_DAYS days, next to the raw segments. File layout (little
+  endian):
+    RollupFileHeader
+    { RollupBlockHeader, startUs[n], count[n],
+      then per channel sum[n], sumSquares[n], min[n], max[n] } ...
+  Blocks are column by column, so a query reads only the channels it needs.
+  Rows are appended when the store flushes. Open buckets are not persisted:
+  RollupWriter::open() rebuilds them (and any rows lost in a crash) from the
+  raw segments, and builds every tier from scratch when no rollups exist yet.
+*/
+
+#ifndef TelemetryRollup_h
+#define TelemetryRollup_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "Telemetry.h"
+
+const int ROLLUP_VERSION = 1; // bump when the file layout changes
+
+// rollup resolutions for convenience and bookkeeping, finest first
+enum RollupTiers
+{   TIER_1S = 0,
+    TIER_1MIN,
+    TIER_15MIN,
+    TIER_1H,
+    TIER_1D,
+    NUM_TIERS
+};
+
+const char * const TIER_NAMES[NUM_TIERS] = {
+  "1s",
+  "1m",
+  "15m",
+  "1h",
+  "1d"};
+
+const int64_t TIER_US[NUM_TIERS] = {1000000LL, 60000000LL, 900000000LL, 3600000000LL, 86400000000LL};
+const int TIER_FILE_DAYS[NUM_TIERS] = {1, 1, 16, 64, 1024}; // days per rollup file, ~1500 rows except 1 s
+const uint32_t ALL_TIERS = (1u << NUM_TIERS) - 1;
+// the 1 s tier repeats a 1 Hz stream at 232 bytes a row; it only pays off for faster streams
+const uint32_t DEFAULT_TIERS = ALL_TIERS & ~(1u << TIER_1S);
+
+struct RollupFileHeader
+{
+  char magic[4]; // "ATVR"
+  uint16_t version; // ROLLUP_VERSION
+  uint16_t numChannels; // NUM_CHANNELS when written
+  int64_t tierUs; // bucket width of every row
+};
+
+struct RollupBlockHeader
+{
+  char magic[4]; // "ROW1"
+  uint32_t numRows; // rows in this block
+  int64_t firstStartUs; // smallest bucket start in the block
+  int64_t lastStartUs; // largest bucket start in the block
+};
+
+// closed buckets, stored column by column
+struct RollupRows
+{
+  std::vector<int64_t> startUs; // bucket start
+  std::vector<int64_t> count; // samples in the bucket
+  std::vector<int64_t> sum[NUM_CHANNELS];
+  std::vector<double> sumSquares[NUM_CHANNELS];
+  std::vector<int32_t> min[NUM_CHANNELS];
+  std::vector<int32_t> max[NUM_CHANNELS];
+  int size() const { return (int)startUs.size(); }
+  void clear(); // drops every row
+  void resize(int rows, uint32_t channelMask); // rows for readBlock(), only the masked channels
+  void append(const RollupRows& other); // adds other's rows after these, every channel
+};
+
+// the open bucket of one tier, channels side by side so a sample is one pass over each array
+struct RollupAccumulator
+{
+  int64_t startUs = INT64_MIN; // INT64_MIN while no bucket is open
+  int64_t count = 0;
+  int64_t sum[NUM_CHANNELS];
+  double sumSquares[NUM_CHANNELS];
+  int32_t min[NUM_CHANNELS];
+  int32_t max[NUM_CHANNELS];
+  void reset(int64_t start); // empties the bucket starting at start
+};
+
+std::string rollupPrefix(int tier); // e.g. rollup-1h
+int64_t rollupFileStart(int tier, int64_t timestampUs); // start of the file period holding timestampUs
+bool parseTierList(const char* list, uint32_t& tierMask); // comma separated TIER_NAMES, "" for none
+bool writeRollupFile(const std::string& path, int64_t tierUs,
+  const RollupRows& rows); // creates a file holding rows as one block
+bool rollupRange(const std::string& directory, int tier, int64_t& startUs,
+  int64_t& endUs); // from the first row's start to the last row's end, false if none
+
+class RollupReader
+{
+  public:
+    RollupReader(); // constructor
+    ~RollupReader(); // closes the file
+    bool open(const char* path); // opens a rollup file and indexes its block headers
+    void close(); // closes the file
+    int64_t getTierUs(); // bucket width of every row
+    int getNumBlocks(); // number of complete blocks
+    const RollupBlockHeader& getBlockHeader(int block); // row count and bucket range of one block
+    bool readBlock(int block, uint32_t channelMask, RollupRows& rows); // starts, counts and the masked channels
+  private:
+    FILE* _file = NULL;
+    int64_t _tierUs = 0;
+    std::vector<RollupBlockHeader> _blocks;
+    std::vector<long> _offsets; // file offset of every block's first column
+};
+
+class RollupWriter
+{
+  public:
+    RollupWriter(); // constructor
+    ~RollupWriter(); // writes closed rows
+    bool open(const std::string& directory, uint32_t tierMask); // resumes where each tier stopped
+    void add(const TelemetrySample& sample); // adds one sample to the open 1 s bucket
+    bool flush(); // appends every closed row to its file
+    void close(); // appends closed rows; open buckets are rebuilt by the next open()
+    long getRowsWritten(); // rows appended since open()
+  private:
+    std::string _directory;
+    uint32_t _tierMask = 0; // 1 << RollupTiers for every tier written to disk
+    RollupAccumulator _open[NUM_TIERS];
+    RollupRows _closed[NUM_TIERS]; // rows waiting for flush()
+    int64_t _resumeUs[NUM_TIERS]; // rows starting before this are already on disk
+    long _rowsWritten = 0;
+    void closeBucket(int tier); // emits the open bucket and folds it into the next tier
+    bool replay(int64_t fromUs); // adds raw samples at or after fromUs
+    bool writeRows(int tier, int first, int last, int64_t fileStartUs); // appends one block
+};
+
+#endif
@@ -0,0 +1,125 @@
+/*
+  TelemetryStore.cpp - On-disk layout of archived telemetry for one device
+  Released into the public domain.
+*/
+
+#include "TelemetryStore.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// creates a directory and its parents, like mkdir -p
+bool makeDirectories(const std::string& path) {
+  for (size_t slash = 1; slash <= path.size(); slash++) {
+    if (slash < path.size() && path[slash] != '/')
+      continue;
+    std::string partial = path.substr(0, slash);
+    if (mkdir(partial.c_str(), 0755) != 0 && errno != EEXIST)
+      return false;
+  }
+  return true;
+}
+
+// segment file name for the UTC day holding timestampUs, e.g. raw-20250423.atv
+std::string segmentFileName(const char* prefix, int64_t timestampUs) {
+  time_t seconds = (time_t)(timestampUs/1000000);
+  struct tm fields;
+  gmtime_r(&seconds, &fields);
+  char name[64];
+  snprintf(name, sizeof(name), "%s-%04d%02d%02d.atv", prefix, fields.tm_year + 1900,
+    fields.tm_mon + 1, fields.tm_mday);
+  return name;
+}
+
+// start of the UTC day named by a segment file, false if the name holds no date
+bool segmentStartTime(const std::string& path, int64_t& startUs) {
+  size_t dash = path.rfind('-');
+  if (dash == std::string::npos || path.size() < dash + 13 || path.compare(dash + 9, 4, ".atv") != 0)
+    return false;
+  struct tm fields;
+  memset(&fields, 0, sizeof(fields));
+  if (sscanf(path.c_str() + dash + 1, "%4d%2d%2d", &fields.tm_year, &fields.tm_mon, &fields.tm_mday) != 3)
+    return false;
+  fields.tm_year -= 1900;
+  fields.tm_mon -= 1;
+  startUs = (int64_t)timegm(&fields)*1000000;
+  return true;
+}
+
+// sorted paths of <prefix>-*.atv files in a directory (names sort by date)
+bool listSegments(const std::string& directory, const char* prefix, std::vector<std::string>& paths) {
+  paths.clear();
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+    return false;
+  size_t prefixLength = strlen(prefix);
+  while (struct dirent* entry = readdir(dir)) {
+    const char* name = entry->d_name;
+    size_t length = strlen(name);
+    if (length > prefixLength + 5 && strncmp(name, prefix, prefixLength) == 0
+      && name[prefixLength] == '-' && strcmp(name + length - 4, ".atv") == 0)
+      paths.push_back(directory + "/" + name);
+  }
+  closedir(dir);
+  std::sort(paths.begin(), paths.end());
+  return true;
+}
+
+TelemetryStore::TelemetryStore() {
+}
+
+TelemetryStore::~TelemetryStore() {
+  close();
+}
+
+// creates <root>/<device> if needed and brings the rollup tiers up to date with the raw
+// segments; segments are opened lazily by append()
+bool TelemetryStore::open(const char* root, const char* device, uint32_t rollupTiers) {
+  close();
+  _directory = std::string(root) + "/" + device;
+  return makeDirectories(_directory) && _rollups.open(_directory, rollupTiers);
+}
+
+// appends to the segment for the sample's UTC day, rolling over at midnight
+bool TelemetryStore::append(const TelemetrySample& sample) {
+  int64_t day = sample.timestampUs/STORE_SEGMENT_US;
+  if (day != _segmentDay || !_writer.isOpen()) {
+    _writer.close();
+    std::string path = _directory + "/" + segmentFileName("raw", sample.timestampUs);
+    if (!_writer.open(path.c_str()))
+      return false;
+    _segmentDay = day;
+  }
+  if (!_writer.append(sample))
+    return false;
+  _rollups.add(sample);
+  return true;
+}
+
+// writes buffered samples as a (short) block so they survive a power cut
+bool TelemetryStore::flush() {
+  bool ok = !_writer.isOpen() || _writer.flush();
+  return _rollups.flush() && ok;
+}
+
+// flushes and closes the current segment
+void TelemetryStore::close() {
+  _writer.close();
+  _rollups.close();
+  _segmentDay = -1;
+}
+
+// <root>/<device>
+const std::string& TelemetryStore::getDirectory() {
+  return _directory;
+}
+
+// bytes appended to the current segment since it was opened
+long TelemetryStore::getBytesWritten() {
+  return _writer.getBytesWritten();
+}
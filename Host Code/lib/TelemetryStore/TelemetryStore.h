@@ -0,0 +1,49 @@
+/*
+  TelemetryStore.h - On-disk layout of archived telemetry for one device
+  Released into the public domain.
+
+  <root>/<device>/raw-YYYYMMDD.atv, one TelemetryArchive segment per UTC day.
+  Day-sized segments keep every file small enough to rewrite and let old data
+  be dropped a whole file at a time. The rollup tiers (TelemetryRollup.h) are
+  kept up to date by append() and live in the same directory.
+*/
+
+#ifndef TelemetryStore_h
+#define TelemetryStore_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Telemetry.h"
+#include "TelemetryArchive.h"
+#include "TelemetryRollup.h"
+
+const int64_t STORE_SEGMENT_US = 86400LL*1000000; // one raw segment per UTC day
+
+bool makeDirectories(const std::string& path); // mkdir -p
+std::string segmentFileName(const char* prefix, int64_t timestampUs); // e.g. raw-20250423.atv
+bool segmentStartTime(const std::string& path, int64_t& startUs); // UTC midnight of a segment's day
+bool listSegments(const std::string& directory, const char* prefix,
+  std::vector<std::string>& paths); // sorted paths of <prefix>-*.atv files
+
+class TelemetryStore
+{
+  public:
+    TelemetryStore(); // constructor
+    ~TelemetryStore(); // flushes and closes
+    bool open(const char* root, const char* device,
+      uint32_t rollupTiers = DEFAULT_TIERS); // creates <root>/<device> if needed and resumes the rollups
+    bool append(const TelemetrySample& sample); // appends to the segment for the sample's day and the rollups
+    bool flush(); // writes buffered samples as a (short) block, and closed rollup rows
+    void close(); // flushes and closes the current segment
+    const std::string& getDirectory(); // <root>/<device>
+    long getBytesWritten(); // bytes appended to the current segment since it was opened
+  private:
+    std::string _directory;
+    ArchiveWriter _writer;
+    RollupWriter _rollups;
+    int64_t _segmentDay = -1; // UTC day number of the open segment
+};
+
+#endif
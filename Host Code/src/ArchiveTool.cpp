@@ -0,0 +1,179 @@
+/*
+  ArchiveTool.cpp - Command line tool for AtverterH telemetry archives
+  Released into the public domain.
+
+  usage:
+    atv-archive import <data.json> <archive.atv>  append data.json records to an archive
+    atv-archive export <archive.atv>              print an archive in data.json form
+    atv-archive info <archive.atv>                print the block index and compression ratio
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Telemetry.h"
+#include "TelemetryArchive.h"
+
+// reads a whole file into memory
+static bool readFile(const char* path, std::string& contents) {
+  FILE* file = fopen(path, "rb");
+  if (!file)
+    return false;
+  char buffer[65536];
+  size_t got;
+  while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    contents.append(buffer, got);
+  fclose(file);
+  return true;
+}
+
+// reads one JSON string or bare number starting at p, returns the position after it
+static const char* readJsonToken(const char* p, std::string& token) {
+  token.clear();
+  if (*p == '"') {
+    for (p++; *p && *p != '"'; p++) {
+      if (*p == '\\' && p[1])
+        p++;
+      token += *p;
+    }
+    return *p ? p + 1 : p;
+  }
+  while (*p && *p != ',' && *p != '}' && *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t')
+    token += *p++;
+  return p;
+}
+
+// imports the flat array of flat objects written by UART.py; incomplete records are skipped
+// like UART.py does, and the power channels it dropped are recomputed
+static int importJson(const char* jsonPath, const char* archivePath) {
+  std::string json;
+  if (!readFile(jsonPath, json)) {
+    fprintf(stderr, "cannot read %s\n", jsonPath);
+    return 1;
+  }
+  ArchiveWriter writer;
+  if (!writer.open(archivePath)) {
+    fprintf(stderr, "cannot open %s\n", archivePath);
+    return 1;
+  }
+  long imported = 0;
+  long skipped = 0;
+  std::string key;
+  std::string value;
+  const char* p = json.c_str();
+  while ((p = strchr(p, '{')) != NULL) {
+    TelemetrySample sample;
+    memset(&sample, 0, sizeof(sample));
+    bool hasTimestamp = false;
+    unsigned int present = 0;
+    for (p++; *p && *p != '}';) {
+      if (*p != '"') {
+        p++;
+        continue;
+      }
+      p = readJsonToken(p, key);
+      while (*p == ' ' || *p == ':')
+        p++;
+      p = readJsonToken(p, value);
+      if (key == "timestamp") {
+        hasTimestamp = parseIsoTimestamp(value.c_str(), sample.timestampUs);
+      } else {
+        int channel = channelIndex(key.c_str());
+        if (channel >= 0) {
+          sample.values[channel] = atoi(value.c_str());
+          present |= 1u << channel;
+        }
+      }
+    }
+    if (hasTimestamp && (present & REQUIRED_CHANNELS) == REQUIRED_CHANNELS) {
+      if (!(present & ((1u << LOW_SIDE_POWER) | (1u << HIGH_SIDE_POWER))))
+        fillDerivedPower(sample);
+      writer.append(sample);
+      imported++;
+    } else {
+      skipped++;
+    }
+  }
+  writer.close();
+  printf("imported %ld records, skipped %ld incomplete\n", imported, skipped);
+  return 0;
+}
+
+// prints an archive in the same form as data.json, with every channel
+static int exportJson(const char* archivePath) {
+  ArchiveReader reader;
+  if (!reader.open(archivePath)) {
+    fprintf(stderr, "cannot open %s\n", archivePath);
+    return 1;
+  }
+  std::vector<int64_t> timestamps;
+  std::vector<int32_t> columnData[NUM_CHANNELS];
+  int32_t* columns[NUM_CHANNELS];
+  char time[40];
+  bool first = true;
+  printf("[");
+  for (int b = 0; b < reader.getNumBlocks(); b++) {
+    int count = reader.getBlockInfo(b).numSamples;
+    timestamps.resize(count);
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+      columnData[c].resize(count);
+      columns[c] = columnData[c].data();
+    }
+    if (!reader.readBlock(b, timestamps.data(), columns)) {
+      fprintf(stderr, "block %d is corrupt\n", b);
+      return 1;
+    }
+    for (int n = 0; n < count; n++) {
+      formatIsoTimestamp(timestamps[n], time, sizeof(time));
+      printf("%s\n    {\n        \"timestamp\": \"%s\"", first ? "" : ",", time);
+      for (int c = 0; c < NUM_CHANNELS; c++)
+        printf(",\n        \"%s\": \"%d\"", CHANNEL_NAMES[c], (int)columns[c][n]);
+      printf("\n    }");
+      first = false;
+    }
+  }
+  printf("\n]\n");
+  return 0;
+}
+
+// prints the block index and the achieved compression
+static int printInfo(const char* archivePath) {
+  ArchiveReader reader;
+  if (!reader.open(archivePath)) {
+    fprintf(stderr, "cannot open %s\n", archivePath);
+    return 1;
+  }
+  char start[40];
+  char end[40];
+  long payloadBytes = 0;
+  printf("%d channels, %d blocks, %ld samples\n", reader.getNumChannels(), reader.getNumBlocks(),
+    reader.getNumSamples());
+  for (int b = 0; b < reader.getNumBlocks(); b++) {
+    const ArchiveBlockInfo& info = reader.getBlockInfo(b);
+    formatIsoTimestamp(info.timestampMin, start, sizeof(start));
+    formatIsoTimestamp(info.timestampMax, end, sizeof(end));
+    printf("block %d: %u samples, %u bytes, %s .. %s\n", b, info.numSamples, info.payloadBytes,
+      start, end);
+    payloadBytes += info.payloadBytes;
+  }
+  if (reader.getNumSamples() > 0)
+    printf("%.3f bytes/sample/channel (timestamps included)\n",
+      (double)payloadBytes/reader.getNumSamples()/reader.getNumChannels());
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc == 4 && strcmp(argv[1], "import") == 0)
+    return importJson(argv[2], argv[3]);
+  if (argc == 3 && strcmp(argv[1], "export") == 0)
+    return exportJson(argv[2]);
+  if (argc == 3 && strcmp(argv[1], "info") == 0)
+    return printInfo(argv[2]);
+  fprintf(stderr, "usage: %s import <data.json> <archive.atv>\n"
+    "       %s export <archive.atv>\n"
+    "       %s info <archive.atv>\n", argv[0], argv[0], argv[0]);
+  return 2;
+}
@@ -0,0 +1,738 @@
+/*
+  AtverterDaemon.cpp - Host service for one or more AtverterH MPPT controllers
+  Released into the public domain.
+
+  Reads transmitData() records from each converter's UART, archives them
+  (TelemetryStore), keeps a short data.json for the web interface, runs the
+  anomaly detectors, and serves Prometheus metrics at /metrics, live alerts at
+  /alerts and aggregate queries over the archive at /query. The latest record
+  of every device is also published in shared memory (SharedTelemetry.h). A
+  low priority thread applies the retention policy and compacts old files. Everything runs in
+  one poll() loop; only /query fans out to worker threads while it runs.
+
+  Records from firmware that prints its control tick are timestamped from the
+  tick, through a clock fit kept up by an "RTCK:" exchange every few seconds
+  (ClockSync.h); until the fit locks, and for older firmware, a record gets
+  the host time its line arrived. With --deadband-heartbeat the converter is
+  switched to its deadband mode, and the records it skips are filled back in
+  (TelemetryDelta.h), so everything downstream still sees one record a second.
+
+  usage: atverterd [options]
+    --device NAME=PATH[@BAUD]  serial port of a converter, repeatable
+                               (default: atverter=/dev/ttyUSB0@38400)
+    --archive DIR              archive root, records go to DIR/NAME/ (default: /var/lib/atverter)
+    --json PATH                data.json for the web interface, first device only
+                               (default: /var/www/html/data.json, "" to disable)
+    --json-records N           records kept in data.json (default: 120, what index.html plots)
+    --listen PORT              HTTP port for /metrics (default: 9110, 0 to disable)
+    --flush-seconds S          write partial archive blocks every S seconds (default: 600)
+    --detectors LIST           comma separated anomaly detectors (default: duty,stuck,efficiency,shutdown,
+                               "" to disable)
+    --rollups LIST             rollup tiers kept next to the archive, any of 1s,1m,15m,1h,1d
+                               (default: 1m,15m,1h,1d, "" to disable)
+    --retention LIST           how long each kind of file is kept, e.g. raw=30d,1m=2y
+                               (default: raw=7d,1s=2d,1m=1y,15m=5y,1h=forever,1d=forever)
+    --compact-rate KBPS        disk budget of retention and compaction (default: 1024, 0 unlimited)
+    --shm NAME                 shared memory segment for the latest records (default: /atverter,
+                               "" to disable)
+    --tick-us US               firmware control period, INTERRUPT_TIME (default: 1000, 0 disables
+                               clock sync)
+    --deadband-heartbeat N     switch converters to deadband telemetry with a keyframe every N
+                               records (default: 0, leave the telemetry mode alone)
+*/
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AnomalyDetectors.h"
+#include "ClockSync.h"
+#include "HttpServer.h"
+#include "Metrics.h"
+#include "SerialPort.h"
+#include "SharedTelemetry.h"
+#include "StoreMaintenance.h"
+#include "Telemetry.h"
+#include "TelemetryDelta.h"
+#include "TelemetryQuery.h"
+#include "TelemetryStore.h"
+
+const int64_t ENERGY_GAP_MAX_US = 10LL*1000000; // longer gaps between records are not integrated
+const int REOPEN_INTERVAL_S = 5; // retry period for unplugged serial adapters
+const int POLL_FDS_MAX = 64;
+const int RECENT_ALERTS_MAX = 100; // alerts kept for /alerts
+
+// serial-to-store latency buckets, seconds
+const double LATENCY_BOUNDS[] = {0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+  0.025, 0.05, 0.1};
+
+// sides of the converter as used in metric labels
+enum ConverterSide
+{   LOW_SIDE = 0,
+    HIGH_SIDE,
+    NUM_SIDES
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int signal) {
+  (void)signal;
+  stopRequested = 1;
+}
+
+static int64_t wallClockUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static double steadySeconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class AtverterDaemon;
+struct Device;
+
+// forwards a device's alerts to the daemon
+class DeviceAlertSink : public AlertSink
+{
+  public:
+    AtverterDaemon* daemon = NULL;
+    Device* device = NULL;
+    void publishAlert(const Alert& alert) override;
+};
+
+// everything the daemon tracks for one converter
+struct Device
+{
+  std::string name;
+  std::string path;
+  int baud = SERIAL_DEFAULT_BAUD;
+  bool isFile = false; // capture files are read once, never reopened
+  bool finished = false;
+  double nextOpenTime = 0.0;
+  SerialPort port;
+  TelemetryStore store;
+  // pipeline state
+  bool inShutdown = false;
+  int64_t lastTimestampUs = 0;
+  int32_t lastPower[NUM_SIDES] = {0, 0};
+  long lastOverflows = 0;
+  AnomalyPipeline anomalies;
+  DeviceAlertSink alertSink;
+  int sharedSlot = -1; // slot in the shared memory segment
+  ClockSync clock; // device ticks to host time
+  TelemetryDeltaDecoder deltas; // fills in the records of the deadband mode
+  double nextModeTime = 0.0; // when the deadband mode commands may be sent again
+  // metric slots
+  int voltage[NUM_SIDES];
+  int current[NUM_SIDES];
+  int power[NUM_SIDES];
+  int energy[NUM_SIDES];
+  int duty;
+  int temperature[2];
+  int records;
+  int droppedFrames;
+  int parseErrors;
+  int unrecognizedLines;
+  int isrOverruns;
+  int lastRecordTime;
+  int storeBytes;
+  int latency;
+  int clockLocked;
+  int clockDrift;
+  int clockResidual;
+  int deltaGaps;
+  int filledRecords;
+  std::map<int, int> shutdownEvents; // shutdown code -> counter slot
+  int alerts[NUM_ALERTKINDS];
+  int alertsActive[NUM_ALERTKINDS];
+};
+
+// last few records in the exact layout UART.py used, rewritten atomically after each record
+class RecentJson
+{
+  public:
+    void configure(const std::string& path, int maxRecords) {
+      _path = path;
+      _maxRecords = maxRecords;
+    }
+    bool isEnabled() {
+      return !_path.empty() && _maxRecords > 0;
+    }
+    void add(const TelemetrySample& sample) {
+      char time[40];
+      formatIsoTimestamp(sample.timestampUs, time, sizeof(time));
+      std::string entry = std::string("    {\n        \"timestamp\": \"") + time + "\"";
+      for (int c = 0; c < NUM_CHANNELS; c++) {
+        char field[64];
+        snprintf(field, sizeof(field), ",\n        \"%s\": \"%d\"", CHANNEL_NAMES[c], (int)sample.values[c]);
+        entry += field;
+      }
+      entry += "\n    }";
+      _entries.push_back(entry);
+      while ((int)_entries.size() > _maxRecords)
+        _entries.pop_front();
+      write();
+    }
+  private:
+    std::string _path;
+    int _maxRecords = 0;
+    std::deque<std::string> _entries;
+    void write() {
+      std::string temporary = _path + ".tmp";
+      FILE* file = fopen(temporary.c_str(), "w");
+      if (!file)
+        return;
+      fputs("[\n", file);
+      for (size_t n = 0; n < _entries.size(); n++) {
+        fputs(_entries[n].c_str(), file);
+        fputs(n + 1 < _entries.size() ? ",\n" : "\n", file);
+      }
+      fputs("]", file);
+      fclose(file);
+      rename(temporary.c_str(), _path.c_str()); // readers never see a half written file
+    }
+};
+
+class AtverterDaemon : public HttpServer
+{
+  public:
+    std::vector<std::unique_ptr<Device> > devices;
+    std::string archiveRoot = "/var/lib/atverter";
+    RecentJson recentJson;
+    int flushSeconds = 600;
+    std::string detectors = "duty,stuck,efficiency,shutdown";
+    std::string sharedName = SHARED_TELEMETRY_NAME;
+    uint32_t rollupTiers = DEFAULT_TIERS;
+    RetentionPolicy retention;
+    long compactBytesPerSecond = MAINTENANCE_DEFAULT_BYTES_PER_SECOND;
+    double tickUs = CLOCK_SYNC_DEFAULT_TICK_US;
+    int deadbandHeartbeat = 0;
+
+    // registers every metric family and the series of every device
+    void setupMetrics() {
+      int voltageFamily = _metrics.addFamily("atverter_voltage_volts", "Averaged terminal voltage.", METRIC_GAUGE);
+      int currentFamily = _metrics.addFamily("atverter_current_amperes", "Averaged terminal current.", METRIC_GAUGE);
+      int powerFamily = _metrics.addFamily("atverter_power_watts", "Terminal power as reported by the firmware.", METRIC_GAUGE);
+      int dutyFamily = _metrics.addFamily("atverter_duty_cycle_ratio", "PWM duty cycle referenced to side 1.", METRIC_GAUGE);
+      int temperatureFamily = _metrics.addFamily("atverter_temperature_celsius", "Switch thermistor temperature.", METRIC_GAUGE);
+      int energyFamily = _metrics.addFamily("atverter_energy_joules_total", "Energy through each terminal, integrated from power.", METRIC_COUNTER);
+      int recordsFamily = _metrics.addFamily("atverter_records_total", "Complete telemetry records received.", METRIC_COUNTER);
+      _shutdownFamily = _metrics.addFamily("atverter_shutdown_events_total", "Gate shutdowns by shutdown code.", METRIC_COUNTER);
+      int droppedFamily = _metrics.addFamily("atverter_dropped_frames_total", "Telemetry lines that were cut short or overflowed.", METRIC_COUNTER);
+      int parseFamily = _metrics.addFamily("atverter_parse_errors_total", "Telemetry lines with non-numeric field values.", METRIC_COUNTER);
+      int unknownFamily = _metrics.addFamily("atverter_unrecognized_lines_total", "UART lines that are not telemetry (responses, debug output).", METRIC_COUNTER);
+      int overrunFamily = _metrics.addFamily("atverter_isr_overruns_total", "Control ISR overruns reported by the firmware.", METRIC_COUNTER);
+      int lastFamily = _metrics.addFamily("atverter_last_record_timestamp_seconds", "Host time of the last complete record.", METRIC_GAUGE);
+      int latencyFamily = _metrics.addFamily("atverter_serial_to_store_latency_seconds", "Time from a line arriving to the record being stored.", METRIC_HISTOGRAM);
+      int alertsFamily = _metrics.addFamily("atverter_alerts_total", "Anomaly alerts raised, by kind.", METRIC_COUNTER);
+      int activeFamily = _metrics.addFamily("atverter_alert_active", "1 while an anomaly alert is raised.", METRIC_GAUGE);
+      int storeFamily = _metrics.addFamily("atverter_store_bytes", "Disk used by the archive and rollups after the last maintenance pass.", METRIC_GAUGE);
+      int deletedFamily = _metrics.addFamily("atverter_store_files_deleted_total", "Files removed by the retention policy.", METRIC_COUNTER);
+      int compactedFamily = _metrics.addFamily("atverter_store_files_compacted_total", "Files rewritten by compaction.", METRIC_COUNTER);
+      int lockedFamily = _metrics.addFamily("atverter_clock_synced", "1 while records are timestamped from the device's tick counter.", METRIC_GAUGE);
+      int driftFamily = _metrics.addFamily("atverter_clock_drift_ppm", "How much longer a device tick is than nominal.", METRIC_GAUGE);
+      int residualFamily = _metrics.addFamily("atverter_clock_residual_seconds", "RMS distance of the clock sync exchanges from the fit.", METRIC_GAUGE);
+      int gapsFamily = _metrics.addFamily("atverter_telemetry_gaps_total", "Deadband mode lines found missing by their sequence number.", METRIC_COUNTER);
+      int filledFamily = _metrics.addFamily("atverter_records_filled_total", "Records the deadband mode skipped, filled in with held values.", METRIC_COUNTER);
+      _filesDeleted = _metrics.addSeries(deletedFamily, "");
+      _filesCompacted = _metrics.addSeries(compactedFamily, "");
+      const char* sideNames[NUM_SIDES] = {"low", "high"};
+      char labels[160];
+      for (auto& device : devices) {
+        Device& d = *device;
+        for (int side = 0; side < NUM_SIDES; side++) {
+          snprintf(labels, sizeof(labels), "device=\"%s\",side=\"%s\"", d.name.c_str(), sideNames[side]);
+          d.voltage[side] = _metrics.addSeries(voltageFamily, labels);
+          d.current[side] = _metrics.addSeries(currentFamily, labels);
+          d.power[side] = _metrics.addSeries(powerFamily, labels);
+          d.energy[side] = _metrics.addSeries(energyFamily, labels);
+        }
+        for (int sensor = 0; sensor < 2; sensor++) {
+          snprintf(labels, sizeof(labels), "device=\"%s\",sensor=\"%d\"", d.name.c_str(), sensor + 1);
+          d.temperature[sensor] = _metrics.addSeries(temperatureFamily, labels);
+        }
+        snprintf(labels, sizeof(labels), "device=\"%s\"", d.name.c_str());
+        d.duty = _metrics.addSeries(dutyFamily, labels);
+        d.records = _metrics.addSeries(recordsFamily, labels);
+        d.droppedFrames = _metrics.addSeries(droppedFamily, labels);
+        d.parseErrors = _metrics.addSeries(parseFamily, labels);
+        d.unrecognizedLines = _metrics.addSeries(unknownFamily, labels);
+        d.isrOverruns = _metrics.addSeries(overrunFamily, labels);
+        d.lastRecordTime = _metrics.addSeries(lastFamily, labels);
+        d.storeBytes = _metrics.addSeries(storeFamily, labels);
+        d.clockLocked = _metrics.addSeries(lockedFamily, labels);
+        d.clockDrift = _metrics.addSeries(driftFamily, labels);
+        d.clockResidual = _metrics.addSeries(residualFamily, labels);
+        d.deltaGaps = _metrics.addSeries(gapsFamily, labels);
+        d.filledRecords = _metrics.addSeries(filledFamily, labels);
+        d.latency = _metrics.addHistogram(latencyFamily, labels, LATENCY_BOUNDS,
+          sizeof(LATENCY_BOUNDS)/sizeof(LATENCY_BOUNDS[0]));
+        for (int code = 0; code <= 4; code++) // preset codes plus the firmware's overvoltage code 4
+          shutdownSlot(d, code);
+        for (int kind = 0; kind < NUM_ALERTKINDS; kind++) {
+          snprintf(labels, sizeof(labels), "device=\"%s\",kind=\"%s\"", d.name.c_str(), ALERT_NAMES[kind]);
+          d.alerts[kind] = _metrics.addSeries(alertsFamily, labels);
+          d.alertsActive[kind] = _metrics.addSeries(activeFamily, labels);
+        }
+      }
+    }
+
+    // builds each device's detector pipeline from the --detectors list
+    bool setupDetectors() {
+      for (auto& device : devices) {
+        device->alertSink.daemon = this;
+        device->alertSink.device = device.get();
+        std::string list = detectors;
+        size_t start = 0;
+        while (start < list.size()) {
+          size_t comma = list.find(',', start);
+          std::string name = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+          if (!name.empty() && !device->anomalies.addDetectorByName(name.c_str())) {
+            fprintf(stderr, "unknown detector %s\n", name.c_str());
+            return false;
+          }
+          start = comma == std::string::npos ? list.size() : comma + 1;
+        }
+      }
+      return true;
+    }
+
+    // logs an alert, updates its metrics and keeps it for /alerts
+    void publishAlert(Device& d, const Alert& alert) {
+      char time[40];
+      formatIsoTimestamp(alert.timestampUs, time, sizeof(time));
+      fprintf(stderr, "%s %s: %s %s: %s\n", time, d.name.c_str(), alert.active ? "ALERT" : "clear",
+        ALERT_NAMES[alert.kind], alert.message);
+      if (alert.active)
+        _metrics.add(d.alerts[alert.kind], 1.0);
+      _metrics.set(d.alertsActive[alert.kind], alert.active ? 1.0 : 0.0);
+      std::string entry = std::string("{\"timestamp\": \"") + time + "\", \"device\": \"" + d.name
+        + "\", \"kind\": \"" + ALERT_NAMES[alert.kind] + "\", \"active\": " + (alert.active ? "true" : "false")
+        + ", \"message\": \"" + alert.message + "\"}";
+      _recentAlerts.push_back(entry);
+      while ((int)_recentAlerts.size() > RECENT_ALERTS_MAX)
+        _recentAlerts.pop_front();
+    }
+
+    // opens every archive and serial port; ports that fail are retried from the loop
+    bool start() {
+      if (!sharedName.empty()) {
+        if (_shared.open(sharedName.c_str(), (int)devices.size())) {
+          for (size_t n = 0; n < devices.size(); n++) {
+            devices[n]->sharedSlot = (int)n;
+            _shared.setDeviceName((int)n, devices[n]->name.c_str());
+          }
+        } else {
+          fprintf(stderr, "cannot create shared memory %s, continuing without it\n", sharedName.c_str());
+        }
+      }
+      for (auto& device : devices) {
+        if (!device->store.open(archiveRoot.c_str(), device->name.c_str(), rollupTiers)) {
+          fprintf(stderr, "cannot open archive %s/%s\n", archiveRoot.c_str(), device->name.c_str());
+          return false;
+        }
+        struct stat info;
+        device->isFile = stat(device->path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+        openPort(*device);
+        _maintenance.addDirectory(device->store.getDirectory());
+      }
+      _maintenance.setPolicy(retention);
+      _maintenance.setBytesPerSecond(compactBytesPerSecond);
+      _maintenance.start();
+      return true;
+    }
+
+    // the poll() loop: serial lines, HTTP clients and periodic archive flushes
+    void run() {
+      struct pollfd fds[POLL_FDS_MAX];
+      double nextFlush = steadySeconds() + flushSeconds;
+      while (!stopRequested) {
+        int count = 0;
+        std::vector<Device*> polled;
+        for (auto& device : devices) {
+          if (device->port.isOpen() && count < POLL_FDS_MAX) {
+            fds[count].fd = device->port.getFd();
+            fds[count].events = POLLIN;
+            fds[count].revents = 0;
+            polled.push_back(device.get());
+            count++;
+          }
+        }
+        int serialCount = count;
+        count += fillPollFds(fds + count, POLL_FDS_MAX - count);
+        poll(fds, count, 500);
+        for (int n = 0; n < serialCount; n++) {
+          if (fds[n].revents || polled[n]->isFile)
+            serviceDevice(*polled[n]);
+        }
+        processPollFds(fds + serialCount, count - serialCount);
+        double now = steadySeconds();
+        for (auto& device : devices) {
+          if (!device->port.isOpen() && !device->finished && now >= device->nextOpenTime)
+            openPort(*device);
+          if (device->deltas.isSynced()) // deadband mode: the UART is idle most of the time
+            syncClock(*device);
+        }
+        if (now >= nextFlush) {
+          for (auto& device : devices)
+            device->store.flush();
+          updateStoreMetrics();
+          nextFlush = now + flushSeconds;
+        }
+      }
+      _maintenance.stop();
+      for (auto& device : devices)
+        device->store.close();
+      _shared.close();
+    }
+
+    // GET /metrics returns the preformatted exposition buffer as-is
+    void handleRequest(const char* path, const char* query, HttpResponse& response) override {
+      if (strcmp(path, "/metrics") == 0) {
+        response.contentType = "text/plain; version=0.0.4; charset=utf-8";
+        response.body.assign(_metrics.getText(), _metrics.getTextLength());
+      } else if (strcmp(path, "/alerts") == 0) {
+        response.contentType = "application/json";
+        response.body = "[";
+        for (size_t n = 0; n < _recentAlerts.size(); n++)
+          response.body += (n ? ",\n " : "\n ") + _recentAlerts[n];
+        response.body += "\n]\n";
+      } else if (strcmp(path, "/query") == 0) {
+        answerQuery(query, response);
+      } else if (strcmp(path, "/") == 0) {
+        response.body = "atverterd\n  /metrics  Prometheus metrics\n  /alerts   recent anomaly alerts (JSON)\n"
+          "  /query    aggregates over archived records, e.g. /query?device=NAME&start=now-7d&bucket=1h"
+          "&channels=HighSidePower&agg=mean,max\n";
+      } else {
+        response.status = 404;
+        response.body = "not found\n";
+      }
+    }
+
+  private:
+    MetricsRegistry _metrics;
+    TelemetryQueryEngine _queryEngine;
+    SharedTelemetryWriter _shared;
+    StoreMaintenance _maintenance;
+    int _shutdownFamily;
+    int _filesDeleted;
+    int _filesCompacted;
+    std::deque<std::string> _recentAlerts; // newest last
+
+    // copies the maintenance thread's totals into the metrics, which only this thread touches
+    void updateStoreMetrics() {
+      MaintenanceStats stats = _maintenance.getStats();
+      for (size_t n = 0; n < devices.size() && n < stats.directoryBytes.size(); n++)
+        _metrics.set(devices[n]->storeBytes, (double)stats.directoryBytes[n]);
+      _metrics.set(_filesDeleted, (double)stats.filesDeleted);
+      _metrics.set(_filesCompacted, (double)stats.filesCompacted);
+    }
+
+    // /query?device=NAME&format=json|binary plus the keys parseQuery() reads; covers blocks
+    // already written to the archive, so the last --flush-seconds may be missing
+    void answerQuery(const char* queryString, HttpResponse& response) {
+      std::string name;
+      if (!getQueryParameter(queryString, "device", name))
+        name = devices[0]->name;
+      bool known = false;
+      for (auto& device : devices)
+        known = known || device->name == name;
+      TelemetryQuery query;
+      std::string error;
+      if (!known) {
+        response.status = 404;
+        response.body = "unknown device " + name + "\n";
+      } else if (!parseQuery(queryString, wallClockUs(), query, error)) {
+        response.status = 400;
+        response.body = error + "\n";
+      } else {
+        AggregateBuckets result;
+        QueryStats stats;
+        if (!_queryEngine.run(archiveRoot + "/" + name, query, result, stats, error)) {
+          response.status = 404;
+          response.body = error + "\n";
+          return;
+        }
+        std::string format;
+        if (getQueryParameter(queryString, "format", format) && format == "binary") {
+          response.contentType = "application/octet-stream";
+          formatQueryBinary(query, result, response.body);
+        } else {
+          response.contentType = "application/json";
+          formatQueryJson(query, result, stats, response.body);
+        }
+      }
+    }
+
+    // counter slot for a shutdown code, created the first time the code is seen
+    int shutdownSlot(Device& d, int code) {
+      auto found = d.shutdownEvents.find(code);
+      if (found != d.shutdownEvents.end())
+        return found->second;
+      char labels[160];
+      snprintf(labels, sizeof(labels), "device=\"%s\",code=\"%d\"", d.name.c_str(), code);
+      int slot = _metrics.addSeries(_shutdownFamily, labels);
+      d.shutdownEvents[code] = slot;
+      return slot;
+    }
+
+    void openPort(Device& d) {
+      if (!d.port.open(d.path.c_str(), d.baud)) {
+        fprintf(stderr, "%s: cannot open %s, retrying in %d s\n", d.name.c_str(), d.path.c_str(), REOPEN_INTERVAL_S);
+        d.nextOpenTime = steadySeconds() + REOPEN_INTERVAL_S;
+      }
+      d.clock.reset(); // the board may have been reset along with the adapter
+      d.clock.setBaud(d.baud);
+      d.clock.setTickPeriod(tickUs);
+      d.deltas.reset();
+      d.nextModeTime = 0.0;
+    }
+
+    // asks a converter that sends every record for the deadband mode; repeated while full
+    // records keep coming, since the board may still be booting after the port opened
+    void requestDeadbandMode(Device& d) {
+      if (deadbandHeartbeat <= 0 || d.isFile || steadySeconds() < d.nextModeTime)
+        return;
+      char command[16]; // PicroBoard COMMBUFFERSIZE
+      snprintf(command, sizeof(command), "WHBT:%d\n", deadbandHeartbeat);
+      d.port.write(command, strlen(command));
+      d.port.write("WTXM:1\n", 7);
+      d.nextModeTime = steadySeconds() + REOPEN_INTERVAL_S;
+    }
+
+    // starts a clock sync exchange when one is due, called right after a record arrived so the
+    // answer does not queue behind the next one; capture files cannot answer
+    void syncClock(Device& d) {
+      if (tickUs <= 0.0 || d.isFile || !d.port.isOpen())
+        return;
+      if (d.clock.isDue(steadySeconds()*1e6) && d.port.write("RTCK:\n", 6))
+        d.clock.beginExchange(steadySeconds()*1e6);
+    }
+
+    // reads whatever arrived and processes every complete line
+    void serviceDevice(Device& d) {
+      int got = d.port.readAvailable();
+      std::string line;
+      while (d.port.nextLine(line))
+        processLine(d, line);
+      if (d.port.getOverflows() != d.lastOverflows) {
+        _metrics.add(d.droppedFrames, (double)(d.port.getOverflows() - d.lastOverflows));
+        d.lastOverflows = d.port.getOverflows();
+      }
+      if (got < 0) { // unplugged adapter or end of a capture file
+        d.port.close();
+        d.finished = d.isFile;
+        d.nextOpenTime = steadySeconds() + REOPEN_INTERVAL_S;
+      }
+    }
+
+    // parses one line and updates the archive, data.json and metrics
+    void processLine(Device& d, std::string& text) {
+      double arrival = steadySeconds();
+      int64_t timestampUs = wallClockUs();
+      int64_t wallMinusSteadyUs = timestampUs - (int64_t)(arrival*1e6);
+      TelemetryLine parsed;
+      int type = parseTelemetryLine(&text[0], parsed);
+      if (parsed.badValues > 0)
+        _metrics.add(d.parseErrors, 1.0);
+      if (parsed.isrOverruns >= 0)
+        _metrics.set(d.isrOverruns, (double)parsed.isrOverruns);
+      switch (type) {
+        case LINE_RECORD:
+        case LINE_DELTA_RECORD:
+          storeRecords(d, parsed, timestampUs, wallMinusSteadyUs);
+          _metrics.observe(d.latency, steadySeconds() - arrival);
+          if (parsed.ticks >= 0)
+            syncClock(d);
+          if (type == LINE_RECORD && parsed.sequence < 0)
+            requestDeadbandMode(d);
+          break;
+        case LINE_PARTIAL_RECORD:
+          _metrics.add(d.droppedFrames, 1.0);
+          break;
+        case LINE_SHUTDOWN_CODE:
+          // the firmware repeats the code every control tick while latched, count the transition only
+          if (!d.inShutdown) {
+            d.deltas.breakSeries(); // the records stop until the latch clears, do not fill the gap
+            _metrics.add(shutdownSlot(d, parsed.shutdownCode), 1.0);
+            d.anomalies.onShutdown(timestampUs, parsed.shutdownCode, d.alertSink);
+            _shared.publishShutdown(d.sharedSlot, parsed.shutdownCode);
+          }
+          d.inShutdown = true;
+          break;
+        case LINE_UNKNOWN:
+          _metrics.add(d.unrecognizedLines, 1.0);
+          break;
+        case LINE_TICK_ANSWER:
+          if (d.clock.completeExchange((uint32_t)parsed.ticks, arrival*1e6)) {
+            _metrics.set(d.clockLocked, d.clock.isLocked() ? 1.0 : 0.0);
+            _metrics.set(d.clockDrift, d.clock.getDriftPpm());
+            _metrics.set(d.clockResidual, d.clock.getResidualUs()/1e6);
+          }
+          break;
+        default:
+          break;
+      }
+    }
+
+    // rebuilds the records a record line stands for and stores each with its own timestamp:
+    // from its tick when the clock fit is locked, else back from the line's arrival
+    void storeRecords(Device& d, const TelemetryLine& parsed, int64_t arrivalUs, int64_t wallMinusSteadyUs) {
+      std::vector<TelemetryLine> records;
+      bool wasSynced = d.deltas.isSynced();
+      long filled = d.deltas.getFilled();
+      if (!d.deltas.decode(parsed, records)) {
+        _metrics.set(d.deltaGaps, (double)d.deltas.getGaps());
+        if (wasSynced && !d.isFile) // a line was lost, get a keyframe instead of waiting for the heartbeat
+          d.port.write("WKEY:1\n", 7);
+        return;
+      }
+      _metrics.set(d.deltaGaps, (double)d.deltas.getGaps());
+      _metrics.add(d.filledRecords, (double)(d.deltas.getFilled() - filled));
+      for (TelemetryLine& record : records) {
+        record.sample.timestampUs = arrivalUs;
+        if (record.ticks >= 0 && d.clock.isLocked()) // when the values were sampled, not when they arrived
+          record.sample.timestampUs = (int64_t)d.clock.toHostUs((uint32_t)record.ticks) + wallMinusSteadyUs;
+        else if (record.ticks >= 0 && parsed.ticks >= 0)
+          record.sample.timestampUs -= (int64_t)((uint32_t)(parsed.ticks - record.ticks)*tickUs);
+        storeRecord(d, record);
+      }
+    }
+
+    void storeRecord(Device& d, const TelemetryLine& parsed) {
+      const TelemetrySample& sample = parsed.sample;
+      d.store.append(sample);
+      if (recentJson.isEnabled() && &d == devices[0].get())
+        recentJson.add(sample);
+      d.inShutdown = false;
+      const int voltageChannel[NUM_SIDES] = {LOW_SIDE_VOLTAGE, HIGH_SIDE_VOLTAGE};
+      const int currentChannel[NUM_SIDES] = {LOW_SIDE_CURRENT, HIGH_SIDE_CURRENT};
+      const int powerChannel[NUM_SIDES] = {LOW_SIDE_POWER, HIGH_SIDE_POWER};
+      int64_t elapsedUs = sample.timestampUs - d.lastTimestampUs;
+      bool integrate = d.lastTimestampUs > 0 && elapsedUs > 0 && elapsedUs <= ENERGY_GAP_MAX_US;
+      for (int side = 0; side < NUM_SIDES; side++) {
+        int32_t power = sample.values[powerChannel[side]];
+        _metrics.set(d.voltage[side], sample.values[voltageChannel[side]]/1000.0);
+        _metrics.set(d.current[side], sample.values[currentChannel[side]]/1000.0);
+        _metrics.set(d.power[side], power/1000.0);
+        if (integrate) // trapezoid rule, mW*us -> J
+          _metrics.add(d.energy[side], (d.lastPower[side] + (double)power)/2.0*elapsedUs/1e9);
+        d.lastPower[side] = power;
+      }
+      d.lastTimestampUs = sample.timestampUs;
+      _metrics.set(d.duty, sample.values[DUTY_CYCLE]/100.0);
+      for (int sensor = 0; sensor < 2; sensor++) {
+        if (parsed.presentMask & (1u << (TEMPERATURE_1 + sensor)))
+          _metrics.set(d.temperature[sensor], sample.values[TEMPERATURE_1 + sensor]);
+      }
+      _metrics.add(d.records, 1.0);
+      _metrics.set(d.lastRecordTime, sample.timestampUs/1e6);
+      d.anomalies.onSample(sample, d.alertSink);
+      _shared.publish(d.sharedSlot, sample, parsed.presentMask);
+    }
+};
+
+void DeviceAlertSink::publishAlert(const Alert& alert) {
+  daemon->publishAlert(*device, alert);
+}
+
+// parses NAME=PATH[@BAUD]
+static bool parseDevice(const char* text, Device& device) {
+  const char* equals = strchr(text, '=');
+  if (!equals || equals == text)
+    return false;
+  device.name.assign(text, equals - text);
+  device.path = equals + 1;
+  size_t at = device.path.rfind('@');
+  if (at != std::string::npos) {
+    device.baud = atoi(device.path.c_str() + at + 1);
+    device.path.erase(at);
+  }
+  return !device.path.empty();
+}
+
+static void printUsage(const char* program) {
+  fprintf(stderr, "usage: %s [--device NAME=PATH[@BAUD]]... [--archive DIR] [--json PATH]\n"
+    "       [--json-records N] [--listen PORT] [--flush-seconds S] [--detectors LIST]\n"
+    "       [--rollups LIST] [--retention LIST] [--compact-rate KBPS] [--shm NAME] [--tick-us US]\n"
+    "       [--deadband-heartbeat N]\n", program);
+}
+
+int main(int argc, char** argv) {
+  AtverterDaemon daemon;
+  std::string jsonPath = "/var/www/html/data.json";
+  int jsonRecords = 120;
+  int port = 9110;
+  for (int n = 1; n < argc; n++) {
+    bool hasValue = n + 1 < argc;
+    if (strcmp(argv[n], "--device") == 0 && hasValue) {
+      std::unique_ptr<Device> device(new Device());
+      if (!parseDevice(argv[++n], *device)) {
+        printUsage(argv[0]);
+        return 2;
+      }
+      daemon.devices.push_back(std::move(device));
+    } else if (strcmp(argv[n], "--archive") == 0 && hasValue) {
+      daemon.archiveRoot = argv[++n];
+    } else if (strcmp(argv[n], "--json") == 0 && hasValue) {
+      jsonPath = argv[++n];
+    } else if (strcmp(argv[n], "--json-records") == 0 && hasValue) {
+      jsonRecords = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--listen") == 0 && hasValue) {
+      port = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--flush-seconds") == 0 && hasValue) {
+      daemon.flushSeconds = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--detectors") == 0 && hasValue) {
+      daemon.detectors = argv[++n];
+    } else if (strcmp(argv[n], "--rollups") == 0 && hasValue) {
+      if (!parseTierList(argv[++n], daemon.rollupTiers)) {
+        fprintf(stderr, "unknown rollup tier in %s\n", argv[n]);
+        return 2;
+      }
+    } else if (strcmp(argv[n], "--retention") == 0 && hasValue) {
+      if (!parseRetention(argv[++n], daemon.retention)) {
+        fprintf(stderr, "bad retention list %s\n", argv[n]);
+        return 2;
+      }
+    } else if (strcmp(argv[n], "--compact-rate") == 0 && hasValue) {
+      daemon.compactBytesPerSecond = atol(argv[++n])*1024;
+    } else if (strcmp(argv[n], "--shm") == 0 && hasValue) {
+      daemon.sharedName = argv[++n];
+    } else if (strcmp(argv[n], "--tick-us") == 0 && hasValue) {
+      daemon.tickUs = atof(argv[++n]);
+    } else if (strcmp(argv[n], "--deadband-heartbeat") == 0 && hasValue) {
+      daemon.deadbandHeartbeat = atoi(argv[++n]);
+    } else {
+      printUsage(argv[0]);
+      return 2;
+    }
+  }
+  if (daemon.devices.empty()) {
+    std::unique_ptr<Device> device(new Device());
+    parseDevice("atverter=/dev/ttyUSB0", *device);
+    daemon.devices.push_back(std::move(device));
+  }
+  daemon.recentJson.configure(jsonPath, jsonRecords);
+  signal(SIGINT, requestStop);
+  signal(SIGTERM, requestStop);
+  signal(SIGPIPE, SIG_IGN);
+  daemon.setupMetrics();
+  if (!daemon.setupDetectors() || !daemon.start())
+    return 1;
+  if (port > 0 && !daemon.listen(port)) {
+    fprintf(stderr, "cannot listen on port %d\n", port);
+    return 1;
+  }
+  daemon.run();
+  return 0;
+}
@@ -0,0 +1,728 @@
+/*
+  CompDesignTool.cpp - Designs AtverterH compensators from the buck stage and writes their coefficients
+  Released into the public domain.
+
+  usage: atv-compdesign [options]
+    --loop cv1|cv2      the panel (side 1) or the battery (side 2) voltage (default: cv1)
+    --type pi|pid|type3 compensator (default: pi)
+    --inductance H      (default: 47e-6)
+    --capacitance F     on the regulated side (default: 22e-6)
+    --esr OHM           of that capacitor (default: 0.05)
+    --vin V             side 1 at the operating point (default: 30 for cv1, 39 for cv2)
+    --vout V            side 2 at the operating point (default: 12.5)
+    --load OHM          cv1: the panel's dynamic resistance (default: PlantSim's
+                        module at --vin, 1000 W/m2); cv2: the battery's (default: 0.1)
+    --fsw HZ            switching frequency (default: 100000)
+    --fs HZ             control interrupt rate (default: 1000)
+    --crossover HZ      (default: fs/40)
+    --phase-margin DEG  (default: 60)
+    --step V            reference step of the checks (default: 2 for cv1, 0.5 for cv2)
+    --name NAME         prefix of the header's constants (default: CV1 or CV2)
+    --header FILE       writes the coefficients there rather than to stdout
+    --no-verify         skips the closed loop run on PlantSim
+
+  The plant is the averaged buck stage linearized at the operating point:
+  inductor current and capacitor voltage, with the capacitor's ESR and the
+  conduction losses. For cv1 the battery is stiff and the panel is a
+  resistance. For cv2 the input is stiff and the battery is a resistance:
+  the panel has to be well above its maximum power point, where more duty
+  cycle draws more power, or the loop has nothing to regulate with.
+  It is discretized exactly for the control period (zero-order hold: the
+  duty cycle holds from one interrupt to the next, and the ADC samples at
+  the end of the period). The loop then adds the 13x divider and the
+  10-bit ADC, AtverterH's moving average of the voltage
+  (SENSOR_V_WINDOW_MAX samples) and dutyRaw (1024 = 100 %).
+
+  The compensator is designed with the K factor method. It has an
+  integrator, and its zeros and poles are placed symmetrically about the
+  crossover frequency, so that the loop has the phase margin there:
+    pi     one zero                        up to 90 degrees of boost
+    pid    two zeros and one pole          up to 180 degrees
+    type3  two zeros and two poles         up to 180 degrees, rolls off above
+  It is discretized with the bilinear transform, prewarped at the
+  crossover, and split into biquads with the integrator in the last
+  section, as AtverterH::setComp() wants them. The tool picks the smallest
+  post shift that fits the Q15 coefficients and keeps the integrator's pole
+  exactly at 1 through the rounding. The loop is then checked with the
+  quantized coefficients: crossover, phase and gain margin, and the
+  step response of the linear model.
+
+  Finally the quantized compensator runs on AtverterH's own compensator
+  code against PlantSim's averaged model, with its inductance, capacitance
+  and switching frequency set to the options. The run uses whole % duty
+  cycles and the real panel and battery, but no ESR. The loop starts where
+  the plant is, then the reference steps up and back down, and the tool
+  prints the rise time, overshoot and settling time of each step next to
+  the prediction, and the ripple left at its end: a limit cycle between
+  whole % duty cycles shows there. The header goes after AtverterH.h and holds
+  NAME_SECTIONS, NAME_POST_SHIFT and NAME_COMP, for
+  setComp(NAME_COMP, NAME_SECTIONS, NAME_POST_SHIFT). Use NAME_ERROR_SIGN
+  to form the compensator's input from the ADC readings:
+  NAME_ERROR_SIGN*(reference - reading).
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <complex>
+#include <string>
+#include <vector>
+
+#include <AtverterH.h>
+#include "PlantSim.h"
+
+typedef std::complex<double> Complex;
+
+const double ADC_RAW_PER_V = 1024.0/(5.0*13.0); // 10 bits of 5 V behind the 13x divider
+const int SWEEP_POINTS = 2000;
+const double SETTLED_SHARE = 0.05; // of the step, or one % of duty cycle if that moves the output further
+const double VERIFY_HOLD_S = 0.5; // open loop at the start duty cycle, then with the loop at the plant's voltage
+const double VERIFY_STEP_S = 0.5; // each step
+const int VERIFY_AVERAGE_TICKS = 50; // of the voltage before a step
+const int VERIFY_RIPPLE_TICKS = 100; // at the end of a step, where a limit cycle shows
+
+// regulated voltage, for convenience and bookkeeping
+enum DesignLoops
+{   LOOP_CV1 = 0, // panel voltage, more duty draws it down
+    LOOP_CV2, // battery voltage
+    NUM_DESIGNLOOPS
+};
+
+const char * const DESIGN_LOOP_NAMES[NUM_DESIGNLOOPS] = {"cv1", "cv2"};
+
+// compensator structures, for convenience and bookkeeping
+enum CompTypes
+{   COMP_PI = 0,
+    COMP_PID,
+    COMP_TYPE3,
+    NUM_COMPTYPES
+};
+
+const char * const COMP_TYPE_NAMES[NUM_COMPTYPES] = {"pi", "pid", "type3"};
+const int COMP_TYPE_ZEROS[NUM_COMPTYPES] = {1, 2, 2}; // besides the integrator
+const int COMP_TYPE_POLES[NUM_COMPTYPES] = {0, 1, 2};
+
+struct DesignSpec
+{
+  int loop = LOOP_CV1; // DesignLoops
+  int type = COMP_PI; // CompTypes
+  double inductanceH = 47e-6;
+  double capacitanceF = 22e-6;
+  double esrOhm = 0.05;
+  double vinV = 0.0; // 0 for the default
+  double voutV = 12.5;
+  double loadOhm = 0.0; // 0 for the default
+  double fswHz = 100000.0;
+  double fsHz = 1000.0;
+  double crossoverHz = 0.0; // 0 for fs/40
+  double phaseMarginDeg = 60.0;
+  double stepV = 0.0; // 0 for the default
+};
+
+// the linearized plant from duty cycle (0 to 1) to the regulated voltage, continuous and discretized
+struct Plant
+{
+  double a[2][2]; // x = {inductor current, capacitor voltage}
+  double b[2];
+  double c[2];
+  double d; // ESR feedthrough
+  double phi[2][2]; // zero-order hold equivalent over one control period
+  double gamma[2];
+  double sign; // of the compensator's input: +1 for reference - reading, -1 for reading - reference
+  double dcGain; // V per unit duty cycle
+};
+
+// biquads as setComp() takes them, in doubles
+struct Sections
+{
+  std::vector<double> coefficients; // {b0, b1, b2, a1, a2} per section
+  int count() const { return (int)coefficients.size()/COMP_SECTION_COEFFICIENTS; }
+};
+
+struct StepStats
+{
+  double riseS = -1.0; // 10 to 90 %
+  double overshoot = 0.0; // share of the step
+  double settleS = -1.0; // into the band for good
+};
+
+// Plant ----
+
+static void buildPlant(const DesignSpec& spec, double rpvOhm, double panelA, Plant& plant) {
+  double l = spec.inductanceH, c = spec.capacitanceF, esr = spec.esrOhm;
+  PlantParams defaults;
+  if (spec.loop == LOOP_CV2) {
+    double r = spec.loadOhm; // the battery as a resistance to its open-circuit voltage
+    double rl = defaults.buck.conductionOhm;
+    double kr = r/(r + esr); // vo = kr*(vc + esr*iL)
+    plant.a[0][0] = -(rl + kr*esr)/l;
+    plant.a[0][1] = -kr/l;
+    plant.a[1][0] = (1.0 - kr*esr/r)/c;
+    plant.a[1][1] = -kr/(r*c);
+    plant.b[0] = spec.vinV/l;
+    plant.b[1] = 0.0;
+    plant.c[0] = kr*esr;
+    plant.c[1] = kr;
+    plant.d = 0.0;
+    plant.sign = 1.0;
+  } else {
+    double duty = spec.voutV/spec.vinV;
+    double inductorA = panelA/duty;
+    double rl = defaults.buck.conductionOhm + defaults.battery.internalOhm; // the battery is stiff otherwise
+    double g = 1.0/(1.0 + esr/rpvOhm); // v1 = g*(vc - esr*(duty*iL + inductorA*d))
+    plant.a[0][0] = (-g*esr*duty*duty - rl)/l;
+    plant.a[0][1] = duty*g/l;
+    plant.a[1][0] = (g*esr*duty/rpvOhm - duty)/c;
+    plant.a[1][1] = -g/(rpvOhm*c);
+    plant.b[0] = (spec.vinV - duty*g*esr*inductorA)/l;
+    plant.b[1] = (g*esr*inductorA/rpvOhm - inductorA)/c;
+    plant.c[0] = -g*esr*duty;
+    plant.c[1] = g;
+    plant.d = -g*esr*inductorA;
+    plant.sign = -1.0;
+  }
+
+  // zero-order hold: exp([[A, B], [0, 0]]*T) by scaling and squaring a Taylor series
+  double t = 1.0/spec.fsHz;
+  double m[3][3] = {{plant.a[0][0]*t, plant.a[0][1]*t, plant.b[0]*t},
+                    {plant.a[1][0]*t, plant.a[1][1]*t, plant.b[1]*t},
+                    {0.0, 0.0, 0.0}};
+  double norm = 0.0;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      norm = fmax(norm, fabs(m[i][j]));
+  int squarings = norm > 0.5 ? (int)ceil(log2(norm/0.5)) : 0;
+  double scale = ldexp(1.0, -squarings);
+  double e[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  double term[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  for (int k = 1; k <= 16; k++) {
+    double next[3][3] = {};
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+        for (int n = 0; n < 3; n++)
+          next[i][j] += term[i][n]*m[n][j]*scale/k;
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++) {
+        term[i][j] = next[i][j];
+        e[i][j] += term[i][j];
+      }
+  }
+  for (int s = 0; s < squarings; s++) {
+    double square[3][3] = {};
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+        for (int n = 0; n < 3; n++)
+          square[i][j] += e[i][n]*e[n][j];
+    memcpy(e, square, sizeof(e));
+  }
+  for (int i = 0; i < 2; i++) {
+    plant.phi[i][0] = e[i][0];
+    plant.phi[i][1] = e[i][1];
+    plant.gamma[i] = e[i][2];
+  }
+
+  // steady state: x = -A^-1 B
+  double det = plant.a[0][0]*plant.a[1][1] - plant.a[0][1]*plant.a[1][0];
+  double x0 = -(plant.a[1][1]*plant.b[0] - plant.a[0][1]*plant.b[1])/det;
+  double x1 = -(-plant.a[1][0]*plant.b[0] + plant.a[0][0]*plant.b[1])/det;
+  plant.dcGain = plant.c[0]*x0 + plant.c[1]*x1 + plant.d;
+}
+
+// sampled plant at z, V per unit duty: C (zI - Phi)^-1 Gamma + d/z, the ESR term seen a period late
+static Complex plantResponse(const Plant& plant, Complex z) {
+  Complex m00 = z - plant.phi[0][0], m01 = -plant.phi[0][1];
+  Complex m10 = -plant.phi[1][0], m11 = z - plant.phi[1][1];
+  Complex det = m00*m11 - m01*m10;
+  Complex x0 = (m11*plant.gamma[0] - m01*plant.gamma[1])/det;
+  Complex x1 = (-m10*plant.gamma[0] + m00*plant.gamma[1])/det;
+  return plant.c[0]*x0 + plant.c[1]*x1 + plant.d/z;
+}
+
+// everything in the loop but the compensator: dutyRaw in, compensator input (raw) out
+static Complex loopResponse(const Plant& plant, double fsHz, double hz) {
+  Complex z = std::polar(1.0, 2.0*M_PI*hz/fsHz);
+  Complex average = 0.0;
+  for (int n = 0; n < SENSOR_V_WINDOW_MAX; n++)
+    average += pow(z, -n);
+  average /= (double)SENSOR_V_WINDOW_MAX;
+  return plant.sign*ADC_RAW_PER_V*average*plantResponse(plant, z)/(double)DUTY_RAW_SCALE;
+}
+
+// Compensator ----
+
+static Complex sectionsResponse(const Sections& sections, double fsHz, double hz) {
+  Complex zi = std::polar(1.0, -2.0*M_PI*hz/fsHz); // z^-1
+  Complex response = 1.0;
+  for (int k = 0; k < sections.count(); k++) {
+    const double* c = &sections.coefficients[k*COMP_SECTION_COEFFICIENTS];
+    response *= (c[0] + c[1]*zi + c[2]*zi*zi)/(1.0 + c[3]*zi + c[4]*zi*zi);
+  }
+  return response;
+}
+
+// phase boost of the zeros and poles, placed at crossover/sqrt(k) and crossover*sqrt(k)
+static double boostDeg(int type, double k) {
+  double zero = atan(sqrt(k)), pole = atan(1.0/sqrt(k));
+  return (COMP_TYPE_ZEROS[type]*zero - COMP_TYPE_POLES[type]*pole)*180.0/M_PI;
+}
+
+// the K factor that gives the boost, 0 if the type cannot
+static double kFactor(int type, double boost) {
+  double low = -12.0, high = 12.0; // log10 of k
+  if (boost <= boostDeg(type, pow(10.0, low)) || boost >= boostDeg(type, pow(10.0, high)))
+    return 0.0;
+  for (int n = 0; n < 100; n++) {
+    double middle = 0.5*(low + high);
+    if (boostDeg(type, pow(10.0, middle)) < boost)
+      low = middle;
+    else
+      high = middle;
+  }
+  return pow(10.0, 0.5*(low + high));
+}
+
+// phase of the loop at hz, unwrapped from DC
+static double unwrappedPhaseDeg(const Plant& plant, const Sections* sections, double fsHz, double hz) {
+  double phase = 0.0;
+  double last = 0.0;
+  for (int n = 0; n <= SWEEP_POINTS; n++) {
+    double f = hz*pow(1e-4, 1.0 - (double)n/SWEEP_POINTS);
+    Complex response = loopResponse(plant, fsHz, f);
+    if (sections)
+      response *= sectionsResponse(*sections, fsHz, f)*Complex(0.0, 1.0); // less the integrator's -90 degrees
+    double angle = std::arg(response)*180.0/M_PI;
+    if (n == 0)
+      phase = angle;
+    else {
+      double delta = angle - last;
+      delta -= 360.0*floor((delta + 180.0)/360.0);
+      phase += delta;
+    }
+    last = angle;
+  }
+  return sections ? phase - 90.0 : phase;
+}
+
+// continuous design, then the bilinear transform prewarped at the crossover; returns false if it cannot
+static bool design(const DesignSpec& spec, const Plant& plant, Sections& sections, double& kOut) {
+  double wc = 2.0*M_PI*spec.crossoverHz;
+  double t = 1.0/spec.fsHz;
+  double plantPhase = unwrappedPhaseDeg(plant, nullptr, spec.fsHz, spec.crossoverHz);
+  double boost = spec.phaseMarginDeg - 90.0 - plantPhase;
+  if (spec.type == COMP_PI && boost < 1.0)
+    boost = 1.0; // an integrator alone would do, the zero goes well above the crossover
+  double k = kFactor(spec.type, boost);
+  if (k <= 0.0) {
+    fprintf(stderr, "a %s compensator cannot add the %.1f degrees the plant needs at %g Hz\n",
+      COMP_TYPE_NAMES[spec.type], boost, spec.crossoverHz);
+    return false;
+  }
+  kOut = k;
+  double wz = wc/sqrt(k), wp = wc*sqrt(k);
+  if (COMP_TYPE_POLES[spec.type] > 0 && wp > 0.9*M_PI/t)
+    fprintf(stderr, "note: the poles at %.0f Hz are close to the Nyquist frequency, the bilinear transform "
+      "moves them\n", wp/(2.0*M_PI));
+
+  // C(s) = kc*(1 + s/wz)^zeros/(s*(1 + s/wp)^poles), kc so that |C G| = 1 at the crossover
+  int zeros = COMP_TYPE_ZEROS[spec.type], poles = COMP_TYPE_POLES[spec.type];
+  Complex s(0.0, wc);
+  Complex shape = pow(1.0 + s/wz, zeros)/(s*pow(1.0 + s/wp, poles));
+  double kc = 1.0/std::abs(shape*loopResponse(plant, spec.fsHz, spec.crossoverHz));
+
+  // s = kw*(1 - z^-1)/(1 + z^-1): (1 + s/w) -> (kw + w)/w*(1 - q z^-1)/(1 + z^-1), q = (kw - w)/(kw + w)
+  double kw = wc/tan(wc*t/2.0);
+  double q = (kw - wz)/(kw + wz), r = (kw - wp)/(kw + wp);
+  double gain = kc/kw*pow((kw + wz)/wz, zeros)*pow(wp/(kw + wp), poles);
+  sections.coefficients.clear();
+  if (spec.type == COMP_PI) {
+    sections.coefficients = {gain, -gain*q, 0.0, -1.0, 0.0};
+  } else if (spec.type == COMP_PID) {
+    // (1 - q z^-1)^2/((1 - z^-1)(1 - r z^-1)), the (1 + z^-1) of the integrator and the pole cancel the zeros'
+    sections.coefficients = {gain, -2.0*gain*q, gain*q*q, -(1.0 + r), r};
+  } else {
+    // a lead (1 - q z^-1)(1 + z^-1)/(1 - r z^-1)^2 at unit gain at the crossover, then the integrator section
+    std::vector<double> lead = {1.0, 1.0 - q, -q, -2.0*r, r*r};
+    Sections leadOnly;
+    leadOnly.coefficients = lead;
+    double leadGain = std::abs(sectionsResponse(leadOnly, spec.fsHz, spec.crossoverHz));
+    for (int n = 0; n < 3; n++)
+      lead[n] /= leadGain;
+    sections.coefficients = lead;
+    std::vector<double> integrator = {gain*leadGain, -gain*leadGain*q, 0.0, -1.0, 0.0};
+    sections.coefficients.insert(sections.coefficients.end(), integrator.begin(), integrator.end());
+  }
+  return true;
+}
+
+// the smallest post shift the coefficients fit in, and the integrator's pole kept at 1; -1 if none fits
+static int quantize(const Sections& sections, std::vector<int>& quantized, Sections& rounded) {
+  for (int shift = 0; shift <= COMP_MAX_POST_SHIFT; shift++) {
+    double scale = ldexp(1.0, 15 - shift);
+    bool fits = true;
+    quantized.clear();
+    for (double c : sections.coefficients) {
+      long value = lround(c*scale);
+      fits = fits && value >= -32768 && value <= 32767;
+      quantized.push_back((int)value);
+    }
+    if (!fits)
+      continue;
+    int last = (sections.count() - 1)*COMP_SECTION_COEFFICIENTS;
+    quantized[last + 3] = -(int)scale - quantized[last + 4]; // 1 + a1 + a2 = 0 exactly
+    if (quantized[last + 3] < -32768)
+      continue;
+    rounded.coefficients.clear();
+    for (int value : quantized)
+      rounded.coefficients.push_back(value/scale);
+    return shift;
+  }
+  return -1;
+}
+
+// Checks ----
+
+struct Margins
+{
+  double crossoverHz = -1.0;
+  double phaseMarginDeg = 0.0;
+  double gainMarginDb = INFINITY; // at the first -180 degree crossing
+};
+
+static Margins margins(const Plant& plant, const Sections& sections, double fsHz) {
+  Margins result;
+  double phase = 0.0, last = 0.0, lastPhase = 0.0;
+  double lastMagnitude = INFINITY;
+  for (int n = 0; n <= SWEEP_POINTS; n++) {
+    double f = 0.4999*fsHz*pow(1e-5, 1.0 - (double)n/SWEEP_POINTS);
+    Complex response = loopResponse(plant, fsHz, f)*sectionsResponse(sections, fsHz, f);
+    double angle = std::arg(response)*180.0/M_PI;
+    if (n == 0)
+      phase = angle > 0.0 ? angle - 360.0 : angle; // the integrator's -90 degrees at the lowest frequency
+    else {
+      double delta = angle - last;
+      delta -= 360.0*floor((delta + 180.0)/360.0);
+      phase += delta;
+    }
+    last = angle;
+    double magnitude = std::abs(response);
+    if (result.crossoverHz < 0.0 && n > 0 && lastMagnitude >= 1.0 && magnitude < 1.0) {
+      result.crossoverHz = f;
+      result.phaseMarginDeg = 180.0 + phase;
+    }
+    if (std::isinf(result.gainMarginDb) && n > 0 && lastPhase > -180.0 && phase <= -180.0)
+      result.gainMarginDb = -20.0*log10(magnitude);
+    lastMagnitude = magnitude;
+    lastPhase = phase;
+  }
+  return result;
+}
+
+static StepStats stepStats(const std::vector<double>& response, double step, double band, double periodS) {
+  StepStats stats;
+  long rise10 = -1, rise90 = -1, settled = -1;
+  for (size_t n = 0; n < response.size(); n++) {
+    double progress = response[n]/step;
+    rise10 = rise10 < 0 && progress >= 0.1 ? (long)n : rise10;
+    rise90 = rise90 < 0 && progress >= 0.9 ? (long)n : rise90;
+    stats.overshoot = fmax(stats.overshoot, progress - 1.0);
+    if (fabs(response[n] - step) > band)
+      settled = -1;
+    else if (settled < 0)
+      settled = (long)n;
+  }
+  stats.riseS = rise10 >= 0 && rise90 >= 0 ? (rise90 - rise10)*periodS : -1.0;
+  stats.settleS = settled >= 0 ? settled*periodS : -1.0;
+  return stats;
+}
+
+// the linear loop's response to a reference step, in volts from the operating point
+static std::vector<double> linearStep(const Plant& plant, const Sections& sections, double stepV, int ticks) {
+  int count = sections.count();
+  std::vector<double> in(count*3, 0.0), out(count*3, 0.0); // x[n], x[n-1], x[n-2] of each section, and y
+  std::vector<double> samples(SENSOR_V_WINDOW_MAX, 0.0);
+  double x0 = 0.0, x1 = 0.0, lastDuty = 0.0;
+  std::vector<double> response;
+  for (int n = 0; n < ticks; n++) {
+    double volts = plant.c[0]*x0 + plant.c[1]*x1 + plant.d*lastDuty;
+    response.push_back(volts);
+    samples[n % SENSOR_V_WINDOW_MAX] = volts*ADC_RAW_PER_V;
+    double average = 0.0;
+    for (double sample : samples)
+      average += sample/SENSOR_V_WINDOW_MAX;
+    double value = plant.sign*(stepV*ADC_RAW_PER_V - average);
+    for (int k = 0; k < count; k++) {
+      const double* c = &sections.coefficients[k*COMP_SECTION_COEFFICIENTS];
+      double* x = &in[k*3];
+      double* y = &out[k*3];
+      x[2] = x[1]; x[1] = x[0]; x[0] = value;
+      y[2] = y[1]; y[1] = y[0];
+      y[0] = c[0]*x[0] + c[1]*x[1] + c[2]*x[2] - c[3]*y[1] - c[4]*y[2];
+      value = y[0];
+    }
+    double duty = value/DUTY_RAW_SCALE;
+    double next0 = plant.phi[0][0]*x0 + plant.phi[0][1]*x1 + plant.gamma[0]*duty;
+    double next1 = plant.phi[1][0]*x0 + plant.phi[1][1]*x1 + plant.gamma[1]*duty;
+    x0 = next0;
+    x1 = next1;
+    lastDuty = duty;
+  }
+  return response;
+}
+
+// Closed loop on PlantSim ----
+
+static AtverterH board; // static like a sketch's
+static int verifyLoop = LOOP_CV1;
+static bool verifyClosed = false;
+static int verifyReferenceRaw = 0;
+static int verifySign = 1;
+
+static void verifyTick() {
+  board.updateVISensors();
+  if (!verifyClosed)
+    return;
+  int reading = verifyLoop == LOOP_CV1 ? board.getRawV1() : board.getRawV2();
+  board.updateCompPast(verifySign*(verifyReferenceRaw - reading));
+  board.setDutyCycleRaw((int)board.calculateCompOut());
+}
+
+static double regulatedV(PlantSim& plant) {
+  return verifyLoop == LOOP_CV1 ? plant.getState().panelV : plant.getState().batteryV;
+}
+
+// runs the quantized compensator on the plant simulator; prints each step's stats next to the prediction
+static void verify(const DesignSpec& spec, const Plant& plant, const std::vector<int>& quantized, int sections,
+    int shift, double band, const StepStats& predicted) {
+  PlantParams params;
+  params.buckModel = BUCK_AVERAGED;
+  params.buck.pwmHz = spec.fswHz;
+  params.buck.inductorH = spec.inductanceH;
+  if (spec.loop == LOOP_CV1)
+    params.buck.inputCapF = spec.capacitanceF;
+  else {
+    params.buck.outputCapF = spec.capacitanceF;
+    params.battery.internalOhm = spec.loadOhm;
+  }
+  static PlantSim sim; // static like the board
+  sim.configure(params);
+  sim.setIrradiance(1000.0);
+  sim.attach();
+  verifyLoop = spec.loop;
+  verifySign = (int)plant.sign;
+  verifyClosed = false;
+  board.setupPinMode();
+  board.initializeSensors();
+  board.startPWM((int)lround(100.0*spec.voutV/spec.vinV));
+  board.initializeInterruptTimer(lround(1e6/spec.fsHz), verifyTick);
+  board.applyHoldHigh2();
+  board.setComp(quantized.data(), sections, shift);
+
+  int ticks = (int)(VERIFY_HOLD_S*spec.fsHz);
+  for (int n = 0; n < ticks; n++)
+    sim.step();
+  verifyReferenceRaw = verifyLoop == LOOP_CV1 ? board.getRawV1() : board.getRawV2();
+  board.resetComp(); // from the duty cycle it has
+  verifyClosed = true;
+  for (int n = 0; n < ticks; n++)
+    sim.step();
+  printf("PlantSim (averaged, %.0f kHz, %g uH, %g uF, no ESR): %s at %.2f V, side %d at %.2f V, duty %d %%\n",
+    spec.fswHz/1000.0, spec.inductanceH*1e6, spec.capacitanceF*1e6, spec.loop == LOOP_CV1 ? "panel" : "battery",
+    regulatedV(sim), spec.loop == LOOP_CV1 ? 2 : 1,
+    spec.loop == LOOP_CV1 ? sim.getState().batteryV : sim.getState().panelV, board.getDutyCycle());
+  printf("  %-12s %9s %9s %11s %9s %9s %9s\n", "step", "rise ms", "overshoot", "settled ms", "start V", "end V",
+    "ripple V");
+  printf("  %-12s %9.1f %8.1f%% %11.1f %9s %9s\n", "linear model", predicted.riseS*1e3, predicted.overshoot*100.0,
+    predicted.settleS*1e3, "", "");
+  int stepTicks = (int)(VERIFY_STEP_S*spec.fsHz);
+  for (int direction = 1; direction >= -1; direction -= 2) {
+    double start = 0.0;
+    for (int n = 0; n < VERIFY_AVERAGE_TICKS; n++) { // to see past the whole % duty cycle steps
+      sim.step();
+      start += regulatedV(sim)/VERIFY_AVERAGE_TICKS;
+    }
+    double stepV = direction*spec.stepV;
+    verifyReferenceRaw += (int)lround(stepV*ADC_RAW_PER_V);
+    std::vector<double> response;
+    double low = INFINITY, high = -INFINITY;
+    for (int n = 0; n < stepTicks; n++) {
+      sim.step();
+      response.push_back(regulatedV(sim) - start);
+      if (n >= stepTicks - VERIFY_RIPPLE_TICKS) {
+        low = fmin(low, regulatedV(sim));
+        high = fmax(high, regulatedV(sim));
+      }
+    }
+    StepStats measured = stepStats(response, stepV, band, 1.0/spec.fsHz);
+    char rise[16], settle[16];
+    snprintf(rise, sizeof(rise), measured.riseS < 0.0 ? "-" : "%.1f", measured.riseS*1e3);
+    snprintf(settle, sizeof(settle), measured.settleS < 0.0 ? "-" : "%.1f", measured.settleS*1e3);
+    printf("  %-12s %9s %8.1f%% %11s %9.2f %9.2f %9.2f\n", direction > 0 ? "up" : "down", rise,
+      measured.overshoot*100.0, settle, start, regulatedV(sim), high - low);
+  }
+  sim.detach();
+}
+
+// Output ----
+
+static void writeHeader(FILE* file, const DesignSpec& spec, const char* name, const std::vector<int>& quantized,
+    int sections, int shift, const Margins& achieved) {
+  fprintf(file, "/*\n  %sCompensator.h - %s loop coefficients for AtverterH::setComp(), from atv-compdesign\n",
+    name, name);
+  fprintf(file, "  Released into the public domain.\n\n");
+  fprintf(file, "  %s, L %g uH, C %g uF, ESR %g mOhm, Vin %g V, Vout %g V, load %g Ohm,\n",
+    COMP_TYPE_NAMES[spec.type], spec.inductanceH*1e6, spec.capacitanceF*1e6, spec.esrOhm*1e3, spec.vinV,
+    spec.voutV, spec.loadOhm);
+  fprintf(file, "  fsw %g kHz, fs %g Hz: crossover %.1f Hz, phase margin %.1f degrees, gain margin %.1f dB\n",
+    spec.fswHz/1000.0, spec.fsHz, achieved.crossoverHz, achieved.phaseMarginDeg, achieved.gainMarginDb);
+  fprintf(file, "  include after AtverterH.h; the input is %s_ERROR_SIGN*(reference - reading), raw\n*/\n\n", name);
+  fprintf(file, "#ifndef %sCompensator_h\n#define %sCompensator_h\n\n", name, name);
+  fprintf(file, "const int %s_ERROR_SIGN = %d; // more duty cycle %s the %s voltage\n", name,
+    spec.loop == LOOP_CV1 ? -1 : 1, spec.loop == LOOP_CV1 ? "draws down" : "raises",
+    spec.loop == LOOP_CV1 ? "panel" : "battery");
+  fprintf(file, "const int %s_SECTIONS = %d;\n", name, sections);
+  fprintf(file, "const int %s_POST_SHIFT = %d; // Q%d\n", name, shift, 15 - shift);
+  fprintf(file, "const int %s_COMP[%s_SECTIONS*COMP_SECTION_COEFFICIENTS] = {\n", name, name);
+  for (int k = 0; k < sections; k++) {
+    const int* c = &quantized[k*COMP_SECTION_COEFFICIENTS];
+    fprintf(file, "  %d, %d, %d, %d, %d%s // b0, b1, b2, a1, a2%s\n", c[0], c[1], c[2], c[3], c[4],
+      k + 1 < sections ? "," : "", k + 1 == sections ? ", with the integrator" : "");
+  }
+  fprintf(file, "};\n\n#endif\n");
+}
+
+int main(int argc, char** argv) {
+  DesignSpec spec;
+  const char* name = nullptr;
+  const char* headerPath = nullptr;
+  bool verifying = true;
+  for (int n = 1; n < argc; n++) {
+    const char* option = argv[n];
+    if (strcmp(option, "--no-verify") == 0) {
+      verifying = false;
+      continue;
+    }
+    const char* value = n + 1 < argc ? argv[++n] : nullptr;
+    if (value && strcmp(option, "--loop") == 0) {
+      for (spec.loop = 0; spec.loop < NUM_DESIGNLOOPS && strcmp(value, DESIGN_LOOP_NAMES[spec.loop]) != 0; spec.loop++)
+        ;
+    } else if (value && strcmp(option, "--type") == 0) {
+      for (spec.type = 0; spec.type < NUM_COMPTYPES && strcmp(value, COMP_TYPE_NAMES[spec.type]) != 0; spec.type++)
+        ;
+    } else if (value && strcmp(option, "--inductance") == 0)
+      spec.inductanceH = atof(value);
+    else if (value && strcmp(option, "--capacitance") == 0)
+      spec.capacitanceF = atof(value);
+    else if (value && strcmp(option, "--esr") == 0)
+      spec.esrOhm = atof(value);
+    else if (value && strcmp(option, "--vin") == 0)
+      spec.vinV = atof(value);
+    else if (value && strcmp(option, "--vout") == 0)
+      spec.voutV = atof(value);
+    else if (value && strcmp(option, "--load") == 0)
+      spec.loadOhm = atof(value);
+    else if (value && strcmp(option, "--fsw") == 0)
+      spec.fswHz = atof(value);
+    else if (value && strcmp(option, "--fs") == 0)
+      spec.fsHz = atof(value);
+    else if (value && strcmp(option, "--crossover") == 0)
+      spec.crossoverHz = atof(value);
+    else if (value && strcmp(option, "--phase-margin") == 0)
+      spec.phaseMarginDeg = atof(value);
+    else if (value && strcmp(option, "--step") == 0)
+      spec.stepV = atof(value);
+    else if (value && strcmp(option, "--name") == 0)
+      name = value;
+    else if (value && strcmp(option, "--header") == 0)
+      headerPath = value;
+    else {
+      fprintf(stderr, "usage: %s [--loop cv1|cv2] [--type pi|pid|type3] [--inductance H] [--capacitance F] [--esr OHM]"
+        " [--vin V] [--vout V] [--load OHM] [--fsw HZ] [--fs HZ] [--crossover HZ] [--phase-margin DEG] [--step V]"
+        " [--name NAME] [--header FILE] [--no-verify]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (spec.loop == NUM_DESIGNLOOPS || spec.type == NUM_COMPTYPES) {
+    fprintf(stderr, "unknown --loop or --type\n");
+    return 1;
+  }
+  spec.vinV = spec.vinV > 0.0 ? spec.vinV : spec.loop == LOOP_CV1 ? 30.0 : 39.0;
+  spec.stepV = spec.stepV > 0.0 ? spec.stepV : spec.loop == LOOP_CV1 ? 2.0 : 0.5;
+  name = name ? name : spec.loop == LOOP_CV1 ? "CV1" : "CV2";
+  if (spec.inductanceH <= 0.0 || spec.capacitanceF <= 0.0 || spec.esrOhm < 0.0 || spec.vinV <= spec.voutV
+      || spec.voutV <= 0.0 || spec.fsHz <= 0.0 || spec.fswHz < spec.fsHz) {
+    fprintf(stderr, "needs L, C > 0, ESR >= 0, Vin > Vout > 0 and fsw >= fs > 0\n");
+    return 1;
+  }
+  spec.crossoverHz = spec.crossoverHz > 0.0 ? spec.crossoverHz : spec.fsHz/40.0;
+  if (spec.crossoverHz >= spec.fsHz/4.0) {
+    fprintf(stderr, "the crossover needs to stay well below fs/2, %g Hz is not\n", spec.crossoverHz);
+    return 1;
+  }
+
+  // the panel's current and dynamic resistance at vin, from PlantSim's module
+  PvModule pv;
+  pv.setConditions(1000.0, 25.0);
+  double slope;
+  double panelA = pv.current(spec.vinV, slope);
+  if (spec.loop == LOOP_CV1 && spec.loadOhm <= 0.0)
+    spec.loadOhm = slope < 0.0 ? -1.0/slope : 1e6;
+  if (spec.loop == LOOP_CV2 && spec.loadOhm <= 0.0)
+    spec.loadOhm = 0.1;
+  if (spec.loop == LOOP_CV1 && panelA <= 0.0) {
+    fprintf(stderr, "%g V is beyond the panel's open-circuit voltage\n", spec.vinV);
+    return 1;
+  }
+
+  Plant plant;
+  buildPlant(spec, spec.loadOhm, panelA, plant);
+  printf("plant: %s, %.1f V per unit duty at DC, %s %.2f Ohm; %.1f degrees at %g Hz with the ADC average\n",
+    DESIGN_LOOP_NAMES[spec.loop], plant.dcGain, spec.loop == LOOP_CV1 ? "panel" : "battery", spec.loadOhm,
+    unwrappedPhaseDeg(plant, nullptr, spec.fsHz, spec.crossoverHz), spec.crossoverHz);
+
+  Sections sections;
+  double k;
+  if (!design(spec, plant, sections, k))
+    return 1;
+  std::vector<int> quantized;
+  Sections rounded;
+  int shift = quantize(sections, quantized, rounded);
+  if (shift < 0) {
+    fprintf(stderr, "the coefficients do not fit Q%d; lower the crossover or the gain\n", 15 - COMP_MAX_POST_SHIFT);
+    return 1;
+  }
+  Margins designed = margins(plant, sections, spec.fsHz);
+  Margins achieved = margins(plant, rounded, spec.fsHz);
+  printf("%s, K %.3g: crossover %.1f Hz, phase margin %.1f degrees, gain margin %.1f dB\n",
+    COMP_TYPE_NAMES[spec.type], k, designed.crossoverHz, designed.phaseMarginDeg, designed.gainMarginDb);
+  printf("quantized, Q%d: crossover %.1f Hz, phase margin %.1f degrees, gain margin %.1f dB\n", 15 - shift,
+    achieved.crossoverHz, achieved.phaseMarginDeg, achieved.gainMarginDb);
+  for (size_t n = 0; n < quantized.size(); n++) {
+    double exact = sections.coefficients[n];
+    if (exact != 0.0 && fabs(rounded.coefficients[n] - exact) > 0.01*fabs(exact))
+      printf("note: coefficient %zu rounds from %.6f to %.6f\n", n, exact, rounded.coefficients[n]);
+  }
+
+  double band = fmax(SETTLED_SHARE*spec.stepV, 0.01*fabs(plant.dcGain));
+  std::vector<double> response = linearStep(plant, rounded, spec.stepV, (int)(VERIFY_STEP_S*spec.fsHz));
+  StepStats predicted = stepStats(response, spec.stepV, SETTLED_SHARE*spec.stepV, 1.0/spec.fsHz);
+  printf("linear %g V step: rise %.1f ms, overshoot %.1f %%, settled within %.0f %% in %.1f ms\n\n", spec.stepV,
+    predicted.riseS*1e3, predicted.overshoot*100.0, SETTLED_SHARE*100.0, predicted.settleS*1e3);
+  if (verifying) {
+    verify(spec, plant, quantized, sections.count(), shift, band, predicted);
+    printf("  settled: within %.2f V, the larger of %.0f %% of the step and one %% of duty cycle; ripple: peak to"
+      " peak over the last %d ms\n\n", band, SETTLED_SHARE*100.0, (int)(VERIFY_RIPPLE_TICKS*1000.0/spec.fsHz));
+  }
+
+  FILE* header = headerPath ? fopen(headerPath, "w") : stdout;
+  if (!header) {
+    perror(headerPath);
+    return 1;
+  }
+  writeHeader(header, spec, name, quantized, sections.count(), shift, achieved);
+  if (headerPath) {
+    fclose(header);
+    printf("wrote %s\n", headerPath);
+  }
+  return 0;
+}
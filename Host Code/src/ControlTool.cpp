@@ -0,0 +1,111 @@
+/*
+  ControlTool.cpp - Reads and writes AtverterH registers from the command line
+  Released into the public domain.
+
+  usage: atv-ctl [--serial PATH[@BAUD] | --i2c PATH[@ADDRESS]] [--window N] [--timeout MS]
+                 [--attempts N] REGISTER[=VALUE]...
+  e.g.   atv-ctl --serial /dev/ttyUSB0 V1 V2 I1 I2 DutyCycle ThermalShutdown=55
+  Every REGISTER reads, every REGISTER=VALUE writes; all of them go out as one
+  pipelined batch. Register names are the ones in AtverterClient.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "AtverterClient.h"
+
+static void printUsage(const char* program) {
+  fprintf(stderr, "usage: %s [--serial PATH[@BAUD] | --i2c PATH[@ADDRESS]] [--window N] [--timeout MS]\n"
+    "       [--attempts N] REGISTER[=VALUE]...\nregisters:", program);
+  for (int r = 0; r < NUM_REGISTERS; r++)
+    fprintf(stderr, " %s%s", REGISTERS[r].name, REGISTERS[r].readCommand ? "" : "(write only)");
+  fprintf(stderr, "\n");
+}
+
+// splits PATH@NUMBER, keeping number unchanged when there is no @
+static std::string splitAt(const char* text, int& number) {
+  std::string path = text;
+  size_t at = path.rfind('@');
+  if (at != std::string::npos) {
+    number = (int)strtol(path.c_str() + at + 1, NULL, 0);
+    path.resize(at);
+  }
+  return path;
+}
+
+int main(int argc, char** argv) {
+  std::string serialPath = "/dev/ttyUSB0";
+  std::string i2cPath;
+  int baud = SERIAL_DEFAULT_BAUD;
+  int address = I2C_DEFAULT_ADDRESS;
+  int window = CLIENT_DEFAULT_WINDOW;
+  int timeoutMs = CLIENT_DEFAULT_TIMEOUT_MS;
+  int attempts = CLIENT_DEFAULT_ATTEMPTS;
+  std::vector<AtverterRequest> requests;
+  for (int n = 1; n < argc; n++) {
+    bool hasValue = n + 1 < argc;
+    if (strcmp(argv[n], "--serial") == 0 && hasValue) {
+      serialPath = splitAt(argv[++n], baud);
+    } else if (strcmp(argv[n], "--i2c") == 0 && hasValue) {
+      i2cPath = splitAt(argv[++n], address);
+    } else if (strcmp(argv[n], "--window") == 0 && hasValue) {
+      window = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--timeout") == 0 && hasValue) {
+      timeoutMs = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--attempts") == 0 && hasValue) {
+      attempts = atoi(argv[++n]);
+    } else if (argv[n][0] != '-') {
+      AtverterRequest request;
+      const char* equals = strchr(argv[n], '=');
+      std::string name(argv[n], equals ? equals - argv[n] : strlen(argv[n]));
+      request.reg = -1;
+      for (int r = 0; r < NUM_REGISTERS; r++) {
+        if (strcasecmp(name.c_str(), REGISTERS[r].name) == 0)
+          request.reg = r;
+      }
+      if (request.reg < 0) {
+        fprintf(stderr, "unknown register %s\n", name.c_str());
+        printUsage(argv[0]);
+        return 2;
+      }
+      request.write = equals != NULL;
+      request.value = equals ? atoi(equals + 1) : 0;
+      requests.push_back(request);
+    } else {
+      printUsage(argv[0]);
+      return 2;
+    }
+  }
+  if (requests.empty()) {
+    printUsage(argv[0]);
+    return 2;
+  }
+  SerialTransport serial;
+  I2cTransport i2c;
+  AtverterTransport* transport = &serial;
+  if (!i2cPath.empty()) {
+    if (!i2c.open(i2cPath.c_str(), address)) {
+      fprintf(stderr, "cannot open %s at address 0x%02x\n", i2cPath.c_str(), address);
+      return 1;
+    }
+    transport = &i2c;
+  } else if (!serial.open(serialPath.c_str(), baud)) {
+    fprintf(stderr, "cannot open %s\n", serialPath.c_str());
+    return 1;
+  }
+  AtverterClient client(*transport);
+  client.setWindow(window);
+  client.setTimeout(timeoutMs);
+  client.setAttempts(attempts);
+  bool ok = client.execute(requests.data(), (int)requests.size());
+  for (const AtverterRequest& request : requests) {
+    if (request.status == REQUEST_OK)
+      printf("%s%s%d\n", REGISTERS[request.reg].name, request.write ? " := " : " = ", (int)request.value);
+    else
+      printf("%s: %s\n", REGISTERS[request.reg].name, REQUEST_STATUS_NAMES[request.status]);
+  }
+  return ok ? 0 : 1;
+}
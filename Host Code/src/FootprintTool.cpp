@@ -0,0 +1,1100 @@
+/*
+  FootprintTool.cpp - Flash, RAM and stack footprint of the [env:uno] firmware
+  Released into the public domain.
+
+  usage: atv-footprint [options] firmware.elf
+    --flash-size BYTES     program memory for the application (default: 32256, the Uno's less its bootloader)
+    --ram-size BYTES       SRAM (default: 2048)
+    --flash-budget BYTES   exit with status 2 if more flash is used
+    --ram-budget BYTES     exit with status 2 if more RAM is used by variables
+    --stack-budget BYTES   exit with status 2 if an interrupt handler can take more stack
+    --indirect CALLER=TARGET[,TARGET...]
+                           where the indirect calls (icall) of a function go, repeatable; a name
+                           without parameters stands for every overload
+    --top N                symbols listed by flash and by RAM (default: 15)
+    --history FILE         appends the totals under --label to a CSV, replacing an entry with the same label
+    --label TEXT           (default: git describe --always --dirty)
+
+  Reads the ELF that pio run -e uno leaves in .pio/build/uno/firmware.elf;
+  no AVR toolchain is needed. Flash counts every loaded section (the code,
+  the vector table, progmem and the initial values of .data), RAM counts
+  .data, .bss and .noinit. Symbols come from the symbol table and their
+  translation unit from the DWARF debug info (the file a function or
+  variable was declared in), so build with -g (see platformio.ini); with
+  LTO, inlined code counts to the function it was inlined into.
+
+  The stack depth is estimated from the machine code, like avstack does:
+  every function's frame (the registers its prologue pushes and the frame
+  it allocates, plus arguments pushed for varargs calls) and the 2 byte
+  return address of each call, along the deepest path of the static call
+  graph. Tail calls (jmp, rjmp out of the function) reuse the caller's
+  frame. Indirect calls cannot be followed from the code, so their targets
+  come from --indirect; the control interrupt reaches controlUpdate() that
+  way through TimerOne's callback unless LTO made the call direct. A path
+  through an indirect call without targets, or through recursion, makes the
+  depth a lower bound, marked >=. Interrupt handlers add the 2 byte return
+  address the hardware pushes; they do not nest unless one enables
+  interrupts (sei), which is reported. The worst case for the RAM is
+  main()'s deepest path, interrupted at its deepest point by the deepest
+  handler, on top of the variables.
+
+  Without budgets it only fails when the flash or the worst case RAM do not
+  fit at all. The budgets are margins below that, to be set from a
+  measured build.
+
+  --history keeps one line per commit, so a change that costs flash, RAM or
+  stack shows up next to the one before it (footprint-budget target of the
+  CMake build).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cxxabi.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+const uint16_t EM_AVR_MACHINE = 83;
+const uint32_t AVR_EEPROM_START = 0x810000; // EEPROM, fuses, lock bits and signature from here on
+const int RETURN_ADDRESS_BYTES = 2; // ATmega328P, 16-bit program counter
+const int MAX_CALL_DEPTH = 64; // of the graph walk, deeper is reported as recursion
+
+// ATmega328P interrupt vectors, for the report
+const int NUM_VECTORS = 26;
+const char * const VECTOR_NAMES[NUM_VECTORS] = {"RESET", "INT0", "INT1", "PCINT0", "PCINT1", "PCINT2", "WDT",
+  "TIMER2_COMPA", "TIMER2_COMPB", "TIMER2_OVF", "TIMER1_CAPT", "TIMER1_COMPA", "TIMER1_COMPB", "TIMER1_OVF",
+  "TIMER0_COMPA", "TIMER0_COMPB", "TIMER0_OVF", "SPI_STC", "USART_RX", "USART_UDRE", "USART_TX", "ADC",
+  "EE_READY", "ANALOG_COMP", "TWI", "SPM_READY"};
+
+// memory a section takes, for convenience and bookkeeping
+enum MemoryKinds
+{   MEMORY_NONE = 0, // not loaded (debug info, symbol tables) or EEPROM and fuses
+    MEMORY_FLASH, // code and constants
+    MEMORY_FLASH_RAM, // initialized variables: their values in flash, copied to RAM at reset
+    MEMORY_RAM, // zeroed or uninitialized variables
+    NUM_MEMORYKINDS
+};
+
+struct Section
+{
+  std::string name;
+  uint32_t nameOffset; // in the section name table
+  uint32_t type;
+  uint32_t flags;
+  uint32_t address;
+  uint32_t offset;
+  uint32_t size;
+  int memory; // MemoryKinds
+};
+
+struct Symbol
+{
+  std::string name; // demangled
+  uint32_t address;
+  uint32_t size;
+  bool isFunction;
+  int memory; // MemoryKinds of its section
+  std::string unit; // source file it was declared in, empty if unknown
+};
+
+// the ELF file and what was read from it
+struct Image
+{
+  std::vector<uint8_t> bytes;
+  uint16_t machine = 0;
+  std::vector<Section> sections;
+  std::vector<Symbol> symbols;
+};
+
+// little endian reads with bounds checks; a truncated file reads as zeros
+static uint32_t read8(const std::vector<uint8_t>& bytes, size_t offset) {
+  return offset < bytes.size() ? bytes[offset] : 0;
+}
+
+static uint32_t read16(const std::vector<uint8_t>& bytes, size_t offset) {
+  return read8(bytes, offset) | read8(bytes, offset + 1) << 8;
+}
+
+static uint32_t read32(const std::vector<uint8_t>& bytes, size_t offset) {
+  return read16(bytes, offset) | read16(bytes, offset + 2) << 16;
+}
+
+static std::string readString(const std::vector<uint8_t>& bytes, size_t offset) {
+  std::string text;
+  while (offset < bytes.size() && bytes[offset])
+    text += (char)bytes[offset++];
+  return text;
+}
+
+static std::string demangle(const std::string& name) {
+  if (name.compare(0, 2, "_Z") != 0) // C names, which __cxa_demangle() would take for types
+    return name;
+  int status;
+  char* demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+  if (status != 0 || !demangled)
+    return name;
+  std::string result = demangled;
+  free(demangled);
+  return result;
+}
+
+static std::string baseName(const std::string& path) {
+  size_t slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static int memoryOf(const Section& section, bool isAvr) {
+  const uint32_t SHF_WRITE = 1;
+  const uint32_t SHF_ALLOC = 2;
+  const uint32_t SHT_NOBITS = 8;
+  if (!(section.flags & SHF_ALLOC) || section.size == 0)
+    return MEMORY_NONE;
+  if (isAvr && section.address >= AVR_EEPROM_START)
+    return MEMORY_NONE;
+  if (section.type == SHT_NOBITS)
+    return MEMORY_RAM;
+  return (section.flags & SHF_WRITE) ? MEMORY_FLASH_RAM : MEMORY_FLASH;
+}
+
+static bool readImage(const char* path, Image& image) {
+  FILE* file = fopen(path, "rb");
+  if (!file)
+    return false;
+  uint8_t buffer[65536];
+  size_t got;
+  while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    image.bytes.insert(image.bytes.end(), buffer, buffer + got);
+  fclose(file);
+  const std::vector<uint8_t>& bytes = image.bytes;
+  if (bytes.size() < 52 || memcmp(bytes.data(), "\x7f" "ELF", 4) != 0 || bytes[4] != 1 || bytes[5] != 1) {
+    fprintf(stderr, "%s is not a 32-bit little endian ELF file\n", path);
+    return false;
+  }
+  image.machine = (uint16_t)read16(bytes, 18);
+  uint32_t sectionOffset = read32(bytes, 32);
+  uint32_t sectionEntrySize = read16(bytes, 46);
+  uint32_t sectionCount = read16(bytes, 48);
+  uint32_t namesIndex = read16(bytes, 50);
+  for (uint32_t n = 0; n < sectionCount; n++) {
+    size_t entry = sectionOffset + (size_t)n*sectionEntrySize;
+    Section section;
+    section.nameOffset = read32(bytes, entry);
+    section.type = read32(bytes, entry + 4);
+    section.flags = read32(bytes, entry + 8);
+    section.address = read32(bytes, entry + 12);
+    section.offset = read32(bytes, entry + 16);
+    section.size = read32(bytes, entry + 20);
+    image.sections.push_back(section);
+  }
+  if (namesIndex >= image.sections.size())
+    return false;
+  uint32_t namesOffset = image.sections[namesIndex].offset;
+  bool isAvr = image.machine == EM_AVR_MACHINE;
+  for (Section& section : image.sections) {
+    section.name = readString(bytes, namesOffset + section.nameOffset);
+    section.memory = memoryOf(section, isAvr);
+  }
+
+  const uint32_t SHT_SYMTAB = 2;
+  const int STT_OBJECT = 1;
+  const int STT_FUNC = 2;
+  std::set<std::pair<uint32_t, int>> seen; // aliases, e.g. the complete and base object constructors, count once
+  for (size_t s = 0; s < image.sections.size(); s++) {
+    const Section& table = image.sections[s];
+    uint32_t link = read32(bytes, sectionOffset + s*sectionEntrySize + 24);
+    if (table.type != SHT_SYMTAB || link >= image.sections.size())
+      continue;
+    uint32_t stringsOffset = image.sections[link].offset;
+    for (uint32_t entry = table.offset + 16; entry + 16 <= table.offset + table.size; entry += 16) {
+      int type = read8(bytes, entry + 12) & 0xF;
+      uint32_t index = read16(bytes, entry + 14);
+      if ((type != STT_OBJECT && type != STT_FUNC) || index == 0 || index >= image.sections.size())
+        continue;
+      Symbol symbol;
+      symbol.name = demangle(readString(bytes, stringsOffset + read32(bytes, entry)));
+      symbol.address = read32(bytes, entry + 4);
+      symbol.size = read32(bytes, entry + 8);
+      symbol.isFunction = type == STT_FUNC;
+      symbol.memory = image.sections[index].memory;
+      if (symbol.memory != MEMORY_NONE && seen.insert(std::make_pair(symbol.address, symbol.memory)).second)
+        image.symbols.push_back(symbol);
+    }
+  }
+  return true;
+}
+
+static const Section* findSection(const Image& image, const char* name) {
+  for (const Section& section : image.sections) {
+    if (section.name == name)
+      return &section;
+  }
+  return nullptr;
+}
+
+// DWARF ----
+
+// reads forward through one section of the file
+struct Cursor
+{
+  const std::vector<uint8_t>* bytes;
+  size_t position;
+  size_t end;
+
+  bool atEnd() { return position >= end; }
+  uint64_t fixed(int size) {
+    uint64_t value = 0;
+    for (int n = 0; n < size; n++)
+      value |= (uint64_t)read8(*bytes, position + n) << (8*n);
+    position += size;
+    return value;
+  }
+  uint64_t uleb() {
+    uint64_t value = 0;
+    int shift = 0;
+    uint32_t byte;
+    do {
+      byte = read8(*bytes, position++);
+      value |= shift < 64 ? (uint64_t)(byte & 0x7F) << shift : 0;
+      shift += 7;
+    } while ((byte & 0x80) && position < end);
+    return value;
+  }
+  int64_t sleb() {
+    int64_t value = 0;
+    int shift = 0;
+    uint32_t byte;
+    do {
+      byte = read8(*bytes, position++);
+      value |= shift < 64 ? (int64_t)(byte & 0x7F) << shift : 0;
+      shift += 7;
+    } while ((byte & 0x80) && position < end);
+    if (shift < 64 && (byte & 0x40))
+      value |= -((int64_t)1 << shift);
+    return value;
+  }
+  std::string string() {
+    std::string text = readString(*bytes, position);
+    position += text.size() + 1;
+    return text;
+  }
+};
+
+// DWARF 2 to 5 constants this tool uses
+const uint32_t DW_TAG_COMPILE_UNIT = 0x11;
+const uint32_t DW_TAG_SUBPROGRAM = 0x2e;
+const uint32_t DW_TAG_VARIABLE = 0x34;
+const uint32_t DW_AT_LOCATION = 0x02;
+const uint32_t DW_AT_NAME = 0x03;
+const uint32_t DW_AT_STMT_LIST = 0x10;
+const uint32_t DW_AT_LOW_PC = 0x11;
+const uint32_t DW_AT_ABSTRACT_ORIGIN = 0x31;
+const uint32_t DW_AT_DECL_FILE = 0x3a;
+const uint32_t DW_AT_SPECIFICATION = 0x47;
+const uint32_t DW_FORM_ADDR = 0x01;
+const uint32_t DW_FORM_STRING = 0x08;
+const uint32_t DW_FORM_STRP = 0x0e;
+const uint32_t DW_FORM_REF_ADDR = 0x10;
+const uint32_t DW_FORM_LINE_STRP = 0x1f;
+const uint32_t DW_FORM_IMPLICIT_CONST = 0x21;
+const uint32_t DW_OP_ADDR = 0x03;
+const uint32_t DW_LNCT_PATH = 1;
+
+// the string sections a form can point into
+struct DwarfStrings
+{
+  const Section* str = nullptr; // .debug_str
+  const Section* lineStr = nullptr; // .debug_line_str
+};
+
+struct FormValue
+{
+  uint64_t number = 0; // constants, addresses, references and offsets
+  std::string text; // strings
+  size_t blockStart = 0; // blocks and expressions
+  size_t blockLength = 0;
+  bool isReference = false; // number is an offset in the unit (ref1 to ref_udata), not the section
+};
+
+// reads one attribute value of the given form; false for a form this tool does not know
+static bool readForm(Cursor& cursor, uint32_t form, int addressSize, int version, int64_t implicitConst,
+  const DwarfStrings& strings, FormValue& value) {
+  value = FormValue();
+  const std::vector<uint8_t>& bytes = *cursor.bytes;
+  switch (form) {
+    case DW_FORM_ADDR: value.number = cursor.fixed(addressSize); return true;
+    case 0x03: value.blockLength = cursor.fixed(2); break; // block2
+    case 0x04: value.blockLength = cursor.fixed(4); break; // block4
+    case 0x05: value.number = cursor.fixed(2); return true; // data2
+    case 0x06: value.number = cursor.fixed(4); return true; // data4
+    case 0x07: value.number = cursor.fixed(8); return true; // data8
+    case DW_FORM_STRING: value.text = cursor.string(); return true;
+    case 0x09: case 0x18: value.blockLength = cursor.uleb(); break; // block, exprloc
+    case 0x0a: value.blockLength = cursor.fixed(1); break; // block1
+    case 0x0b: case 0x0c: value.number = cursor.fixed(1); return true; // data1, flag
+    case 0x0d: value.number = (uint64_t)cursor.sleb(); return true; // sdata
+    case DW_FORM_STRP: case DW_FORM_LINE_STRP: {
+      value.number = cursor.fixed(4);
+      const Section* section = form == DW_FORM_STRP ? strings.str : strings.lineStr;
+      if (section && value.number < section->size)
+        value.text = readString(bytes, section->offset + value.number);
+      return true;
+    }
+    case 0x0f: value.number = cursor.uleb(); return true; // udata
+    case DW_FORM_REF_ADDR: value.number = cursor.fixed(version <= 2 ? addressSize : 4); return true;
+    case 0x11: value.number = cursor.fixed(1); value.isReference = true; return true; // ref1
+    case 0x12: value.number = cursor.fixed(2); value.isReference = true; return true; // ref2
+    case 0x13: value.number = cursor.fixed(4); value.isReference = true; return true; // ref4
+    case 0x14: value.number = cursor.fixed(8); value.isReference = true; return true; // ref8
+    case 0x15: value.number = cursor.uleb(); value.isReference = true; return true; // ref_udata
+    case 0x16: return readForm(cursor, (uint32_t)cursor.uleb(), addressSize, version, implicitConst, strings, value);
+    case 0x17: case 0x1c: case 0x1d: case 0x1f20: case 0x1f21: value.number = cursor.fixed(4); return true;
+    case 0x19: value.number = 1; return true; // flag_present
+    case 0x1a: case 0x1b: case 0x22: case 0x23: case 0x1f01: case 0x1f02: value.number = cursor.uleb(); return true;
+    case 0x1e: cursor.position += 16; return true; // data16
+    case 0x20: case 0x24: value.number = cursor.fixed(8); return true; // ref_sig8, ref_sup8
+    case DW_FORM_IMPLICIT_CONST: value.number = (uint64_t)implicitConst; return true;
+    case 0x25: case 0x29: value.number = cursor.fixed(1); return true; // strx1, addrx1
+    case 0x26: case 0x2a: value.number = cursor.fixed(2); return true; // strx2, addrx2
+    case 0x27: case 0x2b: value.number = cursor.fixed(3); return true; // strx3, addrx3
+    case 0x28: case 0x2c: value.number = cursor.fixed(4); return true; // strx4, addrx4
+    default: return false;
+  }
+  value.blockStart = cursor.position;
+  cursor.position += value.blockLength;
+  return true;
+}
+
+struct AttributeSpec
+{
+  uint32_t attribute;
+  uint32_t form;
+  int64_t implicitConst;
+};
+
+struct Abbreviation
+{
+  uint32_t tag;
+  bool hasChildren;
+  std::vector<AttributeSpec> attributes;
+};
+
+static void readAbbreviations(const Image& image, const Section& abbrev, uint64_t offset,
+  std::map<uint64_t, Abbreviation>& table) {
+  Cursor cursor = {&image.bytes, abbrev.offset + offset, (size_t)abbrev.offset + abbrev.size};
+  while (!cursor.atEnd()) {
+    uint64_t code = cursor.uleb();
+    if (code == 0)
+      break;
+    Abbreviation& abbreviation = table[code];
+    abbreviation.tag = (uint32_t)cursor.uleb();
+    abbreviation.hasChildren = cursor.fixed(1) != 0;
+    while (!cursor.atEnd()) {
+      AttributeSpec spec;
+      spec.attribute = (uint32_t)cursor.uleb();
+      spec.form = (uint32_t)cursor.uleb();
+      spec.implicitConst = spec.form == DW_FORM_IMPLICIT_CONST ? cursor.sleb() : 0;
+      if (spec.attribute == 0 && spec.form == 0)
+        break;
+      abbreviation.attributes.push_back(spec);
+    }
+  }
+}
+
+// the file names of a line program header, indexed like DW_AT_decl_file (from 1 before DWARF 5, from 0 since)
+static std::vector<std::string> readLineFiles(const Image& image, const Section& line, uint64_t offset,
+  const DwarfStrings& strings) {
+  std::vector<std::string> files;
+  Cursor cursor = {&image.bytes, line.offset + offset, (size_t)line.offset + line.size};
+  uint64_t length = cursor.fixed(4);
+  if (length >= 0xfffffff0) // 64-bit DWARF, not on a 32-bit target
+    return files;
+  cursor.end = std::min(cursor.end, (size_t)(cursor.position + length));
+  int version = (int)cursor.fixed(2);
+  int addressSize = 4;
+  if (version >= 5) {
+    addressSize = (int)cursor.fixed(1);
+    cursor.fixed(1); // segment selector size
+  }
+  cursor.fixed(4); // header length
+  cursor.fixed(version >= 4 ? 2 : 1); // minimum instruction length, maximum operations per instruction
+  cursor.fixed(3); // default is_stmt, line base, line range
+  int opcodeBase = (int)cursor.fixed(1);
+  cursor.position += opcodeBase > 0 ? opcodeBase - 1 : 0;
+  if (version < 5) {
+    while (!cursor.atEnd() && !cursor.string().empty()) // include directories
+      ;
+    files.push_back(""); // file 0 is the unit itself
+    while (!cursor.atEnd()) {
+      std::string name = cursor.string();
+      if (name.empty())
+        break;
+      cursor.uleb(); // directory
+      cursor.uleb(); // modification time
+      cursor.uleb(); // length
+      files.push_back(name);
+    }
+    return files;
+  }
+  FormValue value;
+  for (int table = 0; table < 2; table++) { // directories, then files
+    std::vector<std::pair<uint32_t, uint32_t>> format;
+    int formatCount = (int)cursor.fixed(1);
+    for (int n = 0; n < formatCount; n++) {
+      uint32_t content = (uint32_t)cursor.uleb();
+      format.push_back(std::make_pair(content, (uint32_t)cursor.uleb()));
+    }
+    uint64_t count = cursor.uleb();
+    for (uint64_t n = 0; n < count && !cursor.atEnd(); n++) {
+      std::string path;
+      for (const std::pair<uint32_t, uint32_t>& entry : format) {
+        if (!readForm(cursor, entry.second, addressSize, version, 0, strings, value))
+          return files;
+        if (entry.first == DW_LNCT_PATH)
+          path = value.text;
+      }
+      if (table == 1)
+        files.push_back(path);
+    }
+  }
+  return files;
+}
+
+// what the debug info says about one entry, for following DW_AT_specification and DW_AT_abstract_origin
+struct DebugEntry
+{
+  std::string file; // declared in, empty if not given
+  uint64_t origin = 0; // the entry this one completes, 0 if none
+  std::string unitFile; // the unit's own source file
+};
+
+// the source file of every function and variable with an address, from the .debug_info units
+static std::map<uint32_t, std::string> readDeclarationFiles(const Image& image) {
+  std::map<uint32_t, std::string> filesByAddress;
+  const Section* info = findSection(image, ".debug_info");
+  const Section* abbrev = findSection(image, ".debug_abbrev");
+  const Section* line = findSection(image, ".debug_line");
+  if (!info || !abbrev)
+    return filesByAddress;
+  DwarfStrings strings;
+  strings.str = findSection(image, ".debug_str");
+  strings.lineStr = findSection(image, ".debug_line_str");
+
+  std::map<uint64_t, DebugEntry> entries; // by offset in .debug_info
+  std::vector<std::pair<uint32_t, uint64_t>> addressed; // address, entry
+  Cursor cursor = {&image.bytes, info->offset, (size_t)info->offset + info->size};
+  while (!cursor.atEnd()) {
+    size_t unitStart = cursor.position;
+    uint64_t length = cursor.fixed(4);
+    if (length == 0 || length >= 0xfffffff0)
+      break;
+    size_t unitEnd = cursor.position + length;
+    int version = (int)cursor.fixed(2);
+    uint64_t abbrevOffset;
+    int addressSize;
+    if (version >= 5) {
+      int unitType = (int)cursor.fixed(1);
+      addressSize = (int)cursor.fixed(1);
+      abbrevOffset = cursor.fixed(4);
+      if (unitType == 2 || unitType == 6) // type units: signature and type offset
+        cursor.position += 12;
+      else if (unitType == 4 || unitType == 5) // skeleton and split units: DWO id
+        cursor.position += 8;
+    } else {
+      abbrevOffset = cursor.fixed(4);
+      addressSize = (int)cursor.fixed(1);
+    }
+    std::map<uint64_t, Abbreviation> table;
+    readAbbreviations(image, *abbrev, abbrevOffset, table);
+    std::vector<std::string> files;
+    std::string unitFile;
+    FormValue value;
+    Cursor unit = {&image.bytes, cursor.position, unitEnd};
+    while (!unit.atEnd()) {
+      uint64_t entryOffset = unit.position - info->offset;
+      uint64_t code = unit.uleb();
+      if (code == 0)
+        continue;
+      std::map<uint64_t, Abbreviation>::const_iterator found = table.find(code);
+      if (found == table.end())
+        break; // corrupt, give up on the unit
+      const Abbreviation& abbreviation = found->second;
+      DebugEntry entry;
+      bool hasFile = false;
+      int64_t address = -1;
+      bool readable = true;
+      for (const AttributeSpec& spec : abbreviation.attributes) {
+        if (!readForm(unit, spec.form, addressSize, version, spec.implicitConst, strings, value)) {
+          readable = false;
+          break;
+        }
+        if (abbreviation.tag == DW_TAG_COMPILE_UNIT) {
+          if (spec.attribute == DW_AT_NAME)
+            unitFile = value.text[0] == '<' ? "" : baseName(value.text); // "<artificial>" for LTO partitions
+          else if (spec.attribute == DW_AT_STMT_LIST && line)
+            files = readLineFiles(image, *line, value.number, strings);
+        } else if (spec.attribute == DW_AT_DECL_FILE) {
+          hasFile = value.number < files.size() && !files[value.number].empty();
+          entry.file = hasFile ? baseName(files[value.number]) : "";
+        } else if (spec.attribute == DW_AT_SPECIFICATION || spec.attribute == DW_AT_ABSTRACT_ORIGIN) {
+          entry.origin = value.isReference ? unitStart - info->offset + value.number : value.number;
+        } else if (spec.attribute == DW_AT_LOW_PC && spec.form == DW_FORM_ADDR
+            && abbreviation.tag == DW_TAG_SUBPROGRAM) {
+          address = (int64_t)value.number;
+        } else if (spec.attribute == DW_AT_LOCATION && abbreviation.tag == DW_TAG_VARIABLE
+            && value.blockLength == 1 + (size_t)addressSize && read8(image.bytes, value.blockStart) == DW_OP_ADDR) {
+          Cursor expression = {&image.bytes, value.blockStart + 1, value.blockStart + value.blockLength};
+          address = (int64_t)expression.fixed(addressSize);
+        }
+      }
+      if (!readable)
+        break; // an unknown form, the rest of the unit cannot be read
+      entry.unitFile = unitFile;
+      if (hasFile || entry.origin)
+        entries[entryOffset] = entry;
+      if (address >= 0) {
+        entries[entryOffset] = entry;
+        addressed.push_back(std::make_pair((uint32_t)address, entryOffset));
+      }
+    }
+    cursor.position = unitEnd;
+  }
+
+  for (const std::pair<uint32_t, uint64_t>& item : addressed) {
+    std::string file;
+    std::string unitFile = entries[item.second].unitFile;
+    uint64_t offset = item.second;
+    for (int hops = 0; hops < 8 && file.empty(); hops++) {
+      std::map<uint64_t, DebugEntry>::const_iterator found = entries.find(offset);
+      if (found == entries.end())
+        break;
+      file = found->second.file;
+      offset = found->second.origin;
+      if (!offset)
+        break;
+    }
+    if (!filesByAddress.count(item.first) || filesByAddress[item.first].empty())
+      filesByAddress[item.first] = file.empty() ? unitFile : file;
+  }
+  return filesByAddress;
+}
+
+// stack ----
+
+struct Call
+{
+  uint32_t target; // byte address
+  int bytes; // stack in use in the caller at the call, with the return address
+};
+
+struct Function
+{
+  std::string name;
+  uint32_t start; // byte address
+  uint32_t end;
+  int frame = 0; // deepest the function itself goes: saved registers, locals, pushed arguments
+  std::vector<Call> calls; // direct calls and tail calls
+  std::vector<int> indirectCalls; // stack in use at each icall, with the return address
+  bool indirectJump = false; // an ijmp out of the function (not a jump table)
+  bool enablesInterrupts = false; // sei
+};
+
+// deepest path from a function, filled in by stackDepth()
+struct Depth
+{
+  int bytes = 0;
+  bool lowerBound = false; // an indirect call without targets or recursion on the way
+  int next = -1; // function on the deepest path, -1 at its end
+  bool enablesInterrupts = false; // somewhere on any path
+  std::vector<std::string> unresolved; // functions with indirect calls without targets
+};
+
+static bool isTwoWordInstruction(uint32_t word) {
+  return (word & 0xFE0C) == 0x940C // jmp, call
+    || (word & 0xFC0F) == 0x9000; // lds, sts
+}
+
+// one pass over a function's code, see the notes at the top
+static void analyzeFunction(const std::vector<uint8_t>& bytes, uint32_t fileOffset, Function& function) {
+  int base = 0; // bytes the prologue takes
+  int pending = 0; // bytes pushed since, e.g. varargs arguments
+  bool inPrologue = true;
+  bool framePointerLoaded = false; // in r28, SPL seen, the next sbiw or subi on r28 allocates the frame
+  for (uint32_t pc = function.start; pc < function.end; pc += 2) {
+    uint32_t word = read16(bytes, fileOffset + pc);
+    uint32_t next = read16(bytes, fileOffset + pc + 2);
+    int* grows = inPrologue ? &base : &pending;
+    bool controlFlow = false;
+    if ((word & 0xFE0F) == 0x920F) { // push
+      *grows += 1;
+    } else if ((word & 0xFE0F) == 0x900F) { // pop
+      pending = pending > 0 ? pending - 1 : 0;
+    } else if ((word & 0xF800) == 0xB000 && ((word >> 4) & 0x1F) == 28
+        && (((word >> 5) & 0x30) | (word & 0xF)) == 0x3D) { // in r28, SPL
+      framePointerLoaded = true;
+    } else if (framePointerLoaded && (word & 0xFF30) == 0x9720) { // sbiw r28, K
+      *grows += ((word >> 2) & 0x30) | (word & 0xF);
+      framePointerLoaded = false;
+    } else if (framePointerLoaded && (word & 0xF0F0) == 0x50C0) { // subi r28, K: the low byte of a large frame
+      *grows += ((word >> 4) & 0xF0) | (word & 0xF);
+    } else if (framePointerLoaded && (word & 0xF0F0) == 0x40D0) { // sbci r29, K: its high byte
+      *grows += (((word >> 4) & 0xF0) | (word & 0xF)) << 8;
+      framePointerLoaded = false;
+    } else if ((word & 0xF800) == 0xB800 && (((word >> 5) & 0x30) | (word & 0xF)) == 0x3D) { // out SPL, r
+      if (!inPrologue)
+        pending = 0; // the stack pointer moved back, arguments released or the frame torn down
+    } else if (word == 0xD000) { // rcall .+0, allocates 2 bytes
+      *grows += RETURN_ADDRESS_BYTES;
+    } else if ((word & 0xFE0E) == 0x940E) { // call
+      uint32_t target = ((((word >> 3) & 0x3E) | (word & 1)) << 16 | next)*2;
+      function.calls.push_back({target, base + pending + RETURN_ADDRESS_BYTES});
+      controlFlow = true;
+    } else if ((word & 0xF000) == 0xD000) { // rcall
+      int offset = (word & 0x800) ? (int)(word & 0xFFF) - 0x1000 : (int)(word & 0xFFF);
+      function.calls.push_back({pc + 2 + offset*2, base + pending + RETURN_ADDRESS_BYTES});
+      controlFlow = true;
+    } else if ((word & 0xFE0E) == 0x940C || (word & 0xF000) == 0xC000) { // jmp, rjmp
+      uint32_t target;
+      if ((word & 0xF000) == 0xC000) {
+        int offset = (word & 0x800) ? (int)(word & 0xFFF) - 0x1000 : (int)(word & 0xFFF);
+        target = pc + 2 + offset*2;
+      } else {
+        target = ((((word >> 3) & 0x3E) | (word & 1)) << 16 | next)*2;
+      }
+      if (target < function.start || target >= function.end)
+        function.calls.push_back({target, 0}); // tail call: the frame is already gone
+      controlFlow = true;
+    } else if (word == 0x9509 || word == 0x9519) { // icall, eicall
+      function.indirectCalls.push_back(base + pending + RETURN_ADDRESS_BYTES);
+      controlFlow = true;
+    } else if (word == 0x9409 || word == 0x9419) { // ijmp, eijmp
+      function.indirectJump = function.name.compare(0, 11, "__tablejump") != 0; // libgcc's switch tables jump back
+      controlFlow = true;
+    } else if (word == 0x9478) { // sei
+      function.enablesInterrupts = true;
+    } else if ((word & 0xF800) == 0xF000 || (word & 0xFC00) == 0x1000 || (word & 0xFC00) == 0xFC00
+        || (word & 0xFD00) == 0x9900 || word == 0x9508 || word == 0x9518) { // branches, skips, ret, reti
+      controlFlow = true;
+    }
+    if (controlFlow)
+      inPrologue = false;
+    function.frame = std::max(function.frame, base + pending);
+    if (isTwoWordInstruction(word))
+      pc += 2;
+  }
+}
+
+static int findFunction(const std::vector<Function>& functions, uint32_t address) {
+  size_t low = 0;
+  size_t high = functions.size();
+  while (low < high) {
+    size_t middle = (low + high)/2;
+    if (functions[middle].end <= address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low < functions.size() && functions[low].start <= address ? (int)low : -1;
+}
+
+// every sized function in flash, with its calls
+static std::vector<Function> readFunctions(const Image& image) {
+  std::vector<Function> functions;
+  for (const Symbol& symbol : image.symbols) {
+    if (!symbol.isFunction || symbol.memory != MEMORY_FLASH || symbol.size == 0)
+      continue;
+    Function function;
+    function.name = symbol.name;
+    function.start = symbol.address;
+    function.end = symbol.address + symbol.size;
+    functions.push_back(function);
+  }
+  std::sort(functions.begin(), functions.end(), [](const Function& a, const Function& b) {
+    return a.start < b.start;
+  });
+  for (Function& function : functions) {
+    for (const Section& section : image.sections) {
+      if (section.memory == MEMORY_FLASH && section.address <= function.start
+          && function.end <= section.address + section.size) {
+        analyzeFunction(image.bytes, section.offset - section.address, function);
+        break;
+      }
+    }
+  }
+  return functions;
+}
+
+// a function name as given to --indirect: the demangled name, or without its parameters
+static bool nameMatches(const std::string& name, const std::string& pattern) {
+  if (name == pattern)
+    return true;
+  size_t parameters = name.find('(');
+  return parameters != std::string::npos && name.compare(0, parameters, pattern) == 0
+    && parameters == pattern.size();
+}
+
+static const Depth& stackDepth(const std::vector<Function>& functions,
+  const std::map<int, std::vector<int>>& indirectTargets, int index, std::vector<Depth>& depths,
+  std::vector<int>& state, int level) {
+  Depth& depth = depths[index];
+  if (state[index] == 2)
+    return depth;
+  if (state[index] == 1 || level > MAX_CALL_DEPTH) { // recursion
+    static Depth recursion;
+    recursion.lowerBound = true;
+    return recursion;
+  }
+  state[index] = 1;
+  const Function& function = functions[index];
+  depth.bytes = function.frame;
+  depth.enablesInterrupts = function.enablesInterrupts;
+  std::vector<Call> calls = function.calls;
+  std::map<int, std::vector<int>>::const_iterator targets = indirectTargets.find(index);
+  for (int bytes : function.indirectCalls) {
+    if (targets == indirectTargets.end())
+      continue;
+    for (int target : targets->second)
+      calls.push_back({functions[target].start, bytes});
+  }
+  if ((!function.indirectCalls.empty() || function.indirectJump) && targets == indirectTargets.end()) {
+    depth.lowerBound = true;
+    depth.unresolved.push_back(function.name);
+  }
+  for (const Call& call : calls) {
+    int callee = findFunction(functions, call.target);
+    if (callee < 0)
+      continue; // into code without a symbol size, e.g. startup code
+    const Depth& calleeDepth = stackDepth(functions, indirectTargets, callee, depths, state, level + 1);
+    if (call.bytes + calleeDepth.bytes > depth.bytes) {
+      depth.bytes = call.bytes + calleeDepth.bytes;
+      depth.next = callee;
+    }
+    depth.lowerBound = depth.lowerBound || calleeDepth.lowerBound;
+    depth.enablesInterrupts = depth.enablesInterrupts || calleeDepth.enablesInterrupts;
+    for (const std::string& name : calleeDepth.unresolved) {
+      if (std::find(depth.unresolved.begin(), depth.unresolved.end(), name) == depth.unresolved.end())
+        depth.unresolved.push_back(name);
+    }
+  }
+  state[index] = 2;
+  return depth;
+}
+
+static std::string describePath(const std::vector<Function>& functions, const std::vector<Depth>& depths, int index) {
+  std::string path;
+  for (int n = index, hops = 0; n >= 0 && hops < MAX_CALL_DEPTH; n = depths[n].next, hops++)
+    path += (path.empty() ? "" : " > ") + functions[n].name;
+  return path;
+}
+
+// report ----
+
+struct Totals
+{
+  long flash = 0;
+  long ram = 0;
+  int isrStack = -1; // deepest interrupt handler, -1 without stack analysis
+  int mainStack = -1;
+  long freeRam = 0; // after the variables and both stacks
+};
+
+static long flashBytes(int memory, uint32_t size) {
+  return memory == MEMORY_FLASH || memory == MEMORY_FLASH_RAM ? size : 0;
+}
+
+static long ramBytes(int memory, uint32_t size) {
+  return memory == MEMORY_FLASH_RAM || memory == MEMORY_RAM ? size : 0;
+}
+
+static void printUnits(const Image& image, const Totals& totals) {
+  struct Unit
+  {
+    long flash = 0;
+    long ram = 0;
+    int symbols = 0;
+  };
+  std::map<std::string, Unit> units;
+  long flashInSymbols = 0;
+  long ramInSymbols = 0;
+  for (const Symbol& symbol : image.symbols) {
+    Unit& unit = units[symbol.unit.empty() ? "(no debug info)" : symbol.unit];
+    unit.flash += flashBytes(symbol.memory, symbol.size);
+    unit.ram += ramBytes(symbol.memory, symbol.size);
+    unit.symbols++;
+    flashInSymbols += flashBytes(symbol.memory, symbol.size);
+    ramInSymbols += ramBytes(symbol.memory, symbol.size);
+  }
+  std::vector<std::pair<std::string, Unit>> sorted(units.begin(), units.end());
+  std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Unit>& a, const std::pair<std::string, Unit>& b) {
+    return a.second.flash + a.second.ram > b.second.flash + b.second.ram;
+  });
+  printf("\n%-32s %8s %8s %8s\n", "translation unit", "flash", "RAM", "symbols");
+  for (const std::pair<std::string, Unit>& unit : sorted)
+    printf("%-32s %8ld %8ld %8d\n", unit.first.c_str(), unit.second.flash, unit.second.ram, unit.second.symbols);
+  printf("%-32s %8ld %8ld\n", "(outside symbols)", totals.flash - flashInSymbols, totals.ram - ramInSymbols);
+}
+
+static void printLargest(const Image& image, bool byRam, int top) {
+  std::vector<const Symbol*> sorted;
+  for (const Symbol& symbol : image.symbols) {
+    if ((byRam ? ramBytes(symbol.memory, symbol.size) : flashBytes(symbol.memory, symbol.size)) > 0)
+      sorted.push_back(&symbol);
+  }
+  std::sort(sorted.begin(), sorted.end(), [](const Symbol* a, const Symbol* b) {
+    return a->size > b->size || (a->size == b->size && a->name < b->name);
+  });
+  printf("\nlargest symbols in %s:\n", byRam ? "RAM" : "flash");
+  for (int n = 0; n < top && n < (int)sorted.size(); n++) {
+    std::string name = sorted[n]->name.size() > 60 ? sorted[n]->name.substr(0, 57) + "..." : sorted[n]->name;
+    printf("%8u  %-60s %s\n", sorted[n]->size, name.c_str(), sorted[n]->unit.c_str());
+  }
+}
+
+static std::string formatDepth(const Depth& depth) {
+  return (depth.lowerBound ? ">=" : "") + std::to_string(depth.bytes);
+}
+
+// the deepest interrupt handler and main(), filled into totals
+static void printStack(const Image& image, const std::map<std::string, std::vector<std::string>>& indirect,
+  Totals& totals) {
+  std::vector<Function> functions = readFunctions(image);
+  std::map<int, std::vector<int>> indirectTargets; // function, the functions its icalls reach
+  for (const std::pair<const std::string, std::vector<std::string>>& item : indirect) {
+    for (size_t caller = 0; caller < functions.size(); caller++) {
+      if (!nameMatches(functions[caller].name, item.first))
+        continue;
+      std::vector<int>& targets = indirectTargets[(int)caller];
+      for (const std::string& targetName : item.second) {
+        bool found = false;
+        for (size_t target = 0; target < functions.size(); target++) {
+          if (nameMatches(functions[target].name, targetName)) {
+            targets.push_back((int)target);
+            found = true;
+          }
+        }
+        if (!found)
+          fprintf(stderr, "--indirect: no function %s\n", targetName.c_str());
+      }
+    }
+  }
+  std::vector<Depth> depths(functions.size());
+  std::vector<int> state(functions.size(), 0);
+
+  printf("\n%-14s %-12s %8s  %s\n", "stack", "function", "bytes", "deepest path");
+  std::vector<std::string> unresolved;
+  bool nests = false;
+  for (size_t n = 0; n < functions.size(); n++) {
+    int vector;
+    char rest;
+    if (sscanf(functions[n].name.c_str(), "__vector_%d%c", &vector, &rest) != 1)
+      continue;
+    const Depth& depth = stackDepth(functions, indirectTargets, (int)n, depths, state, 0);
+    Depth isr = depth;
+    isr.bytes += RETURN_ADDRESS_BYTES;
+    printf("%-14s %-12s %8s  %s\n", vector < NUM_VECTORS ? VECTOR_NAMES[vector] : "?", functions[n].name.c_str(),
+      formatDepth(isr).c_str(), describePath(functions, depths, (int)n).c_str());
+    totals.isrStack = std::max(totals.isrStack, isr.bytes);
+    unresolved.insert(unresolved.end(), depth.unresolved.begin(), depth.unresolved.end());
+    nests = nests || depth.enablesInterrupts;
+  }
+  int mainIndex = -1;
+  for (size_t n = 0; n < functions.size(); n++)
+    mainIndex = functions[n].name == "main" ? (int)n : mainIndex;
+  if (mainIndex >= 0) {
+    Depth main = stackDepth(functions, indirectTargets, mainIndex, depths, state, 0);
+    main.bytes += RETURN_ADDRESS_BYTES; // called from the startup code
+    totals.mainStack = main.bytes;
+    printf("%-14s %-12s %8s  %s\n", "main", "main", formatDepth(main).c_str(),
+      describePath(functions, depths, mainIndex).c_str());
+    unresolved.insert(unresolved.end(), main.unresolved.begin(), main.unresolved.end());
+  }
+  std::sort(unresolved.begin(), unresolved.end());
+  unresolved.erase(std::unique(unresolved.begin(), unresolved.end()), unresolved.end());
+  if (!unresolved.empty()) {
+    printf("indirect calls without --indirect targets, the depths through them are lower bounds:\n");
+    for (const std::string& name : unresolved)
+      printf("  %s\n", name.c_str());
+  }
+  if (nests)
+    printf("an interrupt handler enables interrupts (sei), handlers can nest: the depths above do not include that\n");
+}
+
+static std::string gitLabel() {
+  std::string label;
+  FILE* pipe = popen("git describe --always --dirty 2>/dev/null", "r");
+  if (!pipe)
+    return "unknown";
+  char buffer[128];
+  while (fgets(buffer, sizeof(buffer), pipe))
+    label += buffer;
+  pclose(pipe);
+  while (!label.empty() && (label.back() == '\n' || label.back() == '\r'))
+    label.pop_back();
+  return label.empty() ? "unknown" : label;
+}
+
+// rewrites the history without an older entry of the same label, with this one at the end
+static bool appendHistory(const char* path, const std::string& label, const Totals& totals) {
+  const char* HEADER = "label,flash,ram,isr_stack,main_stack,free_ram";
+  std::vector<std::string> lines;
+  FILE* file = fopen(path, "r");
+  if (file) {
+    char buffer[512];
+    while (fgets(buffer, sizeof(buffer), file)) {
+      std::string line = buffer;
+      while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+        line.pop_back();
+      if (!line.empty() && line != HEADER && line.compare(0, label.size() + 1, label + ",") != 0)
+        lines.push_back(line);
+    }
+    fclose(file);
+  }
+  if (!lines.empty()) {
+    char previous[128];
+    long flash, ram, freeRam;
+    int isrStack, mainStack;
+    if (sscanf(lines.back().c_str(), "%127[^,],%ld,%ld,%d,%d,%ld", previous, &flash, &ram, &isrStack, &mainStack,
+        &freeRam) == 6)
+      printf("\nsince %s: flash %+ld, RAM %+ld, ISR stack %+d, main stack %+d, free RAM %+ld bytes\n", previous,
+        totals.flash - flash, totals.ram - ram, totals.isrStack - isrStack, totals.mainStack - mainStack,
+        totals.freeRam - freeRam);
+  }
+  char line[256];
+  snprintf(line, sizeof(line), "%s,%ld,%ld,%d,%d,%ld", label.c_str(), totals.flash, totals.ram, totals.isrStack,
+    totals.mainStack, totals.freeRam);
+  lines.push_back(line);
+  file = fopen(path, "w");
+  if (!file)
+    return false;
+  fprintf(file, "%s\n", HEADER);
+  for (const std::string& entry : lines)
+    fprintf(file, "%s\n", entry.c_str());
+  return fclose(file) == 0;
+}
+
+int main(int argc, char** argv) {
+  long flashSize = 32256;
+  long ramSize = 2048;
+  long flashBudget = -1;
+  long ramBudget = -1;
+  long stackBudget = -1;
+  int top = 15;
+  const char* historyPath = nullptr;
+  std::string label;
+  std::map<std::string, std::vector<std::string>> indirect; // caller, targets
+  const char* elfPath = nullptr;
+  for (int n = 1; n < argc; n++) {
+    const char* option = argv[n];
+    if (strncmp(option, "--", 2) != 0 && !elfPath) {
+      elfPath = option;
+      continue;
+    }
+    const char* value = n + 1 < argc ? argv[++n] : nullptr;
+    const char* equals = value ? strchr(value, '=') : nullptr;
+    if (value && strcmp(option, "--flash-size") == 0)
+      flashSize = atol(value);
+    else if (value && strcmp(option, "--ram-size") == 0)
+      ramSize = atol(value);
+    else if (value && strcmp(option, "--flash-budget") == 0)
+      flashBudget = atol(value);
+    else if (value && strcmp(option, "--ram-budget") == 0)
+      ramBudget = atol(value);
+    else if (value && strcmp(option, "--stack-budget") == 0)
+      stackBudget = atol(value);
+    else if (value && strcmp(option, "--top") == 0)
+      top = atoi(value);
+    else if (value && strcmp(option, "--history") == 0)
+      historyPath = value;
+    else if (value && strcmp(option, "--label") == 0)
+      label = value;
+    else if (equals && strcmp(option, "--indirect") == 0) {
+      std::vector<std::string>& targets = indirect[std::string(value, equals - value)];
+      std::string target;
+      int parentheses = 0; // commas inside a parameter list belong to the name
+      for (const char* c = equals + 1; *c; c++) {
+        parentheses += *c == '(' ? 1 : *c == ')' ? -1 : 0;
+        if (*c == ',' && parentheses == 0) {
+          targets.push_back(target);
+          target.clear();
+        } else {
+          target += *c;
+        }
+      }
+      targets.push_back(target);
+    } else {
+      elfPath = nullptr;
+      break;
+    }
+  }
+  if (!elfPath) {
+    fprintf(stderr, "usage: %s [--flash-size BYTES] [--ram-size BYTES] [--flash-budget BYTES] [--ram-budget BYTES]"
+      " [--stack-budget BYTES] [--indirect CALLER=TARGET[,TARGET...]]... [--top N] [--history FILE] [--label TEXT]"
+      " firmware.elf\n", argv[0]);
+    return 1;
+  }
+
+  Image image;
+  if (!readImage(elfPath, image)) {
+    fprintf(stderr, "cannot read %s\n", elfPath);
+    return 1;
+  }
+  Totals totals;
+  for (const Section& section : image.sections) {
+    totals.flash += flashBytes(section.memory, section.size);
+    totals.ram += ramBytes(section.memory, section.size);
+  }
+  std::map<uint32_t, std::string> files = readDeclarationFiles(image);
+  for (Symbol& symbol : image.symbols) {
+    std::map<uint32_t, std::string>::const_iterator found = files.find(symbol.address);
+    symbol.unit = found == files.end() ? "" : found->second;
+  }
+
+  printf("%s: flash %ld of %ld bytes (%.1f %%), RAM %ld of %ld bytes (%.1f %%) in variables\n", elfPath,
+    totals.flash, flashSize, 100.0*totals.flash/flashSize, totals.ram, ramSize, 100.0*totals.ram/ramSize);
+  if (files.empty())
+    printf("no DWARF debug info, build with -g to see the translation units\n");
+  printUnits(image, totals);
+  printLargest(image, false, top);
+  printLargest(image, true, top);
+  if (image.machine == EM_AVR_MACHINE) {
+    printStack(image, indirect, totals);
+    totals.freeRam = ramSize - totals.ram - std::max(totals.mainStack, 0) - std::max(totals.isrStack, 0);
+    printf("worst case: %ld bytes of variables, %d of main() and %d of an interrupt handler leave %ld bytes free\n",
+      totals.ram, std::max(totals.mainStack, 0), std::max(totals.isrStack, 0), totals.freeRam);
+  } else {
+    totals.freeRam = ramSize - totals.ram;
+    printf("\nnot an AVR ELF file, no stack analysis\n");
+  }
+
+  if (historyPath) {
+    if (!appendHistory(historyPath, label.empty() ? gitLabel() : label, totals)) {
+      fprintf(stderr, "cannot write %s\n", historyPath);
+      return 1;
+    }
+  }
+  bool over = false;
+  if (totals.flash > flashSize) {
+    printf("over budget: %ld bytes of flash, there are %ld\n", totals.flash, flashSize);
+    over = true;
+  }
+  if (flashBudget >= 0 && totals.flash > flashBudget) {
+    printf("over budget: %ld bytes of flash, the budget is %ld\n", totals.flash, flashBudget);
+    over = true;
+  }
+  if (ramBudget >= 0 && totals.ram > ramBudget) {
+    printf("over budget: %ld bytes of RAM in variables, the budget is %ld\n", totals.ram, ramBudget);
+    over = true;
+  }
+  if (stackBudget >= 0 && totals.isrStack > stackBudget) {
+    printf("over budget: an interrupt handler can take %d bytes of stack, the budget is %ld\n", totals.isrStack,
+      stackBudget);
+    over = true;
+  }
+  if (totals.freeRam < 0) {
+    printf("over budget: the worst case needs %ld bytes more RAM than there is\n", -totals.freeRam);
+    over = true;
+  }
+  return over ? 2 : 0;
+}
@@ -0,0 +1,451 @@
+/*
+  GoldenTool.cpp - Replays recorded telemetry through the sketch's IC step and checks it against a golden trace
+  Released into the public domain.
+
+  usage: atv-golden [options] CAPTURE...
+    --record FILE     writes the decisions as a golden trace
+    --check FILE      compares the decisions with a golden trace, exits 1 if any differ
+    --context N       records shown around a difference (default: 3)
+    --max-diffs N     differences shown, the rest only counted (default: 10)
+    --ver N           voltage error range, mV (default: the sketch's 10)
+    --cer N           current error range, mA (default: the sketch's 10)
+    --dci N           duty cycle increment, % (default: the sketch's 1)
+    --from-power-up   starts from the state setup() leaves, instead of the first record
+    --follow          takes the duty cycle every step starts from from the record before it
+
+  A CAPTURE is a data.json written by UART.py, a telemetry archive (.atv, e.g.
+  the raw-*.atv segments of an atverterd store) or a UART log as the
+  firmware prints it, plain or in deadband mode (the skipped records are
+  filled with the held values, like atverterd does). Several are replayed as
+  one, in the order given.
+
+  Every record holds the battery side voltage and current the IC step of its
+  MPPT period ran on, and the duty cycle it set. The replay feeds them, in
+  order, through IncrementalConductance (the firmware library, compiled for
+  the host) and collects the duty cycle and the decision of every step. By
+  default the first record only seeds the step, with its duty cycle and its
+  measurements; --from-power-up steps it too, from duty cycle 50 and no
+  previous measurements. --follow seeds every step with the recorded duty
+  cycle of the record before it, so one shutdown, or one step down at the
+  charge setpoint, in the capture does not move every later step.
+
+  --record writes the settings and one line per record, duty cycle and
+  decision, to a golden trace. --check replays with the settings of the
+  golden trace and reports every record whose decision differs, with the
+  records around it (tick, or host time, measurements, the recorded duty
+  cycle, expected and got), so a change to the control path that is meant
+  to be a refactoring can be shown to decide exactly the same. The summary
+  also gives how often the replayed duty cycle (limited to 1 to 99, like
+  setDutyCycle()) agrees with the recorded one.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "IncrementalConductance.h"
+#include "Telemetry.h"
+#include "TelemetryArchive.h"
+#include "TelemetryDelta.h"
+
+const int GOLDEN_VERSION = 1; // bump when the golden trace layout changes
+
+struct ReplayRecord
+{
+  int64_t timestampUs; // host time, 0 if the capture has none
+  int64_t ticks; // control tick, -1 if the capture has none
+  int32_t voltage; // mV, battery side
+  int32_t current; // mA, battery side
+  int32_t duty; // %, as recorded
+};
+
+struct ReplaySettings
+{
+  int32_t voltageErrorRange = IC_DEFAULT_VOLTAGE_ERROR_RANGE;
+  int32_t currentErrorRange = IC_DEFAULT_CURRENT_ERROR_RANGE;
+  int dutyCycleIncrement = IC_DEFAULT_DUTY_CYCLE_INCREMENT;
+  bool fromPowerUp = false;
+  bool follow = false;
+};
+
+struct Decision
+{
+  uint16_t duty; // the step's duty cycle, before setDutyCycle() limits it
+  int8_t decision; // IcDecisions, -1 for a record that only seeded the replay
+};
+
+// reads a whole file into memory
+static bool readFile(const char* path, std::string& contents) {
+  FILE* file = fopen(path, "rb");
+  if (!file)
+    return false;
+  char buffer[65536];
+  size_t got;
+  while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    contents.append(buffer, got);
+  fclose(file);
+  return true;
+}
+
+// reads one JSON string or bare number starting at p, returns the position after it
+static const char* readJsonToken(const char* p, std::string& token) {
+  token.clear();
+  if (*p == '"') {
+    for (p++; *p && *p != '"'; p++) {
+      if (*p == '\\' && p[1])
+        p++;
+      token += *p;
+    }
+    return *p ? p + 1 : p;
+  }
+  while (*p && *p != ',' && *p != '}' && *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t')
+    token += *p++;
+  return p;
+}
+
+static bool hasSuffix(const char* text, const char* suffix) {
+  size_t length = strlen(text);
+  size_t suffixLength = strlen(suffix);
+  return length >= suffixLength && strcmp(text + length - suffixLength, suffix) == 0;
+}
+
+// the records of a data.json, skipping incomplete ones like UART.py and atv-archive import do
+static bool loadJson(const char* path, std::vector<ReplayRecord>& records) {
+  std::string json;
+  if (!readFile(path, json))
+    return false;
+  std::string key;
+  std::string value;
+  const char* p = json.c_str();
+  while ((p = strchr(p, '{')) != NULL) {
+    ReplayRecord record = {0, -1, 0, 0, 0};
+    int32_t values[NUM_CHANNELS] = {0};
+    unsigned int present = 0;
+    for (p++; *p && *p != '}';) {
+      if (*p != '"') {
+        p++;
+        continue;
+      }
+      p = readJsonToken(p, key);
+      while (*p == ' ' || *p == ':')
+        p++;
+      p = readJsonToken(p, value);
+      if (key == "timestamp") {
+        parseIsoTimestamp(value.c_str(), record.timestampUs);
+      } else {
+        int channel = channelIndex(key.c_str());
+        if (channel >= 0) {
+          values[channel] = atoi(value.c_str());
+          present |= 1u << channel;
+        }
+      }
+    }
+    if ((present & REQUIRED_CHANNELS) != REQUIRED_CHANNELS)
+      continue;
+    record.voltage = values[LOW_SIDE_VOLTAGE];
+    record.current = values[LOW_SIDE_CURRENT];
+    record.duty = values[DUTY_CYCLE];
+    records.push_back(record);
+  }
+  return true;
+}
+
+// the records of a telemetry archive
+static bool loadArchive(const char* path, std::vector<ReplayRecord>& records) {
+  ArchiveReader reader;
+  if (!reader.open(path))
+    return false;
+  std::vector<int64_t> timestamps;
+  std::vector<int32_t> columnData[NUM_CHANNELS];
+  int32_t* columns[NUM_CHANNELS];
+  records.reserve(records.size() + reader.getNumSamples());
+  for (int b = 0; b < reader.getNumBlocks(); b++) {
+    int count = reader.getBlockInfo(b).numSamples;
+    timestamps.resize(count);
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+      columnData[c].resize(count);
+      columns[c] = columnData[c].data();
+    }
+    if (!reader.readBlock(b, timestamps.data(), columns)) {
+      fprintf(stderr, "%s: block %d is corrupt\n", path, b);
+      return false;
+    }
+    for (int n = 0; n < count; n++) {
+      ReplayRecord record = {timestamps[n], -1, columns[LOW_SIDE_VOLTAGE][n], columns[LOW_SIDE_CURRENT][n],
+        columns[DUTY_CYCLE][n]};
+      records.push_back(record);
+    }
+  }
+  return true;
+}
+
+// the records of a UART log, through the deadband decoder like atverterd
+static bool loadLog(const char* path, std::vector<ReplayRecord>& records) {
+  FILE* file = fopen(path, "r");
+  if (!file)
+    return false;
+  TelemetryDeltaDecoder deltas;
+  std::vector<TelemetryLine> decoded;
+  TelemetryLine parsed;
+  bool inShutdown = false;
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    int type = parseTelemetryLine(line, parsed);
+    if (type == LINE_SHUTDOWN_CODE) {
+      if (!inShutdown)
+        deltas.breakSeries(); // the records stop until the latch clears, do not fill the gap
+      inShutdown = true;
+      continue;
+    }
+    if (type != LINE_RECORD && type != LINE_DELTA_RECORD)
+      continue;
+    decoded.clear();
+    if (!deltas.decode(parsed, decoded))
+      continue;
+    for (const TelemetryLine& record : decoded) {
+      ReplayRecord replayRecord = {0, record.ticks, record.sample.values[LOW_SIDE_VOLTAGE],
+        record.sample.values[LOW_SIDE_CURRENT], record.sample.values[DUTY_CYCLE]};
+      records.push_back(replayRecord);
+    }
+    inShutdown = false;
+  }
+  fclose(file);
+  return true;
+}
+
+// the steps the sketch would have taken on the records
+static void replay(const std::vector<ReplayRecord>& records, const ReplaySettings& settings,
+  std::vector<Decision>& decisions) {
+  IncrementalConductance mppt;
+  mppt.setVoltageErrorRange(settings.voltageErrorRange);
+  mppt.setCurrentErrorRange(settings.currentErrorRange);
+  mppt.setDutyCycleIncrement(settings.dutyCycleIncrement);
+  decisions.resize(records.size());
+  size_t first = 0;
+  if (!settings.fromPowerUp && !records.empty()) {
+    mppt.setDutyCycle((uint16_t)records[0].duty);
+    mppt.setPrevious(records[0].voltage, records[0].current);
+    decisions[0].duty = mppt.getDutyCycle();
+    decisions[0].decision = -1;
+    first = 1;
+  }
+  for (size_t n = first; n < records.size(); n++) {
+    if (settings.follow && n > 0)
+      mppt.setDutyCycle((uint16_t)records[n - 1].duty);
+    decisions[n].decision = (int8_t)mppt.step(records[n].voltage, records[n].current);
+    decisions[n].duty = mppt.getDutyCycle();
+  }
+}
+
+static bool writeGolden(const char* path, const ReplaySettings& settings, const std::vector<Decision>& decisions) {
+  FILE* file = fopen(path, "w");
+  if (!file)
+    return false;
+  fprintf(file, "atv-golden %d records %zu ver %ld cer %ld dci %d power-up %d follow %d\n", GOLDEN_VERSION,
+    decisions.size(), (long)settings.voltageErrorRange, (long)settings.currentErrorRange,
+    settings.dutyCycleIncrement, settings.fromPowerUp ? 1 : 0, settings.follow ? 1 : 0);
+  for (const Decision& decision : decisions)
+    fprintf(file, "%u %d\n", decision.duty, decision.decision);
+  return fclose(file) == 0;
+}
+
+static bool readGolden(const char* path, ReplaySettings& settings, std::vector<Decision>& decisions) {
+  FILE* file = fopen(path, "r");
+  if (!file)
+    return false;
+  int version;
+  size_t count;
+  long ver;
+  long cer;
+  int powerUp;
+  int follow;
+  bool ok = fscanf(file, "atv-golden %d records %zu ver %ld cer %ld dci %d power-up %d follow %d\n", &version,
+    &count, &ver, &cer, &settings.dutyCycleIncrement, &powerUp, &follow) == 7 && version == GOLDEN_VERSION;
+  settings.voltageErrorRange = (int32_t)ver;
+  settings.currentErrorRange = (int32_t)cer;
+  settings.fromPowerUp = powerUp != 0;
+  settings.follow = follow != 0;
+  decisions.resize(ok ? count : 0);
+  for (size_t n = 0; ok && n < count; n++) {
+    unsigned int duty;
+    int decision;
+    ok = fscanf(file, "%u %d", &duty, &decision) == 2;
+    decisions[n].duty = (uint16_t)duty;
+    decisions[n].decision = (int8_t)decision;
+  }
+  fclose(file);
+  return ok;
+}
+
+static const char* decisionName(int decision) {
+  return decision >= 0 && decision < NUM_ICDECISIONS ? IC_DECISION_NAMES[decision] : "seed";
+}
+
+static void printContextRow(const std::vector<ReplayRecord>& records, const std::vector<Decision>& expected,
+  const std::vector<Decision>& got, size_t n) {
+  const ReplayRecord& record = records[n];
+  char when[40];
+  if (record.ticks >= 0)
+    snprintf(when, sizeof(when), "tick %lld", (long long)record.ticks);
+  else if (record.timestampUs != 0)
+    formatIsoTimestamp(record.timestampUs, when, sizeof(when));
+  else
+    snprintf(when, sizeof(when), "-");
+  bool differs = expected[n].duty != got[n].duty || expected[n].decision != got[n].decision;
+  printf("%c %9zu  %-26s %7d %7d %5d   %5u %-17s  %5u %s\n", differs ? '>' : ' ', n, when, (int)record.voltage,
+    (int)record.current, (int)record.duty, expected[n].duty, decisionName(expected[n].decision), got[n].duty,
+    decisionName(got[n].decision));
+}
+
+// prints the differing records with their context, merging overlapping stretches like diff does
+static long reportDiffs(const std::vector<ReplayRecord>& records, const std::vector<Decision>& expected,
+  const std::vector<Decision>& got, int context, int maxDiffs) {
+  long differing = 0;
+  long shown = 0;
+  size_t printedUntil = 0; // rows before this were printed
+  for (size_t n = 0; n < records.size(); n++) {
+    if (expected[n].duty == got[n].duty && expected[n].decision == got[n].decision)
+      continue;
+    differing++;
+    if (shown >= maxDiffs)
+      continue;
+    if (shown == 0)
+      printf("  %9s  %-26s %7s %7s %5s   %-23s  %s\n", "record", "tick or time", "V2 mV", "-I2 mA", "duty",
+        "expected", "got");
+    size_t start = n > (size_t)context ? n - context : 0;
+    if (start < printedUntil)
+      start = printedUntil;
+    else if (shown > 0)
+      printf("  ...\n");
+    size_t end = n + context + 1 < records.size() ? n + context + 1 : records.size();
+    for (size_t row = start; row < end; row++)
+      printContextRow(records, expected, got, row);
+    printedUntil = end;
+    shown++;
+  }
+  return differing;
+}
+
+int main(int argc, char** argv) {
+  ReplaySettings settings;
+  bool settingsGiven = false;
+  const char* recordPath = nullptr;
+  const char* checkPath = nullptr;
+  int context = 3;
+  int maxDiffs = 10;
+  std::vector<const char*> captures;
+  for (int n = 1; n < argc; n++) {
+    const char* option = argv[n];
+    if (strcmp(option, "--from-power-up") == 0) {
+      settings.fromPowerUp = settingsGiven = true;
+      continue;
+    }
+    if (strcmp(option, "--follow") == 0) {
+      settings.follow = settingsGiven = true;
+      continue;
+    }
+    if (strncmp(option, "--", 2) != 0) {
+      captures.push_back(option);
+      continue;
+    }
+    const char* value = n + 1 < argc ? argv[++n] : nullptr;
+    if (value && strcmp(option, "--record") == 0)
+      recordPath = value;
+    else if (value && strcmp(option, "--check") == 0)
+      checkPath = value;
+    else if (value && strcmp(option, "--context") == 0)
+      context = atoi(value);
+    else if (value && strcmp(option, "--max-diffs") == 0)
+      maxDiffs = atoi(value);
+    else if (value && strcmp(option, "--ver") == 0) {
+      settings.voltageErrorRange = atol(value);
+      settingsGiven = true;
+    } else if (value && strcmp(option, "--cer") == 0) {
+      settings.currentErrorRange = atol(value);
+      settingsGiven = true;
+    } else if (value && strcmp(option, "--dci") == 0) {
+      settings.dutyCycleIncrement = atoi(value);
+      settingsGiven = true;
+    } else {
+      captures.clear();
+      break;
+    }
+  }
+  if (captures.empty() || (recordPath && checkPath)) {
+    fprintf(stderr, "usage: %s [--record FILE | --check FILE] [--context N] [--max-diffs N] [--ver N] [--cer N]"
+      " [--dci N] [--from-power-up] [--follow] CAPTURE...\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<Decision> expected;
+  if (checkPath) {
+    if (settingsGiven) {
+      fprintf(stderr, "the replay settings come from the golden trace with --check\n");
+      return 1;
+    }
+    if (!readGolden(checkPath, settings, expected)) {
+      fprintf(stderr, "cannot read the golden trace %s\n", checkPath);
+      return 1;
+    }
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<ReplayRecord> records;
+  for (const char* capture : captures) {
+    bool loaded = hasSuffix(capture, ".json") ? loadJson(capture, records)
+      : hasSuffix(capture, ".atv") ? loadArchive(capture, records) : loadLog(capture, records);
+    if (!loaded) {
+      fprintf(stderr, "cannot read %s\n", capture);
+      return 1;
+    }
+  }
+  std::chrono::steady_clock::time_point loadedAt = std::chrono::steady_clock::now();
+  std::vector<Decision> got;
+  replay(records, settings, got);
+  std::chrono::steady_clock::time_point replayedAt = std::chrono::steady_clock::now();
+
+  long counts[NUM_ICDECISIONS] = {0};
+  long matching = 0;
+  long stepped = 0;
+  for (size_t n = 0; n < got.size(); n++) {
+    if (got[n].decision < 0)
+      continue;
+    counts[got[n].decision]++;
+    int applied = got[n].duty < 1 ? 1 : got[n].duty > 99 ? 99 : got[n].duty; // as setDutyCycle() limits it
+    matching += applied == records[n].duty ? 1 : 0;
+    stepped++;
+  }
+  printf("%zu records, loaded in %.3f s, replayed in %.3f s (ver %ld mV, cer %ld mA, dci %d%s%s)\n", records.size(),
+    std::chrono::duration<double>(loadedAt - start).count(), std::chrono::duration<double>(replayedAt - loadedAt).count(),
+    (long)settings.voltageErrorRange, (long)settings.currentErrorRange, settings.dutyCycleIncrement,
+    settings.fromPowerUp ? ", from power up" : "", settings.follow ? ", following the recorded duty cycle" : "");
+  for (int d = 0; d < NUM_ICDECISIONS; d++)
+    printf("  %-17s %9ld\n", IC_DECISION_NAMES[d], counts[d]);
+  if (stepped > 0)
+    printf("replayed duty cycle agrees with the recorded one in %ld of %ld steps (%.2f %%)\n", matching, stepped,
+      100.0*matching/stepped);
+
+  if (recordPath) {
+    if (!writeGolden(recordPath, settings, got)) {
+      fprintf(stderr, "cannot write %s\n", recordPath);
+      return 1;
+    }
+    printf("golden trace written to %s\n", recordPath);
+  }
+  if (checkPath) {
+    if (expected.size() != got.size()) {
+      printf("golden trace has %zu records, the capture %zu\n", expected.size(), got.size());
+      return 1;
+    }
+    long differing = reportDiffs(records, expected, got, context < 0 ? 0 : context, maxDiffs);
+    if (differing > 0) {
+      printf("%ld of %zu records differ from %s\n", differing, got.size(), checkPath);
+      return 1;
+    }
+    printf("all %zu records match %s\n", got.size(), checkPath);
+  }
+  return 0;
+}
@@ -0,0 +1,265 @@
+/*
+  IsrTimingTool.cpp - Cycle counts of the control interrupt on an emulated ATmega328P
+  Released into the public domain.
+
+  usage: atv-isrtime [options] firmware.elf
+    --seconds N       simulated seconds to run (default: 10)
+    --irradiance W    W/m2 on the simulated panel (default: 1000)
+    --budget CYCLES   exit with status 2 if the longest ISR takes more
+    --csv FILE        one row per control interrupt: latency, cycles, cycles per stage
+    --edges FILE      every GPIO edge with its cycle
+
+  Loads the [env:uno] ELF (pio run -e uno, .pio/build/uno/firmware.elf) into
+  simavr and runs it at 16 MHz against PlantSim: before each Timer1 interrupt
+  the plant advances one control period with the duty cycle the firmware
+  left in Timer2 (FastPwmPin on D3) and the pin levels it wrote (the gate
+  driver latch included), and its sensor readings become the ADC inputs.
+
+  simavr reports when the Timer1 overflow interrupt becomes pending, when
+  its handler starts and when it returns, and the firmware marks the stages
+  of controlUpdate() in GPIOR0 (halMarkStage(), see IsrStages in
+  AtverterH_MPPT.cpp). lib/IsrTiming turns these into exact cycle counts per
+  interrupt and per stage, the latency from the overflow to the handler's
+  first instruction (longer while loop() has interrupts off), and overruns.
+  The budget is for regression checks (the isr-budget target of the CMake
+  build, once ISR_BUDGET_CYCLES is set from a measurement); the slot is
+  16000 cycles.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/sim_irq.h>
+#include <simavr/avr_adc.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_uart.h>
+
+#include <AtverterH.h>
+#include "IsrTiming.h"
+#include "PlantSim.h"
+
+const int TIMER1_OVF_VECTOR = 13; // ATmega328P, TimerOne's interrupt
+const uint16_t GPIOR0_ADDRESS = 0x3E; // data space
+const uint16_t TCCR2A_ADDRESS = 0xB0;
+const uint16_t OCR2A_ADDRESS = 0xB3;
+const uint16_t OCR2B_ADDRESS = 0xB4;
+const uint8_t COM2B1_BIT = 1 << 5;
+const uint8_t COM2B0_BIT = 1 << 4; // inverted output, FastPwmPin's duty cycles above 50 %
+
+// everything the simavr callbacks share
+struct Harness
+{
+  avr_t* avr = nullptr;
+  PlantSim plant;
+  IsrTiming timing;
+  bool driving = false; // raising a pin ourselves, not the firmware
+  long edges[HAL_NATIVE_PINS];
+  FILE* edgeFile = nullptr;
+};
+
+static Harness harness;
+static int pinNumbers[HAL_NATIVE_PINS]; // callback parameters
+
+// Arduino pin of a port bit
+static int arduinoPin(char port, int bit) {
+  return port == 'D' ? bit : port == 'B' ? 8 + bit : A0 + bit;
+}
+
+// the duty cycle FastPwmPin left in Timer2 for D3, as the plant reads it from PicroHAL
+static void mirrorPwm() {
+  uint8_t control = harness.avr->data[TCCR2A_ADDRESS];
+  if (!(control & COM2B1_BIT))
+    return; // not started
+  int top = harness.avr->data[OCR2A_ADDRESS] + 1;
+  int duty = (int)((harness.avr->data[OCR2B_ADDRESS] + 1)*100L/top);
+  if (control & COM2B0_BIT)
+    duty = 100 - duty;
+  halSetPwm(PWM_PIN, ISR_CPU_HZ/top, duty);
+}
+
+// the plant's sensor readings onto the ADC pins, and the gate driver latch onto GATESD
+static void drivePins() {
+  const int ADC_PINS[] = {T2_PIN, T1_PIN, I1_PIN, V1_PIN, -1, -1, I2_PIN, V2_PIN}; // channel 0 to 7
+  for (int channel = 0; channel < 8; channel++) {
+    if (ADC_PINS[channel] < 0)
+      continue;
+    uint32_t mV = (uint32_t)((halAnalogRead(ADC_PINS[channel]) + 0.5)*5000.0/1024.0);
+    avr_raise_irq(avr_io_getirq(harness.avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + channel), mV);
+  }
+  harness.driving = true;
+  avr_raise_irq(avr_io_getirq(harness.avr, AVR_IOCTL_IOPORT_GETIRQ('D'), GATESD_PIN), halDigitalRead(GATESD_PIN));
+  harness.driving = false;
+}
+
+static void timerPending(avr_irq_t*, uint32_t value, void*) {
+  if (value)
+    harness.timing.pending(harness.avr->cycle);
+}
+
+static void timerRunning(avr_irq_t*, uint32_t value, void*) {
+  if (value) {
+    harness.plant.step(); // the period that ends with this interrupt
+    mirrorPwm();
+    drivePins();
+    harness.timing.entry(harness.avr->cycle);
+  } else {
+    harness.timing.exit(harness.avr->cycle);
+  }
+}
+
+// halMarkStage(): GPIOR0 is plain storage, so keep the value as the core would
+static void stageWritten(avr_t* avr, avr_io_addr_t addr, uint8_t value, void*) {
+  avr->data[addr] = value;
+  harness.timing.stage(avr->cycle, value);
+}
+
+static void pinChanged(avr_irq_t*, uint32_t value, void* param) {
+  if (harness.driving)
+    return;
+  int pin = *(int*)param;
+  harness.edges[pin]++;
+  if (harness.edgeFile)
+    fprintf(harness.edgeFile, "%llu,%d,%u\n", (unsigned long long)harness.avr->cycle, pin, value);
+  halDigitalWrite(pin, value); // the plant's view, runs the latch model
+}
+
+static void directionChanged(avr_irq_t*, uint32_t value, void* param) {
+  char port = *(char*)param;
+  for (int bit = 0; bit < 8; bit++) {
+    int pin = arduinoPin(port, bit);
+    if (pin < HAL_NATIVE_PINS)
+      halPinMode(pin, (value >> bit) & 1 ? OUTPUT : INPUT);
+  }
+}
+
+int main(int argc, char** argv) {
+  double seconds = 10.0;
+  double irradiance = 1000.0;
+  long budget = -1;
+  const char* csvPath = nullptr;
+  const char* edgesPath = nullptr;
+  const char* elfPath = nullptr;
+  for (int n = 1; n < argc; n++) {
+    if (strcmp(argv[n], "--seconds") == 0 && n + 1 < argc) {
+      seconds = atof(argv[++n]);
+    } else if (strcmp(argv[n], "--irradiance") == 0 && n + 1 < argc) {
+      irradiance = atof(argv[++n]);
+    } else if (strcmp(argv[n], "--budget") == 0 && n + 1 < argc) {
+      budget = atol(argv[++n]);
+    } else if (strcmp(argv[n], "--csv") == 0 && n + 1 < argc) {
+      csvPath = argv[++n];
+    } else if (strcmp(argv[n], "--edges") == 0 && n + 1 < argc) {
+      edgesPath = argv[++n];
+    } else if (argv[n][0] != '-' && !elfPath) {
+      elfPath = argv[n];
+    } else {
+      elfPath = nullptr;
+      break;
+    }
+  }
+  if (!elfPath) {
+    fprintf(stderr, "usage: %s [--seconds N] [--irradiance W] [--budget CYCLES] [--csv FILE] [--edges FILE] firmware.elf\n",
+      argv[0]);
+    return 1;
+  }
+
+  elf_firmware_t firmware;
+  memset(&firmware, 0, sizeof(firmware));
+  if (elf_read_firmware(elfPath, &firmware) != 0) {
+    fprintf(stderr, "%s: cannot read the ELF\n", elfPath);
+    return 1;
+  }
+  const char* mcu = firmware.mmcu[0] ? firmware.mmcu : "atmega328p";
+  avr_t* avr = avr_make_mcu_by_name(mcu);
+  if (!avr) {
+    fprintf(stderr, "simavr does not know %s\n", mcu);
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->frequency = ISR_CPU_HZ;
+  avr->vcc = avr->avcc = 5000; // mV, the ADC reference of analogReadFast() and readVCC()
+  avr->log = LOG_WARNING;
+  harness.avr = avr;
+
+  uint32_t flags = 0;
+  avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+  flags &= ~AVR_UART_FLAG_STDIO; // the records would go to our stdout
+  avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+  harness.plant.configure(PlantParams());
+  harness.plant.setIrradiance(irradiance);
+  harness.plant.attach();
+  FILE* csv = nullptr;
+  if (csvPath) {
+    csv = fopen(csvPath, "w");
+    if (!csv) {
+      perror(csvPath);
+      return 1;
+    }
+    harness.timing.setCsv(csv);
+  }
+  if (edgesPath) {
+    harness.edgeFile = fopen(edgesPath, "w");
+    if (!harness.edgeFile) {
+      perror(edgesPath);
+      return 1;
+    }
+    fprintf(harness.edgeFile, "cycle,pin,level\n");
+  }
+
+  avr_irq_t* vector = avr_get_interrupt_irq(avr, TIMER1_OVF_VECTOR);
+  avr_irq_register_notify(vector + AVR_INT_IRQ_PENDING, timerPending, nullptr);
+  avr_irq_register_notify(vector + AVR_INT_IRQ_RUNNING, timerRunning, nullptr);
+  avr_register_io_write(avr, GPIOR0_ADDRESS, stageWritten, nullptr);
+  static char ports[3] = {'B', 'C', 'D'};
+  for (int p = 0; p < 3; p++) {
+    for (int bit = 0; bit < 8; bit++) {
+      int pin = arduinoPin(ports[p], bit);
+      if (pin >= HAL_NATIVE_PINS)
+        continue;
+      pinNumbers[pin] = pin;
+      avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(ports[p]), bit), pinChanged, &pinNumbers[pin]);
+    }
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(ports[p]), IOPORT_IRQ_DIRECTION_ALL),
+      directionChanged, &ports[p]);
+  }
+  drivePins();
+
+  avr_cycle_count_t end = (avr_cycle_count_t)(seconds*ISR_CPU_HZ);
+  int state = cpu_Running;
+  while (avr->cycle < end && state != cpu_Done && state != cpu_Crashed)
+    state = avr_run(avr);
+  if (csv)
+    fclose(csv);
+  if (harness.edgeFile)
+    fclose(harness.edgeFile);
+  if (state == cpu_Crashed) {
+    fprintf(stderr, "the firmware crashed at cycle %llu, PC 0x%04x\n", (unsigned long long)avr->cycle, avr->pc);
+    return 1;
+  }
+
+  IsrTiming& timing = harness.timing;
+  printf("%s on %s at %u MHz: %.1f s simulated, %ld control interrupts, duty %d%%\n", elfPath, mcu,
+    ISR_CPU_HZ/1000000, avr->cycle/(double)ISR_CPU_HZ, timing.isr.count, halNativeGetPwmDuty(PWM_PIN));
+  timing.printReport(stdout);
+  printf("GPIO edges:");
+  for (int pin = 0; pin < HAL_NATIVE_PINS; pin++) {
+    if (harness.edges[pin])
+      printf(" %d:%ld", pin, harness.edges[pin]);
+  }
+  printf("\n");
+  if (timing.isr.count == 0) {
+    fprintf(stderr, "no control interrupt ran\n");
+    return 1;
+  }
+  if (budget >= 0 && timing.overBudget(budget)) {
+    printf("over budget: the longest ISR took %ld cycles, the budget is %ld\n", timing.isr.max, budget);
+    return 2;
+  }
+  return 0;
+}
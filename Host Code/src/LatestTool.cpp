@@ -0,0 +1,86 @@
+/*
+  LatestTool.cpp - Prints the latest record of every device from shared memory
+  Released into the public domain.
+
+  usage: atv-latest [--shm NAME] [--watch] [device]...
+    --shm NAME  segment atverterd publishes into (default: /atverter)
+    --watch     print every new record until interrupted, polling at 10 Hz
+
+  A minimal consumer of SharedTelemetry.h: it needs neither the daemon's HTTP
+  port nor the archive, and never blocks atverterd.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "SharedTelemetry.h"
+
+static void printRecord(const char* name, const SharedTelemetryRecord& record) {
+  printf("%s\trecord %llu\t%.3f", name, (unsigned long long)record.recordCount,
+    record.sample.timestampUs/1e6);
+  for (int channel = 0; channel < NUM_CHANNELS; channel++) {
+    if (record.presentMask & (1u << channel))
+      printf("\t%s: %d", CHANNEL_NAMES[channel], (int)record.sample.values[channel]);
+  }
+  if (record.shutdownCode >= 0)
+    printf("\tShutdown: %d", (int)record.shutdownCode);
+  printf("\n");
+}
+
+int main(int argc, char** argv) {
+  const char* name = SHARED_TELEMETRY_NAME;
+  bool watch = false;
+  std::vector<const char*> devices;
+  for (int n = 1; n < argc; n++) {
+    if (strcmp(argv[n], "--shm") == 0 && n + 1 < argc) {
+      name = argv[++n];
+    } else if (strcmp(argv[n], "--watch") == 0) {
+      watch = true;
+    } else if (argv[n][0] == '-') {
+      fprintf(stderr, "usage: %s [--shm NAME] [--watch] [device]...\n", argv[0]);
+      return 2;
+    } else {
+      devices.push_back(argv[n]);
+    }
+  }
+
+  SharedTelemetryReader reader;
+  if (!reader.open(name)) {
+    fprintf(stderr, "cannot open shared memory %s (is atverterd running?)\n", name);
+    return 1;
+  }
+  std::vector<int> slots;
+  for (const char* device : devices) {
+    int slot = reader.findDevice(device);
+    if (slot < 0) {
+      fprintf(stderr, "unknown device %s\n", device);
+      return 1;
+    }
+    slots.push_back(slot);
+  }
+  if (devices.empty()) {
+    for (int slot = 0; slot < reader.getNumDevices(); slot++)
+      slots.push_back(slot);
+  }
+
+  std::vector<uint64_t> seen(slots.size(), 0);
+  do {
+    for (size_t n = 0; n < slots.size(); n++) {
+      SharedTelemetryRecord record;
+      if (!reader.read(slots[n], record)) {
+        fprintf(stderr, "%s: slot stayed busy\n", reader.getDeviceName(slots[n]));
+        continue;
+      }
+      if (record.recordCount == 0 || record.recordCount == seen[n])
+        continue;
+      seen[n] = record.recordCount;
+      printRecord(reader.getDeviceName(slots[n]), record);
+    }
+    fflush(stdout);
+    if (watch)
+      usleep(100000);
+  } while (watch);
+  return 0;
+}
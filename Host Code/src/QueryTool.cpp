@@ -0,0 +1,68 @@
+/*
+  QueryTool.cpp - Command line front end of the telemetry query engine
+  Released into the public domain.
+
+  usage: atv-query <archive-root>/<device> [key=value]...
+    start=T     first timestamp: now, now-7d, epoch seconds or ISO (default: now-1d)
+    end=T       end of the range, excluded (default: now)
+    bucket=D    bucket width, e.g. 15m, 1h, 1d (default: 0, one bucket)
+    channels=L  comma separated channel names or "all" (default: all)
+    agg=L       any of count,sum,mean,min,max,stddev (default: mean)
+    filter=F    CHANNEL:MIN:MAX, only samples inside the bounds count, e.g. HighSidePower:10000:
+    rollups=B   0 to ignore the rollup tiers and scan the raw segments (default: 1)
+    format=F    json or binary (default: json)
+    threads=N   worker threads (default: one per core)
+
+  The same keys work as the query string of atverterd's /query endpoint.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+
+#include "HttpServer.h"
+#include "TelemetryQuery.h"
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argv[1][0] == '-') {
+    fprintf(stderr, "usage: %s <archive-root>/<device> [start=T] [end=T] [bucket=D] [channels=L]\n"
+      "       [agg=L] [filter=CHANNEL:MIN:MAX] [rollups=0|1] [format=json|binary] [threads=N]\n", argv[0]);
+    return 2;
+  }
+  std::string queryString;
+  for (int n = 2; n < argc; n++) {
+    if (!strchr(argv[n], '=')) {
+      fprintf(stderr, "expected key=value: %s\n", argv[n]);
+      return 2;
+    }
+    queryString += (n > 2 ? "&" : "") + std::string(argv[n]);
+  }
+  int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  TelemetryQuery query;
+  std::string error;
+  if (!parseQuery(queryString.c_str(), nowUs, query, error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 2;
+  }
+  std::string value;
+  int threads = getQueryParameter(queryString.c_str(), "threads", value) ? atoi(value.c_str()) : 0;
+  bool binary = getQueryParameter(queryString.c_str(), "format", value) && value == "binary";
+
+  TelemetryQueryEngine engine(threads);
+  AggregateBuckets result;
+  QueryStats stats;
+  if (!engine.run(argv[1], query, result, stats, error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  std::string out;
+  if (binary)
+    formatQueryBinary(query, result, out);
+  else
+    formatQueryJson(query, result, stats, out);
+  fwrite(out.data(), 1, out.size(), stdout);
+  return 0;
+}
@@ -0,0 +1,389 @@
+/*
+  TuneTool.cpp - Monte Carlo tuning of the sketch's IC thresholds on the plant simulator
+  Released into the public domain.
+
+  usage: atv-tune [options]
+    --candidates N    random parameter sets, besides the current defaults (default: 16)
+    --generations N   rounds of refinement around the Pareto front (default: 2)
+    --offspring N     parameter sets per refinement round (default: 8)
+    --scenarios N     random scenarios every parameter set runs (default: 8)
+    --seconds N       simulated seconds per scenario (default: 240)
+    --jobs N          simulations at once (default: one per core)
+    --seed N          scenarios and search (default: 1)
+    --csv FILE        every parameter set with its scores
+
+  Tunes what mpptCommand() of AtverterH_MPPT.cpp sets at run time:
+    WVER  voltage error range, mV   1 to 200
+    WCER  current error range, mA   0 to 200
+    WDCI  duty cycle increment, %   1 to 5
+    WMPI  slowInterruptCount, ticks 99 to 5000 (the IC step interval, less one)
+
+  Every parameter set runs the same scenarios (common random numbers), each
+  from power up: an irradiance trace (a level, a slow drift, cloud edges of
+  random depth and length), ambient temperature, sensor noise, current
+  sensor offsets, divider gain error, battery chemistry, state of charge and
+  load. A simulation is one forked process (ProcessPool.h): the sketch is
+  process-global, so the work is spread over processes rather than threads,
+  and a new one starts whenever one finishes.
+
+  Each parameter set scores its tracking efficiency (panel energy over the
+  maximum power point energy, over all scenarios) and its oscillation (duty
+  cycle reversals per minute: a step up followed by a step down or the other
+  way round). The search starts with random sets and the defaults, then each
+  generation perturbs members of the Pareto front (log-normal for the
+  ranges and the interval, +-1 for the increment). Prints the front and
+  three recommendations: the most efficient set, the knee of the front, and
+  the calmest set within 1 % of the best efficiency, with the commands that
+  apply them.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ProcessPool.h"
+#include "SketchRunner.h"
+
+// ranges of the parameters, for convenience and bookkeeping
+enum TuneParameters
+{   PARAM_VOLTAGE_ERROR = 0, // WVER
+    PARAM_CURRENT_ERROR, // WCER
+    PARAM_DUTY_INCREMENT, // WDCI
+    PARAM_MPPT_INTERVAL, // WMPI
+    NUM_TUNEPARAMETERS
+};
+
+const char * const PARAM_COMMANDS[NUM_TUNEPARAMETERS] = {"WVER", "WCER", "WDCI", "WMPI"};
+const long PARAM_MIN[NUM_TUNEPARAMETERS] = {1, 0, 1, 99};
+const long PARAM_MAX[NUM_TUNEPARAMETERS] = {200, 200, 5, 5000};
+const long PARAM_DEFAULTS[NUM_TUNEPARAMETERS] = {10, 10, 1, 1000}; // the defines of AtverterH_MPPT.cpp
+
+const double REFINE_SIGMA = 0.35; // of the log-normal perturbation
+const double CALM_TOLERANCE = 0.01; // efficiency given up for the calmest recommendation
+
+struct Candidate
+{
+  long params[NUM_TUNEPARAMETERS];
+  double efficiency = 0.0;
+  double reversalsPerMinute = 0.0;
+  int failed = 0; // scenarios whose process died
+  bool pareto = false;
+};
+
+// what a scenario varies, drawn from its seed
+struct Scenario
+{
+  std::vector<double> irradiance; // W/m2, one per second
+  PlantParams plant;
+  double ambientC;
+};
+
+static Scenario makeScenario(uint32_t seed, int seconds) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  Scenario scenario;
+  double level = 300.0 + 700.0*unit(random);
+  double drift = (unit(random) - 0.5)*1.0; // W/m2/s
+  double cloudiness = unit(random);
+  double meanGap = 30.0 + 90.0*unit(random); // s between cloud edges
+  std::exponential_distribution<double> gap(1.0/meanGap);
+  double shade = 0.0; // fraction of the level a cloud takes
+  double target = 0.0;
+  double nextEdge = gap(random);
+  for (int t = 0; t < seconds; t++) {
+    if (t >= nextEdge) {
+      target = target > 0.0 || unit(random) > cloudiness ? 0.0 : 0.2 + 0.6*unit(random);
+      nextEdge = t + 1.0 + gap(random);
+    }
+    shade += (target - shade)*0.3; // cloud edges take a few seconds
+    double irradiance = (level + drift*t)*(1.0 - shade);
+    scenario.irradiance.push_back(constrain(irradiance, 20.0, 1100.0));
+  }
+  scenario.ambientC = 12.0 + 28.0*unit(random); // raw2degC's table starts at 10 °C
+  SensorParams& sensors = scenario.plant.sensors;
+  sensors.currentNoisemA = 5.0 + 35.0*unit(random);
+  sensors.voltageNoiseLsb = 0.2 + 0.8*unit(random);
+  sensors.currentOffsetmV[0] = (unit(random) - 0.5)*30.0;
+  sensors.currentOffsetmV[1] = (unit(random) - 0.5)*30.0;
+  sensors.dividerGainError = (unit(random) - 0.5)*0.02;
+  BatteryParams& battery = scenario.plant.battery;
+  battery.chemistry = unit(random) < 0.3 ? BATTERY_LIFEPO4 : BATTERY_LEAD_ACID;
+  battery.initialSoc = 0.2 + 0.7*unit(random);
+  battery.loadA = 2.0*unit(random);
+  scenario.plant.seed = seed;
+  return scenario;
+}
+
+// runs in a child process: "pvJ mppJ reversals minutes"
+static std::string simulate(const Candidate& candidate, uint32_t seed, int seconds) {
+  Scenario scenario = makeScenario(seed, seconds);
+  static PlantSim plant; // static like the sketch's board
+  plant.configure(scenario.plant);
+  plant.setAmbient(scenario.ambientC);
+  plant.setIrradiance(scenario.irradiance[0]);
+  startSketch(plant);
+  std::string commands;
+  for (int n = 0; n < NUM_TUNEPARAMETERS; n++)
+    commands += std::string(PARAM_COMMANDS[n]) + ":" + std::to_string(candidate.params[n]) + "\n";
+  halNativeUARTReceive(commands.c_str()); // read by the first loop()
+
+  long reversals = 0;
+  int lastDuty = -1;
+  int lastDirection = 0;
+  for (int t = 0; t < seconds; t++) {
+    double from = scenario.irradiance[t];
+    double to = t + 1 < seconds ? scenario.irradiance[t + 1] : from;
+    for (int n = 0; n < SKETCH_TICKS_PER_SECOND; n++) {
+      if (n % SKETCH_IRRADIANCE_TICKS == 0)
+        plant.setIrradiance(from + (to - from)*n/SKETCH_TICKS_PER_SECOND);
+      plant.step();
+      loop();
+      int duty = atverterH.getDutyCycle();
+      if (duty != lastDuty && lastDuty >= 0) {
+        int direction = duty > lastDuty ? 1 : -1;
+        if (lastDirection && direction != lastDirection)
+          reversals++;
+        lastDirection = direction;
+      }
+      lastDuty = duty;
+    }
+    halNativeUARTTake();
+  }
+  plant.detach();
+  char result[128];
+  snprintf(result, sizeof(result), "%.6f %.6f %ld %.4f", plant.getPvEnergyJ(), plant.getMppEnergyJ(), reversals,
+    seconds/60.0);
+  return result;
+}
+
+// runs every candidate from first on every scenario and scores it
+static void evaluate(std::vector<Candidate>& candidates, size_t first, const std::vector<uint32_t>& seeds,
+    int seconds, int jobs) {
+  int perCandidate = (int)seeds.size();
+  int count = (int)(candidates.size() - first)*perCandidate;
+  std::vector<std::string> results = runInProcesses(count, jobs, [&](int n) {
+    return simulate(candidates[first + n/perCandidate], seeds[n % perCandidate], seconds);
+  });
+  for (size_t c = first; c < candidates.size(); c++) {
+    double pvJ = 0.0, mppJ = 0.0, reversals = 0.0, minutes = 0.0;
+    for (int s = 0; s < perCandidate; s++) {
+      const std::string& result = results[(c - first)*perCandidate + s];
+      double scenarioPvJ, scenarioMppJ, scenarioReversals, scenarioMinutes;
+      if (sscanf(result.c_str(), "%lf %lf %lf %lf", &scenarioPvJ, &scenarioMppJ, &scenarioReversals,
+          &scenarioMinutes) != 4) {
+        candidates[c].failed++;
+        continue;
+      }
+      pvJ += scenarioPvJ;
+      mppJ += scenarioMppJ;
+      reversals += scenarioReversals;
+      minutes += scenarioMinutes;
+    }
+    candidates[c].efficiency = mppJ > 0.0 ? pvJ/mppJ : 0.0;
+    candidates[c].reversalsPerMinute = minutes > 0.0 ? reversals/minutes : 0.0;
+  }
+}
+
+// more efficient and no more oscillating, or as efficient and calmer
+static bool dominates(const Candidate& a, const Candidate& b) {
+  return a.efficiency >= b.efficiency && a.reversalsPerMinute <= b.reversalsPerMinute
+    && (a.efficiency > b.efficiency || a.reversalsPerMinute < b.reversalsPerMinute);
+}
+
+static void markPareto(std::vector<Candidate>& candidates) {
+  for (Candidate& candidate : candidates) {
+    candidate.pareto = !candidate.failed;
+    for (const Candidate& other : candidates) {
+      if (!other.failed && dominates(other, candidate)) {
+        candidate.pareto = false;
+        break;
+      }
+    }
+  }
+}
+
+static long randomParam(int param, std::mt19937& random) {
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  if (param == PARAM_DUTY_INCREMENT)
+    return PARAM_MIN[param] + (long)(unit(random)*(PARAM_MAX[param] - PARAM_MIN[param] + 1));
+  double low = log((double)PARAM_MIN[param] + 1.0); // log-uniform, +1 so a range can be 0
+  double high = log((double)PARAM_MAX[param] + 1.0);
+  long value = lround(exp(low + (high - low)*unit(random)) - 1.0);
+  return constrain(value, PARAM_MIN[param], PARAM_MAX[param]);
+}
+
+static Candidate perturb(const Candidate& parent, std::mt19937& random) {
+  std::normal_distribution<double> gaussian(0.0, REFINE_SIGMA);
+  std::uniform_int_distribution<int> step(-1, 1);
+  Candidate child;
+  for (int n = 0; n < NUM_TUNEPARAMETERS; n++) {
+    long value;
+    if (n == PARAM_DUTY_INCREMENT)
+      value = parent.params[n] + step(random);
+    else
+      value = lround((parent.params[n] + 1.0)*exp(gaussian(random)) - 1.0);
+    child.params[n] = constrain(value, PARAM_MIN[n], PARAM_MAX[n]);
+  }
+  return child;
+}
+
+static std::string describe(const Candidate& candidate) {
+  char text[160];
+  snprintf(text, sizeof(text), "%5ld %5ld %4ld %5ld  %7.2f %9.2f", candidate.params[PARAM_VOLTAGE_ERROR],
+    candidate.params[PARAM_CURRENT_ERROR], candidate.params[PARAM_DUTY_INCREMENT],
+    candidate.params[PARAM_MPPT_INTERVAL], 100.0*candidate.efficiency, candidate.reversalsPerMinute);
+  return text;
+}
+
+static void recommend(const char* why, const Candidate& candidate) {
+  printf("%-28s %s   ", why, describe(candidate).c_str());
+  for (int n = 0; n < NUM_TUNEPARAMETERS; n++)
+    printf(" %s:%ld", PARAM_COMMANDS[n], candidate.params[n]);
+  printf("\n");
+}
+
+int main(int argc, char** argv) {
+  int candidateCount = 16;
+  int generations = 2;
+  int offspring = 8;
+  int scenarioCount = 8;
+  int seconds = 240;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int jobs = cores > 0 ? (int)cores : 1;
+  uint32_t seed = 1;
+  const char* csvPath = nullptr;
+  for (int n = 1; n < argc; n++) {
+    const char* option = argv[n];
+    const char* value = n + 1 < argc ? argv[++n] : nullptr;
+    if (value && strcmp(option, "--candidates") == 0)
+      candidateCount = atoi(value);
+    else if (value && strcmp(option, "--generations") == 0)
+      generations = atoi(value);
+    else if (value && strcmp(option, "--offspring") == 0)
+      offspring = atoi(value);
+    else if (value && strcmp(option, "--scenarios") == 0)
+      scenarioCount = atoi(value);
+    else if (value && strcmp(option, "--seconds") == 0)
+      seconds = atoi(value);
+    else if (value && strcmp(option, "--jobs") == 0)
+      jobs = atoi(value);
+    else if (value && strcmp(option, "--seed") == 0)
+      seed = (uint32_t)atol(value);
+    else if (value && strcmp(option, "--csv") == 0)
+      csvPath = value;
+    else {
+      fprintf(stderr, "usage: %s [--candidates N] [--generations N] [--offspring N] [--scenarios N] [--seconds N]"
+        " [--jobs N] [--seed N] [--csv FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (seconds < 2 || scenarioCount < 1) {
+    fprintf(stderr, "at least one scenario of 2 s\n");
+    return 1;
+  }
+
+  std::mt19937 random(seed);
+  std::vector<uint32_t> seeds;
+  for (int n = 0; n < scenarioCount; n++)
+    seeds.push_back(random());
+  std::vector<Candidate> candidates(1);
+  std::copy(PARAM_DEFAULTS, PARAM_DEFAULTS + NUM_TUNEPARAMETERS, candidates[0].params);
+  for (int n = 0; n < candidateCount; n++) {
+    Candidate candidate;
+    for (int param = 0; param < NUM_TUNEPARAMETERS; param++)
+      candidate.params[param] = randomParam(param, random);
+    candidates.push_back(candidate);
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  evaluate(candidates, 0, seeds, seconds, jobs);
+  for (int generation = 0; generation < generations; generation++) {
+    markPareto(candidates);
+    std::vector<const Candidate*> front;
+    for (const Candidate& candidate : candidates) {
+      if (candidate.pareto)
+        front.push_back(&candidate);
+    }
+    if (front.empty())
+      break;
+    size_t first = candidates.size();
+    std::vector<Candidate> children;
+    for (int n = 0; n < offspring; n++)
+      children.push_back(perturb(*front[random() % front.size()], random));
+    candidates.insert(candidates.end(), children.begin(), children.end());
+    evaluate(candidates, first, seeds, seconds, jobs);
+  }
+  markPareto(candidates);
+  double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  long simulations = (long)candidates.size()*scenarioCount;
+  printf("%zu parameter sets x %d scenarios of %d s: %ld simulations, %.1f simulated h in %.1f s with %d jobs\n\n",
+    candidates.size(), scenarioCount, seconds, simulations, simulations*seconds/3600.0, wallS, jobs);
+  std::vector<Candidate> front;
+  for (const Candidate& candidate : candidates) {
+    if (candidate.pareto)
+      front.push_back(candidate);
+  }
+  std::sort(front.begin(), front.end(), [](const Candidate& a, const Candidate& b) {
+    return a.reversalsPerMinute < b.reversalsPerMinute;
+  });
+  printf("Pareto front\n%5s %5s %4s %5s  %7s %9s\n", "WVER", "WCER", "WDCI", "WMPI", "track %", "rev/min");
+  for (const Candidate& candidate : front)
+    printf("%s\n", describe(candidate).c_str());
+  printf("\ndefaults %s%s\n\n", describe(candidates[0]).c_str(), candidates[0].pareto ? "  (on the front)" : "");
+
+  if (!front.empty()) {
+    const Candidate* best = &front[0];
+    for (const Candidate& candidate : front)
+      best = candidate.efficiency > best->efficiency ? &candidate : best;
+    const Candidate* calm = best;
+    for (const Candidate& candidate : front) {
+      if (candidate.efficiency >= best->efficiency - CALM_TOLERANCE
+          && candidate.reversalsPerMinute < calm->reversalsPerMinute)
+        calm = &candidate;
+    }
+    // the knee: furthest from the line between the ends of the front, both axes scaled to their span
+    const Candidate& low = front.front();
+    const Candidate& high = front.back();
+    double spanE = high.efficiency - low.efficiency;
+    double spanR = high.reversalsPerMinute - low.reversalsPerMinute;
+    const Candidate* knee = best;
+    double kneeDistance = -1.0;
+    for (const Candidate& candidate : front) {
+      double e = spanE > 0.0 ? (candidate.efficiency - low.efficiency)/spanE : 0.0;
+      double r = spanR > 0.0 ? (candidate.reversalsPerMinute - low.reversalsPerMinute)/spanR : 0.0;
+      double distance = e - r; // above the diagonal
+      if (distance > kneeDistance) {
+        kneeDistance = distance;
+        knee = &candidate;
+      }
+    }
+    printf("%-28s %5s %5s %4s %5s  %7s %9s\n", "recommended", "WVER", "WCER", "WDCI", "WMPI", "track %", "rev/min");
+    recommend("most efficient", *best);
+    recommend("knee of the front", *knee);
+    recommend("calmest within 1 %", *calm);
+  }
+
+  if (csvPath) {
+    FILE* csv = fopen(csvPath, "w");
+    if (!csv) {
+      perror(csvPath);
+      return 1;
+    }
+    fprintf(csv, "voltage_error_mv,current_error_ma,duty_increment,mppt_interval,efficiency,reversals_per_min,pareto,failed\n");
+    for (const Candidate& candidate : candidates) {
+      fprintf(csv, "%ld,%ld,%ld,%ld,%.5f,%.3f,%d,%d\n", candidate.params[0], candidate.params[1], candidate.params[2],
+        candidate.params[3], candidate.efficiency, candidate.reversalsPerMinute, candidate.pareto ? 1 : 0,
+        candidate.failed);
+    }
+    fclose(csv);
+  }
+  return 0;
+}
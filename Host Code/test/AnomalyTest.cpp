@@ -0,0 +1,69 @@
+/*
+  AnomalyTest.cpp - Checks the duty cycle detector's limit cycle alert with its default thresholds
+  Released into the public domain.
+
+  usage: test-anomaly   (exits non-zero on the first failed check)
+  Feeds the IC step's normal 1 % dither, then the step hunting 2 % either
+  side of its duty, then the dither again, and expects the limit cycle
+  alert to stay quiet, to be raised once and to be cleared once.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AnomalyDetectors.h"
+
+#define CHECK(condition) do { if (!(condition)) { \
+  fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); exit(1); } } while (0)
+
+class CycleSink : public AlertSink
+{
+  public:
+    int raised = 0;
+    int cleared = 0;
+    void publishAlert(const Alert& alert) override {
+      if (alert.kind != ALERT_DUTY_LIMIT_CYCLE)
+        return;
+      if (alert.active)
+        raised++;
+      else
+        cleared++;
+    }
+};
+
+static int64_t timeUs = 0;
+
+static void feed(DutyCycleDetector& detector, CycleSink& sink, const int32_t* pattern, int length, int samples) {
+  TelemetrySample sample;
+  memset(&sample, 0, sizeof(sample));
+  sample.values[HIGH_SIDE_POWER] = 40000;
+  for (int n = 0; n < samples; n++) {
+    sample.timestampUs = timeUs += 1000000;
+    sample.values[DUTY_CYCLE] = 50 + pattern[n%length];
+    detector.onSample(sample, sink);
+  }
+}
+
+int main() {
+  const int32_t dither[4] = {0, 1, 0, -1}; // tracking at the maximum power point, a swing of 2
+  const int32_t hunt[8] = {0, 1, 2, 1, 0, -1, -2, -1}; // a swing of 4
+  DutyCycleDetector detector;
+  CycleSink sink;
+
+  feed(detector, sink, dither, 4, 600);
+  CHECK(sink.raised == 0);
+
+  feed(detector, sink, hunt, 8, 60);
+  CHECK(sink.raised == 1);
+  feed(detector, sink, hunt, 8, 600);
+  CHECK(sink.raised == 1);
+  CHECK(sink.cleared == 0);
+
+  feed(detector, sink, dither, 4, 120);
+  CHECK(sink.cleared == 1);
+  CHECK(sink.raised == 1);
+
+  printf("limit cycle alert raised and cleared\n");
+  return 0;
+}
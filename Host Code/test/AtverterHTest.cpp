@@ -0,0 +1,193 @@
+/*
+  AtverterHTest.cpp - Checks AtverterH's control path on PicroHAL's fakes
+  Released into the public domain.
+
+  usage: test-atverterh   (exits non-zero on the first failed check)
+  The sensor moving averages and conversions at their ends, the current and
+  thermal shutdowns at their limits (with the protection latch modelled on
+  the pin writes), the biquad compensator's saturation and anti-windup, and
+  every decision of the incremental conductance step.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <AtverterH.h>
+#include <IncrementalConductance.h>
+
+#define CHECK(condition) do { if (!(condition)) { \
+  fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); exit(1); } } while (0)
+
+// the protection latch: pulling GATESD low latches it, a PRORESET pulse releases it
+static void latchGates(int pin, int level) {
+  if (pin == GATESD_PIN && level == LOW && halNativeGetPinMode(GATESD_PIN) == OUTPUT)
+    halNativeSetInput(GATESD_PIN, LOW);
+  else if (pin == PRORESET_PIN && level == HIGH)
+    halNativeSetInput(GATESD_PIN, HIGH);
+}
+
+static void startBoard(AtverterH& board) {
+  halNativeReset();
+  halNativeOnPinWrite(latchGates);
+  halNativeSetAnalog(I1_PIN, 512); // no current
+  halNativeSetAnalog(I2_PIN, 512);
+  halNativeSetAnalog(T1_PIN, 301); // 30 °C
+  halNativeSetAnalog(T2_PIN, 301);
+  board.initialize();
+  board.startPWM(50);
+}
+
+static void testSensors() {
+  static AtverterH board; // static storage like the sketch's, its sensor averages start at zero
+  startBoard(board);
+  CHECK(board.getVCC() == 1125300L/(1125300L/5000)); // 5001, the bandgap reading rounds
+  CHECK(board.getRawV1() == 0);
+  halNativeSetAnalog(V1_PIN, 400);
+  board.updateVISensors();
+  CHECK(board.getRawV1() == 100); // a quarter of the window
+  for (int n = 1; n < SENSOR_V_WINDOW_MAX; n++)
+    board.updateVISensors();
+  CHECK(board.getRawV1() == 400);
+  CHECK(board.getV1() == 400L*board.getVCC()*13/1024);
+  halNativeSetAnalog(I1_PIN, 512 - 100);
+  for (int n = 0; n < SENSOR_I_WINDOW_MAX - 1; n++)
+    board.updateVISensors();
+  CHECK(board.getRawI1() > -100); // one sample of the window still reads 0 A
+  board.updateVISensors();
+  CHECK(board.getRawI1() == -100);
+  CHECK(board.getI1() == -100L*board.getVCC()*3/1024);
+
+  // a supply read low over USB is taken as the 5 V rail
+  halNativeSetVCC(4500);
+  board.updateVCC();
+  CHECK(board.getVCC() == 5000);
+  halNativeSetVCC(5100);
+  board.updateVCC();
+  CHECK(board.getVCC() == 1125300L/(1125300L/5100));
+
+  // the thermistor table saturates at its ends
+  CHECK(board.raw2degC(0) == 10);
+  CHECK(board.raw2degC(139) == 10);
+  CHECK(board.raw2degC(1023) == 100);
+  CHECK(board.raw2degC(301) == 30);
+  CHECK(board.raw2degC(356) == 35);
+}
+
+static void testCurrentShutdown() {
+  static AtverterH board;
+  startBoard(board);
+  CHECK(!board.isGateShutdown());
+  CHECK(board.getShutdownCode() == -1);
+  int limitRaw = 6500L*128/1875; // initialize()'s 6.5 A
+  halNativeSetAnalog(I2_PIN, 512 + limitRaw); // at the limit does not trip
+  for (int n = 0; n < SENSOR_I_WINDOW_MAX; n++)
+    board.updateVISensors();
+  board.checkCurrentShutdown();
+  CHECK(!board.isGateShutdown());
+  halNativeSetAnalog(I2_PIN, 512 - limitRaw - 1); // one step past it, either direction
+  for (int n = 0; n < SENSOR_I_WINDOW_MAX; n++)
+    board.updateVISensors();
+  board.checkCurrentShutdown();
+  CHECK(board.isGateShutdown());
+  CHECK(board.getShutdownCode() == OVERCURRENT);
+  halNativeSetAnalog(I2_PIN, 512);
+  for (int n = 0; n < SENSOR_I_WINDOW_MAX; n++)
+    board.updateVISensors();
+  board.enableGateDrivers();
+  CHECK(!board.isGateShutdown());
+  CHECK(board.getShutdownCode() == -1);
+}
+
+static void testThermalShutdown() {
+  static AtverterH board;
+  startBoard(board);
+  board.checkThermalShutdown();
+  CHECK(!board.isGateShutdown());
+  halNativeSetAnalog(T1_PIN, 776); // 80 °C, at the limit
+  for (int n = 0; n < SENSOR_T_WINDOW_MAX; n++)
+    board.updateTSensors();
+  board.checkThermalShutdown();
+  CHECK(!board.isGateShutdown());
+  halNativeSetAnalog(T1_PIN, 1023); // shorted, reads 100 °C
+  for (int n = 0; n < SENSOR_T_WINDOW_MAX; n++)
+    board.updateTSensors();
+  board.checkThermalShutdown();
+  CHECK(board.getShutdownCode() == OVERTEMPERATURE);
+
+  startBoard(board);
+  halNativeSetAnalog(T2_PIN, THERMISTOR_OPEN_RAW - 1); // open, would read a cold 10 °C
+  for (int n = 0; n < SENSOR_T_WINDOW_MAX; n++)
+    board.updateTSensors();
+  board.checkThermalShutdown();
+  CHECK(board.getShutdownCode() == OVERTEMPERATURE);
+}
+
+static void testCompensator() {
+  static const int integrator[COMP_SECTION_COEFFICIENTS] = {16384, 0, 0, -16384, 0}; // y[n] = y[n-1] + x[n]
+  static AtverterH board;
+  startBoard(board);
+  CHECK(board.calculateCompOut() == 0); // not set up
+
+  board.setDutyCycleRaw(512);
+  board.setComp(integrator, 1, 1);
+  board.updateCompPast(10);
+  CHECK(board.calculateCompOut() == 522); // bumpless, from the duty cycle already set
+  board.updateCompPast(-2);
+  CHECK(board.calculateCompOut() == 520);
+
+  // saturates at the duty cycle limits and does not wind up past them
+  for (int n = 0; n < 100; n++) {
+    board.updateCompPast(100);
+    CHECK(board.calculateCompOut() <= DUTY_RAW_MAX);
+  }
+  board.updateCompPast(100);
+  CHECK(board.calculateCompOut() == DUTY_RAW_MAX);
+  board.updateCompPast(-10);
+  CHECK(board.calculateCompOut() == DUTY_RAW_MAX - 10);
+  for (int n = 0; n < 100; n++)
+    board.updateCompPast(-100), board.calculateCompOut();
+  board.updateCompPast(10);
+  CHECK(board.calculateCompOut() == DUTY_RAW_MIN + 10);
+
+  board.setCompLimits(300, 700);
+  board.updateCompPast(0);
+  CHECK(board.calculateCompOut() == 300);
+
+  // reset goes back to the present duty cycle
+  board.setDutyCycleRaw(600);
+  board.resetComp();
+  board.updateCompPast(0);
+  CHECK(board.calculateCompOut() == 600);
+}
+
+static void testIncrementalConductance() {
+  IncrementalConductance mppt;
+  mppt.setDutyCycle(50);
+  mppt.setPrevious(12000, 2000);
+  // the battery side's dI/dV against -I/V, with a band of the error ranges' ratio (1 A/V) either side
+  CHECK(mppt.step(12100, 2100) == IC_UP_SLOPE);
+  CHECK(mppt.getDutyCycle() == 51);
+  CHECK(mppt.step(12200, 1900) == IC_DOWN_SLOPE);
+  CHECK(mppt.getDutyCycle() == 50);
+  CHECK(mppt.step(12300, 1895) == IC_HOLD_SLOPE);
+  // changes inside the error ranges hold
+  CHECK(mppt.step(12305, 1900) == IC_HOLD_FLAT);
+  CHECK(mppt.getDutyCycle() == 50);
+  // no voltage change, the current alone decides
+  CHECK(mppt.step(12305, 1950) == IC_UP_FLAT);
+  CHECK(mppt.step(12305, 1850) == IC_DOWN_FLAT);
+  CHECK(mppt.getDutyCycle() == 50);
+  // a zero voltage error range is taken as 1 mV, step() divides by it
+  mppt.setVoltageErrorRange(0);
+  CHECK(mppt.getVoltageErrorRange() == 1);
+}
+
+int main() {
+  testSensors();
+  testCurrentShutdown();
+  testThermalShutdown();
+  testCompensator();
+  testIncrementalConductance();
+  printf("sensors, shutdowns, compensator and IC step behave at their edges\n");
+  return 0;
+}
@@ -0,0 +1,193 @@
+/*
+  ChargeStagesTest.cpp - Checks the charge stages and the sketch's CV2 limit at their edges
+  Released into the public domain.
+
+  usage: test-chargestages   (exits non-zero on the first failed check)
+  Bulk into absorption at the regulation margin, absorption into float by
+  the tail current held for CHARGE_TAIL_HOLD_S or by the absorption time,
+  back to bulk below the rebulk voltage for CHARGE_REBULK_HOLD_S, and the
+  temperature compensation with its clamp. Then AtverterH_MPPT.cpp's CV2
+  limit on PicroHAL's fakes, one tick at a time: its rise and how fast,
+  the back off when nothing goes into the battery, the headroom it stops
+  at and the release when the battery drops under the setpoint.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <AtverterH.h>
+#include <ChargeStages.h>
+
+#define CHECK(condition) do { if (!(condition)) { \
+  fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); exit(1); } } while (0)
+
+// from AtverterH_MPPT.cpp
+void setup();
+void limitBatteryVoltage();
+extern AtverterH atverterH;
+extern volatile int batteryReferenceRaw;
+extern long chargeLimit;
+extern volatile int panelReferenceMaxRaw;
+extern volatile int panelReferenceRaw;
+
+// the defaults at 25 °C: absorption 14.4 V, float 13.6 V, rebulk 12.6 V, 1 A of tail current
+const int32_t AT_ABSORPTION = CHARGE_DEFAULT_ABSORPTION_VOLTAGE;
+const int32_t UNDER_MARGIN = CHARGE_DEFAULT_ABSORPTION_VOLTAGE - CHARGE_REGULATION_MARGIN - 1;
+const int32_t UNDER_REBULK = CHARGE_DEFAULT_REBULK_VOLTAGE - 1;
+
+static void updateFor(ChargeStages& charger, int seconds, int32_t voltage, int32_t current) {
+  for (int s = 0; s < seconds; s++)
+    charger.update(voltage, current, CHARGE_REFERENCE_C);
+}
+
+static void testBulkToAbsorption() {
+  ChargeStages charger;
+  CHECK(charger.getStage() == CHARGE_BULK);
+  updateFor(charger, 1000, UNDER_MARGIN, 3000);
+  CHECK(charger.getStage() == CHARGE_BULK);
+  CHECK(charger.getStageSeconds() == 1000);
+  CHECK(charger.update(UNDER_MARGIN + 1, 3000, CHARGE_REFERENCE_C) == CHARGE_ABSORPTION); // at the margin is at it
+  CHECK(charger.getStageSeconds() == 0);
+  CHECK(charger.getSetpoint() == AT_ABSORPTION);
+}
+
+static void testTail() {
+  ChargeStages charger;
+  charger.setStage(CHARGE_ABSORPTION);
+  updateFor(charger, CHARGE_TAIL_HOLD_S - 1, AT_ABSORPTION, 500);
+  CHECK(charger.getStage() == CHARGE_ABSORPTION);
+  updateFor(charger, 1, UNDER_MARGIN, 500); // a second off the setpoint starts the hold over
+  updateFor(charger, CHARGE_TAIL_HOLD_S - 1, AT_ABSORPTION, 500);
+  CHECK(charger.getStage() == CHARGE_ABSORPTION);
+  CHECK(charger.update(AT_ABSORPTION, 500, CHARGE_REFERENCE_C) == CHARGE_FLOAT);
+  CHECK(charger.getSetpoint() == CHARGE_DEFAULT_FLOAT_VOLTAGE);
+
+  // the tail is on the averaged current: one second below it after hours above is not the tail
+  charger.setStage(CHARGE_BULK);
+  updateFor(charger, 100, UNDER_MARGIN, 3000);
+  charger.setStage(CHARGE_ABSORPTION);
+  updateFor(charger, 1, AT_ABSORPTION, 0);
+  CHECK(charger.getStage() == CHARGE_ABSORPTION);
+  updateFor(charger, 2*CHARGE_TAIL_HOLD_S, AT_ABSORPTION, 0);
+  CHECK(charger.getStage() == CHARGE_FLOAT);
+}
+
+static void testAbsorptionTime() {
+  ChargeStages charger;
+  charger.setAbsorptionTime(100);
+  updateFor(charger, 100, UNDER_MARGIN, 3000); // the average well above the tail current
+  charger.setStage(CHARGE_ABSORPTION);
+  updateFor(charger, 50, AT_ABSORPTION, 3000);
+  updateFor(charger, 20, UNDER_MARGIN, 3000); // seconds off the setpoint do not count
+  updateFor(charger, 49, AT_ABSORPTION, 3000);
+  CHECK(charger.getStage() == CHARGE_ABSORPTION);
+  CHECK(charger.getStageSeconds() == 119);
+  CHECK(charger.update(AT_ABSORPTION, 3000, CHARGE_REFERENCE_C) == CHARGE_FLOAT);
+}
+
+static void testRebulk() {
+  ChargeStages charger;
+  charger.setStage(CHARGE_FLOAT);
+  updateFor(charger, CHARGE_REBULK_HOLD_S - 1, UNDER_REBULK, -2000);
+  updateFor(charger, 1, CHARGE_DEFAULT_REBULK_VOLTAGE, -2000); // at the rebulk voltage starts the hold over
+  updateFor(charger, CHARGE_REBULK_HOLD_S - 1, UNDER_REBULK, -2000);
+  CHECK(charger.getStage() == CHARGE_FLOAT);
+  CHECK(charger.update(UNDER_REBULK, -2000, CHARGE_REFERENCE_C) == CHARGE_BULK);
+
+  // absorption goes back to bulk the same way
+  charger.setStage(CHARGE_ABSORPTION);
+  updateFor(charger, CHARGE_REBULK_HOLD_S, UNDER_REBULK, -2000);
+  CHECK(charger.getStage() == CHARGE_BULK);
+
+  // bulk does not count it towards anything
+  updateFor(charger, 10*CHARGE_REBULK_HOLD_S, UNDER_REBULK, -2000);
+  CHECK(charger.getStage() == CHARGE_BULK);
+}
+
+static void testTemperature() {
+  ChargeStages charger;
+  charger.update(UNDER_REBULK, 0, 35);
+  CHECK(charger.getSetpoint() == AT_ABSORPTION - 300);
+  charger.update(UNDER_REBULK, 0, 80); // clamped to 50 °C
+  CHECK(charger.getSetpoint() == AT_ABSORPTION - 750);
+  charger.update(UNDER_REBULK, 0, -20); // clamped to 0 °C
+  CHECK(charger.getSetpoint() == AT_ABSORPTION + 750);
+  CHECK(charger.update(AT_ABSORPTION - 300 - CHARGE_REGULATION_MARGIN, 0, 35) == CHARGE_ABSORPTION);
+
+  // the rebulk voltage moves with it
+  charger.setStage(CHARGE_FLOAT);
+  updateFor(charger, CHARGE_REBULK_HOLD_S, CHARGE_DEFAULT_REBULK_VOLTAGE - 1, 0);
+  CHECK(charger.getStage() == CHARGE_BULK);
+  charger.setStage(CHARGE_FLOAT);
+  for (int s = 0; s < CHARGE_REBULK_HOLD_S; s++)
+    charger.update(CHARGE_DEFAULT_REBULK_VOLTAGE - 1, 0, 45); // 600 mV over the rebulk voltage at 45 °C
+  CHECK(charger.getStage() == CHARGE_FLOAT);
+
+  charger.setTemperatureCompensation(0);
+  charger.update(UNDER_REBULK, 0, 50);
+  CHECK(charger.getSetpoint() == CHARGE_DEFAULT_FLOAT_VOLTAGE);
+  charger.setStage(NUM_CHARGESTAGES); // no such stage starts bulk
+  CHECK(charger.getStage() == CHARGE_BULK);
+}
+
+// the battery voltage and the current into the converter's low side (I2, negative while charging) as ADC readings
+static void settle(int v2Raw, int i2Raw) {
+  halNativeSetAnalog(V2_PIN, v2Raw);
+  halNativeSetAnalog(I2_PIN, 512 + i2Raw);
+  for (int n = 0; n < SENSOR_I_WINDOW_MAX; n++)
+    atverterH.updateVISensors();
+  CHECK(atverterH.getRawV2() == v2Raw);
+  CHECK(atverterH.getRawI2() == i2Raw);
+}
+
+static void testCV2Limit() {
+  halNativeReset();
+  halNativeSetAnalog(I1_PIN, 512); // no current
+  halNativeSetAnalog(I2_PIN, 512);
+  halNativeSetAnalog(T1_PIN, 301); // 30 °C
+  halNativeSetAnalog(T2_PIN, 301);
+  setup();
+  const int setpointRaw = 800;
+  const int headroom = 10 << 8; // Q8 raw
+  batteryReferenceRaw = setpointRaw;
+  panelReferenceRaw = 500;
+  panelReferenceMaxRaw = 510;
+  chargeLimit = 0;
+
+  settle(setpointRaw, -100);
+  limitBatteryVoltage();
+  CHECK(chargeLimit == 0); // at the setpoint nothing moves
+  settle(setpointRaw + 2, -100);
+  limitBatteryVoltage();
+  CHECK(chargeLimit == 2*16); // CV2_GAIN per raw over it
+  settle(setpointRaw + 50, -100);
+  limitBatteryVoltage();
+  CHECK(chargeLimit == 2*16 + 4*16); // no faster than CV2_RELEASE raw a tick
+  for (int n = 0; n < 100; n++)
+    limitBatteryVoltage();
+  CHECK(chargeLimit == headroom); // the panel voltage reference stops at VREF_MAX
+
+  settle(setpointRaw + 50, 0); // over the setpoint and nothing goes in: it backs off instead
+  limitBatteryVoltage();
+  CHECK(chargeLimit == headroom - 16);
+  settle(setpointRaw - 3, -100); // just under the setpoint it backs off in proportion
+  limitBatteryVoltage();
+  CHECK(chargeLimit == headroom - 16 - 3*16);
+  settle(setpointRaw - 4, -100); // CV2_RELEASE under it lets go at once
+  limitBatteryVoltage();
+  CHECK(chargeLimit == 0);
+  settle(setpointRaw - 3, -100); // and it does not go below zero
+  limitBatteryVoltage();
+  CHECK(chargeLimit == 0);
+}
+
+int main() {
+  testBulkToAbsorption();
+  testTail();
+  testAbsorptionTime();
+  testRebulk();
+  testTemperature();
+  testCV2Limit();
+  printf("charge stages and the CV2 limit behave at their edges\n");
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*
+  DeadbandTelemetryTest.cpp - Checks which records and fields the deadband mode sends
+  Released into the public domain.
+
+  usage: test-deadband   (exits non-zero on the first failed check)
+  A change of exactly the deadband is held and one more is sent, in either
+  direction and measured from the value last sent rather than the last
+  record; unwatched fields only travel in keyframes; keyframes come with the
+  mode switched off, on switching it on, on request and every heartbeat;
+  the sequence number counts sent records only and wraps. Then a random
+  walk, checking that a receiver holding each field at its last value sees
+  it within its deadband at every record.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <DeadbandTelemetry.h>
+
+#define CHECK(condition) do { if (!(condition)) { \
+  fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); exit(1); } } while (0)
+
+const int FIELDS = 3; // a voltage with a deadband of 10, a duty cycle with 1, an unwatched power
+
+static void startTelemetry(DeadbandTelemetry& telemetry, const long values[]) {
+  telemetry.begin(FIELDS);
+  telemetry.setDeadband(0, 10);
+  telemetry.setDeadband(1, 1);
+  telemetry.setDeadband(2, DEADBAND_UNSUBSCRIBED);
+  telemetry.setHeartbeat(1000);
+  telemetry.setEnabled(true);
+  CHECK(telemetry.update(values) == RECORD_KEYFRAME); // the receiver has nothing yet
+}
+
+static void testDeadbandEdges() {
+  DeadbandTelemetry telemetry;
+  long values[FIELDS] = {12000, 50, 600};
+  startTelemetry(telemetry, values);
+  CHECK(telemetry.getSequence() == 0);
+
+  values[0] = 12010; // exactly the deadband is held
+  values[1] = 49;
+  values[2] = 900; // and an unwatched field never sends a record
+  CHECK(telemetry.update(values) == RECORD_NONE);
+  CHECK(!telemetry.isFieldSent(0));
+  CHECK(telemetry.getSequence() == 0);
+
+  values[0] = 12011;
+  CHECK(telemetry.update(values) == RECORD_DELTA);
+  CHECK(telemetry.isFieldSent(0));
+  CHECK(!telemetry.isFieldSent(1));
+  CHECK(!telemetry.isFieldSent(2));
+  CHECK(telemetry.getDelta(0) == 11);
+  CHECK(telemetry.getSequence() == 1);
+
+  // a slow drift is measured from the value last sent, not from the last record
+  values[1] = 51;
+  CHECK(telemetry.update(values) == RECORD_NONE);
+  values[1] = 52;
+  CHECK(telemetry.update(values) == RECORD_DELTA);
+  CHECK(telemetry.isFieldSent(1));
+  CHECK(telemetry.getDelta(1) == 2);
+  values[0] = 12000;
+  values[1] = 50; // and down the same
+  CHECK(telemetry.update(values) == RECORD_DELTA);
+  CHECK(telemetry.getDelta(0) == -11);
+  CHECK(telemetry.getDelta(1) == -2);
+  values[0] = 11990;
+  CHECK(telemetry.update(values) == RECORD_NONE);
+
+  // a deadband of 0 sends every change
+  telemetry.setDeadband(1, 0);
+  values[1] = 51;
+  CHECK(telemetry.update(values) == RECORD_DELTA);
+  CHECK(telemetry.getDelta(1) == 1);
+  CHECK(telemetry.getDeadband(FIELDS) == DEADBAND_UNSUBSCRIBED); // no such field
+  telemetry.setDeadband(-4, 5); // ignored
+  telemetry.setDeadband(0, -7); // any negative deadband unwatches the field
+  CHECK(telemetry.getDeadband(0) == DEADBAND_UNSUBSCRIBED);
+}
+
+static void testKeyframes() {
+  DeadbandTelemetry telemetry;
+  long values[FIELDS] = {12000, 50, 600};
+  telemetry.begin(FIELDS);
+  CHECK(!telemetry.isEnabled()); // off, every record is a keyframe
+  for (int n = 0; n < 3; n++)
+    CHECK(telemetry.update(values) == RECORD_KEYFRAME);
+  telemetry.setEnabled(true); // switching on starts with a keyframe
+  CHECK(telemetry.update(values) == RECORD_KEYFRAME);
+  CHECK(telemetry.update(values) == RECORD_NONE);
+  telemetry.setEnabled(true); // already on, nothing changes
+  CHECK(telemetry.update(values) == RECORD_NONE);
+
+  telemetry.requestKeyframe();
+  values[2] = 700;
+  CHECK(telemetry.update(values) == RECORD_KEYFRAME);
+  for (int n = 0; n < FIELDS; n++)
+    CHECK(telemetry.isFieldSent(n)); // the unwatched field too
+
+  // a heartbeat of 4: three records held, the fourth is a keyframe, sent or not the records between count
+  telemetry.setHeartbeat(4);
+  CHECK(telemetry.update(values) == RECORD_NONE);
+  values[0] = 12100;
+  CHECK(telemetry.update(values) == RECORD_DELTA);
+  CHECK(telemetry.update(values) == RECORD_NONE);
+  CHECK(telemetry.update(values) == RECORD_KEYFRAME);
+  telemetry.setHeartbeat(0); // at least 1, every record a keyframe
+  CHECK(telemetry.getHeartbeat() == 1);
+  CHECK(telemetry.update(values) == RECORD_KEYFRAME);
+
+  // begin() starts over with a keyframe, its fields capped at DEADBAND_FIELDS_MAX
+  long many[DEADBAND_FIELDS_MAX + 2] = {};
+  telemetry.begin(DEADBAND_FIELDS_MAX + 2);
+  CHECK(telemetry.update(many) == RECORD_KEYFRAME);
+  CHECK(telemetry.isFieldSent(DEADBAND_FIELDS_MAX - 1));
+  CHECK(!telemetry.isFieldSent(DEADBAND_FIELDS_MAX));
+}
+
+static void testSequence() {
+  DeadbandTelemetry telemetry;
+  long values[FIELDS] = {12000, 50, 600};
+  startTelemetry(telemetry, values);
+  for (int n = 1; n < 256; n++) {
+    values[1] += n % 2 ? 5 : -5;
+    CHECK(telemetry.update(values) == RECORD_DELTA);
+    CHECK(telemetry.update(values) == RECORD_NONE); // not counted
+    CHECK(telemetry.getSequence() == n);
+  }
+  values[1] += 5;
+  CHECK(telemetry.update(values) == RECORD_DELTA);
+  CHECK(telemetry.getSequence() == 0);
+}
+
+// a receiver holding each field at its last value sees every watched field within its deadband at every record
+static void testReceiver() {
+  DeadbandTelemetry telemetry;
+  long values[FIELDS] = {12000, 50, 600};
+  startTelemetry(telemetry, values);
+  telemetry.setHeartbeat(60);
+  long held[FIELDS] = {12000, 50, 600};
+  const long deadbands[FIELDS] = {10, 1, DEADBAND_UNSUBSCRIBED};
+  uint8_t sequence = telemetry.getSequence();
+  int sent = 0;
+  srand(1);
+  for (int n = 0; n < 20000; n++) {
+    values[0] += rand() % 9 - 4;
+    values[1] += rand() % 100 < 10 ? rand() % 3 - 1 : 0;
+    values[2] = values[0]*values[1]/1000;
+    int type = telemetry.update(values);
+    if (type != RECORD_NONE) {
+      CHECK(telemetry.getSequence() == (uint8_t)(sequence + 1));
+      sequence = telemetry.getSequence();
+      sent++;
+    }
+    for (int f = 0; f < FIELDS; f++) {
+      if (type == RECORD_KEYFRAME)
+        held[f] = values[f];
+      else if (type == RECORD_DELTA && telemetry.isFieldSent(f))
+        held[f] += telemetry.getDelta(f);
+      if (type != RECORD_NONE && telemetry.isFieldSent(f))
+        CHECK(held[f] == values[f]); // sent exactly as measured
+      if (deadbands[f] != DEADBAND_UNSUBSCRIBED)
+        CHECK(labs(values[f] - held[f]) <= deadbands[f]);
+    }
+  }
+  CHECK(sent < 20000/2); // the walk is slow enough for the deadbands to hold most records
+}
+
+int main() {
+  testDeadbandEdges();
+  testKeyframes();
+  testSequence();
+  testReceiver();
+  printf("deadband telemetry sends what it should at its edges\n");
+  return 0;
+}
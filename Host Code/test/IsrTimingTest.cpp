@@ -0,0 +1,67 @@
+/*
+  IsrTimingTest.cpp - Checks the control interrupt's cycle accounting on made-up emulator events
+  Released into the public domain.
+
+  usage: test-isrtiming   (exits non-zero on the first failed check)
+  The events atv-isrtime gets from simavr, written out by hand: stage marks
+  adding up to the handler's cycles, the latency from the overflow, an
+  overflow while the handler runs counted as an overrun, and the budget.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "IsrTiming.h"
+
+#define CHECK(condition) do { if (!(condition)) { \
+  fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); exit(1); } } while (0)
+
+int main() {
+  IsrTiming timing;
+  timing.stage(10, 1); // outside the handler, loop() writing GPIOR0 does not count
+  timing.exit(20);
+  CHECK(timing.isr.count == 0);
+
+  // one interrupt: 40 cycles late, 100 in entry/exit, 900 sensors, 60 protection, 2000 mppt
+  timing.pending(16000);
+  timing.entry(16040);
+  CHECK(timing.inIsr());
+  timing.stage(16090, 1);
+  timing.stage(16990, 2);
+  timing.stage(17050, 5);
+  timing.stage(19050, 0);
+  timing.exit(19100);
+  CHECK(!timing.inIsr());
+  CHECK(timing.isr.count == 1);
+  CHECK(timing.isr.max == 3060);
+  CHECK(timing.latencies.max == 40);
+  CHECK(timing.stages[0].max == 100);
+  CHECK(timing.stages[1].max == 900);
+  CHECK(timing.stages[2].max == 60);
+  CHECK(timing.stages[5].max == 2000);
+  CHECK(timing.stages[3].count == 0); // not reached, not counted as 0 cycles
+  CHECK(timing.getWorstCase() == 3100);
+  CHECK(!timing.overBudget(12000));
+  CHECK(timing.overBudget(3000));
+
+  // a longer one with an unknown mark, and the next overflow before it returns
+  timing.pending(32000);
+  timing.entry(32010);
+  timing.stage(32020, 200); // counted as entry/exit
+  timing.pending(48000);
+  timing.exit(48100);
+  CHECK(timing.overruns == 1);
+  CHECK(timing.isr.max == 16090);
+  CHECK(timing.stages[0].count == 2);
+  CHECK(timing.stages[0].max == 16090);
+  CHECK(timing.overBudget(20000)); // a lost tick is over any budget
+  timing.entry(48110);
+  timing.exit(49110);
+  CHECK(timing.latencies.max == 110);
+  CHECK(timing.isr.min == 1000);
+  CHECK(timing.isr.percentile(0.0) == 1000);
+  CHECK(timing.isr.percentile(1.0) == 16090);
+
+  printf("ISR cycle accounting adds up\n");
+  return 0;
+}
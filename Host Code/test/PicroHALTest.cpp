@@ -0,0 +1,216 @@
+/*
+  PicroHALTest.cpp - Checks PicroHAL's in-memory fakes at the edges the firmware relies on
+  Released into the public domain.
+
+  usage: test-picrohal   (exits non-zero on the first failed check)
+  ADC readings clamped to 10 bits, GPIO read back by pin mode, PWM with its
+  dither and the duty cycle limits, the control timer and the interrupt
+  state inside it, UART output capped and counted, I2C writes cut to
+  TwoWire's buffer, and an EEPROM that is erased at power up and survives an
+  MCU reset.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include <AtverterH.h>
+
+#define CHECK(condition) do { if (!(condition)) { \
+  fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); exit(1); } } while (0)
+
+static void testADC() {
+  halNativeReset();
+  CHECK(halAnalogRead(V1_PIN) == 0);
+  halNativeSetAnalog(V1_PIN, 2000);
+  CHECK(halAnalogRead(V1_PIN) == 1023);
+  halNativeSetAnalog(V1_PIN, -5);
+  CHECK(halAnalogRead(V1_PIN) == 0);
+  halNativeSetAnalog(HAL_NATIVE_PINS, 600); // no such pin
+  CHECK(halAnalogRead(HAL_NATIVE_PINS) == 0);
+  CHECK(halAnalogRead(-1) == 0);
+  halNativeSetVCC(4000);
+  CHECK(halReadBandgap() == 1125300L/4000);
+  halNativeSetVCC(0); // ignored, the bandgap divides by it
+  CHECK(halReadBandgap() == 1125300L/4000);
+}
+
+static void testGPIO() {
+  halNativeReset();
+  CHECK(halNativeGetPinMode(LED1_PIN) == INPUT);
+  halNativeSetInput(GATESD_PIN, 7); // any nonzero level is HIGH
+  CHECK(halDigitalRead(GATESD_PIN) == HIGH);
+  halPinMode(LED1_PIN, OUTPUT);
+  halDigitalWrite(LED1_PIN, 3);
+  CHECK(halDigitalRead(LED1_PIN) == HIGH);
+  CHECK(halNativeGetPinLevel(LED1_PIN) == HIGH);
+  halPinMode(LED1_PIN, INPUT); // an input reads the outside, not the last write
+  CHECK(halDigitalRead(LED1_PIN) == LOW);
+  halDigitalWrite(HAL_NATIVE_PINS, HIGH); // no such pin, nothing happens
+  CHECK(halDigitalRead(HAL_NATIVE_PINS) == LOW);
+  uint64_t before = halNativeMicros();
+  halDelayMicroseconds(250);
+  CHECK(halNativeMicros() == before + 250);
+}
+
+static void testPWM() {
+  halNativeReset();
+  static AtverterH board; // static storage like the sketch's, its sensor averages start at zero
+  CHECK(halNativeGetPwmDuty(PWM_PIN) == -1);
+  board.setDutyCycle(0);
+  CHECK(halNativeGetPwmDuty(PWM_PIN) == 1);
+  CHECK(halNativeGetPwmFrequency(PWM_PIN) == 100000UL);
+  board.setDutyCycle(150);
+  CHECK(halNativeGetPwmDuty(PWM_PIN) == 99);
+  board.setDutyCycleRaw(0);
+  CHECK(board.getDutyCycleRaw() == DUTY_RAW_MIN);
+  CHECK(halNativeGetPwmDuty(PWM_PIN) == 1);
+  board.setDutyCycleRaw(DUTY_RAW_SCALE);
+  CHECK(board.getDutyCycleRaw() == DUTY_RAW_MAX);
+  CHECK(halNativeGetPwmDuty(PWM_PIN) == 99);
+  board.setDutyCycle(50); // whole %, nothing carried
+  long sum = 0;
+  for (int n = 0; n < DUTY_RAW_SCALE; n++) {
+    board.setDutyCycleRaw(517); // 50.49 %, the switch dithers between 50 and 51
+    int duty = halNativeGetPwmDuty(PWM_PIN);
+    CHECK(duty == 50 || duty == 51);
+    sum += duty;
+  }
+  CHECK(sum == 517L*100); // and averages it exactly
+  CHECK(board.getDutyCycle() == 50); // the nearest % to the average, whichever the last tick gave the switch
+  board.setDutyCycleRaw(DUTY_RAW_MAX); // 99.02 %, the switch stays within 99
+  board.setDutyCycleRaw(DUTY_RAW_MAX);
+  CHECK(halNativeGetPwmDuty(PWM_PIN) == 99);
+  halNativeRestart();
+  CHECK(halNativeGetPwmDuty(PWM_PIN) == -1);
+}
+
+static int isrCalls;
+static bool isrSawInterrupts;
+
+static void countTick() {
+  isrCalls++;
+  isrSawInterrupts = halNativeInterruptsEnabled();
+}
+
+static void testTimer() {
+  halNativeReset();
+  CHECK(!halNativeTick());
+  CHECK(!halNativeSkipTicks(10));
+  static AtverterH board;
+  isrCalls = 0;
+  board.initializeInterruptTimer(1000, countTick);
+  CHECK(halNativeGetTimerPeriod() == 1000);
+  uint64_t start = halNativeMicros();
+  for (int n = 0; n < 5; n++)
+    CHECK(halNativeTick());
+  CHECK(isrCalls == 5);
+  CHECK(!isrSawInterrupts); // like the AVR, the ISR runs with interrupts disabled
+  CHECK(halNativeInterruptsEnabled());
+  CHECK(board.getTicks() == 5);
+  CHECK(halNativeMicros() == start + 5000);
+  CHECK(halNativeSkipTicks(100));
+  board.skipTicks(100);
+  CHECK(isrCalls == 5);
+  CHECK(board.getTicks() == 105);
+  CHECK(halNativeMicros() == start + 105000);
+
+  // nested critical sections restore rather than enable
+  uint8_t outer = halDisableInterrupts();
+  uint8_t inner = halDisableInterrupts();
+  halRestoreInterrupts(inner);
+  CHECK(!halNativeInterruptsEnabled());
+  halRestoreInterrupts(outer);
+  CHECK(halNativeInterruptsEnabled());
+
+  halNativeRestart(); // a reset stops the timer
+  CHECK(!halNativeTick());
+  CHECK(halNativeMicros() == 0);
+}
+
+static void testUART() {
+  halNativeReset();
+  Serial.begin(115200);
+  CHECK(Serial.getBaud() == 115200);
+  CHECK(Serial.read() == -1);
+  const char withNul[4] = {'A', '\0', 'B', '\n'};
+  halNativeUARTReceive(withNul, sizeof(withNul));
+  CHECK(Serial.available() == 4);
+  CHECK(Serial.read() == 'A');
+  CHECK(Serial.read() == 0);
+  halNativeUARTReceive("C"); // appends to what is not read yet
+  CHECK(Serial.available() == 3);
+  CHECK(Serial.read() == 'B');
+
+  Serial.print(-2147483647L - 1);
+  Serial.print(' ');
+  Serial.print(255, 16);
+  Serial.print(' ');
+  Serial.println(-1.5);
+  CHECK(halNativeUARTTake() == "-2147483648 FF -1.50\r\n");
+  CHECK(halNativeUARTTake().empty());
+
+  std::string block(HAL_NATIVE_UART_TX_MAX, 'x');
+  Serial.print(block);
+  Serial.print("0123456789");
+  CHECK(Serial.getDropped() == 10);
+  CHECK(halNativeUARTTake().size() == HAL_NATIVE_UART_TX_MAX);
+  Serial.print("ok");
+  CHECK(halNativeUARTTake() == "ok");
+}
+
+static int i2cReceived;
+
+static void receiveI2C(int howMany) {
+  i2cReceived = howMany;
+  while (Wire.available())
+    Wire.read();
+}
+
+static void requestI2C() {
+  Wire.write("WDC:50");
+}
+
+static void testI2C() {
+  halNativeReset();
+  Wire.begin(0x2C);
+  Wire.onReceive(receiveI2C);
+  Wire.onRequest(requestI2C);
+  CHECK(Wire.getAddress() == 0x2C);
+  std::string write(40, 'x');
+  halNativeI2CWrite(write.data(), (int)write.size());
+  CHECK(i2cReceived == HAL_NATIVE_I2C_BUFFER); // the TWI driver NACKs the rest
+  CHECK(Wire.read() == -1);
+  CHECK(halNativeI2CRead() == "WDC:50");
+  CHECK(halNativeI2CRead() == "WDC:50"); // each read is answered afresh
+}
+
+static void testEEPROM() {
+  halNativeReset();
+  CHECK(halEepromRead(0) == 0xFF);
+  CHECK(halEepromRead(HAL_EEPROM_SIZE - 1) == 0xFF);
+  halEepromWrite(0, 0x12);
+  halEepromWrite(HAL_EEPROM_SIZE - 1, 0x34);
+  halEepromWrite(HAL_EEPROM_SIZE, 0x56); // past the end, ignored
+  halEepromWrite(-1, 0x56);
+  CHECK(halEepromRead(0) == 0x12);
+  CHECK(halEepromRead(HAL_EEPROM_SIZE - 1) == 0x34);
+  CHECK(halEepromRead(HAL_EEPROM_SIZE) == 0xFF);
+  CHECK(halEepromRead(-1) == 0xFF);
+  halNativeRestart(); // the MCU resets, the EEPROM stays
+  CHECK(halEepromRead(0) == 0x12);
+  halNativeReset(); // a new board
+  CHECK(halEepromRead(0) == 0xFF);
+}
+
+int main() {
+  testADC();
+  testGPIO();
+  testPWM();
+  testTimer();
+  testUART();
+  testI2C();
+  testEEPROM();
+  printf("PicroHAL fakes behave at their edges\n");
+  return 0;
+}
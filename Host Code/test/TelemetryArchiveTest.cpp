@@ -0,0 +1,159 @@
+/*
+  TelemetryArchiveTest.cpp - Checks that an archive survives a crash and a restart
+  Released into the public domain.
+
+  usage: test-archive [dir]   (exits non-zero on the first failed check; files go in dir, default /tmp)
+  A writer reopening an archive whose last block a crash cut off truncates
+  it before appending, so everything written after the restart reads back
+  at its place, and it refuses to append to an archive of another version
+  or channel count.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "TelemetryArchive.h"
+
+#define CHECK(condition) do { if (!(condition)) { \
+  fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); exit(1); } } while (0)
+
+const int BLOCK_SAMPLES = 100;
+
+// one record a second, every channel a different function of the sample number
+static TelemetrySample sample(long n) {
+  TelemetrySample s;
+  s.timestampUs = 1700000000000000LL + n*1000000LL;
+  for (int c = 0; c < NUM_CHANNELS; c++)
+    s.values[c] = (int32_t)(n*(c + 1) % 9973) - 4000;
+  return s;
+}
+
+static void writeSamples(const char* path, long first, long count) {
+  ArchiveWriter writer;
+  CHECK(writer.open(path, BLOCK_SAMPLES));
+  for (long n = first; n < first + count; n++)
+    CHECK(writer.append(sample(n)));
+  writer.close();
+}
+
+static long fileSize(const char* path) {
+  FILE* file = fopen(path, "rb");
+  CHECK(file);
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+// reads the whole archive back and checks it holds samples first to first + count - 1, in order
+static void checkSamples(const char* path, long first, long count) {
+  ArchiveReader reader;
+  CHECK(reader.open(path));
+  CHECK(reader.getNumSamples() == count);
+  long n = first;
+  for (int block = 0; block < reader.getNumBlocks(); block++) {
+    int samples = (int)reader.getBlockInfo(block).numSamples;
+    std::vector<int64_t> timestamps(samples);
+    std::vector<int32_t> values[NUM_CHANNELS];
+    int32_t* columns[NUM_CHANNELS];
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+      values[c].resize(samples);
+      columns[c] = values[c].data();
+    }
+    CHECK(reader.readBlock(block, timestamps.data(), columns));
+    for (int k = 0; k < samples; k++, n++) {
+      TelemetrySample expected = sample(n);
+      CHECK(timestamps[k] == expected.timestampUs);
+      for (int c = 0; c < NUM_CHANNELS; c++)
+        CHECK(values[c][k] == expected.values[c]);
+    }
+  }
+  CHECK(n == first + count);
+}
+
+// a crash cut the last block short: it is lost, but what is appended after the restart is not
+static void testTruncatedThenAppended(const std::string& dir) {
+  std::string path = dir + "/test-archive-truncated.atv";
+  unlink(path.c_str());
+  writeSamples(path.c_str(), 0, 250); // blocks of 100, 100 and 50
+  CHECK(truncate(path.c_str(), fileSize(path.c_str()) - 20) == 0);
+  checkSamples(path.c_str(), 0, 200);
+
+  ArchiveWriter writer;
+  CHECK(writer.open(path.c_str(), BLOCK_SAMPLES));
+  for (long n = 250; n < 600; n++)
+    CHECK(writer.append(sample(n)));
+  writer.close();
+  ArchiveReader reader;
+  CHECK(reader.open(path.c_str()));
+  CHECK(reader.getNumSamples() == 550);
+  CHECK(reader.getNumBlocks() == 6);
+  CHECK(reader.getBlockInfo(2).timestampMin == sample(250).timestampUs);
+  reader.close();
+
+  // a crash inside the file header leaves nothing to keep, the writer starts the file afresh
+  CHECK(truncate(path.c_str(), sizeof(ArchiveFileHeader) - 4) == 0);
+  writeSamples(path.c_str(), 0, 30);
+  checkSamples(path.c_str(), 0, 30);
+  unlink(path.c_str());
+}
+
+// a complete archive is appended to as it is
+static void testReopened(const std::string& dir) {
+  std::string path = dir + "/test-archive-reopened.atv";
+  unlink(path.c_str());
+  writeSamples(path.c_str(), 0, 150);
+  long size = fileSize(path.c_str());
+  writeSamples(path.c_str(), 150, 120);
+  CHECK(fileSize(path.c_str()) > size);
+  checkSamples(path.c_str(), 0, 270);
+  unlink(path.c_str());
+}
+
+// an archive of another version or channel count is left alone
+static void testMismatched(const std::string& dir) {
+  std::string path = dir + "/test-archive-mismatched.atv";
+  for (int field = 0; field < 2; field++) {
+    unlink(path.c_str());
+    writeSamples(path.c_str(), 0, 10);
+    FILE* file = fopen(path.c_str(), "r+b");
+    CHECK(file);
+    ArchiveFileHeader header;
+    CHECK(fread(&header, sizeof(header), 1, file) == 1);
+    if (field == 0)
+      header.version = ARCHIVE_VERSION + 1;
+    else
+      header.numChannels = NUM_CHANNELS - 1;
+    fseek(file, 0, SEEK_SET);
+    CHECK(fwrite(&header, sizeof(header), 1, file) == 1);
+    fclose(file);
+    long size = fileSize(path.c_str());
+    ArchiveWriter writer;
+    CHECK(!writer.open(path.c_str(), BLOCK_SAMPLES));
+    CHECK(!writer.isOpen());
+    CHECK(fileSize(path.c_str()) == size);
+  }
+  // nor is a file that is not an archive at all
+  FILE* file = fopen(path.c_str(), "wb");
+  CHECK(file);
+  std::string text(64, 'x');
+  CHECK(fwrite(text.data(), 1, text.size(), file) == text.size());
+  fclose(file);
+  ArchiveWriter writer;
+  CHECK(!writer.open(path.c_str(), BLOCK_SAMPLES));
+  CHECK(fileSize(path.c_str()) == (long)text.size());
+  unlink(path.c_str());
+}
+
+int main(int argc, char** argv) {
+  std::string dir = argc > 1 ? argv[1] : "/tmp";
+  testTruncatedThenAppended(dir);
+  testReopened(dir);
+  testMismatched(dir);
+  printf("archives survive a cut last block, a reopen and a mismatched header\n");
+  return 0;
+}